@@ -0,0 +1,243 @@
+#define LOG_TAG "audio_hal_sm8650"
+
+#include <log/log.h>
+#include <errno.h>
+#include <string.h>
+#include "audio_channel_mix.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CHANNEL_MIX_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define CHANNEL_MIX_SSE2 1
+#endif
+
+namespace {
+
+constexpr float MINUS_3DB = 0.70710678f;
+
+// Gains used when a channel position is missing on the output: {left, right}
+struct FoldGain {
+    uint32_t position;
+    float left;
+    float right;
+};
+
+constexpr FoldGain STEREO_FOLD[] = {
+    { AUDIO_CHANNEL_OUT_FRONT_LEFT, 1.0f, 0.0f },
+    { AUDIO_CHANNEL_OUT_FRONT_RIGHT, 0.0f, 1.0f },
+    { AUDIO_CHANNEL_OUT_FRONT_CENTER, MINUS_3DB, MINUS_3DB },
+    { AUDIO_CHANNEL_OUT_LOW_FREQUENCY, 0.0f, 0.0f },
+    { AUDIO_CHANNEL_OUT_BACK_LEFT, MINUS_3DB, 0.0f },
+    { AUDIO_CHANNEL_OUT_BACK_RIGHT, 0.0f, MINUS_3DB },
+    { AUDIO_CHANNEL_OUT_SIDE_LEFT, MINUS_3DB, 0.0f },
+    { AUDIO_CHANNEL_OUT_SIDE_RIGHT, 0.0f, MINUS_3DB },
+};
+
+// Surround positions that can stand in for each other before folding to
+// the front pair.
+constexpr uint32_t SURROUND_SUBSTITUTE[][2] = {
+    { AUDIO_CHANNEL_OUT_SIDE_LEFT, AUDIO_CHANNEL_OUT_BACK_LEFT },
+    { AUDIO_CHANNEL_OUT_SIDE_RIGHT, AUDIO_CHANNEL_OUT_BACK_RIGHT },
+    { AUDIO_CHANNEL_OUT_BACK_LEFT, AUDIO_CHANNEL_OUT_SIDE_LEFT },
+    { AUDIO_CHANNEL_OUT_BACK_RIGHT, AUDIO_CHANNEL_OUT_SIDE_RIGHT },
+};
+
+// Index of position within the interleaved order of mask, or -1
+int ChannelIndex(audio_channel_mask_t mask, uint32_t position) {
+    if (!(mask & position)) {
+        return -1;
+    }
+    return __builtin_popcount(mask & (position - 1));
+}
+
+const FoldGain* FindFold(uint32_t position) {
+    for (const FoldGain& fold : STEREO_FOLD) {
+        if (fold.position == position) {
+            return &fold;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace
+
+ChannelMixer::ChannelMixer()
+    : mActive(false)
+    , mInChannels(0)
+    , mOutChannels(0) {
+    memset(mColumns, 0, sizeof(mColumns));
+    memset(mStereoPairs, 0, sizeof(mStereoPairs));
+}
+
+int ChannelMixer::Init(audio_channel_mask_t inMask, uint32_t outChannels) {
+    uint32_t inChannels = __builtin_popcount(inMask);
+    if (inChannels == 0 || inChannels > MAX_CHANNELS ||
+            outChannels == 0 || outChannels > MAX_CHANNELS) {
+        ALOGE("Unsupported channel mix: mask %x -> %u channels", inMask, outChannels);
+        return -EINVAL;
+    }
+
+    // Mono input and folded positions land on the front pair, so every
+    // output layout but mono needs one.
+    audio_channel_mask_t outMask = audio_channel_out_mask_from_count(outChannels);
+    const int left = ChannelIndex(outMask, AUDIO_CHANNEL_OUT_FRONT_LEFT);
+    const int right = ChannelIndex(outMask, AUDIO_CHANNEL_OUT_FRONT_RIGHT);
+    if (outMask == 0 || (outChannels > 1 && (left < 0 || right < 0))) {
+        ALOGE("No output layout for %u channels", outChannels);
+        return -EINVAL;
+    }
+    memset(mColumns, 0, sizeof(mColumns));
+
+    int in = 0;
+    for (uint32_t bits = inMask; bits != 0; bits &= bits - 1, in++) {
+        uint32_t position = bits & -bits;
+        float* column = mColumns[in];
+
+        if (outChannels == 1) {
+            const FoldGain* fold = FindFold(position);
+            column[0] = fold ? (fold->left + fold->right) * 0.5f : 0.0f;
+            continue;
+        }
+
+        if (inChannels == 1) {
+            column[left] = 1.0f;
+            column[right] = 1.0f;
+            continue;
+        }
+
+        int out = ChannelIndex(outMask, position);
+        if (out >= 0) {
+            column[out] = 1.0f;
+            continue;
+        }
+
+        for (const auto& sub : SURROUND_SUBSTITUTE) {
+            if (sub[0] == position && (out = ChannelIndex(outMask, sub[1])) >= 0) {
+                break;
+            }
+        }
+        if (out >= 0) {
+            column[out] = 1.0f;
+            continue;
+        }
+
+        const FoldGain* fold = FindFold(position);
+        if (fold) {
+            column[left] = fold->left;
+            column[right] = fold->right;
+        }
+    }
+
+    // Normalize so the loudest output cannot exceed full scale.
+    float maxGain = 0.0f;
+    for (uint32_t o = 0; o < outChannels; o++) {
+        float gain = 0.0f;
+        for (uint32_t i = 0; i < inChannels; i++) {
+            gain += mColumns[i][o];
+        }
+        if (gain > maxGain) {
+            maxGain = gain;
+        }
+    }
+    if (maxGain > 1.0f) {
+        for (uint32_t i = 0; i < inChannels; i++) {
+            for (uint32_t o = 0; o < outChannels; o++) {
+                mColumns[i][o] /= maxGain;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < inChannels; i++) {
+        mStereoPairs[i][0] = mStereoPairs[i][2] = mColumns[i][0];
+        mStereoPairs[i][1] = mStereoPairs[i][3] = mColumns[i][1];
+    }
+
+    mInChannels = inChannels;
+    mOutChannels = outChannels;
+    mActive = inMask != outMask;
+    return 0;
+}
+
+void ChannelMixer::Process(float* out, const float* in, size_t frames) const {
+    if (mOutChannels == 2) {
+        ProcessStereo(out, in, frames);
+    } else {
+        ProcessGeneric(out, in, frames);
+    }
+}
+
+void ChannelMixer::ProcessStereo(float* out, const float* in, size_t frames) const {
+    const uint32_t inChannels = mInChannels;
+    size_t f = 0;
+#if CHANNEL_MIX_NEON || CHANNEL_MIX_SSE2
+    // Two frames per vector: lanes are {L0, R0, L1, R1}.
+    for (; f + 2 <= frames; f += 2) {
+        const float* a = in + f * inChannels;
+        const float* b = a + inChannels;
+#if CHANNEL_MIX_NEON
+        float32x4_t acc = vdupq_n_f32(0.0f);
+        for (uint32_t i = 0; i < inChannels; i++) {
+            float32x4_t x = vcombine_f32(vdup_n_f32(a[i]), vdup_n_f32(b[i]));
+            acc = vmlaq_f32(acc, x, vld1q_f32(mStereoPairs[i]));
+        }
+        vst1q_f32(out + f * 2, acc);
+#else
+        __m128 acc = _mm_setzero_ps();
+        for (uint32_t i = 0; i < inChannels; i++) {
+            __m128 x = _mm_movelh_ps(_mm_set1_ps(a[i]), _mm_set1_ps(b[i]));
+            acc = _mm_add_ps(acc, _mm_mul_ps(x, _mm_load_ps(mStereoPairs[i])));
+        }
+        _mm_storeu_ps(out + f * 2, acc);
+#endif
+    }
+#endif
+    for (; f < frames; f++) {
+        const float* frame = in + f * inChannels;
+        float left = 0.0f;
+        float right = 0.0f;
+        for (uint32_t i = 0; i < inChannels; i++) {
+            left += frame[i] * mColumns[i][0];
+            right += frame[i] * mColumns[i][1];
+        }
+        out[f * 2] = left;
+        out[f * 2 + 1] = right;
+    }
+}
+
+void ChannelMixer::ProcessGeneric(float* out, const float* in, size_t frames) const {
+    const uint32_t inChannels = mInChannels;
+    const uint32_t outChannels = mOutChannels;
+    for (size_t f = 0; f < frames; f++) {
+        const float* frame = in + f * inChannels;
+        alignas(16) float acc[PADDED_CHANNELS];
+#if CHANNEL_MIX_NEON || CHANNEL_MIX_SSE2
+        // One output frame as up to two four-lane vectors.
+        for (uint32_t o = 0; o < outChannels; o += 4) {
+#if CHANNEL_MIX_NEON
+            float32x4_t sum = vdupq_n_f32(0.0f);
+            for (uint32_t i = 0; i < inChannels; i++) {
+                sum = vmlaq_n_f32(sum, vld1q_f32(&mColumns[i][o]), frame[i]);
+            }
+            vst1q_f32(&acc[o], sum);
+#else
+            __m128 sum = _mm_setzero_ps();
+            for (uint32_t i = 0; i < inChannels; i++) {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_load_ps(&mColumns[i][o]),
+                                                 _mm_set1_ps(frame[i])));
+            }
+            _mm_store_ps(&acc[o], sum);
+#endif
+        }
+#else
+        for (uint32_t o = 0; o < outChannels; o++) {
+            acc[o] = 0.0f;
+            for (uint32_t i = 0; i < inChannels; i++) {
+                acc[o] += frame[i] * mColumns[i][o];
+            }
+        }
+#endif
+        memcpy(out + f * outChannels, acc, outChannels * sizeof(float));
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef AUDIO_CHANNEL_MIX_H
+#define AUDIO_CHANNEL_MIX_H
+
+#include <system/audio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Downmix / channel remap of interleaved float frames.
+//
+// The coefficient matrix is computed once in Init from the stream channel
+// mask and the hardware channel count: channels present on both sides map
+// 1:1, missing positions fold into their neighbours (center and surrounds
+// at -3 dB into left/right), and the result is normalized so a full-scale
+// downmix cannot clip. Process runs the matrix with NEON or SSE2.
+class ChannelMixer {
+public:
+    static constexpr uint32_t MAX_CHANNELS = 8;
+
+    ChannelMixer();
+
+    int Init(audio_channel_mask_t inMask, uint32_t outChannels);
+
+    // True when the stream must go through Process before reaching the PCM
+    bool IsActive() const { return mActive; }
+
+    uint32_t GetInputChannels() const { return mInChannels; }
+    uint32_t GetOutputChannels() const { return mOutChannels; }
+
+    // out must not alias in
+    void Process(float* out, const float* in, size_t frames) const;
+
+private:
+    // Lane-padded columns: mColumns[i][o] is the gain of input channel i
+    // into output channel o, with o padded to a multiple of four.
+    static constexpr uint32_t PADDED_CHANNELS = MAX_CHANNELS;
+
+    void ProcessStereo(float* out, const float* in, size_t frames) const;
+    void ProcessGeneric(float* out, const float* in, size_t frames) const;
+
+    bool mActive;
+    uint32_t mInChannels;
+    uint32_t mOutChannels;
+    alignas(16) float mColumns[MAX_CHANNELS][PADDED_CHANNELS];
+    // Stereo output kernel coefficients {L, R, L, R} per input channel
+    alignas(16) float mStereoPairs[MAX_CHANNELS][4];
+};
+
+#endif // AUDIO_CHANNEL_MIX_H
@@ -0,0 +1,286 @@
+#define LOG_TAG "audio_hal_sm8650"
+
+#include <log/log.h>
+#include <errno.h>
+#include <string.h>
+#include "audio_compress_offload.h"
+
+CompressOffload::CompressOffload()
+    : mCompress(nullptr)
+    , mCallback(nullptr)
+    , mCookie(nullptr)
+    , mState(State::IDLE)
+    , mNewMetadata(false)
+    , mWaitPending(false)
+    , mDrainPending(false)
+    , mPartialDrain(false)
+    , mExit(false) {
+    memset(&mConfig, 0, sizeof(mConfig));
+    memset(&mGapless, 0, sizeof(mGapless));
+}
+
+CompressOffload::~CompressOffload() {
+    Close();
+}
+
+bool CompressOffload::IsFormatSupported(audio_format_t format) {
+    audio_format_t main = audio_get_main_format(format);
+    return main == AUDIO_FORMAT_MP3 || main == AUDIO_FORMAT_AAC;
+}
+
+int CompressOffload::Init(const Config& config) {
+    if (!IsFormatSupported(config.format)) {
+        ALOGE("Unsupported offload format: %x", config.format);
+        return -EINVAL;
+    }
+    if (config.channels == 0 || config.fragmentSize == 0 || config.fragments == 0) {
+        ALOGE("Invalid offload config: %u channels, %u x %u bytes",
+              config.channels, config.fragments, config.fragmentSize);
+        return -EINVAL;
+    }
+    mConfig = config;
+    return 0;
+}
+
+void CompressOffload::SetCallback(EventCallback callback, void* cookie) {
+    mCallback = callback;
+    mCookie = cookie;
+}
+
+int CompressOffload::Open(unsigned int card, unsigned int device) {
+    struct snd_codec codec = {};
+    if (audio_get_main_format(mConfig.format) == AUDIO_FORMAT_MP3) {
+        codec.id = SND_AUDIOCODEC_MP3;
+    } else {
+        codec.id = SND_AUDIOCODEC_AAC;
+        codec.format = SND_AUDIOSTREAMFORMAT_RAW;
+    }
+    codec.ch_in = mConfig.channels;
+    codec.ch_out = mConfig.channels;
+    codec.sample_rate = mConfig.sampleRate;
+    codec.bit_rate = mConfig.bitRate;
+
+    struct compr_config config = {};
+    config.fragment_size = mConfig.fragmentSize;
+    config.fragments = mConfig.fragments;
+    config.codec = &codec;
+
+    struct compress* compress = compress_open(card, device, COMPRESS_IN, &config);
+    if (!compress || !is_compress_ready(compress)) {
+        ALOGE("Failed to open compress device %u:%u: %s", card, device,
+              compress ? compress_get_error(compress) : "out of memory");
+        if (compress) {
+            compress_close(compress);
+        }
+        return -ENODEV;
+    }
+    compress_nonblock(compress, mCallback != nullptr);
+
+    mCompress = compress;
+    mState = State::IDLE;
+    mNewMetadata = true;
+    mWaitPending = false;
+    mDrainPending = false;
+    mExit = false;
+    mWorker = std::thread(&CompressOffload::WorkerLoop, this);
+    return 0;
+}
+
+void CompressOffload::Close() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (!mCompress) {
+            return;
+        }
+        // Stopping wakes the worker if it is blocked in a drain or in a
+        // wait on a running device; any other wait ends within a slice.
+        StopLocked();
+        mExit = true;
+    }
+    mCommandReady.notify_one();
+    mWorker.join();
+
+    std::lock_guard<std::mutex> lock(mLock);
+    compress_close(mCompress);
+    mCompress = nullptr;
+}
+
+ssize_t CompressOffload::Write(const void* buffer, size_t bytes) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!mCompress) {
+        return -ENODEV;
+    }
+
+    if (mNewMetadata) {
+        if (compress_set_gapless_metadata(mCompress, &mGapless) != 0) {
+            ALOGW("Failed to set gapless metadata: %s", compress_get_error(mCompress));
+        }
+        mNewMetadata = false;
+    }
+
+    int ret = compress_write(mCompress, buffer, bytes);
+    if (ret < 0) {
+        ALOGE("Compress write failed: %s", compress_get_error(mCompress));
+        return -EIO;
+    }
+
+    if (static_cast<size_t>(ret) < bytes && mCallback) {
+        mWaitPending = true;
+        mCommandReady.notify_one();
+    }
+
+    if (mState == State::IDLE && ret > 0) {
+        if (compress_start(mCompress) != 0) {
+            ALOGE("Failed to start compress device: %s", compress_get_error(mCompress));
+            return -EIO;
+        }
+        mState = State::PLAYING;
+    }
+
+    return ret;
+}
+
+int CompressOffload::Pause() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mState != State::PLAYING) {
+        return -ENOSYS;
+    }
+    if (compress_pause(mCompress) != 0) {
+        ALOGE("Failed to pause compress device: %s", compress_get_error(mCompress));
+        return -EIO;
+    }
+    mState = State::PAUSED;
+    return 0;
+}
+
+int CompressOffload::Resume() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mState != State::PAUSED) {
+        return -ENOSYS;
+    }
+    if (compress_resume(mCompress) != 0) {
+        ALOGE("Failed to resume compress device: %s", compress_get_error(mCompress));
+        return -EIO;
+    }
+    mState = State::PLAYING;
+    return 0;
+}
+
+int CompressOffload::Drain(bool earlyNotify) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mState == State::IDLE) {
+        return -ENOSYS;
+    }
+    mDrainPending = true;
+    mPartialDrain = earlyNotify;
+    mCommandReady.notify_one();
+    return 0;
+}
+
+int CompressOffload::Flush() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mState != State::PAUSED) {
+        return -ENOSYS;
+    }
+    StopLocked();
+    // The DSP forgets the track on stop; resend its metadata on restart.
+    mNewMetadata = true;
+    return 0;
+}
+
+void CompressOffload::SetGaplessMetadata(uint32_t delaySamples, uint32_t paddingSamples) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mGapless.encoder_delay = delaySamples;
+    mGapless.encoder_padding = paddingSamples;
+    mNewMetadata = true;
+}
+
+int CompressOffload::GetTimestamp(uint32_t* frames, uint32_t* sampleRate) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!mCompress || mState == State::IDLE) {
+        return -ENODATA;
+    }
+    unsigned int samples;
+    unsigned int rate;
+    if (compress_get_tstamp(mCompress, &samples, &rate) != 0) {
+        return -EIO;
+    }
+    *frames = samples;
+    *sampleRate = rate;
+    return 0;
+}
+
+void CompressOffload::StopLocked() {
+    if (mState != State::IDLE) {
+        compress_stop(mCompress);
+        mState = State::IDLE;
+    }
+}
+
+void CompressOffload::WorkerLoop() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (true) {
+        mCommandReady.wait(lock, [this] {
+            return mExit || mWaitPending || mDrainPending;
+        });
+        if (mExit) {
+            break;
+        }
+
+        // Blocking calls run unlocked so Pause, Flush and Close can reach
+        // the device; Close keeps mCompress valid until this thread exits.
+        Event event;
+        if (mWaitPending) {
+            mWaitPending = false;
+            // A device that is not running never frees space and cannot be
+            // stopped, so Close could not wake an unbounded wait. Wait in
+            // slices and give up once Close asks.
+            int ret;
+            int error;
+            do {
+                lock.unlock();
+                ret = compress_wait(mCompress, WAIT_SLICE_MS);
+                error = ret < 0 ? errno : 0;
+                lock.lock();
+            } while (ret < 0 && error == ETIME && !mExit);
+            if (mExit) {
+                break;
+            }
+            event = (ret < 0 && mState != State::IDLE) ? Event::ERROR : Event::WRITE_READY;
+        } else {
+            bool partial = mPartialDrain;
+            mDrainPending = false;
+            lock.unlock();
+            int ret;
+            if (partial) {
+                ret = compress_next_track(mCompress);
+                if (ret == 0) {
+                    ret = compress_partial_drain(mCompress);
+                }
+            } else {
+                ret = compress_drain(mCompress);
+            }
+            lock.lock();
+            if (mExit) {
+                break;
+            }
+            if (ret != 0) {
+                ALOGW("Compress drain returned %d", ret);
+            }
+            if (partial) {
+                mNewMetadata = true;
+            }
+            event = Event::DRAIN_READY;
+        }
+
+        lock.unlock();
+        Notify(event);
+        lock.lock();
+    }
+}
+
+void CompressOffload::Notify(Event event) {
+    if (mCallback) {
+        mCallback(event, mCookie);
+    }
+}
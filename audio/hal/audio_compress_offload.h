@@ -0,0 +1,109 @@
+#ifndef AUDIO_COMPRESS_OFFLOAD_H
+#define AUDIO_COMPRESS_OFFLOAD_H
+
+#include <system/audio.h>
+#include <tinycompress/tinycompress.h>
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Compressed playback through a tinycompress device: the DSP decodes, so
+// the application processor only wakes to refill a fragment.
+//
+// With a callback installed the device is non-blocking. Write returns short
+// when the DSP buffer is full, and a worker thread waits for free space and
+// reports WRITE_READY. Drains also run on the worker thread and report
+// DRAIN_READY, so no client call ever blocks on the DSP. Pause and resume
+// map onto compress_pause/compress_resume and keep the device open.
+class CompressOffload {
+public:
+    enum class Event {
+        WRITE_READY,
+        DRAIN_READY,
+        ERROR,
+    };
+
+    typedef void (*EventCallback)(Event event, void* cookie);
+
+    struct Config {
+        audio_format_t format;
+        uint32_t sampleRate;
+        uint32_t channels;
+        uint32_t bitRate;
+        uint32_t fragmentSize;
+        uint32_t fragments;
+    };
+
+    CompressOffload();
+    ~CompressOffload();
+
+    static bool IsFormatSupported(audio_format_t format);
+
+    int Init(const Config& config);
+
+    // Must be called before Open; selects non-blocking mode.
+    void SetCallback(EventCallback callback, void* cookie);
+
+    int Open(unsigned int card, unsigned int device);
+    void Close();
+    bool IsOpen() const { return mCompress != nullptr; }
+
+    // Returns the bytes accepted, or a negative errno. Starts playback
+    // after the first accepted write.
+    ssize_t Write(const void* buffer, size_t bytes);
+
+    int Pause();
+    int Resume();
+
+    // Asynchronous; DRAIN_READY follows. An early-notify drain moves to the
+    // next track so the DSP plays the gap between tracks from the gapless
+    // metadata instead of draining to silence.
+    int Drain(bool earlyNotify);
+
+    // Discards everything queued in the DSP. Only valid while paused.
+    int Flush();
+
+    // Encoder delay and padding of the current track, applied before its
+    // first write.
+    void SetGaplessMetadata(uint32_t delaySamples, uint32_t paddingSamples);
+
+    // Frames rendered by the DSP since the device was started.
+    int GetTimestamp(uint32_t* frames, uint32_t* sampleRate);
+
+private:
+    enum class State {
+        IDLE,       // opened, not started
+        PLAYING,
+        PAUSED,
+    };
+
+    // Longest a worker wait for space runs before checking for Close
+    static constexpr int WAIT_SLICE_MS = 20;
+
+    void StopLocked();
+    void WorkerLoop();
+    void Notify(Event event);
+
+    Config mConfig;
+    struct compress* mCompress;
+    EventCallback mCallback;
+    void* mCookie;
+    State mState;
+    struct compr_gapless_mdata mGapless;
+    bool mNewMetadata;
+
+    // Worker commands are pending flags rather than a queue: there is at
+    // most one outstanding wait for space and one drain at a time.
+    std::mutex mLock;
+    std::condition_variable mCommandReady;
+    std::thread mWorker;
+    bool mWaitPending;
+    bool mDrainPending;
+    bool mPartialDrain;
+    bool mExit;
+};
+
+#endif // AUDIO_COMPRESS_OFFLOAD_H
@@ -0,0 +1,59 @@
+#include <algorithm>
+#include "audio_drift_estimator.h"
+
+DriftEstimator::DriftEstimator()
+    : mNominalRate(0.0)
+    , mRate(0.0)
+    , mLocked(false)
+    , mRefFrames(0)
+    , mRefTimeNs(0) {
+}
+
+void DriftEstimator::Init(uint32_t nominalRate) {
+    mNominalRate = nominalRate;
+    mRate = nominalRate;
+    mLocked = false;
+}
+
+void DriftEstimator::Reset() {
+    mLocked = false;
+}
+
+int64_t DriftEstimator::Update(int64_t frames, int64_t timeNs) {
+    if (!mLocked || frames <= mRefFrames) {
+        mRefFrames = frames;
+        mRefTimeNs = timeNs;
+        mLocked = true;
+        return timeNs;
+    }
+
+    int64_t elapsedFrames = frames - mRefFrames;
+    double predicted = mRefTimeNs + elapsedFrames * 1e9 / mRate;
+    double error = timeNs - predicted;
+
+    // Stalls and xruns move the clock by far more than any drift could;
+    // restart from the measurement instead of slewing towards it.
+    if (error > RESYNC_THRESHOLD_NS || error < -RESYNC_THRESHOLD_NS) {
+        mRefFrames = frames;
+        mRefTimeNs = timeNs;
+        return timeNs;
+    }
+
+    // A late measurement means the hardware runs slower than estimated.
+    double elapsedNs = predicted - mRefTimeNs;
+    mRate *= 1.0 - RATE_GAIN * error / elapsedNs;
+    double maxDeviation = mNominalRate * MAX_DRIFT_PPM * 1e-6;
+    mRate = std::min(std::max(mRate, mNominalRate - maxDeviation),
+                     mNominalRate + maxDeviation);
+
+    mRefFrames = frames;
+    mRefTimeNs = static_cast<int64_t>(predicted + PHASE_GAIN * error);
+    return mRefTimeNs;
+}
+
+double DriftEstimator::GetDriftPpm() const {
+    if (mNominalRate == 0.0) {
+        return 0.0;
+    }
+    return (mRate - mNominalRate) / mNominalRate * 1e6;
+}
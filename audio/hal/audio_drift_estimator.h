@@ -0,0 +1,44 @@
+#ifndef AUDIO_DRIFT_ESTIMATOR_H
+#define AUDIO_DRIFT_ESTIMATOR_H
+
+#include <stdint.h>
+
+// Tracks the ALSA sample clock against CLOCK_MONOTONIC.
+//
+// A second-order delay-locked loop: every (frames, time) measurement is
+// compared with the time predicted from the previous point and the current
+// rate estimate, and the error pulls both the phase and the rate. The
+// smoothed times are free of the period-granular jitter of the raw
+// htimestamps, and the rate converges to the real hardware clock so
+// positions stay frame accurate between measurements.
+class DriftEstimator {
+public:
+    DriftEstimator();
+
+    void Init(uint32_t nominalRate);
+
+    // Forgets the lock, e.g. after the PCM was closed or underran.
+    void Reset();
+
+    // Feeds one measurement and returns the smoothed time of frames.
+    int64_t Update(int64_t frames, int64_t timeNs);
+
+    // Deviation of the estimated rate from the nominal rate
+    double GetDriftPpm() const;
+
+private:
+    // Loop gains per update, and the limits outside of which a measurement
+    // is treated as a discontinuity rather than drift.
+    static constexpr double PHASE_GAIN = 0.05;
+    static constexpr double RATE_GAIN = 0.001;
+    static constexpr double MAX_DRIFT_PPM = 1000.0;
+    static constexpr int64_t RESYNC_THRESHOLD_NS = 20000000;
+
+    double mNominalRate;
+    double mRate;               // frames per second
+    bool mLocked;
+    int64_t mRefFrames;
+    int64_t mRefTimeNs;
+};
+
+#endif // AUDIO_DRIFT_ESTIMATOR_H
@@ -0,0 +1,103 @@
+#define LOG_TAG "audio_hal_sm8650"
+
+#include <log/log.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include "audio_effects_chain.h"
+
+EffectsChain::EffectsChain()
+    : mChannels(0)
+    , mBlockFrames(0)
+    , mActive(&mSlots[0])
+    , mCount(0)
+    , mReaderEpoch(0) {
+    memset(mSlots, 0, sizeof(mSlots));
+}
+
+int EffectsChain::Init(uint32_t channels, size_t blockFrames) {
+    if (channels == 0 || blockFrames == 0) {
+        return -EINVAL;
+    }
+    mChannels = channels;
+    mBlockFrames = blockFrames;
+    return 0;
+}
+
+int EffectsChain::Add(effect_handle_t effect) {
+    std::lock_guard<Mutex> lock(mWriterLock);
+    const Chain* active = mActive.load(std::memory_order_relaxed);
+
+    if (std::find(active->effects, active->effects + active->count, effect) !=
+            active->effects + active->count) {
+        return -EEXIST;
+    }
+    if (active->count == MAX_EFFECTS) {
+        ALOGE("Effects chain full");
+        return -ENOSPC;
+    }
+
+    Chain next = *active;
+    next.effects[next.count++] = effect;
+    Publish(next);
+    return 0;
+}
+
+int EffectsChain::Remove(effect_handle_t effect) {
+    std::lock_guard<Mutex> lock(mWriterLock);
+    const Chain* active = mActive.load(std::memory_order_relaxed);
+
+    Chain next;
+    next.count = 0;
+    for (size_t i = 0; i < active->count; i++) {
+        if (active->effects[i] != effect) {
+            next.effects[next.count++] = active->effects[i];
+        }
+    }
+    if (next.count == active->count) {
+        return -ENOENT;
+    }
+
+    Publish(next);
+    return 0;
+}
+
+// Called with mWriterLock held
+void EffectsChain::Publish(const Chain& next) {
+    const Chain* active = mActive.load(std::memory_order_relaxed);
+    Chain* slot = active == &mSlots[0] ? &mSlots[1] : &mSlots[0];
+
+    // The previous Publish waited out every reader of this slot.
+    *slot = next;
+    mActive.store(slot, std::memory_order_seq_cst);
+    mCount.store(next.count, std::memory_order_relaxed);
+
+    // A reader that entered before the swap may still walk the old slot;
+    // wait until it leaves Process. Readers entering later see the new one.
+    uint64_t epoch = mReaderEpoch.load(std::memory_order_seq_cst);
+    if (epoch & 1) {
+        while (mReaderEpoch.load(std::memory_order_acquire) == epoch) {
+            usleep(500);
+        }
+    }
+}
+
+void EffectsChain::Process(int16_t* data, size_t frames) {
+    mReaderEpoch.fetch_add(1, std::memory_order_seq_cst);
+    const Chain* chain = mActive.load(std::memory_order_seq_cst);
+
+    for (size_t offset = 0; offset < frames && chain->count > 0; offset += mBlockFrames) {
+        audio_buffer_t buffer;
+        buffer.frameCount = std::min(mBlockFrames, frames - offset);
+        buffer.s16 = data + offset * mChannels;
+        for (size_t i = 0; i < chain->count; i++) {
+            effect_handle_t effect = chain->effects[i];
+            // -ENODATA only reports that a disabled effect has finished its
+            // tail; the buffer is left untouched either way.
+            (*effect)->process(effect, &buffer, &buffer);
+        }
+    }
+
+    mReaderEpoch.fetch_add(1, std::memory_order_release);
+}
@@ -0,0 +1,56 @@
+#ifndef AUDIO_EFFECTS_CHAIN_H
+#define AUDIO_EFFECTS_CHAIN_H
+
+#include <hardware/audio_effect.h>
+#include <utils/Mutex.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+
+using namespace android;
+
+// Ordered list of effects run in place over 16-bit interleaved frames.
+//
+// The data path reads the chain without a lock: Add and Remove fill the
+// inactive one of two chain slots, publish it with an atomic swap and then
+// wait for a reader quiescent point before returning, RCU style. The
+// stream keeps running across changes, nothing is allocated per buffer,
+// and a removed effect is guaranteed unused once Remove returns.
+class EffectsChain {
+public:
+    static constexpr size_t MAX_EFFECTS = 8;
+
+    EffectsChain();
+
+    // Effects see at most blockFrames frames per process call.
+    int Init(uint32_t channels, size_t blockFrames);
+
+    int Add(effect_handle_t effect);
+    int Remove(effect_handle_t effect);
+
+    bool IsEmpty() const { return mCount.load(std::memory_order_relaxed) == 0; }
+    size_t GetCount() const { return mCount.load(std::memory_order_relaxed); }
+
+    // Single reader: only the stream's data path thread may call this.
+    void Process(int16_t* data, size_t frames);
+
+private:
+    struct Chain {
+        size_t count;
+        effect_handle_t effects[MAX_EFFECTS];
+    };
+
+    void Publish(const Chain& next);
+
+    uint32_t mChannels;
+    size_t mBlockFrames;
+    Mutex mWriterLock;                  // serializes Add and Remove
+    Chain mSlots[2];
+    std::atomic<const Chain*> mActive;
+    std::atomic<size_t> mCount;
+    // Odd while the reader is inside Process
+    std::atomic<uint64_t> mReaderEpoch;
+};
+
+#endif // AUDIO_EFFECTS_CHAIN_H
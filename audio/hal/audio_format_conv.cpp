@@ -0,0 +1,337 @@
+#define LOG_TAG "audio_hal_sm8650"
+
+#include <log/log.h>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include "audio_format_conv.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FORMAT_CONV_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define FORMAT_CONV_SSE2 1
+#endif
+
+namespace {
+
+constexpr float S16_SCALE = 32768.0f;
+constexpr float S16_MAX = 32767.0f;
+constexpr float Q24_SCALE = 8388608.0f;
+constexpr float Q24_MAX = 8388607.0f;
+constexpr size_t DITHER_MASK = FormatConverter::DITHER_TABLE_SIZE - 1;
+
+static_assert((FormatConverter::DITHER_TABLE_SIZE & DITHER_MASK) == 0,
+              "dither table size must be a power of two");
+
+inline int32_t ClampRound(float v, float lo, float hi) {
+    if (v < lo) v = lo;
+    if (v > hi) v = hi;
+    return static_cast<int32_t>(lrintf(v));
+}
+
+#if FORMAT_CONV_NEON
+typedef float32x4_t vfloat;
+
+inline vfloat VecLoad(const float* p) { return vld1q_f32(p); }
+inline void VecStore(float* p, vfloat v) { vst1q_f32(p, v); }
+inline vfloat VecAdd(vfloat a, vfloat b) { return vaddq_f32(a, b); }
+
+inline int32x4_t VecClampRound(vfloat v, float lo, float hi) {
+    v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(lo)), vdupq_n_f32(hi));
+#if defined(__aarch64__)
+    return vcvtnq_s32_f32(v);
+#else
+    // ARMv7 NEON only truncates; round half away from zero instead.
+    uint32x4_t sign = vandq_u32(vreinterpretq_u32_f32(v), vdupq_n_u32(0x80000000u));
+    vfloat half = vreinterpretq_f32_u32(
+        vorrq_u32(vreinterpretq_u32_f32(vdupq_n_f32(0.5f)), sign));
+    return vcvtq_s32_f32(vaddq_f32(v, half));
+#endif
+}
+
+inline vfloat VecFromInt(const int32_t* p, float scale) {
+    return vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(p)), scale);
+}
+
+inline void VecToInt(int32_t* p, vfloat v, float lo, float hi) {
+    vst1q_s32(p, VecClampRound(v, lo, hi));
+}
+#elif FORMAT_CONV_SSE2
+typedef __m128 vfloat;
+
+inline vfloat VecLoad(const float* p) { return _mm_loadu_ps(p); }
+inline void VecStore(float* p, vfloat v) { _mm_storeu_ps(p, v); }
+inline vfloat VecAdd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+
+inline __m128i VecClampRound(vfloat v, float lo, float hi) {
+    // Clamp first: cvtps2dq returns INT_MIN on overflow.
+    v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(lo)), _mm_set1_ps(hi));
+    return _mm_cvtps_epi32(v);
+}
+
+inline vfloat VecFromInt(const int32_t* p, float scale) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    return _mm_mul_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(scale));
+}
+
+inline void VecToInt(int32_t* p, vfloat v, float lo, float hi) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), VecClampRound(v, lo, hi));
+}
+#endif
+
+// Per-format load/store of samples as floats in [-1, 1).
+struct S16Traits {
+    static constexpr int BITS = 16;
+    static constexpr size_t SIZE = sizeof(int16_t);
+
+    static inline float Load(const void* p, size_t i) {
+        return static_cast<const int16_t*>(p)[i] * (1.0f / S16_SCALE);
+    }
+    static inline void Store(void* p, size_t i, float v) {
+        static_cast<int16_t*>(p)[i] =
+            static_cast<int16_t>(ClampRound(v * S16_SCALE, -S16_SCALE, S16_MAX));
+    }
+#if FORMAT_CONV_NEON
+    static inline vfloat LoadVec(const void* p, size_t i) {
+        int32x4_t x = vmovl_s16(vld1_s16(static_cast<const int16_t*>(p) + i));
+        return vmulq_n_f32(vcvtq_f32_s32(x), 1.0f / S16_SCALE);
+    }
+    static inline void StoreVec(void* p, size_t i, vfloat v) {
+        int32x4_t x = VecClampRound(vmulq_n_f32(v, S16_SCALE), -S16_SCALE, S16_MAX);
+        vst1_s16(static_cast<int16_t*>(p) + i, vmovn_s32(x));
+    }
+#elif FORMAT_CONV_SSE2
+    static inline vfloat LoadVec(const void* p, size_t i) {
+        __m128i x = _mm_loadl_epi64(
+            reinterpret_cast<const __m128i*>(static_cast<const int16_t*>(p) + i));
+        x = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        return _mm_mul_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(1.0f / S16_SCALE));
+    }
+    static inline void StoreVec(void* p, size_t i, vfloat v) {
+        __m128i x = VecClampRound(_mm_mul_ps(v, _mm_set1_ps(S16_SCALE)),
+                                  -S16_SCALE, S16_MAX);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(static_cast<int16_t*>(p) + i),
+                         _mm_packs_epi32(x, x));
+    }
+#endif
+};
+
+struct Q824Traits {
+    static constexpr int BITS = 24;
+    static constexpr size_t SIZE = sizeof(int32_t);
+
+    static inline float Load(const void* p, size_t i) {
+        return static_cast<const int32_t*>(p)[i] * (1.0f / Q24_SCALE);
+    }
+    static inline void Store(void* p, size_t i, float v) {
+        static_cast<int32_t*>(p)[i] = ClampRound(v * Q24_SCALE, -Q24_SCALE, Q24_MAX);
+    }
+#if FORMAT_CONV_NEON || FORMAT_CONV_SSE2
+    static inline vfloat LoadVec(const void* p, size_t i) {
+        return VecFromInt(static_cast<const int32_t*>(p) + i, 1.0f / Q24_SCALE);
+    }
+    static inline void StoreVec(void* p, size_t i, vfloat v) {
+        VecToInt(static_cast<int32_t*>(p) + i,
+#if FORMAT_CONV_NEON
+                 vmulq_n_f32(v, Q24_SCALE),
+#else
+                 _mm_mul_ps(v, _mm_set1_ps(Q24_SCALE)),
+#endif
+                 -Q24_SCALE, Q24_MAX);
+    }
+#endif
+};
+
+// Packed 24-bit has no natural SIMD lane width, so samples are gathered into
+// int32 lanes with scalar byte moves and the arithmetic stays vectorized.
+struct P24Traits {
+    static constexpr int BITS = 24;
+    static constexpr size_t SIZE = 3;
+
+    static inline int32_t Unpack(const uint8_t* b) {
+        return static_cast<int32_t>((static_cast<uint32_t>(b[0]) << 8) |
+                                    (static_cast<uint32_t>(b[1]) << 16) |
+                                    (static_cast<uint32_t>(b[2]) << 24)) >> 8;
+    }
+    static inline void Pack(uint8_t* b, int32_t x) {
+        b[0] = static_cast<uint8_t>(x);
+        b[1] = static_cast<uint8_t>(x >> 8);
+        b[2] = static_cast<uint8_t>(x >> 16);
+    }
+    static inline float Load(const void* p, size_t i) {
+        return Unpack(static_cast<const uint8_t*>(p) + i * SIZE) * (1.0f / Q24_SCALE);
+    }
+    static inline void Store(void* p, size_t i, float v) {
+        Pack(static_cast<uint8_t*>(p) + i * SIZE,
+             ClampRound(v * Q24_SCALE, -Q24_SCALE, Q24_MAX));
+    }
+#if FORMAT_CONV_NEON || FORMAT_CONV_SSE2
+    static inline vfloat LoadVec(const void* p, size_t i) {
+        const uint8_t* b = static_cast<const uint8_t*>(p) + i * SIZE;
+        int32_t x[4] = { Unpack(b), Unpack(b + 3), Unpack(b + 6), Unpack(b + 9) };
+        return VecFromInt(x, 1.0f / Q24_SCALE);
+    }
+    static inline void StoreVec(void* p, size_t i, vfloat v) {
+        int32_t x[4];
+        Q824Traits::StoreVec(x, 0, v);
+        uint8_t* b = static_cast<uint8_t*>(p) + i * SIZE;
+        Pack(b, x[0]);
+        Pack(b + 3, x[1]);
+        Pack(b + 6, x[2]);
+        Pack(b + 9, x[3]);
+    }
+#endif
+};
+
+struct FloatTraits {
+    static constexpr int BITS = 24;  // mantissa precision
+    static constexpr size_t SIZE = sizeof(float);
+
+    static inline float Load(const void* p, size_t i) {
+        return static_cast<const float*>(p)[i];
+    }
+    static inline void Store(void* p, size_t i, float v) {
+        static_cast<float*>(p)[i] = v;
+    }
+#if FORMAT_CONV_NEON || FORMAT_CONV_SSE2
+    static inline vfloat LoadVec(const void* p, size_t i) {
+        return VecLoad(static_cast<const float*>(p) + i);
+    }
+    static inline void StoreVec(void* p, size_t i, vfloat v) {
+        VecStore(static_cast<float*>(p) + i, v);
+    }
+#endif
+};
+
+// Each block is fully loaded before it is stored, so converting in place is
+// safe whenever Dst::SIZE <= Src::SIZE.
+template <typename Src, typename Dst>
+void ConvertKernel(void* dst, const void* src, size_t count,
+                   const float* dither, size_t ditherPos) {
+    constexpr bool kDither = Dst::BITS < Src::BITS;
+    size_t i = 0;
+#if FORMAT_CONV_NEON || FORMAT_CONV_SSE2
+    for (; i + 4 <= count; i += 4) {
+        vfloat v = Src::LoadVec(src, i);
+        if (kDither) {
+            v = VecAdd(v, VecLoad(dither + ((ditherPos + i) & DITHER_MASK)));
+        }
+        Dst::StoreVec(dst, i, v);
+    }
+#endif
+    for (; i < count; i++) {
+        float v = Src::Load(src, i);
+        if (kDither) {
+            v += dither[(ditherPos + i) & DITHER_MASK];
+        }
+        Dst::Store(dst, i, v);
+    }
+}
+
+template <typename Traits>
+void CopyKernel(void* dst, const void* src, size_t count,
+                const float* /*dither*/, size_t /*ditherPos*/) {
+    if (dst != src) {
+        memmove(dst, src, count * Traits::SIZE);
+    }
+}
+
+// Kernel table indexed by [src][dst] in FormatIndex order.
+const FormatConverter::ConvertFn KERNELS[4][4] = {
+    { CopyKernel<S16Traits>,
+      ConvertKernel<S16Traits, P24Traits>,
+      ConvertKernel<S16Traits, Q824Traits>,
+      ConvertKernel<S16Traits, FloatTraits> },
+    { ConvertKernel<P24Traits, S16Traits>,
+      CopyKernel<P24Traits>,
+      ConvertKernel<P24Traits, Q824Traits>,
+      ConvertKernel<P24Traits, FloatTraits> },
+    { ConvertKernel<Q824Traits, S16Traits>,
+      ConvertKernel<Q824Traits, P24Traits>,
+      CopyKernel<Q824Traits>,
+      ConvertKernel<Q824Traits, FloatTraits> },
+    { ConvertKernel<FloatTraits, S16Traits>,
+      ConvertKernel<FloatTraits, P24Traits>,
+      ConvertKernel<FloatTraits, Q824Traits>,
+      CopyKernel<FloatTraits> },
+};
+
+int FormatIndex(audio_format_t format) {
+    switch (format) {
+        case AUDIO_FORMAT_PCM_16_BIT:
+            return 0;
+        case AUDIO_FORMAT_PCM_24_BIT_PACKED:
+            return 1;
+        case AUDIO_FORMAT_PCM_8_24_BIT:
+            return 2;
+        case AUDIO_FORMAT_PCM_FLOAT:
+            return 3;
+        default:
+            return -1;
+    }
+}
+
+int FormatBits(audio_format_t format) {
+    return format == AUDIO_FORMAT_PCM_16_BIT ? S16Traits::BITS : Q824Traits::BITS;
+}
+
+} // namespace
+
+FormatConverter::FormatConverter()
+    : mSrcFormat(AUDIO_FORMAT_PCM_16_BIT)
+    , mDstFormat(AUDIO_FORMAT_PCM_16_BIT)
+    , mKernel(CopyKernel<S16Traits>)
+    , mDitherPos(0) {
+    memset(mDither, 0, sizeof(mDither));
+}
+
+int FormatConverter::Init(audio_format_t src, audio_format_t dst) {
+    ConvertFn kernel = GetKernel(src, dst);
+    if (!kernel) {
+        ALOGE("Unsupported conversion: %x -> %x", src, dst);
+        return -EINVAL;
+    }
+
+    mSrcFormat = src;
+    mDstFormat = dst;
+    mKernel = kernel;
+    mDitherPos = 0;
+    InitDither(dst);
+    return 0;
+}
+
+void FormatConverter::Convert(void* dst, const void* src, size_t count) {
+    mKernel(dst, src, count, mDither, mDitherPos);
+    // Keep the table offset a multiple of four so vector loads stay in bounds.
+    mDitherPos = ((mDitherPos + count + 3) & ~static_cast<size_t>(3)) & DITHER_MASK;
+}
+
+bool FormatConverter::IsSupported(audio_format_t format) {
+    return FormatIndex(format) >= 0;
+}
+
+FormatConverter::ConvertFn FormatConverter::GetKernel(audio_format_t src,
+                                                      audio_format_t dst) {
+    int s = FormatIndex(src);
+    int d = FormatIndex(dst);
+    if (s < 0 || d < 0) {
+        return nullptr;
+    }
+    return KERNELS[s][d];
+}
+
+void FormatConverter::InitDither(audio_format_t dst) {
+    // Triangular PDF dither of +/-1 LSB at the destination resolution,
+    // generated from a fixed-seed LCG so output is reproducible.
+    const float lsb = 1.0f / static_cast<float>(1u << (FormatBits(dst) - 1));
+    uint32_t seed = 0x12345678u;
+    for (size_t i = 0; i < DITHER_TABLE_SIZE; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        float r1 = (seed >> 8) * (1.0f / 16777216.0f);
+        seed = seed * 1664525u + 1013904223u;
+        float r2 = (seed >> 8) * (1.0f / 16777216.0f);
+        mDither[i] = (r1 - r2) * lsb;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef AUDIO_FORMAT_CONV_H
+#define AUDIO_FORMAT_CONV_H
+
+#include <system/audio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Sample format converter between S16, packed 24-bit, 8.24 and float.
+//
+// Samples are widened to float lanes (exact for every supported format),
+// so each kernel is one load/store pair per format. NEON and SSE2 paths
+// process four samples per iteration with a scalar tail. Conversions that
+// lose precision add TPDF dither from a precomputed table, so the kernels
+// never allocate or call into a random number generator.
+class FormatConverter {
+public:
+    typedef void (*ConvertFn)(void* dst, const void* src, size_t count,
+                              const float* dither, size_t ditherPos);
+
+    static constexpr size_t DITHER_TABLE_SIZE = 1024;
+
+    FormatConverter();
+
+    // Selects the kernel for src -> dst. Returns -EINVAL for unsupported pairs.
+    int Init(audio_format_t src, audio_format_t dst);
+
+    // Converts count samples. dst may alias src when the destination sample
+    // is no wider than the source sample.
+    void Convert(void* dst, const void* src, size_t count);
+
+    static bool IsSupported(audio_format_t format);
+    static ConvertFn GetKernel(audio_format_t src, audio_format_t dst);
+
+    audio_format_t GetSourceFormat() const { return mSrcFormat; }
+    audio_format_t GetDestinationFormat() const { return mDstFormat; }
+
+private:
+    void InitDither(audio_format_t dst);
+
+    audio_format_t mSrcFormat;
+    audio_format_t mDstFormat;
+    ConvertFn mKernel;
+    size_t mDitherPos;
+    float mDither[DITHER_TABLE_SIZE];
+};
+
+#endif // AUDIO_FORMAT_CONV_H
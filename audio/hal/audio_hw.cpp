@@ -1,18 +1,97 @@
 #define LOG_TAG "audio_hal_sm8650"
 
 #include <log/log.h>
+#include <cutils/properties.h>
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <cutils/str_parms.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iterator>
 #include "audio_hw.h"
 
-AudioHAL::AudioHAL()
-    : mInitialized(false)
+AudioHAL::AudioHAL(const char* usbProcRoot)
+    : audio_hw_device_t()
+    , mInitialized(false)
+    , mMode(AUDIO_MODE_NORMAL)
     , mOutDevice(AUDIO_DEVICE_NONE)
     , mInDevice(AUDIO_DEVICE_NONE)
-    , mOutputStream(nullptr)
-    , mInputStream(nullptr) {
+    , mMicMute(false)
+    , mOffloadStream(nullptr)
+    , mInputStream(nullptr)
+    , mMixer(nullptr)
+    , mUsbProfiles(usbProcRoot)
+    , mUsbCard(0)
+    , mUsbDevice(0) {
+    InitCapabilities();
+}
+
+void AudioHAL::InitCapabilities() {
+    mOutputCapabilities.sampleRates = BuildSampleRatesResponse(
+        SUPPORTED_SAMPLE_RATES, std::size(SUPPORTED_SAMPLE_RATES));
+    mOutputCapabilities.formats = BuildFormatsResponse(
+        SUPPORTED_FORMATS, std::size(SUPPORTED_FORMATS));
+    mOutputCapabilities.channelMasks = BuildOutputChannelsResponse(SUPPORTED_CHANNEL_MASKS);
+
+    mOffloadCapabilities.sampleRates = BuildSampleRatesResponse(
+        SUPPORTED_OFFLOAD_SAMPLE_RATES, std::size(SUPPORTED_OFFLOAD_SAMPLE_RATES));
+    mOffloadCapabilities.formats = BuildFormatsResponse(
+        SUPPORTED_OFFLOAD_FORMATS, std::size(SUPPORTED_OFFLOAD_FORMATS));
+    mOffloadCapabilities.channelMasks = mOutputCapabilities.channelMasks;
+
+    mInputCapabilities.sampleRates = BuildSampleRatesResponse(
+        SUPPORTED_INPUT_SAMPLE_RATES, std::size(SUPPORTED_INPUT_SAMPLE_RATES));
+    mInputCapabilities.formats = BuildFormatsResponse(&HW_FORMAT, 1);
+    mInputCapabilities.channelMasks = BuildInputChannelsResponse(
+        SUPPORTED_INPUT_CHANNEL_MASKS, std::size(SUPPORTED_INPUT_CHANNEL_MASKS));
+}
+
+// Lists what the device plays natively, so the policy manager picks
+// configurations that need neither resampling nor conversion.
+std::shared_ptr<const CapabilityResponses> AudioHAL::BuildUsbCapabilities(
+        const std::vector<UsbFormatProfile>& profiles, bool output) {
+    std::vector<uint32_t> rates;
+    std::vector<audio_format_t> formats;
+    std::vector<audio_channel_mask_t> inputMasks;
+    audio_channel_mask_t outputMasks = AUDIO_CHANNEL_NONE;
+
+    const uint32_t* candidates = output ? SUPPORTED_SAMPLE_RATES : SUPPORTED_INPUT_SAMPLE_RATES;
+    size_t candidateCount = output ? std::size(SUPPORTED_SAMPLE_RATES) :
+        std::size(SUPPORTED_INPUT_SAMPLE_RATES);
+    for (const UsbFormatProfile& profile : profiles) {
+        // Capture has no conversion stage
+        if (!output && profile.format != HW_FORMAT) {
+            continue;
+        }
+        for (size_t i = 0; i < candidateCount; i++) {
+            if (profile.SupportsRate(candidates[i]) &&
+                    std::find(rates.begin(), rates.end(), candidates[i]) == rates.end()) {
+                rates.push_back(candidates[i]);
+            }
+        }
+        if (std::find(formats.begin(), formats.end(), profile.format) == formats.end()) {
+            formats.push_back(profile.format);
+        }
+        if (output) {
+            outputMasks |= audio_channel_out_mask_from_count(profile.channels);
+        } else {
+            audio_channel_mask_t mask = audio_channel_in_mask_from_count(profile.channels);
+            if (std::find(inputMasks.begin(), inputMasks.end(), mask) == inputMasks.end()) {
+                inputMasks.push_back(mask);
+            }
+        }
+    }
+    std::sort(rates.begin(), rates.end());
+
+    auto responses = std::make_shared<CapabilityResponses>();
+    responses->sampleRates = BuildSampleRatesResponse(rates.data(), rates.size());
+    responses->formats = BuildFormatsResponse(formats.data(), formats.size());
+    responses->channelMasks = output ? BuildOutputChannelsResponse(outputMasks) :
+        BuildInputChannelsResponse(inputMasks.data(), inputMasks.size());
+    return responses;
 }
 
 AudioHAL::~AudioHAL() {
@@ -22,8 +101,8 @@ AudioHAL::~AudioHAL() {
 }
 
 int AudioHAL::CreateInstance(const struct hw_module_t* module,
-                           struct audio_hw_device** device) {
-    AudioHAL* hal = new AudioHAL();
+                           struct audio_hw_device** device, const char* usbProcRoot) {
+    AudioHAL* hal = new AudioHAL(usbProcRoot);
     if (!hal) {
         ALOGE("Failed to allocate AudioHAL");
         return -ENOMEM;
@@ -35,42 +114,118 @@ int AudioHAL::CreateInstance(const struct hw_module_t* module,
         return ret;
     }
 
-    audio_hw_device_t* dev = &hal->mOutputStream->stream.common;
-    dev->common.tag = HARDWARE_DEVICE_TAG;
-    dev->common.version = AUDIO_DEVICE_API_VERSION_3_0;
-    dev->common.module = const_cast<hw_module_t*>(module);
-    dev->common.close = nullptr;  // Will be set by framework
-    dev->init_check = nullptr;
-    dev->set_voice_volume = nullptr;
-    dev->set_master_volume = nullptr;
-    dev->get_master_volume = nullptr;
-    dev->set_master_mute = nullptr;
-    dev->get_master_mute = nullptr;
-    dev->set_mode = nullptr;
-    dev->set_mic_mute = nullptr;
-    dev->get_mic_mute = nullptr;
-    dev->set_parameters = nullptr;
-    dev->get_parameters = nullptr;
-    dev->get_input_buffer_size = nullptr;
-    dev->open_output_stream = nullptr;
-    dev->close_output_stream = nullptr;
-    dev->open_input_stream = nullptr;
-    dev->close_input_stream = nullptr;
-    dev->dump = nullptr;
-
-    *device = dev;
+    // Routing is optional: without mixer paths streams still play on
+    // whatever the mixer defaults to.
+    hal->InitMixerPaths();
+
+    hal->common.tag = HARDWARE_DEVICE_TAG;
+    hal->common.version = AUDIO_DEVICE_API_VERSION_3_0;
+    hal->common.module = const_cast<hw_module_t*>(module);
+    hal->common.close = CloseDevice;
+    hal->init_check = DevInitCheck;
+    hal->set_voice_volume = DevSetVoiceVolume;
+    hal->set_mode = DevSetMode;
+    hal->set_mic_mute = DevSetMicMute;
+    hal->get_mic_mute = DevGetMicMute;
+    hal->set_parameters = DevSetParameters;
+    hal->get_parameters = DevGetParameters;
+    hal->get_input_buffer_size = DevGetInputBufferSize;
+    hal->open_output_stream = DevOpenOutputStream;
+    hal->close_output_stream = DevCloseOutputStream;
+    hal->open_input_stream = DevOpenInputStream;
+    hal->close_input_stream = DevCloseInputStream;
+    hal->dump = DevDump;
+    // No master volume or mute: the framework applies them in software
+
+    *device = hal;
+    return 0;
+}
+
+int AudioHAL::CloseDevice(struct hw_device_t* device) {
+    delete static_cast<AudioHAL*>(reinterpret_cast<audio_hw_device_t*>(device));
+    return 0;
+}
+
+int AudioHAL::DevInitCheck(const struct audio_hw_device* dev) {
+    return static_cast<const AudioHAL*>(dev)->mInitialized ? 0 : -ENODEV;
+}
+
+int AudioHAL::DevSetVoiceVolume(struct audio_hw_device* dev, float volume) {
+    // Voice calls run on the modem DSP, which owns their volume
+    return 0;
+}
+
+int AudioHAL::DevSetMode(struct audio_hw_device* dev, audio_mode_t mode) {
+    return static_cast<AudioHAL*>(dev)->SetMode(mode);
+}
+
+int AudioHAL::DevSetMicMute(struct audio_hw_device* dev, bool state) {
+    static_cast<AudioHAL*>(dev)->mMicMute.store(state, std::memory_order_relaxed);
+    return 0;
+}
+
+int AudioHAL::DevGetMicMute(const struct audio_hw_device* dev, bool* state) {
+    *state = static_cast<const AudioHAL*>(dev)->mMicMute.load(std::memory_order_relaxed);
+    return 0;
+}
+
+int AudioHAL::DevSetParameters(struct audio_hw_device* dev, const char* kvpairs) {
+    return static_cast<AudioHAL*>(dev)->SetDeviceParameters(kvpairs);
+}
+
+char* AudioHAL::DevGetParameters(const struct audio_hw_device* dev, const char* keys) {
+    // Every query the HAL answers is per stream
+    return strdup("");
+}
+
+size_t AudioHAL::DevGetInputBufferSize(const struct audio_hw_device* dev,
+                                       const audio_config_t* config) {
+    return static_cast<const AudioHAL*>(dev)->GetInputBufferSize(config);
+}
+
+int AudioHAL::DevOpenOutputStream(struct audio_hw_device* dev, audio_io_handle_t handle,
+                                  audio_devices_t devices, audio_output_flags_t flags,
+                                  audio_config_t* config,
+                                  struct audio_stream_out** stream_out,
+                                  const char* address) {
+    return static_cast<AudioHAL*>(dev)->OpenOutputStream(handle, devices, flags, config,
+                                                         stream_out);
+}
+
+void AudioHAL::DevCloseOutputStream(struct audio_hw_device* dev,
+                                    struct audio_stream_out* stream) {
+    static_cast<AudioHAL*>(dev)->CloseOutputStream(stream);
+}
+
+int AudioHAL::DevOpenInputStream(struct audio_hw_device* dev, audio_io_handle_t handle,
+                                 audio_devices_t devices, audio_config_t* config,
+                                 struct audio_stream_in** stream_in,
+                                 audio_input_flags_t flags, const char* address,
+                                 audio_source_t source) {
+    return static_cast<AudioHAL*>(dev)->OpenInputStream(handle, devices, config, stream_in);
+}
+
+void AudioHAL::DevCloseInputStream(struct audio_hw_device* dev,
+                                   struct audio_stream_in* stream) {
+    static_cast<AudioHAL*>(dev)->CloseInputStream(stream);
+}
+
+int AudioHAL::DevDump(const struct audio_hw_device* dev, int fd) {
+    // Dumping takes the device lock, as the framework's const is only
+    // about the device's configuration
+    const_cast<AudioHAL*>(static_cast<const AudioHAL*>(dev))->Dump(fd);
     return 0;
 }
 
 int AudioHAL::OpenOutputStream(audio_io_handle_t handle,
                              audio_devices_t devices,
+                             audio_output_flags_t flags,
                              audio_config_t* config,
                              struct audio_stream_out** stream_out) {
     std::lock_guard<Mutex> lock(mLock);
 
-    if (mOutputStream != nullptr) {
-        ALOGE("Output stream already open");
-        return -EINVAL;
+    if (flags & AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD) {
+        return OpenOffloadStream(devices, flags, config, stream_out);
     }
 
     // Validate configuration
@@ -92,7 +247,15 @@ int AudioHAL::OpenOutputStream(audio_io_handle_t handle,
         return -EINVAL;
     }
 
-    if (!(SUPPORTED_FORMATS & config->format)) {
+    bool validFormat = false;
+    for (audio_format_t format : SUPPORTED_FORMATS) {
+        if (format == config->format) {
+            validFormat = true;
+            break;
+        }
+    }
+
+    if (!validFormat) {
         ALOGE("Unsupported format: %x", config->format);
         return -EINVAL;
     }
@@ -105,15 +268,184 @@ int AudioHAL::OpenOutputStream(audio_io_handle_t handle,
     out->config.sampleRate = config->sample_rate;
     out->config.channelMask = config->channel_mask;
     out->config.format = config->format;
-    out->config.bufferSize = PERIOD_SIZE * PERIOD_COUNT *
+    int ret = SelectOutputBackend(devices, &out->config);
+    if (ret != 0) {
+        delete out;
+        return ret;
+    }
+    // Streams on the primary card share its PCM through mOutputMixer; a USB
+    // stream owns its PCM, so there can only be one.
+    for (const Stream* other : mOutputStreams) {
+        if (out->config.card != CARD && other->config.card == out->config.card) {
+            ALOGE("USB output stream already open");
+            delete out;
+            return -EINVAL;
+        }
+    }
+    // Scale the profile to the stream and backend rates so every profile
+    // keeps the same period duration, rounded to 16 frames for mmap
+    // alignment.
+    const PeriodProfile& profile = SelectPeriodProfile(flags);
+    out->config.periodSize = ((static_cast<uint64_t>(profile.periodSize) *
+        config->sample_rate / PERIOD_REFERENCE_RATE) + 15) & ~15u;
+    out->config.hwPeriodSize = ((static_cast<uint64_t>(profile.periodSize) *
+        out->config.hwSampleRate / PERIOD_REFERENCE_RATE) + 15) & ~15u;
+    out->config.periodCount = profile.periodCount;
+    out->config.bufferSize = out->config.periodSize *
         audio_bytes_per_sample(config->format) *
         audio_channel_count_from_out_mask(config->channel_mask);
+    out->flags = flags;
+    out->hal = this;
+    out->standby = true;
+    out->pcm = nullptr;
+    out->offload = nullptr;
+    out->callback = nullptr;
+    out->callbackCookie = nullptr;
+    out->stats = StreamStats();
+    out->hwFramesWritten = 0;
+    out->drift.Init(out->config.hwSampleRate);
+    if (out->config.card != CARD) {
+        out->usbCapabilities = mUsbOutputCapabilities;
+    }
+
+    ret = InitOutputProcessing(out);
+    if (ret != 0) {
+        delete out;
+        return ret;
+    }
+    ret = out->effects.Init(out->config.hwChannels, out->config.hwPeriodSize);
+    if (ret != 0) {
+        delete out;
+        return ret;
+    }
+
+    out->mixerTrack = -1;
+    if (out->config.card == CARD) {
+        out->mixerTrack = mOutputMixer.AddTrack(out->config.hwPeriodSize,
+            out->config.periodCount, (flags & AUDIO_OUTPUT_FLAG_FAST) != 0);
+        if (out->mixerTrack < 0) {
+            ret = out->mixerTrack;
+            delete out;
+            return ret;
+        }
+    }
+
+    out->stream.common.get_sample_rate = GetSampleRate;
+    out->stream.common.set_sample_rate = SetSampleRate;
+    out->stream.common.get_buffer_size = GetBufferSize;
+    out->stream.common.get_channels = GetChannelMask;
+    out->stream.common.get_format = GetFormat;
+    out->stream.common.set_format = SetFormat;
+    out->stream.common.standby = Standby;
+    out->stream.common.dump = Dump;
+    out->stream.common.set_parameters = SetParameters;
+    out->stream.common.get_parameters = GetParameters;
+    out->stream.common.add_audio_effect = AddAudioEffect;
+    out->stream.common.remove_audio_effect = RemoveAudioEffect;
+    out->stream.get_latency = GetLatency;
+    out->stream.set_volume = SetVolume;
+    out->stream.write = Write;
+    out->stream.get_render_position = GetRenderPosition;
+    out->stream.get_presentation_position = GetPresentationPosition;
+
+    mOutputStreams.push_back(out);
+    mOutDevice = devices;
+    ApplyRoute();
+    *stream_out = &out->stream;
+
+    return 0;
+}
+
+// Called with mLock held
+int AudioHAL::OpenOffloadStream(audio_devices_t devices,
+                                audio_output_flags_t flags,
+                                audio_config_t* config,
+                                struct audio_stream_out** stream_out) {
+    if (mOffloadStream != nullptr) {
+        ALOGE("Offload stream already open");
+        return -EINVAL;
+    }
+
+    bool validSampleRate = false;
+    for (uint32_t rate : SUPPORTED_OFFLOAD_SAMPLE_RATES) {
+        if (rate == config->sample_rate) {
+            validSampleRate = true;
+            break;
+        }
+    }
+
+    if (!validSampleRate) {
+        ALOGE("Unsupported offload sample rate: %u", config->sample_rate);
+        return -EINVAL;
+    }
+
+    if (!(SUPPORTED_CHANNEL_MASKS & config->channel_mask)) {
+        ALOGE("Unsupported offload channel mask: %x", config->channel_mask);
+        return -EINVAL;
+    }
+
+    CompressOffload::Config offloadConfig = {};
+    offloadConfig.format = config->format;
+    offloadConfig.sampleRate = config->sample_rate;
+    offloadConfig.channels = audio_channel_count_from_out_mask(config->channel_mask);
+    offloadConfig.bitRate = config->offload_info.bit_rate;
+    offloadConfig.fragmentSize = OFFLOAD_FRAGMENT_SIZE;
+    offloadConfig.fragments = OFFLOAD_FRAGMENT_COUNT;
+
+    Stream* out = new Stream();
+    if (!out) {
+        return -ENOMEM;
+    }
+
+    out->offload = new CompressOffload();
+    int ret = out->offload->Init(offloadConfig);
+    if (ret != 0) {
+        delete out->offload;
+        delete out;
+        return ret;
+    }
+
+    out->config.sampleRate = config->sample_rate;
+    out->config.channelMask = config->channel_mask;
+    out->config.format = config->format;
+    out->config.periodSize = 0;
+    out->config.hwPeriodSize = 0;
+    out->config.periodCount = OFFLOAD_FRAGMENT_COUNT;
+    out->config.bufferSize = OFFLOAD_FRAGMENT_SIZE;
+    out->flags = flags;
     out->hal = this;
     out->standby = true;
     out->pcm = nullptr;
+    out->mixerTrack = -1;
+    out->callback = nullptr;
+    out->callbackCookie = nullptr;
+    out->stats = StreamStats();
 
-    mOutputStream = out;
+    out->stream.common.get_sample_rate = GetSampleRate;
+    out->stream.common.set_sample_rate = SetSampleRate;
+    out->stream.common.get_buffer_size = GetBufferSize;
+    out->stream.common.get_channels = GetChannelMask;
+    out->stream.common.get_format = GetFormat;
+    out->stream.common.set_format = SetFormat;
+    out->stream.common.standby = Standby;
+    out->stream.common.dump = Dump;
+    out->stream.common.set_parameters = SetParameters;
+    out->stream.common.get_parameters = GetParameters;
+    out->stream.common.add_audio_effect = AddAudioEffect;
+    out->stream.common.remove_audio_effect = RemoveAudioEffect;
+    out->stream.get_latency = GetLatency;
+    out->stream.write = Write;
+    out->stream.get_render_position = GetRenderPosition;
+    out->stream.get_presentation_position = GetPresentationPosition;
+    out->stream.set_callback = SetCallback;
+    out->stream.pause = Pause;
+    out->stream.resume = Resume;
+    out->stream.drain = Drain;
+    out->stream.flush = Flush;
+
+    mOffloadStream = out;
     mOutDevice = devices;
+    ApplyRoute();
     *stream_out = &out->stream;
 
     return 0;
@@ -130,35 +462,330 @@ int AudioHAL::OpenInputStream(audio_io_handle_t handle,
         return -EINVAL;
     }
 
-    // Input stream implementation would be similar to output stream
-    // For brevity, we'll return -ENOSYS to indicate unimplemented
-    return -ENOSYS;
+    int ret = CheckInputConfig(config);
+    if (ret != 0) {
+        return ret;
+    }
+
+    InStream* in = new InStream();
+    if (!in) {
+        return -ENOMEM;
+    }
+
+    size_t frameSize = audio_bytes_per_sample(config->format) *
+        audio_channel_count_from_in_mask(config->channel_mask);
+
+    in->config.sampleRate = config->sample_rate;
+    in->config.channelMask = config->channel_mask;
+    in->config.format = config->format;
+    ret = SelectInputBackend(devices, &in->config);
+    if (ret != 0) {
+        delete in;
+        return ret;
+    }
+    in->config.periodSize = GetCapturePeriodSize(config->sample_rate);
+    in->config.hwPeriodSize = in->config.periodSize;
+    in->config.periodCount = CAPTURE_PERIOD_PROFILE.periodCount;
+    in->config.bufferSize = in->config.periodSize * frameSize;
+    in->hal = this;
+    in->device = devices;
+    in->pcm = nullptr;
+    in->standby = true;
+    in->captureRunning.store(false);
+    in->framesCaptured = 0;
+    in->framesRead.store(0);
+    in->framesDropped.store(0);
+    in->framesLost.store(0);
+    if (in->config.card != CARD) {
+        in->usbCapabilities = mUsbInputCapabilities;
+    }
+
+    ret = in->ring.Init(in->config.periodSize * CAPTURE_RING_PERIODS, frameSize);
+    if (ret != 0) {
+        delete in;
+        return ret;
+    }
+    ret = in->effects.Init(audio_channel_count_from_in_mask(config->channel_mask),
+                           in->config.periodSize);
+    if (ret != 0) {
+        delete in;
+        return ret;
+    }
+    in->captureBuffer.resize(in->config.bufferSize);
+    sem_init(&in->dataReady, 0, 0);
+
+    in->stream.common.get_sample_rate = InGetSampleRate;
+    in->stream.common.set_sample_rate = SetSampleRate;
+    in->stream.common.get_buffer_size = InGetBufferSize;
+    in->stream.common.get_channels = InGetChannelMask;
+    in->stream.common.get_format = InGetFormat;
+    in->stream.common.set_format = SetFormat;
+    in->stream.common.standby = InStandby;
+    in->stream.common.dump = InDump;
+    in->stream.common.set_parameters = InSetParameters;
+    in->stream.common.get_parameters = InGetParameters;
+    in->stream.common.add_audio_effect = InAddAudioEffect;
+    in->stream.common.remove_audio_effect = InRemoveAudioEffect;
+    in->stream.set_gain = SetGain;
+    in->stream.read = Read;
+    in->stream.get_input_frames_lost = GetInputFramesLost;
+    in->stream.get_capture_position = GetCapturePosition;
+
+    mInputStream = in;
+    mInDevice = devices;
+    ApplyRoute();
+    *stream_in = &in->stream;
+
+    return 0;
+}
+
+int AudioHAL::SetMode(audio_mode_t mode) {
+    std::lock_guard<Mutex> lock(mLock);
+
+    if (mode == mMode) {
+        return 0;
+    }
+
+    mMode = mode;
+    int ret = ApplyRoute();
+    return ret < 0 ? ret : 0;
+}
+
+size_t AudioHAL::GetInputBufferSize(const audio_config_t* config) const {
+    if (CheckInputConfig(config) != 0) {
+        return 0;
+    }
+    return GetCapturePeriodSize(config->sample_rate) *
+        audio_bytes_per_sample(config->format) *
+        audio_channel_count_from_in_mask(config->channel_mask);
+}
+
+void AudioHAL::Dump(int fd) {
+    std::lock_guard<Mutex> lock(mLock);
+
+    dprintf(fd, "Audio HAL:\n");
+    dprintf(fd, "  mode: %d, out devices: %x, in devices: %x, mic mute: %d\n",
+            mMode, mOutDevice, mInDevice, mMicMute.load(std::memory_order_relaxed));
+    dprintf(fd, "  usb: %s\n", mUsbCapabilities ? "connected" : "none");
+    for (Stream* out : mOutputStreams) {
+        AudioHAL::Dump(&out->stream.common, fd);
+    }
+    if (mOffloadStream) {
+        AudioHAL::Dump(&mOffloadStream->stream.common, fd);
+    }
+    if (mInputStream) {
+        InDump(&mInputStream->stream.common, fd);
+    }
+}
+
+int AudioHAL::SetDeviceParameters(const char* kvpairs) {
+    audio_devices_t connected = AUDIO_DEVICE_NONE;
+    audio_devices_t disconnected = AUDIO_DEVICE_NONE;
+    uint32_t card = 0;
+    uint32_t device = 0;
+    bool hasCard = false;
+
+    ParameterParser parser(kvpairs);
+    std::string_view key;
+    std::string_view value;
+    while (parser.Next(&key, &value)) {
+        uint32_t number;
+        if (!ParameterParser::ParseUint32(value, &number)) {
+            continue;
+        }
+        switch (LookupParameterKey(key)) {
+            case ParameterKey::CONNECT:
+                connected = number;
+                break;
+            case ParameterKey::DISCONNECT:
+                disconnected = number;
+                break;
+            case ParameterKey::CARD:
+                card = number;
+                hasCard = true;
+                break;
+            case ParameterKey::DEVICE:
+                device = number;
+                break;
+            default:
+                break;
+        }
+    }
+
+    std::lock_guard<Mutex> lock(mLock);
+    if ((connected == AUDIO_DEVICE_OUT_USB_DEVICE ||
+            connected == AUDIO_DEVICE_IN_USB_DEVICE) && hasCard) {
+        // Playback and capture connect separately with the same address
+        if (mUsbCapabilities && mUsbCard == card && mUsbDevice == device) {
+            return 0;
+        }
+        return ConnectUsbDevice(card, device);
+    }
+    if (disconnected == AUDIO_DEVICE_OUT_USB_DEVICE ||
+            disconnected == AUDIO_DEVICE_IN_USB_DEVICE) {
+        DisconnectUsbDevice();
+    }
+    return 0;
+}
+
+// Called with mLock held
+int AudioHAL::ConnectUsbDevice(unsigned int card, unsigned int device) {
+    std::shared_ptr<const UsbCapabilities> caps = mUsbProfiles.Probe(card);
+    if (!caps) {
+        ALOGE("USB card %u has no usable stream descriptors", card);
+        return -ENODEV;
+    }
+
+    mUsbCard = card;
+    mUsbDevice = device;
+    mUsbCapabilities = caps;
+    mUsbOutputCapabilities = BuildUsbCapabilities(caps->playback, true);
+    mUsbInputCapabilities = BuildUsbCapabilities(caps->capture, false);
+    ALOGI("USB card %u: %zu playback and %zu capture profiles (%zu probed, %zu cached)",
+          card, caps->playback.size(), caps->capture.size(),
+          mUsbProfiles.GetProbeCount(), mUsbProfiles.GetHitCount());
+    return 0;
+}
+
+// Called with mLock held. Open streams keep their configuration; their
+// writes fail until they are closed.
+void AudioHAL::DisconnectUsbDevice() {
+    mUsbCapabilities.reset();
+    mUsbOutputCapabilities.reset();
+    mUsbInputCapabilities.reset();
+}
+
+// Called with mLock held
+int AudioHAL::SelectOutputBackend(audio_devices_t devices, StreamConfig* config) {
+    if (!(devices & AUDIO_DEVICE_OUT_USB_DEVICE)) {
+        config->card = CARD;
+        config->device = DEVICE;
+        config->hwSampleRate = HW_SAMPLE_RATE;
+        config->hwChannels = PRIMARY_CHANNELS;
+        config->hwFormat = HW_FORMAT;
+        config->hwPcmFormat = HW_PCM_FORMAT;
+        return 0;
+    }
+
+    if (!mUsbCapabilities) {
+        ALOGE("No USB device connected");
+        return -ENODEV;
+    }
+
+    // Play the stream rate natively if the device can, else resample to
+    // HW_SAMPLE_RATE as the primary backend does.
+    UsbStreamConfig usb;
+    uint32_t channels = audio_channel_count_from_out_mask(config->channelMask);
+    int ret = UsbProfileCache::SelectConfig(mUsbCapabilities->playback, config->sampleRate,
+                                            config->format, channels, &usb);
+    if (ret != 0 && Resampler::IsSupported(config->sampleRate, HW_SAMPLE_RATE)) {
+        ret = UsbProfileCache::SelectConfig(mUsbCapabilities->playback, HW_SAMPLE_RATE,
+                                            config->format, channels, &usb);
+    }
+    if (ret != 0) {
+        ALOGE("USB device cannot play %u Hz", config->sampleRate);
+        return ret;
+    }
+
+    config->card = mUsbCard;
+    config->device = mUsbDevice;
+    config->hwSampleRate = usb.sampleRate;
+    config->hwChannels = usb.channels;
+    config->hwFormat = usb.format;
+    config->hwPcmFormat = usb.pcmFormat;
+    return 0;
+}
+
+// Called with mLock held. Capture has no conversion stage, so USB streams
+// must match a native profile exactly.
+int AudioHAL::SelectInputBackend(audio_devices_t devices, StreamConfig* config) {
+    uint32_t channels = audio_channel_count_from_in_mask(config->channelMask);
+    config->hwSampleRate = config->sampleRate;
+    config->hwChannels = channels;
+    config->hwFormat = HW_FORMAT;
+    config->hwPcmFormat = HW_PCM_FORMAT;
+
+    if (devices != AUDIO_DEVICE_IN_USB_DEVICE) {
+        config->card = CARD;
+        config->device = CAPTURE_DEVICE;
+        return 0;
+    }
+
+    if (!mUsbCapabilities) {
+        ALOGE("No USB device connected");
+        return -ENODEV;
+    }
+
+    UsbStreamConfig usb;
+    int ret = UsbProfileCache::SelectConfig(mUsbCapabilities->capture, config->sampleRate,
+                                            HW_FORMAT, channels, &usb);
+    if (ret != 0 || usb.format != HW_FORMAT || usb.channels != channels) {
+        ALOGE("USB device cannot capture %u Hz, %u channels", config->sampleRate, channels);
+        return -EINVAL;
+    }
+
+    config->card = mUsbCard;
+    config->device = mUsbDevice;
+    return 0;
 }
 
 int AudioHAL::CloseOutputStream(struct audio_stream_out* stream) {
     std::lock_guard<Mutex> lock(mLock);
 
     Stream* out = reinterpret_cast<Stream*>(stream);
-    if (out != mOutputStream) {
+    auto it = std::find(mOutputStreams.begin(), mOutputStreams.end(), out);
+    if (it == mOutputStreams.end() && out != mOffloadStream) {
         ALOGE("Invalid output stream");
         return -EINVAL;
     }
 
-    if (out->pcm) {
-        pcm_close(out->pcm);
+    {
+        // Waits for an in-flight write to finish.
+        std::lock_guard<Mutex> streamLock(out->lock);
+        if (out->pcm) {
+            pcm_close(out->pcm);
+        }
+        if (out->mixerTrack >= 0) {
+            mOutputMixer.RemoveTrack(out->mixerTrack);
+        }
+        if (out->offload) {
+            out->offload->Close();
+            delete out->offload;
+        }
+    }
+
+    if (out->offload) {
+        mOffloadStream = nullptr;
+    } else {
+        mOutputStreams.erase(it);
     }
 
     delete out;
-    mOutputStream = nullptr;
     return 0;
 }
 
 int AudioHAL::CloseInputStream(struct audio_stream_in* stream) {
     std::lock_guard<Mutex> lock(mLock);
 
-    // Input stream implementation would be similar to output stream
-    // For brevity, we'll return -ENOSYS to indicate unimplemented
-    return -ENOSYS;
+    InStream* in = reinterpret_cast<InStream*>(stream);
+    if (in != mInputStream) {
+        ALOGE("Invalid input stream");
+        return -EINVAL;
+    }
+
+    {
+        std::lock_guard<Mutex> streamLock(in->lock);
+        if (!in->standby) {
+            StopCapture(in);
+        }
+    }
+
+    sem_destroy(&in->dataReady);
+    delete in;
+    mInputStream = nullptr;
+    mInDevice = AUDIO_DEVICE_NONE;
+    ApplyRoute();
+    return 0;
 }
 
 uint32_t AudioHAL::GetSampleRate(const struct audio_stream* stream) {
@@ -193,13 +820,21 @@ int AudioHAL::SetFormat(struct audio_stream* stream, audio_format_t format) {
 
 int AudioHAL::Standby(struct audio_stream* stream) {
     Stream* s = reinterpret_cast<Stream*>(stream);
-    std::lock_guard<Mutex> lock(s->hal->mLock);
+    std::lock_guard<Mutex> lock(s->lock);
 
     if (!s->standby) {
         if (s->pcm) {
             pcm_close(s->pcm);
             s->pcm = nullptr;
         }
+        if (s->mixerTrack >= 0) {
+            s->hal->mOutputMixer.Standby(s->mixerTrack);
+        }
+        if (s->offload) {
+            s->offload->Close();
+        }
+        s->resampler.Reset();
+        s->drift.Reset();
         s->standby = true;
     }
 
@@ -207,83 +842,1026 @@ int AudioHAL::Standby(struct audio_stream* stream) {
 }
 
 int AudioHAL::SetParameters(struct audio_stream* stream, const char* kvpairs) {
-    // Parameter setting not supported in this implementation
-    return 0;
+    Stream* s = reinterpret_cast<Stream*>(stream);
+
+    int ret = 0;
+    uint32_t delay = 0;
+    uint32_t padding = 0;
+    bool gapless = false;
+    ParameterParser parser(kvpairs);
+    std::string_view key;
+    std::string_view value;
+    while (parser.Next(&key, &value)) {
+        uint32_t number;
+        if (!ParameterParser::ParseUint32(value, &number)) {
+            continue;
+        }
+        switch (LookupParameterKey(key)) {
+            case ParameterKey::ROUTING:
+                if (number != AUDIO_DEVICE_NONE) {
+                    std::lock_guard<Mutex> lock(s->hal->mLock);
+                    s->hal->mOutDevice = number;
+                    ret = s->hal->ApplyRoute();
+                }
+                break;
+            case ParameterKey::OFFLOAD_DELAY_SAMPLES:
+                delay = number;
+                gapless = true;
+                break;
+            case ParameterKey::OFFLOAD_PADDING_SAMPLES:
+                padding = number;
+                gapless = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (gapless && s->offload) {
+        s->offload->SetGaplessMetadata(delay, padding);
+    }
+
+    return ret < 0 ? ret : 0;
 }
 
 char* AudioHAL::GetParameters(const struct audio_stream* stream, const char* keys) {
-    // Parameter getting not supported in this implementation
-    return strdup("");
+    const Stream* s = reinterpret_cast<const Stream*>(stream);
+    const AudioHAL* hal = s->hal;
+    if (s->usbCapabilities) {
+        return s->usbCapabilities->Reply(keys);
+    }
+    return s->offload ? hal->mOffloadCapabilities.Reply(keys) :
+        hal->mOutputCapabilities.Reply(keys);
 }
 
+// Effects changes never take the stream lock, so a write in flight keeps
+// running; the chain swap waits for it instead.
 int AudioHAL::AddAudioEffect(const struct audio_stream* stream, effect_handle_t effect) {
-    // Audio effects not supported in this implementation
-    return 0;
+    const Stream* s = reinterpret_cast<const Stream*>(stream);
+    if (s->offload) {
+        // Offloaded audio never passes through the application processor
+        return -ENOSYS;
+    }
+    if (s->config.hwFormat != AUDIO_FORMAT_PCM_16_BIT) {
+        // Effects process 16-bit buffers only
+        return -ENOSYS;
+    }
+    return s->effects.Add(effect);
 }
 
 int AudioHAL::RemoveAudioEffect(const struct audio_stream* stream, effect_handle_t effect) {
-    // Audio effects not supported in this implementation
-    return 0;
+    const Stream* s = reinterpret_cast<const Stream*>(stream);
+    if (s->offload) {
+        return -ENOSYS;
+    }
+    return s->effects.Remove(effect);
 }
 
-int AudioHAL::InitializeALSA() {
-    if (mInitialized) {
+int AudioHAL::Dump(const struct audio_stream* stream, int fd) {
+    const Stream* s = reinterpret_cast<const Stream*>(stream);
+    std::lock_guard<Mutex> lock(s->lock);
+
+    dprintf(fd, "  Output stream %p:\n", s);
+    if (s->offload) {
+        dprintf(fd, "    standby: %d, compress offload, format: %x\n",
+                s->standby, s->config.format);
+        dprintf(fd, "    fragments: %u x %zu bytes, non-blocking: %d\n",
+                s->config.periodCount, s->config.bufferSize, s->callback != nullptr);
         return 0;
     }
+    dprintf(fd, "    standby: %d, fast: %d\n", s->standby,
+            (s->flags & AUDIO_OUTPUT_FLAG_FAST) != 0);
+    dprintf(fd, "    period: %u frames x %u\n", s->config.periodSize,
+            s->config.periodCount);
+    dprintf(fd, "    channels: %u -> %u (mixing: %d)\n",
+            s->mixer.GetInputChannels(), s->mixer.GetOutputChannels(),
+            s->mixer.IsActive());
+    dprintf(fd, "    sample rate: %u -> %u (resampling: %d)\n",
+            s->config.sampleRate, s->config.hwSampleRate, s->resampler.IsActive());
+    dprintf(fd, "    pcm: card %u device %u, format %x -> %x\n", s->config.card,
+            s->config.device, s->config.format, s->config.hwFormat);
+    if (s->mixerTrack >= 0) {
+        OutputMixer::StartStats start = s->hal->mOutputMixer.GetStartStats();
+        dprintf(fd, "    mixer track: %d, mixer period: %u frames\n", s->mixerTrack,
+                s->hal->mOutputMixer.GetPeriodSize());
+        dprintf(fd, "    mixer starts: %u warm, %u cold, p50 %lld us, max %lld us\n",
+                start.warmStarts, start.coldStarts,
+                static_cast<long long>(start.latency.GetPercentileUs(50)),
+                static_cast<long long>(start.latency.GetMaxUs()));
+    }
+    dprintf(fd, "    frames written: %llu\n",
+            static_cast<unsigned long long>(s->stats.framesWritten));
+    dprintf(fd, "    underruns: %u\n", s->stats.underruns);
+    dprintf(fd, "    clock drift: %.1f ppm\n", s->drift.GetDriftPpm());
+    dprintf(fd, "    effects: %zu\n", s->effects.GetCount());
+    dprintf(fd, "    write latency: p50 %lld us, p99 %lld us, max %lld us\n",
+            static_cast<long long>(s->stats.writeLatency.GetPercentileUs(50)),
+            static_cast<long long>(s->stats.writeLatency.GetPercentileUs(99)),
+            static_cast<long long>(s->stats.writeLatency.GetMaxUs()));
+    dprintf(fd, "    standby exit latency: last %lld us, max %lld us\n",
+            static_cast<long long>(s->stats.standbyExitLatency.GetLastUs()),
+            static_cast<long long>(s->stats.standbyExitLatency.GetMaxUs()));
+    DumpMetrics(s, fd);
+    return 0;
+}
 
-    // Open and configure ALSA card
-    struct pcm_config config = {};
-    config.channels = 2;
-    config.rate = 48000;
-    config.period_size = PERIOD_SIZE;
-    config.period_count = PERIOD_COUNT;
-    config.format = PCM_FORMAT_S16_LE;
-    config.start_threshold = 0;
-    config.stop_threshold = 0;
-    config.silence_threshold = 0;
+// One line of space separated key=value pairs, stable across builds so
+// dumps can be diffed and parsed by regression scripts.
+void AudioHAL::DumpMetrics(const Stream* stream, int fd) {
+    const StreamStats& stats = stream->stats;
+    const double audioSeconds = stream->config.sampleRate && stats.framesWritten ?
+        static_cast<double>(stats.framesWritten) / stream->config.sampleRate : 0.0;
 
-    struct pcm* pcm = pcm_open(CARD, DEVICE, PCM_OUT, &config);
-    if (!pcm || !pcm_is_ready(pcm)) {
-        ALOGE("Failed to open ALSA device: %s", pcm_get_error(pcm));
-        if (pcm) {
-            pcm_close(pcm);
-        }
-        return -ENODEV;
+    dprintf(fd, "    metrics: frames=%llu underruns=%u writes=%llu write_p50_us=%lld "
+            "write_p90_us=%lld write_p99_us=%lld write_max_us=%lld standby_exits=%llu "
+            "standby_exit_p50_us=%lld standby_exit_max_us=%lld cpu_ms_per_s=%.3f",
+            static_cast<unsigned long long>(stats.framesWritten), stats.underruns,
+            static_cast<unsigned long long>(stats.writeLatency.GetCount()),
+            static_cast<long long>(stats.writeLatency.GetPercentileUs(50)),
+            static_cast<long long>(stats.writeLatency.GetPercentileUs(90)),
+            static_cast<long long>(stats.writeLatency.GetPercentileUs(99)),
+            static_cast<long long>(stats.writeLatency.GetMaxUs()),
+            static_cast<unsigned long long>(stats.standbyExitLatency.GetCount()),
+            static_cast<long long>(stats.standbyExitLatency.GetPercentileUs(50)),
+            static_cast<long long>(stats.standbyExitLatency.GetMaxUs()),
+            audioSeconds > 0 ? ns2us(stats.cpuNs) / 1000.0 / audioSeconds : 0.0);
+    if (stream->mixerTrack >= 0) {
+        const OutputMixer& mixer = stream->hal->mOutputMixer;
+        OutputMixer::StartStats start = mixer.GetStartStats();
+        dprintf(fd, " mixer_cpu_ms_per_s=%.3f mixer_warm_starts=%u mixer_cold_starts=%u "
+                "mixer_start_p50_us=%lld mixer_start_p99_us=%lld mixer_start_max_us=%lld",
+                mixer.GetCpuMsPerSecond(), start.warmStarts, start.coldStarts,
+                static_cast<long long>(start.latency.GetPercentileUs(50)),
+                static_cast<long long>(start.latency.GetPercentileUs(99)),
+                static_cast<long long>(start.latency.GetMaxUs()));
     }
+    dprintf(fd, "\n");
+}
+
+uint32_t AudioHAL::GetLatency(const struct audio_stream_out* stream) {
+    const Stream* s = reinterpret_cast<const Stream*>(stream);
+    if (s->offload) {
+        return OFFLOAD_LATENCY_MS;
+    }
+    uint32_t latency = (s->config.hwPeriodSize * s->config.periodCount * 1000) /
+        s->config.hwSampleRate;
+    if (s->mixerTrack >= 0) {
+        // Queued in the track ring, then in the mixer's PCM buffer
+        latency += s->hal->mOutputMixer.GetLatencyMs();
+    }
+    return latency;
+}
+
+int AudioHAL::SetVolume(struct audio_stream_out* stream, float left, float right) {
+    Stream* s = reinterpret_cast<Stream*>(stream);
+    if (s->mixerTrack < 0) {
+        return -ENOSYS;
+    }
+    // One gain per track; balance is left to the framework mixer.
+    s->hal->mOutputMixer.SetVolume(s->mixerTrack, std::max(left, right));
+    return 0;
+}
+
+ssize_t AudioHAL::Write(struct audio_stream_out* stream, const void* buffer, size_t bytes) {
+    Stream* s = reinterpret_cast<Stream*>(stream);
+    std::lock_guard<Mutex> lock(s->lock);
+
+    if (s->offload) {
+        return WriteOffload(s, buffer, bytes);
+    }
+
+    const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    const nsecs_t cpuStart = systemTime(SYSTEM_TIME_THREAD);
+    const bool standbyExit = s->standby;
+
+    // The PCM is opened lazily on the first write after standby and kept
+    // until the next standby or close. Mixer tracks start with their first
+    // write instead.
+    if (s->standby) {
+        if (s->mixerTrack < 0) {
+            int ret = s->hal->ConfigureALSADevice(s);
+            if (ret != 0) {
+                return ret;
+            }
+        }
+        s->standby = false;
+    }
+
+    UpdateUnderrunCount(s);
+
+    size_t frameSize = audio_bytes_per_sample(s->config.format) *
+        audio_channel_count_from_out_mask(s->config.channelMask);
+    size_t hwFrameSize = audio_bytes_per_sample(s->config.hwFormat) * s->config.hwChannels;
+    size_t frames = bytes / frameSize;
+    const uint8_t* src = static_cast<const uint8_t*>(buffer);
+
+    while (frames > 0) {
+        const void* data;
+        size_t dataBytes;
+        size_t consumed = ProcessOutput(s, src, frames, &data, &dataBytes);
+
+        int ret = WriteToPcm(s, data, dataBytes);
+        if (ret != 0) {
+            if (s->pcm) {
+                ALOGE("Failed to write to ALSA device: %s", pcm_get_error(s->pcm));
+                pcm_close(s->pcm);
+                s->pcm = nullptr;
+            } else {
+                s->hal->mOutputMixer.Standby(s->mixerTrack);
+            }
+            s->standby = true;
+            return -EIO;
+        }
+
+        s->hwFramesWritten += dataBytes / hwFrameSize;
+        src += consumed * frameSize;
+        frames -= consumed;
+    }
+
+    s->stats.framesWritten += bytes / frameSize;
+    UpdatePresentationPosition(s);
+    RecordWrite(s, start, cpuStart, standbyExit);
+
+    return bytes;
+}
+
+int AudioHAL::GetRenderPosition(const struct audio_stream_out* stream, uint32_t* dspFrames) {
+    const Stream* s = reinterpret_cast<const Stream*>(stream);
+
+    if (s->offload) {
+        uint32_t sampleRate;
+        return s->offload->GetTimestamp(dspFrames, &sampleRate);
+    }
+
+    PresentationPosition position = s->presentationPosition.Load();
+    if (position.timeNs == 0) {
+        return -ENODATA;
+    }
+    *dspFrames = static_cast<uint32_t>(position.frames);
+    return 0;
+}
+
+int AudioHAL::GetPresentationPosition(const struct audio_stream_out* stream,
+                                      uint64_t* frames, struct timespec* timestamp) {
+    const Stream* s = reinterpret_cast<const Stream*>(stream);
+
+    if (s->offload) {
+        // The DSP reports rendered frames directly; date them now.
+        uint32_t rendered;
+        uint32_t sampleRate;
+        int ret = s->offload->GetTimestamp(&rendered, &sampleRate);
+        if (ret != 0) {
+            return ret;
+        }
+        *frames = rendered;
+        clock_gettime(CLOCK_MONOTONIC, timestamp);
+        return 0;
+    }
+
+    PresentationPosition position = s->presentationPosition.Load();
+    if (position.timeNs == 0) {
+        return -ENODATA;
+    }
+    *frames = position.frames;
+    timestamp->tv_sec = position.timeNs / 1000000000LL;
+    timestamp->tv_nsec = position.timeNs % 1000000000LL;
+    return 0;
+}
+
+// Called with the stream lock held
+ssize_t AudioHAL::WriteOffload(Stream* stream, const void* buffer, size_t bytes) {
+    const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    const nsecs_t cpuStart = systemTime(SYSTEM_TIME_THREAD);
+    const bool standbyExit = stream->standby;
+
+    if (stream->standby) {
+        int ret = stream->offload->Open(CARD, OFFLOAD_DEVICE);
+        if (ret != 0) {
+            return ret;
+        }
+        stream->standby = false;
+    }
+
+    ssize_t ret = stream->offload->Write(buffer, bytes);
+    if (ret < 0) {
+        stream->offload->Close();
+        stream->standby = true;
+        return ret;
+    }
+
+    RecordWrite(stream, start, cpuStart, standbyExit);
+    return ret;
+}
+
+// Called with the stream lock held at the end of a successful write
+void AudioHAL::RecordWrite(Stream* stream, nsecs_t start, nsecs_t cpuStart, bool standbyExit) {
+    const nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    stream->stats.cpuNs += systemTime(SYSTEM_TIME_THREAD) - cpuStart;
+    stream->stats.writeLatency.Record(elapsed);
+    if (standbyExit) {
+        stream->stats.standbyExitLatency.Record(elapsed);
+    }
+}
+
+int AudioHAL::SetCallback(struct audio_stream_out* stream,
+                          stream_callback_t callback, void* cookie) {
+    Stream* s = reinterpret_cast<Stream*>(stream);
+    std::lock_guard<Mutex> lock(s->lock);
+
+    // The callback decides blocking mode when the device opens.
+    if (!s->standby) {
+        return -EINVAL;
+    }
+    s->callback = callback;
+    s->callbackCookie = cookie;
+    s->offload->SetCallback(callback ? OffloadEventCallback : nullptr, s);
+    return 0;
+}
+
+int AudioHAL::Pause(struct audio_stream_out* stream) {
+    Stream* s = reinterpret_cast<Stream*>(stream);
+    std::lock_guard<Mutex> lock(s->lock);
+    return s->standby ? -ENOSYS : s->offload->Pause();
+}
+
+int AudioHAL::Resume(struct audio_stream_out* stream) {
+    Stream* s = reinterpret_cast<Stream*>(stream);
+    std::lock_guard<Mutex> lock(s->lock);
+    return s->standby ? -ENOSYS : s->offload->Resume();
+}
+
+int AudioHAL::Drain(struct audio_stream_out* stream, audio_drain_type_t type) {
+    Stream* s = reinterpret_cast<Stream*>(stream);
+    std::lock_guard<Mutex> lock(s->lock);
+    return s->standby ? -ENOSYS :
+        s->offload->Drain(type == AUDIO_DRAIN_EARLY_NOTIFY);
+}
+
+int AudioHAL::Flush(struct audio_stream_out* stream) {
+    Stream* s = reinterpret_cast<Stream*>(stream);
+    std::lock_guard<Mutex> lock(s->lock);
+    return s->standby ? 0 : s->offload->Flush();
+}
+
+// Runs on the offload worker thread without any HAL lock held.
+void AudioHAL::OffloadEventCallback(CompressOffload::Event event, void* cookie) {
+    Stream* s = static_cast<Stream*>(cookie);
+    stream_callback_event_t streamEvent;
+    switch (event) {
+        case CompressOffload::Event::WRITE_READY:
+            streamEvent = STREAM_CBK_EVENT_WRITE_READY;
+            break;
+        case CompressOffload::Event::DRAIN_READY:
+            streamEvent = STREAM_CBK_EVENT_DRAIN_READY;
+            break;
+        default:
+            streamEvent = STREAM_CBK_EVENT_ERROR;
+            break;
+    }
+    s->callback(streamEvent, nullptr, s->callbackCookie);
+}
+
+int AudioHAL::InitOutputProcessing(Stream* stream) {
+    const StreamConfig& config = stream->config;
+    const size_t bufferFrames = config.periodSize * config.periodCount;
+
+    int ret = stream->mixer.Init(config.channelMask, config.hwChannels);
+    if (ret != 0) {
+        return ret;
+    }
+
+    // The fast path trades stopband attenuation for CPU; everything else
+    // gets the high quality filters.
+    Resampler::Quality quality = (stream->flags & AUDIO_OUTPUT_FLAG_FAST) ?
+        Resampler::Quality::LOW : Resampler::Quality::HIGH;
+    ret = stream->resampler.Init(config.sampleRate, config.hwSampleRate, config.hwChannels,
+                                 quality, bufferFrames);
+    if (ret != 0) {
+        return ret;
+    }
+
+    if (stream->mixer.IsActive() || stream->resampler.IsActive()) {
+        // Float pipeline: format -> float, mix, resample, then float ->
+        // hwFormat in place in the last stage's buffer.
+        ret = stream->converter.Init(config.format, AUDIO_FORMAT_PCM_FLOAT);
+        if (ret == 0) {
+            ret = stream->hwConverter.Init(AUDIO_FORMAT_PCM_FLOAT, config.hwFormat);
+        }
+        if (ret != 0) {
+            return ret;
+        }
+        if (config.format != AUDIO_FORMAT_PCM_FLOAT) {
+            stream->floatBuffer.resize(bufferFrames * stream->mixer.GetInputChannels());
+        }
+        if (stream->mixer.IsActive()) {
+            stream->mixOutBuffer.resize(bufferFrames * config.hwChannels);
+        }
+        if (stream->resampler.IsActive()) {
+            stream->resampleBuffer.resize(
+                stream->resampler.GetMaxOutputFrames(bufferFrames) * config.hwChannels);
+        }
+    } else {
+        // Also allocated for hwFormat streams: effects need a writable
+        // copy of the client buffer.
+        ret = stream->converter.Init(config.format, config.hwFormat);
+        if (ret != 0) {
+            return ret;
+        }
+        stream->convBuffer.resize(bufferFrames * config.hwChannels *
+            audio_bytes_per_sample(config.hwFormat));
+    }
+
+    return 0;
+}
+
+size_t AudioHAL::ProcessOutput(Stream* stream, const void* buffer, size_t frames,
+                               const void** outData, size_t* outBytes) {
+    const uint32_t hwChannels = stream->mixer.GetOutputChannels();
+    const size_t hwFrameSize = audio_bytes_per_sample(stream->config.hwFormat) * hwChannels;
+    const size_t bufferFrames = stream->config.periodSize * stream->config.periodCount;
+
+    if (!stream->mixer.IsActive() && !stream->resampler.IsActive()) {
+        // The client buffer is const, so effects need the copy.
+        if (stream->config.format == stream->config.hwFormat && stream->effects.IsEmpty()) {
+            *outData = buffer;
+            *outBytes = frames * hwFrameSize;
+            return frames;
+        }
+        frames = std::min(frames, bufferFrames);
+        stream->converter.Convert(stream->convBuffer.data(), buffer, frames * hwChannels);
+        stream->effects.Process(reinterpret_cast<int16_t*>(stream->convBuffer.data()), frames);
+        *outData = stream->convBuffer.data();
+        *outBytes = frames * hwFrameSize;
+        return frames;
+    }
+
+    frames = std::min(frames, bufferFrames);
+    const float* in = static_cast<const float*>(buffer);
+    if (stream->config.format != AUDIO_FORMAT_PCM_FLOAT) {
+        stream->converter.Convert(stream->floatBuffer.data(), buffer,
+                                  frames * stream->mixer.GetInputChannels());
+        in = stream->floatBuffer.data();
+    }
+
+    float* out = nullptr;
+    size_t outFrames = frames;
+    if (stream->mixer.IsActive()) {
+        out = stream->mixOutBuffer.data();
+        stream->mixer.Process(out, in, frames);
+        in = out;
+    }
+    if (stream->resampler.IsActive()) {
+        out = stream->resampleBuffer.data();
+        outFrames = stream->resampler.Process(out, in, frames);
+    }
+
+    stream->hwConverter.Convert(out, out, outFrames * hwChannels);
+    stream->effects.Process(reinterpret_cast<int16_t*>(out), outFrames);
+
+    *outData = out;
+    *outBytes = outFrames * hwFrameSize;
+    return frames;
+}
+
+int AudioHAL::WriteToPcm(Stream* stream, const void* buffer, size_t bytes) {
+    if (stream->mixerTrack >= 0) {
+        // Primary card streams are always HW_FORMAT
+        size_t frames = bytes / (audio_bytes_per_sample(HW_FORMAT) * stream->config.hwChannels);
+        return stream->hal->mOutputMixer.Write(stream->mixerTrack,
+                                               static_cast<const int16_t*>(buffer), frames);
+    }
+    const bool mmap = (stream->flags & AUDIO_OUTPUT_FLAG_FAST) != 0;
+    int ret = mmap ? pcm_mmap_write(stream->pcm, buffer, bytes) :
+        pcm_write(stream->pcm, buffer, bytes);
+    if (ret != -EPIPE) {
+        return ret;
+    }
+
+    // Opened with PCM_NORESTART, so an underrun comes back to us instead of
+    // being recovered inside tinyalsa: count it, prepare the stream again
+    // and rewrite the period.
+    stream->stats.underruns++;
+    ret = pcm_prepare(stream->pcm);
+    if (ret != 0) {
+        return ret;
+    }
+    return mmap ? pcm_mmap_write(stream->pcm, buffer, bytes) :
+        pcm_write(stream->pcm, buffer, bytes);
+}
+
+// Direct PCMs count their underruns in WriteToPcm as they recover.
+void AudioHAL::UpdateUnderrunCount(Stream* stream) {
+    if (stream->mixerTrack >= 0) {
+        stream->stats.underruns = stream->hal->mOutputMixer.GetUnderruns(stream->mixerTrack);
+    }
+}
+
+void AudioHAL::UpdatePresentationPosition(Stream* stream) {
+    uint64_t hwFrames;
+    int64_t timeNs;
+
+    if (stream->mixerTrack >= 0) {
+        // The mixer dates the track's frames from its own PCM timestamps.
+        OutputMixer::Position mixed = stream->hal->mOutputMixer.GetPosition(stream->mixerTrack);
+        if (mixed.timeNs == 0) {
+            return;
+        }
+        hwFrames = mixed.frames;
+        timeNs = mixed.timeNs;
+    } else {
+        unsigned int avail;
+        struct timespec tstamp;
+        if (pcm_get_htimestamp(stream->pcm, &avail, &tstamp) != 0) {
+            return;
+        }
+
+        // Frames still queued in the ring have not been presented yet.
+        unsigned int bufferSize = pcm_get_buffer_size(stream->pcm);
+        uint64_t queued = bufferSize - std::min(avail, bufferSize);
+        if (queued > stream->hwFramesWritten) {
+            return;
+        }
+        hwFrames = stream->hwFramesWritten - queued;
+        timeNs = tstamp.tv_sec * 1000000000LL + tstamp.tv_nsec;
+    }
+
+    PresentationPosition position;
+    position.timeNs = stream->drift.Update(hwFrames, timeNs);
+    position.frames = hwFrames * stream->config.sampleRate / stream->config.hwSampleRate;
+    stream->presentationPosition.Store(position);
+}
+
+uint32_t AudioHAL::InGetSampleRate(const struct audio_stream* stream) {
+    const InStream* in = reinterpret_cast<const InStream*>(stream);
+    return in->config.sampleRate;
+}
+
+size_t AudioHAL::InGetBufferSize(const struct audio_stream* stream) {
+    const InStream* in = reinterpret_cast<const InStream*>(stream);
+    return in->config.bufferSize;
+}
+
+uint32_t AudioHAL::InGetChannelMask(const struct audio_stream* stream) {
+    const InStream* in = reinterpret_cast<const InStream*>(stream);
+    return in->config.channelMask;
+}
+
+audio_format_t AudioHAL::InGetFormat(const struct audio_stream* stream) {
+    const InStream* in = reinterpret_cast<const InStream*>(stream);
+    return in->config.format;
+}
+
+int AudioHAL::InStandby(struct audio_stream* stream) {
+    InStream* in = reinterpret_cast<InStream*>(stream);
+    std::lock_guard<Mutex> lock(in->lock);
+
+    if (!in->standby) {
+        in->hal->StopCapture(in);
+    }
+
+    return 0;
+}
+
+int AudioHAL::InDump(const struct audio_stream* stream, int fd) {
+    const InStream* in = reinterpret_cast<const InStream*>(stream);
+    std::lock_guard<Mutex> lock(in->lock);
+
+    dprintf(fd, "  Input stream %p:\n", in);
+    dprintf(fd, "    standby: %d\n", in->standby);
+    dprintf(fd, "    period: %u frames x %u\n", in->config.periodSize,
+            in->config.periodCount);
+    dprintf(fd, "    ring: %zu / %zu frames\n", in->ring.GetReadAvailable(),
+            in->ring.GetCapacity());
+    dprintf(fd, "    frames captured: %lld, read: %lld, dropped: %lld\n",
+            static_cast<long long>(in->framesCaptured),
+            static_cast<long long>(in->framesRead.load()),
+            static_cast<long long>(in->framesDropped.load()));
+    dprintf(fd, "    effects: %zu\n", in->effects.GetCount());
+    return 0;
+}
+
+int AudioHAL::InSetParameters(struct audio_stream* stream, const char* kvpairs) {
+    InStream* in = reinterpret_cast<InStream*>(stream);
+
+    int ret = 0;
+    ParameterParser parser(kvpairs);
+    std::string_view key;
+    std::string_view value;
+    while (parser.Next(&key, &value)) {
+        uint32_t device;
+        if (LookupParameterKey(key) == ParameterKey::ROUTING &&
+                ParameterParser::ParseUint32(value, &device) &&
+                device != AUDIO_DEVICE_NONE) {
+            std::lock_guard<Mutex> lock(in->hal->mLock);
+            in->device = device;
+            in->hal->mInDevice = device;
+            ret = in->hal->ApplyRoute();
+        }
+    }
+
+    return ret < 0 ? ret : 0;
+}
+
+char* AudioHAL::InGetParameters(const struct audio_stream* stream, const char* keys) {
+    const InStream* in = reinterpret_cast<const InStream*>(stream);
+    if (in->usbCapabilities) {
+        return in->usbCapabilities->Reply(keys);
+    }
+    return in->hal->mInputCapabilities.Reply(keys);
+}
+
+int AudioHAL::InAddAudioEffect(const struct audio_stream* stream, effect_handle_t effect) {
+    const InStream* in = reinterpret_cast<const InStream*>(stream);
+    return in->effects.Add(effect);
+}
+
+int AudioHAL::InRemoveAudioEffect(const struct audio_stream* stream, effect_handle_t effect) {
+    const InStream* in = reinterpret_cast<const InStream*>(stream);
+    return in->effects.Remove(effect);
+}
+
+int AudioHAL::SetGain(struct audio_stream_in* stream, float gain) {
+    // Capture gain is applied through mixer controls, not in software
+    return 0;
+}
+
+ssize_t AudioHAL::Read(struct audio_stream_in* stream, void* buffer, size_t bytes) {
+    InStream* in = reinterpret_cast<InStream*>(stream);
+    std::lock_guard<Mutex> lock(in->lock);
+
+    if (in->standby) {
+        int ret = in->hal->StartCapture(in);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    // Drain the ring; only wait on the capture thread, never on ALSA.
+    const size_t frameSize = audio_bytes_per_sample(in->config.format) *
+        audio_channel_count_from_in_mask(in->config.channelMask);
+    uint8_t* dst = static_cast<uint8_t*>(buffer);
+    size_t remaining = bytes / frameSize;
+    while (remaining > 0) {
+        size_t frames = in->ring.Read(dst, remaining);
+        dst += frames * frameSize;
+        remaining -= frames;
+        in->framesRead.fetch_add(frames, std::memory_order_release);
+        if (remaining > 0 && WaitForCapture(in) != 0) {
+            ALOGW("Capture timed out, padding %zu frames of silence", remaining);
+            memset(dst, 0, remaining * frameSize);
+            in->framesRead.fetch_add(remaining, std::memory_order_release);
+            break;
+        }
+    }
+
+    if (in->hal->mMicMute.load(std::memory_order_relaxed)) {
+        memset(buffer, 0, bytes);
+    }
+    return bytes;
+}
+
+uint32_t AudioHAL::GetInputFramesLost(struct audio_stream_in* stream) {
+    InStream* in = reinterpret_cast<InStream*>(stream);
+    return in->framesLost.exchange(0);
+}
+
+int AudioHAL::GetCapturePosition(const struct audio_stream_in* stream,
+                                 int64_t* frames, int64_t* time) {
+    const InStream* in = reinterpret_cast<const InStream*>(stream);
+
+    CapturePosition position = in->capturePosition.Load();
+    if (position.frames == 0) {
+        return -ENOSYS;
+    }
+
+    // Capture index of the next frame the client reads, dated back from
+    // the most recent capture timestamp.
+    int64_t read = in->framesRead.load(std::memory_order_acquire);
+    int64_t index = read + in->framesDropped.load(std::memory_order_acquire);
+    *frames = read;
+    *time = position.timeNs - (position.frames - index) * 1000000000LL /
+        in->config.sampleRate;
+    return 0;
+}
+
+int AudioHAL::StartCapture(InStream* stream) {
+    const StreamConfig* config = &stream->config;
+    struct pcm_config pcm_config = {};
+    pcm_config.channels = audio_channel_count_from_in_mask(config->channelMask);
+    pcm_config.rate = config->sampleRate;
+    pcm_config.period_size = config->periodSize;
+    pcm_config.period_count = config->periodCount;
+    pcm_config.format = config->hwPcmFormat;
+    pcm_config.start_threshold = 0;
+    pcm_config.stop_threshold = 0;
+    pcm_config.silence_threshold = 0;
+
+    struct pcm* pcm = pcm_open(config->card, config->device, PCM_IN | PCM_MONOTONIC,
+                               &pcm_config);
+    if (!pcm || !pcm_is_ready(pcm)) {
+        ALOGE("Failed to open ALSA capture device: %s", pcm_get_error(pcm));
+        if (pcm) {
+            pcm_close(pcm);
+        }
+        return -ENODEV;
+    }
+
+    stream->pcm = pcm;
+    stream->ring.Reset();
+    stream->captureRunning.store(true, std::memory_order_release);
+    stream->captureThread = std::thread(CaptureThreadLoop, stream);
+    stream->standby = false;
+    return 0;
+}
+
+void AudioHAL::StopCapture(InStream* stream) {
+    stream->captureRunning.store(false, std::memory_order_release);
+    if (stream->captureThread.joinable()) {
+        stream->captureThread.join();
+    }
+
+    // Unread frames are discarded; account for them so capture positions
+    // stay aligned with the frames the client actually receives.
+    stream->framesDropped.fetch_add(stream->ring.GetReadAvailable(),
+                                    std::memory_order_release);
+
+    pcm_close(stream->pcm);
+    stream->pcm = nullptr;
+    stream->standby = true;
+}
+
+void AudioHAL::CaptureThreadLoop(InStream* stream) {
+    struct sched_param param = {};
+    param.sched_priority = CAPTURE_THREAD_PRIORITY;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+        ALOGW("Failed to set capture thread priority");
+    }
+
+    const StreamConfig* config = &stream->config;
+    const size_t periodBytes = stream->captureBuffer.size();
+    const size_t frames = config->periodSize;
+
+    while (stream->captureRunning.load(std::memory_order_acquire)) {
+        if (pcm_read(stream->pcm, stream->captureBuffer.data(), periodBytes) != 0) {
+            ALOGE("Failed to read from ALSA device: %s", pcm_get_error(stream->pcm));
+            usleep(frames * 1000000LL / config->sampleRate);
+            continue;
+        }
+
+        // avail frames were captured after the last frame we just read.
+        CapturePosition position;
+        unsigned int avail;
+        struct timespec tstamp;
+        stream->framesCaptured += frames;
+        position.frames = stream->framesCaptured;
+        if (pcm_get_htimestamp(stream->pcm, &avail, &tstamp) == 0) {
+            position.timeNs = tstamp.tv_sec * 1000000000LL + tstamp.tv_nsec -
+                static_cast<int64_t>(avail) * 1000000000LL / config->sampleRate;
+        } else {
+            position.timeNs = systemTime(SYSTEM_TIME_MONOTONIC);
+        }
+        stream->capturePosition.Store(position);
+
+        stream->effects.Process(reinterpret_cast<int16_t*>(stream->captureBuffer.data()),
+                                frames);
+
+        size_t written = stream->ring.Write(stream->captureBuffer.data(), frames);
+        if (written < frames) {
+            stream->framesDropped.fetch_add(frames - written, std::memory_order_release);
+            stream->framesLost.fetch_add(frames - written);
+        }
+        sem_post(&stream->dataReady);
+    }
+}
+
+int AudioHAL::WaitForCapture(InStream* stream) {
+    // Allow two periods before giving up on the capture thread.
+    const int64_t timeoutNs = 2LL * stream->config.periodSize * 1000000000LL /
+        stream->config.sampleRate;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += timeoutNs;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000LL;
+    deadline.tv_nsec %= 1000000000LL;
+
+    while (sem_timedwait(&stream->dataReady, &deadline) != 0) {
+        if (errno != EINTR) {
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+const AudioHAL::PeriodProfile& AudioHAL::SelectPeriodProfile(audio_output_flags_t flags) {
+    if (flags & AUDIO_OUTPUT_FLAG_FAST) {
+        return FAST_PERIOD_PROFILE;
+    }
+    if (flags & AUDIO_OUTPUT_FLAG_DEEP_BUFFER) {
+        return DEEP_BUFFER_PERIOD_PROFILE;
+    }
+    return PRIMARY_PERIOD_PROFILE;
+}
+
+int AudioHAL::CheckInputConfig(const audio_config_t* config) {
+    bool validSampleRate = false;
+    for (uint32_t rate : SUPPORTED_INPUT_SAMPLE_RATES) {
+        if (rate == config->sample_rate) {
+            validSampleRate = true;
+            break;
+        }
+    }
+
+    if (!validSampleRate) {
+        ALOGE("Unsupported input sample rate: %u", config->sample_rate);
+        return -EINVAL;
+    }
+
+    bool validChannelMask = false;
+    for (audio_channel_mask_t mask : SUPPORTED_INPUT_CHANNEL_MASKS) {
+        if (mask == config->channel_mask) {
+            validChannelMask = true;
+            break;
+        }
+    }
+
+    if (!validChannelMask) {
+        ALOGE("Unsupported input channel mask: %x", config->channel_mask);
+        return -EINVAL;
+    }
+
+    if (config->format != HW_FORMAT) {
+        ALOGE("Unsupported input format: %x", config->format);
+        return -EINVAL;
+    }
+    return 0;
+}
 
+// The capture period scaled to the stream rate, in multiples of 16 frames
+unsigned int AudioHAL::GetCapturePeriodSize(uint32_t sampleRate) {
+    return ((static_cast<uint64_t>(CAPTURE_PERIOD_PROFILE.periodSize) *
+        sampleRate / PERIOD_REFERENCE_RATE) + 15) & ~15u;
+}
+
+int AudioHAL::InitializeALSA() {
+    if (mInitialized) {
+        return 0;
+    }
+
+    // Check the primary backend opens before starting the mixer on it
+    struct pcm_config config = {};
+    config.channels = PRIMARY_CHANNELS;
+    config.rate = HW_SAMPLE_RATE;
+    config.period_size = PRIMARY_PERIOD_PROFILE.periodSize;
+    config.period_count = PRIMARY_PERIOD_PROFILE.periodCount;
+    config.format = HW_PCM_FORMAT;
+    config.start_threshold = 0;
+    config.stop_threshold = 0;
+    config.silence_threshold = 0;
+
+    struct pcm* pcm = pcm_open(CARD, DEVICE, PCM_OUT, &config);
+    if (!pcm || !pcm_is_ready(pcm)) {
+        ALOGE("Failed to open ALSA device: %s", pcm_get_error(pcm));
+        if (pcm) {
+            pcm_close(pcm);
+        }
+        return -ENODEV;
+    }
     pcm_close(pcm);
+
+    OutputMixer::Config mixerConfig;
+    mixerConfig.card = CARD;
+    mixerConfig.device = DEVICE;
+    mixerConfig.sampleRate = HW_SAMPLE_RATE;
+    mixerConfig.channels = PRIMARY_CHANNELS;
+    mixerConfig.priority = MIXER_THREAD_PRIORITY;
+    mixerConfig.warmStandbyMs = std::max(0,
+        property_get_int32(WARM_STANDBY_PROPERTY, WARM_STANDBY_DEFAULT_MS));
+    int ret = mOutputMixer.Init(mixerConfig);
+    if (ret != 0) {
+        return ret;
+    }
+
     mInitialized = true;
     return 0;
 }
 
+int AudioHAL::InitMixerPaths() {
+    mMixer = mixer_open(CARD);
+    if (!mMixer) {
+        ALOGE("Failed to open mixer for card %u", CARD);
+        return -ENODEV;
+    }
+
+    int ret = mMixerPaths.Load(MIXER_PATHS_FILE, mMixer);
+    if (ret != 0) {
+        mixer_close(mMixer);
+        mMixer = nullptr;
+        return ret;
+    }
+
+    for (int useCase = 0; useCase < ROUTE_USECASE_COUNT; useCase++) {
+        for (int route = 0; route < OUTPUT_ROUTE_COUNT; route++) {
+            mOutputPathIds[useCase][route] =
+                mMixerPaths.GetPathId(OUTPUT_PATH_NAMES[useCase][route]);
+        }
+    }
+    for (int route = 0; route < INPUT_ROUTE_COUNT; route++) {
+        mInputPathIds[route] = mMixerPaths.GetPathId(INPUT_PATH_NAMES[route]);
+    }
+
+    // Bring the hardware to the initial state before any stream opens.
+    return ApplyRoute();
+}
+
+// Called with mLock held. Returns the number of controls written.
+int AudioHAL::ApplyRoute() {
+    if (!mMixer) {
+        return 0;
+    }
+
+    int pathIds[2];
+    size_t count = 0;
+
+    RouteUseCase useCase = ROUTE_USECASE_MEDIA;
+    if (mMode == AUDIO_MODE_RINGTONE) {
+        useCase = ROUTE_USECASE_RINGTONE;
+    } else if (mMode == AUDIO_MODE_IN_CALL || mMode == AUDIO_MODE_IN_COMMUNICATION) {
+        useCase = ROUTE_USECASE_VOICE_CALL;
+    }
+
+    bool speaker = mOutDevice & AUDIO_DEVICE_OUT_SPEAKER;
+    bool headphones = mOutDevice &
+        (AUDIO_DEVICE_OUT_WIRED_HEADSET | AUDIO_DEVICE_OUT_WIRED_HEADPHONE);
+    if (speaker && headphones) {
+        pathIds[count++] = mOutputPathIds[useCase][OUTPUT_ROUTE_SPEAKER_AND_HEADPHONES];
+    } else if (speaker) {
+        pathIds[count++] = mOutputPathIds[useCase][OUTPUT_ROUTE_SPEAKER];
+    } else if (headphones) {
+        pathIds[count++] = mOutputPathIds[useCase][OUTPUT_ROUTE_HEADPHONES];
+    }
+
+    if (mInDevice == AUDIO_DEVICE_IN_WIRED_HEADSET) {
+        pathIds[count++] = mInputPathIds[INPUT_ROUTE_HEADSET_MIC];
+    } else if (mInDevice == AUDIO_DEVICE_IN_BUILTIN_MIC ||
+               mInDevice == AUDIO_DEVICE_IN_BACK_MIC) {
+        pathIds[count++] = mInputPathIds[INPUT_ROUTE_MAIN_MIC];
+    }
+
+    int ret = mMixerPaths.Apply(pathIds, count);
+    if (ret < 0) {
+        ALOGE("Failed to apply route out %x in %x", mOutDevice, mInDevice);
+    }
+    return ret;
+}
+
 void AudioHAL::DeinitializeALSA() {
     if (!mInitialized) {
         return;
     }
 
-    if (mOutputStream) {
-        CloseOutputStream(&mOutputStream->stream);
+    while (!mOutputStreams.empty()) {
+        CloseOutputStream(&mOutputStreams.back()->stream);
+    }
+
+    if (mOffloadStream) {
+        CloseOutputStream(&mOffloadStream->stream);
     }
 
     if (mInputStream) {
-        CloseInputStream(reinterpret_cast<struct audio_stream_in*>(mInputStream));
+        CloseInputStream(&mInputStream->stream);
+    }
+
+    mOutputMixer.Stop();
+
+    if (mMixer) {
+        mixer_close(mMixer);
+        mMixer = nullptr;
     }
 
     mInitialized = false;
 }
 
-int AudioHAL::ConfigureALSADevice(const StreamConfig* config) {
+// Opens the PCM of a stream that bypasses mOutputMixer
+int AudioHAL::ConfigureALSADevice(Stream* stream) {
+    const StreamConfig* config = &stream->config;
     struct pcm_config pcm_config = {};
-    pcm_config.channels = audio_channel_count_from_out_mask(config->channelMask);
-    pcm_config.rate = config->sampleRate;
-    pcm_config.period_size = PERIOD_SIZE;
-    pcm_config.period_count = PERIOD_COUNT;
-    pcm_config.format = PCM_FORMAT_S16_LE;  // We'll convert if needed
+    pcm_config.channels = config->hwChannels;
+    pcm_config.rate = config->hwSampleRate;
+    pcm_config.period_size = config->hwPeriodSize;
+    pcm_config.period_count = config->periodCount;
+    pcm_config.format = config->hwPcmFormat;  // Converted in Write if needed
     pcm_config.start_threshold = 0;
     pcm_config.stop_threshold = 0;
     pcm_config.silence_threshold = 0;
 
-    struct pcm* pcm = pcm_open(CARD, DEVICE, PCM_OUT, &pcm_config);
+    // Monotonic htimestamps line up with the presentation position clock.
+    // PCM_NORESTART hands underruns to WriteToPcm to count and recover.
+    unsigned int flags = PCM_OUT | PCM_MONOTONIC | PCM_NORESTART;
+    if (stream->flags & AUDIO_OUTPUT_FLAG_FAST) {
+        flags |= PCM_MMAP;
+    }
+
+    struct pcm* pcm = pcm_open(config->card, config->device, flags, &pcm_config);
     if (!pcm || !pcm_is_ready(pcm)) {
         ALOGE("Failed to configure ALSA device: %s", pcm_get_error(pcm));
         if (pcm) {
@@ -292,5 +1870,6 @@ int AudioHAL::ConfigureALSADevice(const StreamConfig* config) {
         return -ENODEV;
     }
 
+    stream->pcm = pcm;
     return 0;
 } 
\ No newline at end of file
@@ -5,21 +5,73 @@
 #include <hardware/hardware.h>
 #include <system/audio.h>
 #include <utils/Mutex.h>
+#include <utils/Timers.h>
 #include <tinyalsa/asoundlib.h>
+#include <semaphore.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "audio_channel_mix.h"
+#include "audio_compress_offload.h"
+#include "audio_drift_estimator.h"
+#include "audio_effects_chain.h"
+#include "audio_format_conv.h"
+#include "audio_latency_histogram.h"
+#include "audio_mixer_paths.h"
+#include "audio_output_mixer.h"
+#include "audio_parameters.h"
+#include "audio_resampler.h"
+#include "audio_ring_buffer.h"
+#include "audio_seqlock.h"
+#include "audio_usb_profiles.h"
 
 using namespace android;
 
-class AudioHAL {
+// The audio device. It is its own audio_hw_device_t, so the device hooks
+// cast the framework's pointer straight back.
+class AudioHAL : public audio_hw_device_t {
 public:
+    // usbProcRoot is where USB cards describe their streams; tests point
+    // it at a /proc/asound lookalike.
     static int CreateInstance(const struct hw_module_t* module,
-                            struct audio_hw_device** device);
+                            struct audio_hw_device** device,
+                            const char* usbProcRoot = "/proc/asound");
 
-    AudioHAL();
+    explicit AudioHAL(const char* usbProcRoot = "/proc/asound");
     ~AudioHAL();
 
+    // Device hooks
+    static int CloseDevice(struct hw_device_t* device);
+    static int DevInitCheck(const struct audio_hw_device* dev);
+    static int DevSetVoiceVolume(struct audio_hw_device* dev, float volume);
+    static int DevSetMode(struct audio_hw_device* dev, audio_mode_t mode);
+    static int DevSetMicMute(struct audio_hw_device* dev, bool state);
+    static int DevGetMicMute(const struct audio_hw_device* dev, bool* state);
+    static int DevSetParameters(struct audio_hw_device* dev, const char* kvpairs);
+    static char* DevGetParameters(const struct audio_hw_device* dev, const char* keys);
+    static size_t DevGetInputBufferSize(const struct audio_hw_device* dev,
+                                        const audio_config_t* config);
+    static int DevOpenOutputStream(struct audio_hw_device* dev, audio_io_handle_t handle,
+                                   audio_devices_t devices, audio_output_flags_t flags,
+                                   audio_config_t* config,
+                                   struct audio_stream_out** stream_out,
+                                   const char* address);
+    static void DevCloseOutputStream(struct audio_hw_device* dev,
+                                     struct audio_stream_out* stream);
+    static int DevOpenInputStream(struct audio_hw_device* dev, audio_io_handle_t handle,
+                                  audio_devices_t devices, audio_config_t* config,
+                                  struct audio_stream_in** stream_in,
+                                  audio_input_flags_t flags, const char* address,
+                                  audio_source_t source);
+    static void DevCloseInputStream(struct audio_hw_device* dev,
+                                    struct audio_stream_in* stream);
+    static int DevDump(const struct audio_hw_device* dev, int fd);
+
     // Device operations
     int OpenOutputStream(audio_io_handle_t handle,
                         audio_devices_t devices,
+                        audio_output_flags_t flags,
                         audio_config_t* config,
                         struct audio_stream_out** stream_out);
 
@@ -30,6 +82,10 @@ public:
 
     int CloseOutputStream(struct audio_stream_out* stream);
     int CloseInputStream(struct audio_stream_in* stream);
+    int SetMode(audio_mode_t mode);
+    int SetDeviceParameters(const char* kvpairs);
+    size_t GetInputBufferSize(const audio_config_t* config) const;
+    void Dump(int fd);
 
     // Stream operations
     static uint32_t GetSampleRate(const struct audio_stream* stream);
@@ -43,36 +99,267 @@ public:
     static char* GetParameters(const struct audio_stream* stream, const char* keys);
     static int AddAudioEffect(const struct audio_stream* stream, effect_handle_t effect);
     static int RemoveAudioEffect(const struct audio_stream* stream, effect_handle_t effect);
+    static int Dump(const struct audio_stream* stream, int fd);
+
+    // Output stream operations
+    static uint32_t GetLatency(const struct audio_stream_out* stream);
+    static int SetVolume(struct audio_stream_out* stream, float left, float right);
+    static ssize_t Write(struct audio_stream_out* stream, const void* buffer, size_t bytes);
+    static int GetRenderPosition(const struct audio_stream_out* stream, uint32_t* dspFrames);
+    static int GetPresentationPosition(const struct audio_stream_out* stream,
+                                       uint64_t* frames, struct timespec* timestamp);
+
+    // Compress offload stream operations
+    static int SetCallback(struct audio_stream_out* stream,
+                           stream_callback_t callback, void* cookie);
+    static int Pause(struct audio_stream_out* stream);
+    static int Resume(struct audio_stream_out* stream);
+    static int Drain(struct audio_stream_out* stream, audio_drain_type_t type);
+    static int Flush(struct audio_stream_out* stream);
+
+    // Input stream operations
+    static uint32_t InGetSampleRate(const struct audio_stream* stream);
+    static size_t InGetBufferSize(const struct audio_stream* stream);
+    static uint32_t InGetChannelMask(const struct audio_stream* stream);
+    static audio_format_t InGetFormat(const struct audio_stream* stream);
+    static int InStandby(struct audio_stream* stream);
+    static int InDump(const struct audio_stream* stream, int fd);
+    static int InSetParameters(struct audio_stream* stream, const char* kvpairs);
+    static char* InGetParameters(const struct audio_stream* stream, const char* keys);
+    static int InAddAudioEffect(const struct audio_stream* stream, effect_handle_t effect);
+    static int InRemoveAudioEffect(const struct audio_stream* stream, effect_handle_t effect);
+    static int SetGain(struct audio_stream_in* stream, float gain);
+    static ssize_t Read(struct audio_stream_in* stream, void* buffer, size_t bytes);
+    static uint32_t GetInputFramesLost(struct audio_stream_in* stream);
+    static int GetCapturePosition(const struct audio_stream_in* stream,
+                                  int64_t* frames, int64_t* time);
 
 private:
+    // Period geometry in frames at the 48 kHz reference rate
+    struct PeriodProfile {
+        unsigned int periodSize;
+        unsigned int periodCount;
+    };
+
     struct StreamConfig {
         uint32_t sampleRate;
         audio_channel_mask_t channelMask;
         audio_format_t format;
+        unsigned int periodSize;
+        unsigned int hwPeriodSize;
+        unsigned int periodCount;
         size_t bufferSize;
+
+        // PCM the stream runs on: the primary card at HW_SAMPLE_RATE and
+        // HW_FORMAT, or a USB card at a configuration it plays natively
+        unsigned int card;
+        unsigned int device;
+        uint32_t hwSampleRate;
+        uint32_t hwChannels;
+        audio_format_t hwFormat;
+        enum pcm_format hwPcmFormat;
     };
 
+    // Write path instrumentation, reported by Dump. cpuNs is the thread
+    // CPU time spent in Write, so blocking on the PCM is not counted.
+    struct StreamStats {
+        uint64_t framesWritten;
+        uint32_t underruns;
+        nsecs_t cpuNs;
+        LatencyHistogram writeLatency;
+        LatencyHistogram standbyExitLatency;    // first write after standby
+    };
+
+    struct PresentationPosition {
+        uint64_t frames;    // stream frames that left the DAC
+        int64_t timeNs;     // CLOCK_MONOTONIC time the last of them did
+    };
+
+    // Streams are locked independently of the device and of each other.
+    // config and flags are immutable after open, so getters read them
+    // without a lock. Lock order is AudioHAL::mLock, then a stream lock.
     struct Stream {
         struct audio_stream_out stream;
         AudioHAL* hal;
+        mutable Mutex lock;     // data path, standby and stream state
         StreamConfig config;
+        audio_output_flags_t flags;
+        struct pcm* pcm;        // only for streams that bypass the mixer
+        int mixerTrack;         // OutputMixer track, -1 for USB streams
+        bool standby;
+        StreamStats stats;
+
+        // Presentation position, published after every write so getters
+        // never take a lock. hwFramesWritten counts frames at hwSampleRate.
+        uint64_t hwFramesWritten;
+        DriftEstimator drift;
+        SeqLock<PresentationPosition> presentationPosition;
+
+        // Output processing: format conversion, channel mixing and
+        // resampling into buffers preallocated at open so the write path
+        // never allocates.
+        FormatConverter converter;
+        FormatConverter hwConverter;
+        ChannelMixer mixer;
+        Resampler resampler;
+        std::vector<uint8_t> convBuffer;
+        std::vector<float> floatBuffer;
+        std::vector<float> mixOutBuffer;
+        std::vector<float> resampleBuffer;
+
+        // Post-processing, run in place on the final hwFormat buffer. It
+        // is changed through the const add/remove_audio_effect hooks.
+        mutable EffectsChain effects;
+
+        // Capability replies of the USB device the stream was opened on
+        std::shared_ptr<const CapabilityResponses> usbCapabilities;
+
+        // Compress offload: the DSP decodes, none of the above is used.
+        CompressOffload* offload;
+        stream_callback_t callback;
+        void* callbackCookie;
+    };
+
+    enum RouteUseCase {
+        ROUTE_USECASE_MEDIA,
+        ROUTE_USECASE_RINGTONE,
+        ROUTE_USECASE_VOICE_CALL,
+        ROUTE_USECASE_COUNT
+    };
+
+    enum OutputRoute {
+        OUTPUT_ROUTE_SPEAKER,
+        OUTPUT_ROUTE_HEADPHONES,
+        OUTPUT_ROUTE_SPEAKER_AND_HEADPHONES,
+        OUTPUT_ROUTE_COUNT
+    };
+
+    enum InputRoute {
+        INPUT_ROUTE_MAIN_MIC,
+        INPUT_ROUTE_HEADSET_MIC,
+        INPUT_ROUTE_COUNT
+    };
+
+    struct CapturePosition {
+        int64_t frames;     // frames captured from ALSA since open
+        int64_t timeNs;     // CLOCK_MONOTONIC capture time of the last one
+    };
+
+    struct InStream {
+        struct audio_stream_in stream;
+        AudioHAL* hal;
+        mutable Mutex lock;     // data path, standby and stream state
+        StreamConfig config;
+        audio_devices_t device;
         struct pcm* pcm;
         bool standby;
+
+        // The capture thread is the only ring producer and Read the only
+        // consumer, so the client never waits on ALSA directly.
+        std::thread captureThread;
+        std::atomic<bool> captureRunning;
+        RingBuffer ring;
+        sem_t dataReady;
+        std::vector<uint8_t> captureBuffer;
+        int64_t framesCaptured;
+        SeqLock<CapturePosition> capturePosition;
+        std::atomic<int64_t> framesRead;
+        std::atomic<int64_t> framesDropped;
+        std::atomic<uint32_t> framesLost;
+
+        // Pre-processing, run by the capture thread on each period before
+        // it enters the ring.
+        mutable EffectsChain effects;
+
+        std::shared_ptr<const CapabilityResponses> usbCapabilities;
     };
 
-    // Device state
+    // Device state. mLock only covers routing, mode and stream open/close;
+    // stream data paths never take it.
     Mutex mLock;
     bool mInitialized;
+    audio_mode_t mMode;
     audio_devices_t mOutDevice;
     audio_devices_t mInDevice;
-    Stream* mOutputStream;
-    Stream* mInputStream;
+    std::atomic<bool> mMicMute;     // read by Read without mLock
+    std::vector<Stream*> mOutputStreams;
+    Stream* mOffloadStream;
+    InStream* mInputStream;
+
+    // Sums the PCM output streams of the primary card into CARD/DEVICE
+    OutputMixer mOutputMixer;
+
+    // Mixer routing, resolved once from mixer_paths.xml at CreateInstance
+    struct mixer* mMixer;
+    MixerPaths mMixerPaths;
+    int mOutputPathIds[ROUTE_USECASE_COUNT][OUTPUT_ROUTE_COUNT];
+    int mInputPathIds[INPUT_ROUTE_COUNT];
+
+    // Replies to the read-only capability queries, built once from the
+    // SUPPORTED_* tables below
+    CapabilityResponses mOutputCapabilities;
+    CapabilityResponses mOffloadCapabilities;
+    CapabilityResponses mInputCapabilities;
+
+    // USB audio: the connected card, probed on connect through a cache
+    // keyed by device identity so replugging the same DAC skips parsing
+    UsbProfileCache mUsbProfiles;
+    unsigned int mUsbCard;
+    unsigned int mUsbDevice;
+    std::shared_ptr<const UsbCapabilities> mUsbCapabilities;
+    std::shared_ptr<const CapabilityResponses> mUsbOutputCapabilities;
+    std::shared_ptr<const CapabilityResponses> mUsbInputCapabilities;
 
     // ALSA configuration
     static constexpr unsigned int CARD = 0;
     static constexpr unsigned int DEVICE = 0;
-    static constexpr unsigned int PERIOD_SIZE = 1024;
-    static constexpr unsigned int PERIOD_COUNT = 4;
+    // Speaker, earpiece and wired headsets are all stereo, so the primary
+    // backend opens at two channels and wider streams are downmixed by
+    // their ChannelMixer. Only USB devices offer wider layouts, chosen from
+    // their probed profiles.
+    static constexpr uint32_t PRIMARY_CHANNELS = 2;
+    static constexpr unsigned int CAPTURE_DEVICE = 0;
+    static constexpr unsigned int OFFLOAD_DEVICE = 1;
+    // The primary backend always runs at HW_SAMPLE_RATE; other stream rates
+    // are resampled in the write path.
+    static constexpr uint32_t HW_SAMPLE_RATE = 48000;
+    static constexpr uint32_t PERIOD_REFERENCE_RATE = HW_SAMPLE_RATE;
+
+    // Period profiles selected by output flags: primary ~85 ms, fast ~10 ms
+    // for low latency, deep buffer ~160 ms with 40 ms periods so the CPU
+    // can stay asleep between wakeups.
+    static constexpr PeriodProfile PRIMARY_PERIOD_PROFILE = { 1024, 4 };
+    static constexpr PeriodProfile FAST_PERIOD_PROFILE = { 240, 2 };
+    static constexpr PeriodProfile DEEP_BUFFER_PERIOD_PROFILE = { 1920, 4 };
+
+    // Compress offload: 32 KiB fragments hold seconds of MP3/AAC, so the
+    // application processor sleeps between refills.
+    static constexpr uint32_t OFFLOAD_FRAGMENT_SIZE = 32 * 1024;
+    static constexpr uint32_t OFFLOAD_FRAGMENT_COUNT = 4;
+    static constexpr uint32_t OFFLOAD_LATENCY_MS = 50;
+
+    static constexpr const char* MIXER_PATHS_FILE = "/vendor/etc/mixer_paths.xml";
+    static constexpr const char* OUTPUT_PATH_NAMES[ROUTE_USECASE_COUNT][OUTPUT_ROUTE_COUNT] = {
+        { "media-speaker", "media-headphones", "speaker-and-headphones" },
+        { "ringtone-speaker", "ringtone-headphones", "speaker-and-headphones" },
+        { "voice-call-speaker", "voice-call-headphones", "speaker-and-headphones" },
+    };
+    static constexpr const char* INPUT_PATH_NAMES[INPUT_ROUTE_COUNT] = {
+        "main-mic", "headset-mic"
+    };
+
+    // Capture: 10 ms periods, a ring of eight periods between the capture
+    // thread and Read, and SCHED_FIFO for the capture thread.
+    static constexpr PeriodProfile CAPTURE_PERIOD_PROFILE = { 480, 4 };
+    static constexpr unsigned int CAPTURE_RING_PERIODS = 8;
+    static constexpr int CAPTURE_THREAD_PRIORITY = 3;
+    static constexpr int MIXER_THREAD_PRIORITY = 3;
+
+    // How long the mixer keeps its PCM prepared after the last output goes
+    // to standby. A write within the window resumes with pcm_start instead
+    // of a full pcm_open; 0 closes immediately.
+    static constexpr const char* WARM_STANDBY_PROPERTY = "vendor.audio.warm_standby_ms";
+    static constexpr int32_t WARM_STANDBY_DEFAULT_MS = 2000;
 
     // Device capabilities
     static constexpr uint32_t SUPPORTED_SAMPLE_RATES[] = {
@@ -80,13 +367,64 @@ private:
     };
     static constexpr audio_channel_mask_t SUPPORTED_CHANNEL_MASKS =
         AUDIO_CHANNEL_OUT_STEREO | AUDIO_CHANNEL_OUT_5POINT1;
-    static constexpr audio_format_t SUPPORTED_FORMATS =
-        AUDIO_FORMAT_PCM_16_BIT | AUDIO_FORMAT_PCM_24_BIT;
+    static constexpr audio_format_t SUPPORTED_FORMATS[] = {
+        AUDIO_FORMAT_PCM_16_BIT, AUDIO_FORMAT_PCM_24_BIT_PACKED,
+        AUDIO_FORMAT_PCM_8_24_BIT, AUDIO_FORMAT_PCM_FLOAT
+    };
+    static constexpr audio_format_t SUPPORTED_OFFLOAD_FORMATS[] = {
+        AUDIO_FORMAT_MP3, AUDIO_FORMAT_AAC_LC, AUDIO_FORMAT_AAC_HE_V1,
+        AUDIO_FORMAT_AAC_HE_V2
+    };
+
+    static constexpr uint32_t SUPPORTED_OFFLOAD_SAMPLE_RATES[] = {
+        8000, 11025, 12000, 16000, 22050, 24000, 32000, 44100, 48000,
+        64000, 88200, 96000, 176400, 192000
+    };
+
+    static constexpr uint32_t SUPPORTED_INPUT_SAMPLE_RATES[] = {
+        8000, 11025, 12000, 16000, 22050, 24000, 32000, 44100, 48000
+    };
+    static constexpr audio_channel_mask_t SUPPORTED_INPUT_CHANNEL_MASKS[] = {
+        AUDIO_CHANNEL_IN_MONO, AUDIO_CHANNEL_IN_STEREO,
+        AUDIO_CHANNEL_IN_VOICE_UPLINK, AUDIO_CHANNEL_IN_VOICE_DNLINK
+    };
+
+    // Format the PCM is opened with; streams are converted to it on write
+    static constexpr audio_format_t HW_FORMAT = AUDIO_FORMAT_PCM_16_BIT;
+    static constexpr enum pcm_format HW_PCM_FORMAT = PCM_FORMAT_S16_LE;
 
     // Helper functions
+    static const PeriodProfile& SelectPeriodProfile(audio_output_flags_t flags);
+    static int CheckInputConfig(const audio_config_t* config);
+    static unsigned int GetCapturePeriodSize(uint32_t sampleRate);
+    void InitCapabilities();
+    static std::shared_ptr<const CapabilityResponses> BuildUsbCapabilities(
+        const std::vector<UsbFormatProfile>& profiles, bool output);
+    int ConnectUsbDevice(unsigned int card, unsigned int device);
+    void DisconnectUsbDevice();
+    int SelectOutputBackend(audio_devices_t devices, StreamConfig* config);
+    int SelectInputBackend(audio_devices_t devices, StreamConfig* config);
     int InitializeALSA();
+    int InitMixerPaths();
+    int ApplyRoute();
     void DeinitializeALSA();
-    int ConfigureALSADevice(const StreamConfig* config);
+    int ConfigureALSADevice(Stream* stream);
+    int InitOutputProcessing(Stream* stream);
+    int OpenOffloadStream(audio_devices_t devices, audio_output_flags_t flags,
+                          audio_config_t* config, struct audio_stream_out** stream_out);
+    static ssize_t WriteOffload(Stream* stream, const void* buffer, size_t bytes);
+    static void OffloadEventCallback(CompressOffload::Event event, void* cookie);
+    static size_t ProcessOutput(Stream* stream, const void* buffer, size_t frames,
+                                const void** outData, size_t* outBytes);
+    static int WriteToPcm(Stream* stream, const void* buffer, size_t bytes);
+    static void UpdateUnderrunCount(Stream* stream);
+    static void UpdatePresentationPosition(Stream* stream);
+    static void RecordWrite(Stream* stream, nsecs_t start, nsecs_t cpuStart, bool standbyExit);
+    static void DumpMetrics(const Stream* stream, int fd);
+    int StartCapture(InStream* stream);
+    void StopCapture(InStream* stream);
+    static void CaptureThreadLoop(InStream* stream);
+    static int WaitForCapture(InStream* stream);
 };
 
 #endif // AUDIO_HW_H 
\ No newline at end of file
@@ -0,0 +1,64 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "audio_latency_histogram.h"
+
+LatencyHistogram::LatencyHistogram() {
+    Reset();
+}
+
+void LatencyHistogram::Reset() {
+    memset(mBuckets, 0, sizeof(mBuckets));
+    mCount = 0;
+    mMaxUs = 0;
+    mLastUs = 0;
+}
+
+// Values below SUB_BUCKETS map 1:1; above, the exponent selects a group of
+// SUB_BUCKETS buckets and the bits after the leading one select within it.
+size_t LatencyHistogram::BucketIndex(int64_t us) {
+    if (us < SUB_BUCKETS) {
+        return us < 0 ? 0 : static_cast<size_t>(us);
+    }
+    int exponent = 63 - __builtin_clzll(static_cast<uint64_t>(us));
+    if (exponent > MAX_EXPONENT) {
+        return BUCKETS - 1;
+    }
+    int shift = exponent - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKETS + ((us >> shift) - SUB_BUCKETS);
+}
+
+int64_t LatencyHistogram::BucketUpperBound(size_t index) {
+    if (index < static_cast<size_t>(SUB_BUCKETS)) {
+        return index;
+    }
+    int shift = index / SUB_BUCKETS - 1;
+    int64_t lower = (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+    return lower + (int64_t(1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(int64_t ns) {
+    int64_t us = ns / 1000;
+    mBuckets[BucketIndex(us)]++;
+    mCount++;
+    mLastUs = us;
+    mMaxUs = std::max(mMaxUs, us);
+}
+
+int64_t LatencyHistogram::GetPercentileUs(double percentile) const {
+    if (mCount == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(ceil(percentile / 100.0 * mCount));
+    rank = std::min(std::max<uint64_t>(rank, 1), mCount);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += mBuckets[i];
+        if (seen >= rank) {
+            // The last bucket also holds everything beyond MAX_EXPONENT.
+            return i == BUCKETS - 1 ? mMaxUs : std::min(BucketUpperBound(i), mMaxUs);
+        }
+    }
+    return mMaxUs;
+}
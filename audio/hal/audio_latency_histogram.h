@@ -0,0 +1,44 @@
+#ifndef AUDIO_LATENCY_HISTOGRAM_H
+#define AUDIO_LATENCY_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Log-linear histogram of durations in microseconds.
+//
+// Every power of two is split into SUB_BUCKETS linear buckets, so a
+// percentile is exact below SUB_BUCKETS us and within 1/SUB_BUCKETS of the
+// recorded value above, up to about a minute, in a fixed array. Record is
+// a few integer operations and never allocates, so it can sit on the write
+// path. Not thread safe; callers serialize with the stream lock.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void Record(int64_t ns);
+    void Reset();
+
+    uint64_t GetCount() const { return mCount; }
+    int64_t GetMaxUs() const { return mMaxUs; }
+    int64_t GetLastUs() const { return mLastUs; }
+
+    // Upper bound of the bucket holding the given percentile (0-100), or 0
+    // when nothing was recorded.
+    int64_t GetPercentileUs(double percentile) const;
+
+private:
+    static constexpr int SUB_BUCKET_BITS = 3;
+    static constexpr int64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr int MAX_EXPONENT = 26;     // 2^26 us, about 67 s
+    static constexpr size_t BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+    static size_t BucketIndex(int64_t us);
+    static int64_t BucketUpperBound(size_t index);
+
+    uint32_t mBuckets[BUCKETS];
+    uint64_t mCount;
+    int64_t mMaxUs;
+    int64_t mLastUs;
+};
+
+#endif // AUDIO_LATENCY_HISTOGRAM_H
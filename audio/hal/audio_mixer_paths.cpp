@@ -0,0 +1,256 @@
+#define LOG_TAG "audio_hal_sm8650"
+
+#include <log/log.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <expat.h>
+#include "audio_mixer_paths.h"
+
+MixerPaths::MixerPaths()
+    : mMixer(nullptr)
+    , mParseDepth(0)
+    , mParsePath(-1) {
+}
+
+int MixerPaths::Load(const char* file, struct mixer* mixer) {
+    FILE* fp = fopen(file, "r");
+    if (!fp) {
+        ALOGE("Failed to open %s (%s)", file, strerror(errno));
+        return -errno;
+    }
+    int ret = Load(fp, mixer);
+    fclose(fp);
+    if (ret != 0) {
+        ALOGE("Failed to load %s", file);
+    }
+    return ret;
+}
+
+int MixerPaths::Load(FILE* file, struct mixer* mixer) {
+    XML_Parser parser = XML_ParserCreate(nullptr);
+    if (!parser) {
+        return -ENOMEM;
+    }
+
+    mMixer = mixer;
+    mControls.clear();
+    mPaths.clear();
+    mTarget.clear();
+    mParseDepth = 0;
+    mParsePath = -1;
+    XML_SetUserData(parser, this);
+    XML_SetElementHandler(parser, StartElement, EndElement);
+
+    int ret = 0;
+    char buffer[4096];
+    for (;;) {
+        size_t len = fread(buffer, 1, sizeof(buffer), file);
+        bool done = len < sizeof(buffer);
+        if (XML_Parse(parser, buffer, len, done) == XML_STATUS_ERROR) {
+            ALOGE("Mixer paths parse error at line %lu: %s",
+                  XML_GetCurrentLineNumber(parser),
+                  XML_ErrorString(XML_GetErrorCode(parser)));
+            ret = -EINVAL;
+            break;
+        }
+        if (done) {
+            break;
+        }
+    }
+
+    XML_ParserFree(parser);
+    for (size_t i = 0; ret == 0 && i < mPaths.size(); i++) {
+        ret = Resolve(i, 0);
+    }
+    if (ret != 0) {
+        // A file that failed to load defines nothing, so Apply is a no-op
+        mControls.clear();
+        mPaths.clear();
+        return ret;
+    }
+
+    mTarget.resize(mControls.size());
+    ALOGI("Loaded %zu mixer paths over %zu controls", mPaths.size(), mControls.size());
+    return 0;
+}
+
+int MixerPaths::GetPathId(const char* name) const {
+    for (size_t i = 0; i < mPaths.size(); i++) {
+        if (mPaths[i].name == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int MixerPaths::Apply(const int* pathIds, size_t count) {
+    for (size_t i = 0; i < mControls.size(); i++) {
+        mTarget[i] = mControls[i].initial;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (pathIds[i] < 0 || pathIds[i] >= static_cast<int>(mPaths.size())) {
+            continue;
+        }
+        for (const Setting& setting : mPaths[pathIds[i]].settings) {
+            mTarget[setting.control] = setting.value;
+        }
+    }
+
+    int written = 0;
+    for (size_t i = 0; i < mControls.size(); i++) {
+        Control& control = mControls[i];
+        if (!control.ctl || control.current == mTarget[i]) {
+            continue;
+        }
+        for (unsigned int v = 0; v < control.numValues; v++) {
+            if (mixer_ctl_set_value(control.ctl, v, mTarget[i]) != 0) {
+                ALOGE("Failed to set %s to %d", control.name.c_str(), mTarget[i]);
+                return -EIO;
+            }
+        }
+        control.current = mTarget[i];
+        written++;
+    }
+    return written;
+}
+
+void MixerPaths::StartElement(void* data, const char* element, const char** attrs) {
+    MixerPaths* paths = static_cast<MixerPaths*>(data);
+    const char* name = nullptr;
+    const char* value = nullptr;
+    for (int i = 0; attrs[i]; i += 2) {
+        if (strcmp(attrs[i], "name") == 0) {
+            name = attrs[i + 1];
+        } else if (strcmp(attrs[i], "value") == 0) {
+            value = attrs[i + 1];
+        }
+    }
+
+    paths->mParseDepth++;
+    if (strcmp(element, "path") == 0 && name) {
+        if (paths->mParsePath < 0) {
+            // Top-level definition
+            Path path;
+            path.name = name;
+            path.resolved = false;
+            paths->mPaths.push_back(path);
+            paths->mParsePath = paths->mPaths.size() - 1;
+        } else {
+            PathEntry entry;
+            entry.include = name;
+            paths->mPaths[paths->mParsePath].entries.push_back(entry);
+        }
+    } else if (strcmp(element, "ctl") == 0 && name && value) {
+        int control = paths->FindOrAddControl(name);
+        int parsed = paths->ParseValue(control, value);
+        if (paths->mParsePath < 0) {
+            paths->mControls[control].initial = parsed;
+        } else {
+            PathEntry entry;
+            entry.setting.control = control;
+            entry.setting.value = parsed;
+            paths->mPaths[paths->mParsePath].entries.push_back(entry);
+        }
+    }
+}
+
+void MixerPaths::EndElement(void* data, const char* element) {
+    MixerPaths* paths = static_cast<MixerPaths*>(data);
+    // <mixer> is depth 1, so a top-level <path> closes at depth 2.
+    if (strcmp(element, "path") == 0 && paths->mParseDepth == 2) {
+        paths->mParsePath = -1;
+    }
+    paths->mParseDepth--;
+}
+
+int MixerPaths::FindOrAddControl(const char* name) {
+    for (size_t i = 0; i < mControls.size(); i++) {
+        if (mControls[i].name == name) {
+            return i;
+        }
+    }
+
+    Control control;
+    control.name = name;
+    control.ctl = mixer_get_ctl_by_name(mMixer, name);
+    control.numValues = 0;
+    control.initial = 0;
+    control.current = 0;
+    if (control.ctl) {
+        control.numValues = mixer_ctl_get_num_values(control.ctl);
+        control.current = mixer_ctl_get_value(control.ctl, 0);
+        control.initial = control.current;
+    } else {
+        ALOGW("Unknown mixer control: %s", name);
+    }
+
+    mControls.push_back(control);
+    return mControls.size() - 1;
+}
+
+int MixerPaths::ParseValue(int control, const char* value) const {
+    struct mixer_ctl* ctl = mControls[control].ctl;
+    if (ctl && mixer_ctl_get_type(ctl) == MIXER_CTL_TYPE_ENUM) {
+        unsigned int count = mixer_ctl_get_num_enums(ctl);
+        for (unsigned int i = 0; i < count; i++) {
+            if (strcmp(mixer_ctl_get_enum_string(ctl, i), value) == 0) {
+                return i;
+            }
+        }
+        ALOGW("Unknown value %s for %s", value, mControls[control].name.c_str());
+        return 0;
+    }
+    return atoi(value);
+}
+
+int MixerPaths::Resolve(int pathId, int depth) {
+    Path& path = mPaths[pathId];
+    if (path.resolved) {
+        return 0;
+    }
+    if (depth > MAX_PATH_DEPTH) {
+        ALOGE("Mixer path %s nests too deeply or recursively", path.name.c_str());
+        return -ELOOP;
+    }
+
+    // Later entries override earlier ones; keep one setting per control.
+    std::vector<int> slot(mControls.size(), -1);
+    std::vector<Setting> settings;
+    auto add = [&](const Setting& setting) {
+        if (slot[setting.control] >= 0) {
+            settings[slot[setting.control]].value = setting.value;
+        } else {
+            slot[setting.control] = settings.size();
+            settings.push_back(setting);
+        }
+    };
+
+    for (const PathEntry& entry : path.entries) {
+        if (entry.include.empty()) {
+            add(entry.setting);
+            continue;
+        }
+        int included = GetPathId(entry.include.c_str());
+        if (included < 0) {
+            ALOGE("Mixer path %s references unknown path %s", path.name.c_str(),
+                  entry.include.c_str());
+            return -EINVAL;
+        }
+        int ret = Resolve(included, depth + 1);
+        if (ret != 0) {
+            return ret;
+        }
+        for (const Setting& setting : mPaths[included].settings) {
+            add(setting);
+        }
+    }
+
+    // mPaths is not resized while resolving, so path is still valid.
+    path.settings = settings;
+    path.entries.clear();
+    path.resolved = true;
+    return 0;
+}
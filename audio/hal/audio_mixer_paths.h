@@ -0,0 +1,79 @@
+#ifndef AUDIO_MIXER_PATHS_H
+#define AUDIO_MIXER_PATHS_H
+
+#include <tinyalsa/asoundlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Compiled mixer_paths.xml.
+//
+// Load parses the file once, resolves every control name to a cached
+// mixer_ctl pointer and flattens nested <path> references into one setting
+// vector per path. Apply computes the target state for a set of paths on
+// top of the initial settings and writes only the controls whose value
+// differs from the cached hardware state.
+class MixerPaths {
+public:
+    MixerPaths();
+
+    int Load(const char* file, struct mixer* mixer);
+    int Load(FILE* file, struct mixer* mixer);
+
+    // Returns the id of a path, or -1 if the file does not define it.
+    int GetPathId(const char* name) const;
+
+    // Activates exactly the given paths. Returns the number of controls
+    // written or a negative errno.
+    int Apply(const int* pathIds, size_t count);
+
+    size_t GetControlCount() const { return mControls.size(); }
+    size_t GetPathCount() const { return mPaths.size(); }
+
+private:
+    struct Control {
+        std::string name;
+        struct mixer_ctl* ctl;
+        unsigned int numValues;
+        int initial;
+        int current;
+    };
+
+    struct Setting {
+        int control;
+        int value;
+    };
+
+    // Raw path entry in document order: a non-empty include references
+    // another path by name, otherwise setting applies.
+    struct PathEntry {
+        std::string include;
+        Setting setting;
+    };
+
+    struct Path {
+        std::string name;
+        std::vector<PathEntry> entries;
+        std::vector<Setting> settings;  // flattened, one per control
+        bool resolved;
+    };
+
+    static constexpr int MAX_PATH_DEPTH = 16;
+
+    static void StartElement(void* data, const char* element, const char** attrs);
+    static void EndElement(void* data, const char* element);
+
+    int FindOrAddControl(const char* name);
+    int ParseValue(int control, const char* value) const;
+    int Resolve(int pathId, int depth);
+
+    struct mixer* mMixer;
+    std::vector<Control> mControls;
+    std::vector<Path> mPaths;
+    std::vector<int> mTarget;       // scratch for Apply, sized at Load
+    int mParseDepth;
+    int mParsePath;
+};
+
+#endif // AUDIO_MIXER_PATHS_H
@@ -0,0 +1,559 @@
+#define LOG_TAG "audio_hal_sm8650"
+
+#include <log/log.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include "audio_output_mixer.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OUTPUT_MIXER_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define OUTPUT_MIXER_SSE2 1
+#endif
+
+namespace {
+
+constexpr int GAIN_SHIFT = 14;
+
+int64_t MonotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int64_t ThreadCpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// acc[i] += (src[i] * gain) >> GAIN_SHIFT
+void MixS16(int32_t* acc, const int16_t* src, size_t count, int32_t gain) {
+    size_t i = 0;
+#if OUTPUT_MIXER_NEON
+    const int16_t g = static_cast<int16_t>(gain);
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t s = vld1q_s16(src + i);
+        int32x4_t lo = vsraq_n_s32(vld1q_s32(acc + i),
+                                   vmull_n_s16(vget_low_s16(s), g), GAIN_SHIFT);
+        int32x4_t hi = vsraq_n_s32(vld1q_s32(acc + i + 4),
+                                   vmull_n_s16(vget_high_s16(s), g), GAIN_SHIFT);
+        vst1q_s32(acc + i, lo);
+        vst1q_s32(acc + i + 4, hi);
+    }
+#elif OUTPUT_MIXER_SSE2
+    const __m128i g = _mm_set1_epi16(static_cast<int16_t>(gain));
+    for (; i + 8 <= count; i += 8) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        // 16x16 -> 32-bit products from the low and high halves
+        __m128i productLo = _mm_mullo_epi16(s, g);
+        __m128i productHi = _mm_mulhi_epi16(s, g);
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(productLo, productHi), GAIN_SHIFT);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(productLo, productHi), GAIN_SHIFT);
+        __m128i* out = reinterpret_cast<__m128i*>(acc + i);
+        _mm_storeu_si128(out, _mm_add_epi32(_mm_loadu_si128(out), lo));
+        _mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1), hi));
+    }
+#endif
+    for (; i < count; i++) {
+        acc[i] += (src[i] * gain) >> GAIN_SHIFT;
+    }
+}
+
+void SaturateS16(int16_t* dst, const int32_t* acc, size_t count) {
+    size_t i = 0;
+#if OUTPUT_MIXER_NEON
+    for (; i + 8 <= count; i += 8) {
+        vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(vld1q_s32(acc + i)),
+                                        vqmovn_s32(vld1q_s32(acc + i + 4))));
+    }
+#elif OUTPUT_MIXER_SSE2
+    for (; i + 8 <= count; i += 8) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + i));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + i + 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(lo, hi));
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = static_cast<int16_t>(std::min(std::max(acc[i], -32768), 32767));
+    }
+}
+
+} // namespace
+
+OutputMixer::OutputMixer()
+    : mPcm(nullptr)
+    , mPcmWarm(false)
+    , mPcmMmap(false)
+    , mPcmPeriodCount(0)
+    , mPeriodSize(0)
+    , mCpuNs(0)
+    , mFramesOut(0)
+    , mExit(false)
+    , mStartRequestNs(0) {
+    memset(&mConfig, 0, sizeof(mConfig));
+    mStartStats.warmStarts = 0;
+    mStartStats.coldStarts = 0;
+}
+
+OutputMixer::~OutputMixer() {
+    Stop();
+    for (size_t i = 0; i < MAX_TRACKS; i++) {
+        RemoveTrack(i);
+    }
+}
+
+int OutputMixer::Init(const Config& config) {
+    if (config.channels == 0 || config.sampleRate == 0) {
+        ALOGE("Invalid mixer config: %u channels at %u Hz", config.channels, config.sampleRate);
+        return -EINVAL;
+    }
+    mConfig = config;
+    mExit = false;
+    mThread = std::thread(&OutputMixer::ThreadLoop, this);
+    return 0;
+}
+
+void OutputMixer::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mExit = true;
+    }
+    mWorkReady.notify_one();
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+int OutputMixer::AddTrack(unsigned int periodSize, unsigned int periodCount, bool mmap) {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    size_t id = 0;
+    while (id < MAX_TRACKS && mTracks[id]) {
+        id++;
+    }
+    if (id == MAX_TRACKS) {
+        ALOGE("No free mixer track");
+        return -ENOSPC;
+    }
+
+    std::unique_ptr<Track> track(new Track());
+    int ret = track->ring.Init(periodSize * periodCount, mConfig.channels * sizeof(int16_t));
+    if (ret != 0) {
+        return ret;
+    }
+    track->periodSize = periodSize;
+    track->periodCount = periodCount;
+    track->mmap = mmap;
+    sem_init(&track->spaceReady, 0, 0);
+    track->active.store(false);
+    track->targetGain.store(UNITY_GAIN);
+    track->gain = 0;
+    track->rampTarget = 0;
+    track->gainStep = 0;
+    track->primed = false;
+    track->framesMixed = 0;
+    track->underruns.store(0);
+
+    mTracks[id] = std::move(track);
+    return id;
+}
+
+void OutputMixer::RemoveTrack(int id) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mTracks[id]) {
+        sem_destroy(&mTracks[id]->spaceReady);
+        mTracks[id].reset();
+    }
+}
+
+int OutputMixer::Write(int id, const int16_t* data, size_t frames) {
+    // The track cannot be removed while its owner writes.
+    Track* track = mTracks[id].get();
+
+    // An inactive track is not read by the mixer, so its first frames are
+    // queued before it is activated. Waking the mixer to an empty ring
+    // would start the PCM on a period of silence.
+    bool activate = !track->active.load(std::memory_order_relaxed);
+    while (frames > 0) {
+        size_t written = track->ring.Write(data, frames);
+        data += written * mConfig.channels;
+        frames -= written;
+        if (activate) {
+            activate = false;
+            Activate(track);
+        }
+        if (frames > 0) {
+            int ret = WaitForSpace(track);
+            if (ret != 0) {
+                ALOGE("Mixer stalled, %zu frames not queued", frames);
+                return ret;
+            }
+        }
+    }
+    return 0;
+}
+
+void OutputMixer::Activate(Track* track) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!HasActiveTrackLocked()) {
+        mStartRequestNs = MonotonicNs();
+    }
+    track->gain = 0;    // fade in
+    track->rampTarget = -1;
+    track->primed = false;
+    track->active.store(true, std::memory_order_relaxed);
+    mWorkReady.notify_one();
+}
+
+int OutputMixer::WaitForSpace(Track* track) {
+    // Allow the whole ring to drain twice before giving up on the mixer.
+    const int64_t timeoutNs = 2LL * track->periodSize * track->periodCount *
+        1000000000LL / mConfig.sampleRate;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += timeoutNs;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000LL;
+    deadline.tv_nsec %= 1000000000LL;
+
+    while (sem_timedwait(&track->spaceReady, &deadline) != 0) {
+        if (errno != EINTR) {
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+void OutputMixer::Standby(int id) {
+    std::lock_guard<std::mutex> lock(mLock);
+    Track* track = mTracks[id].get();
+    // The mixer is locked out and the owner is not writing, so neither
+    // side of the ring runs. Dropped frames still count as mixed so
+    // positions stay in step with the frames the owner wrote.
+    track->active.store(false, std::memory_order_relaxed);
+    track->framesMixed += track->ring.GetReadAvailable();
+    track->ring.Reset();
+}
+
+void OutputMixer::SetVolume(int id, float gain) {
+    gain = std::min(std::max(gain, 0.0f), 1.0f);
+    mTracks[id]->targetGain.store(static_cast<int32_t>(gain * UNITY_GAIN),
+                                  std::memory_order_relaxed);
+}
+
+OutputMixer::Position OutputMixer::GetPosition(int id) const {
+    return mTracks[id]->position.Load();
+}
+
+uint32_t OutputMixer::GetUnderruns(int id) const {
+    return mTracks[id]->underruns.load(std::memory_order_relaxed);
+}
+
+uint32_t OutputMixer::GetLatencyMs() const {
+    std::lock_guard<std::mutex> lock(mLock);
+    unsigned int periodSize;
+    unsigned int periodCount;
+    bool mmap;
+    SelectPeriodLocked(&periodSize, &periodCount, &mmap);
+    return static_cast<uint64_t>(periodSize) * periodCount * 1000 / mConfig.sampleRate;
+}
+
+double OutputMixer::GetCpuMsPerSecond() const {
+    uint64_t frames = mFramesOut.load(std::memory_order_relaxed);
+    if (frames == 0) {
+        return 0.0;
+    }
+    double seconds = static_cast<double>(frames) / mConfig.sampleRate;
+    return mCpuNs.load(std::memory_order_relaxed) / 1000000.0 / seconds;
+}
+
+OutputMixer::StartStats OutputMixer::GetStartStats() const {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mStartStats;
+}
+
+bool OutputMixer::HasActiveTrackLocked() const {
+    for (const auto& track : mTracks) {
+        if (track && track->active.load(std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The writing track with the shortest period drives the PCM, so an idle
+// fast track left open does not hold a deep-buffer stream at its period.
+// With nothing writing, the open tracks decide, for latency reports.
+void OutputMixer::SelectPeriodLocked(unsigned int* periodSize, unsigned int* periodCount,
+                                     bool* mmap) const {
+    const bool anyActive = HasActiveTrackLocked();
+    *periodSize = 0;
+    *periodCount = 0;
+    *mmap = false;
+    for (const auto& track : mTracks) {
+        if (!track || (anyActive && !track->active.load(std::memory_order_relaxed))) {
+            continue;
+        }
+        if (*periodSize == 0 || track->periodSize < *periodSize) {
+            *periodSize = track->periodSize;
+            *periodCount = track->periodCount;
+            *mmap = track->mmap;
+        }
+    }
+}
+
+// Mixer thread only
+int OutputMixer::OpenPcm(unsigned int periodSize, unsigned int periodCount, bool mmap) {
+    struct pcm_config config = {};
+    config.channels = mConfig.channels;
+    config.rate = mConfig.sampleRate;
+    config.period_size = periodSize;
+    config.period_count = periodCount;
+    config.format = PCM_FORMAT_S16_LE;
+    config.start_threshold = 0;
+    config.stop_threshold = 0;
+    config.silence_threshold = 0;
+
+    // Monotonic htimestamps line up with the presentation position clock.
+    unsigned int flags = PCM_OUT | PCM_MONOTONIC;
+    if (mmap) {
+        flags |= PCM_MMAP;
+    }
+
+    struct pcm* pcm = pcm_open(mConfig.card, mConfig.device, flags, &config);
+    if (!pcm || !pcm_is_ready(pcm)) {
+        ALOGE("Failed to open mixer PCM: %s", pcm_get_error(pcm));
+        if (pcm) {
+            pcm_close(pcm);
+        }
+        return -ENODEV;
+    }
+
+    const size_t samples = static_cast<size_t>(periodSize) * mConfig.channels;
+    mAccumulator.resize(samples);
+    mTrackBuffer.resize(samples);
+    mOutBuffer.resize(samples);
+    mPcm = pcm;
+    mPcmMmap = mmap;
+    mPcmPeriodCount = periodCount;
+    mPeriodSize.store(periodSize, std::memory_order_relaxed);
+    return 0;
+}
+
+// Mixer thread only
+void OutputMixer::ClosePcm() {
+    if (mPcm) {
+        pcm_close(mPcm);
+        mPcm = nullptr;
+        mPcmWarm = false;
+        mPeriodSize.store(0, std::memory_order_relaxed);
+    }
+}
+
+// Mixer thread only. pcm_stop drops what is still queued and leaves the
+// stream in SETUP; preparing it again now keeps that off the resume path.
+void OutputMixer::EnterWarmStandby() {
+    if (mConfig.warmStandbyMs == 0 || pcm_stop(mPcm) != 0 || pcm_prepare(mPcm) != 0) {
+        ClosePcm();
+        return;
+    }
+    mPcmWarm = true;
+}
+
+void OutputMixer::ThreadLoop() {
+    struct sched_param param = {};
+    param.sched_priority = mConfig.priority;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+        ALOGW("Failed to set mixer thread priority");
+    }
+
+    std::unique_lock<std::mutex> lock(mLock);
+    auto woken = [this] { return mExit || HasActiveTrackLocked(); };
+    bool running = false;
+    bool startPending = false;   // for the start stats
+    bool startPcm = false;       // the next period written starts the PCM
+    bool coldStart = false;
+
+    while (!mExit) {
+        if (!HasActiveTrackLocked()) {
+            if (running) {
+                running = false;
+                if (mPcm) {
+                    lock.unlock();
+                    EnterWarmStandby();
+                    lock.lock();
+                }
+            } else if (mPcmWarm) {
+                auto window = std::chrono::milliseconds(mConfig.warmStandbyMs);
+                if (!mWorkReady.wait_for(lock, window, woken)) {
+                    lock.unlock();
+                    ClosePcm();
+                    lock.lock();
+                }
+            } else {
+                mWorkReady.wait(lock, woken);
+            }
+            continue;
+        }
+
+        if (!running) {
+            running = true;
+            startPending = true;
+            startPcm = true;
+            coldStart = false;
+        }
+
+        unsigned int periodSize;
+        unsigned int periodCount;
+        bool mmap;
+        SelectPeriodLocked(&periodSize, &periodCount, &mmap);
+        const auto periodTime = std::chrono::microseconds(
+            static_cast<uint64_t>(periodSize) * 1000000 / mConfig.sampleRate);
+
+        // Reopened whenever the tracks writing call for another period,
+        // including while running, as a fast track starts or stops.
+        if (!mPcm || periodSize != mPeriodSize.load(std::memory_order_relaxed) ||
+                periodCount != mPcmPeriodCount || mmap != mPcmMmap) {
+            lock.unlock();
+            ClosePcm();
+            int ret = OpenPcm(periodSize, periodCount, mmap);
+            lock.lock();
+            if (ret != 0) {
+                mWorkReady.wait_for(lock, periodTime);
+                continue;
+            }
+            coldStart = true;
+            startPcm = true;
+        }
+        mPcmWarm = false;
+
+        const int64_t cpuStart = ThreadCpuNs();
+        MixLocked(periodSize);
+
+        lock.unlock();
+        const size_t bytes = mOutBuffer.size() * sizeof(int16_t);
+        int ret = mPcmMmap ? pcm_mmap_write(mPcm, mOutBuffer.data(), bytes) :
+            pcm_write(mPcm, mOutBuffer.data(), bytes);
+        if (ret != 0) {
+            ALOGE("Failed to write mixer PCM: %s", pcm_get_error(mPcm));
+            ClosePcm();
+        } else {
+            mFramesOut.fetch_add(periodSize, std::memory_order_relaxed);
+            if (startPcm) {
+                // Start on the first period rather than the start
+                // threshold. Fails harmlessly if the threshold was already
+                // reached and the stream is running.
+                pcm_start(mPcm);
+            }
+        }
+        mCpuNs.fetch_add(ThreadCpuNs() - cpuStart, std::memory_order_relaxed);
+        lock.lock();
+
+        if (ret != 0) {
+            mWorkReady.wait_for(lock, periodTime);
+            continue;
+        }
+        startPcm = false;
+        if (startPending) {
+            startPending = false;
+            mStartStats.latency.Record(MonotonicNs() - mStartRequestNs);
+            if (coldStart) {
+                mStartStats.coldStarts++;
+            } else {
+                mStartStats.warmStarts++;
+            }
+        }
+        PublishPositionsLocked();
+    }
+    lock.unlock();
+    ClosePcm();
+}
+
+void OutputMixer::MixLocked(size_t frames) {
+    const size_t samples = frames * mConfig.channels;
+    std::fill(mAccumulator.begin(), mAccumulator.begin() + samples, 0);
+    for (const auto& track : mTracks) {
+        if (track && track->active.load(std::memory_order_relaxed)) {
+            MixTrack(track.get(), frames);
+        }
+    }
+    SaturateS16(mOutBuffer.data(), mAccumulator.data(), samples);
+}
+
+void OutputMixer::MixTrack(Track* track, size_t frames) {
+    const size_t channels = mConfig.channels;
+    size_t read = track->ring.Read(mTrackBuffer.data(), frames);
+    if (read < frames) {
+        // A track that has not delivered its first full period is still
+        // starting, not underrunning.
+        if (track->primed) {
+            track->underruns.fetch_add(1, std::memory_order_relaxed);
+        }
+    } else {
+        track->primed = true;
+    }
+    if (read == 0) {
+        return;
+    }
+    track->framesMixed += read;
+    sem_post(&track->spaceReady);
+
+    const int32_t target = track->targetGain.load(std::memory_order_relaxed);
+    if (target != track->rampTarget) {
+        track->rampTarget = target;
+        track->gainStep = std::max<int32_t>(1,
+            std::abs(target - track->gain) * RAMP_STEP_FRAMES / RAMP_FRAMES);
+    }
+
+    // Ramp in steps of RAMP_STEP_FRAMES, then mix the rest at the target.
+    const int16_t* src = mTrackBuffer.data();
+    int32_t* acc = mAccumulator.data();
+    size_t offset = 0;
+    while (offset < read && track->gain != target) {
+        if (track->gain < target) {
+            track->gain = std::min(track->gain + track->gainStep, target);
+        } else {
+            track->gain = std::max(track->gain - track->gainStep, target);
+        }
+        size_t count = std::min(RAMP_STEP_FRAMES, read - offset);
+        MixS16(acc + offset * channels, src + offset * channels, count * channels,
+               track->gain);
+        offset += count;
+    }
+    if (offset < read && track->gain != 0) {
+        MixS16(acc + offset * channels, src + offset * channels,
+               (read - offset) * channels, track->gain);
+    }
+}
+
+void OutputMixer::PublishPositionsLocked() {
+    unsigned int avail;
+    struct timespec tstamp;
+    if (pcm_get_htimestamp(mPcm, &avail, &tstamp) != 0) {
+        return;
+    }
+
+    // Frames still queued in the PCM have not been presented yet.
+    unsigned int bufferSize = pcm_get_buffer_size(mPcm);
+    uint64_t queued = bufferSize - std::min(avail, bufferSize);
+    int64_t timeNs = tstamp.tv_sec * 1000000000LL + tstamp.tv_nsec;
+
+    for (const auto& track : mTracks) {
+        if (track && track->active.load(std::memory_order_relaxed) &&
+                track->framesMixed > queued) {
+            Position position;
+            position.frames = track->framesMixed - queued;
+            position.timeNs = timeNs;
+            track->position.Store(position);
+        }
+    }
+}
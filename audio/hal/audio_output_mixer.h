@@ -0,0 +1,157 @@
+#ifndef AUDIO_OUTPUT_MIXER_H
+#define AUDIO_OUTPUT_MIXER_H
+
+#include <tinyalsa/asoundlib.h>
+#include <semaphore.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "audio_latency_histogram.h"
+#include "audio_ring_buffer.h"
+#include "audio_seqlock.h"
+
+// Sums concurrent output streams into one S16 PCM.
+//
+// Each stream owns a track: a ring of processed frames at the PCM rate and
+// channel count that Write fills and the mixer thread drains one period at
+// a time. The mixer period follows the shortest period of the tracks being
+// written, so a fast track sets the latency of everything mixed with it
+// while it plays, and the PCM is reopened at the longer period once it
+// goes to standby. Tracks are
+// summed into 32-bit accumulators at a Q14 gain and saturated back to 16
+// bits with NEON or SSE2. Gain changes, and the start of every track, ramp
+// over RAMP_FRAMES so they never click.
+//
+// When the last track goes idle the PCM is stopped but kept prepared for
+// warmStandbyMs, so a track starting within that window skips pcm_open and
+// hw_params: the mixer queues one period and calls pcm_start. The PCM is
+// closed once the window passes.
+class OutputMixer {
+public:
+    struct Config {
+        unsigned int card;
+        unsigned int device;
+        uint32_t sampleRate;
+        uint32_t channels;
+        int priority;       // SCHED_FIFO priority of the mixer thread
+        uint32_t warmStandbyMs; // 0 closes the PCM as soon as it idles
+    };
+
+    struct Position {
+        uint64_t frames;    // track frames that left the DAC
+        int64_t timeNs;     // CLOCK_MONOTONIC time the last of them did
+    };
+
+    // Time from a track queueing its first frames to the idle mixer until
+    // the first mixed period is queued and the PCM started
+    struct StartStats {
+        LatencyHistogram latency;
+        uint32_t warmStarts;    // PCM resumed from warm standby
+        uint32_t coldStarts;    // PCM opened
+    };
+
+    static constexpr size_t MAX_TRACKS = 4;
+
+    OutputMixer();
+    ~OutputMixer();
+
+    // Starts the mixer thread, which idles until a track becomes active.
+    int Init(const Config& config);
+    void Stop();
+
+    // periodSize and periodCount size the track ring and are candidates for
+    // the mixer period; mmap tracks also switch the PCM to mmap while they
+    // drive it. Returns a track id or a negative errno.
+    int AddTrack(unsigned int periodSize, unsigned int periodCount, bool mmap);
+    void RemoveTrack(int track);
+
+    // Queues frames, blocking while the ring is full. The first write after
+    // Standby activates the track once its first frames are queued.
+    // Returns 0 or a negative errno.
+    int Write(int track, const int16_t* data, size_t frames);
+
+    // Drops queued frames and stops mixing the track.
+    void Standby(int track);
+
+    // Linear gain, 0.0 to 1.0
+    void SetVolume(int track, float gain);
+
+    Position GetPosition(int track) const;
+    uint32_t GetUnderruns(int track) const;
+    unsigned int GetPeriodSize() const { return mPeriodSize.load(std::memory_order_relaxed); }
+    uint32_t GetLatencyMs() const;
+
+    // Mixer thread CPU time per second of audio it produced
+    double GetCpuMsPerSecond() const;
+    StartStats GetStartStats() const;
+
+private:
+    static constexpr int32_t UNITY_GAIN = 1 << 14;
+    static constexpr size_t RAMP_FRAMES = 480;      // 10 ms at 48 kHz
+    static constexpr size_t RAMP_STEP_FRAMES = 16;
+
+    struct Track {
+        unsigned int periodSize;
+        unsigned int periodCount;
+        bool mmap;
+        RingBuffer ring;
+        sem_t spaceReady;
+
+        // Set by the writer; read by the mixer under mLock
+        std::atomic<bool> active;
+        std::atomic<int32_t> targetGain;
+
+        // Mixer thread state, guarded by mLock
+        int32_t gain;
+        int32_t rampTarget;     // target the current gainStep was computed for
+        int32_t gainStep;
+        bool primed;
+        uint64_t framesMixed;
+        SeqLock<Position> position;
+        std::atomic<uint32_t> underruns;
+    };
+
+    void Activate(Track* track);
+    void ThreadLoop();
+    bool HasActiveTrackLocked() const;
+    void SelectPeriodLocked(unsigned int* periodSize, unsigned int* periodCount,
+                            bool* mmap) const;
+    int OpenPcm(unsigned int periodSize, unsigned int periodCount, bool mmap);
+    void ClosePcm();
+    void EnterWarmStandby();
+    void MixLocked(size_t frames);
+    void MixTrack(Track* track, size_t frames);
+    int WaitForSpace(Track* track);
+    void PublishPositionsLocked();
+
+    Config mConfig;
+    struct pcm* mPcm;
+    bool mPcmWarm;          // stopped and prepared, waiting for a track
+    bool mPcmMmap;
+    unsigned int mPcmPeriodCount;
+    std::atomic<unsigned int> mPeriodSize;
+    std::atomic<int64_t> mCpuNs;
+    std::atomic<uint64_t> mFramesOut;
+
+    // mLock guards the track table and is held while mixing, never across
+    // pcm_write.
+    mutable std::mutex mLock;
+    std::condition_variable mWorkReady;
+    std::unique_ptr<Track> mTracks[MAX_TRACKS];
+    std::thread mThread;
+    bool mExit;
+    int64_t mStartRequestNs;    // when the first track of a start was activated
+    StartStats mStartStats;
+
+    // Mixer thread buffers, sized for the mixer period when the PCM opens
+    std::vector<int32_t> mAccumulator;
+    std::vector<int16_t> mTrackBuffer;
+    std::vector<int16_t> mOutBuffer;
+};
+
+#endif // AUDIO_OUTPUT_MIXER_H
@@ -0,0 +1,223 @@
+#include <hardware/audio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <charconv>
+#include "audio_parameters.h"
+
+namespace {
+
+constexpr uint32_t KeyHash(std::string_view key) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (char c : key) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    return hash;
+}
+
+struct KeyEntry {
+    uint32_t hash;
+    std::string_view name;
+    ParameterKey key;
+};
+
+constexpr KeyEntry MakeKey(std::string_view name, ParameterKey key) {
+    return { KeyHash(name), name, key };
+}
+
+constexpr KeyEntry KEYS[] = {
+    MakeKey(AUDIO_PARAMETER_STREAM_ROUTING, ParameterKey::ROUTING),
+    MakeKey(AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES, ParameterKey::SUP_SAMPLING_RATES),
+    MakeKey(AUDIO_PARAMETER_STREAM_SUP_FORMATS, ParameterKey::SUP_FORMATS),
+    MakeKey(AUDIO_PARAMETER_STREAM_SUP_CHANNELS, ParameterKey::SUP_CHANNELS),
+    MakeKey(AUDIO_OFFLOAD_CODEC_DELAY_SAMPLES, ParameterKey::OFFLOAD_DELAY_SAMPLES),
+    MakeKey(AUDIO_OFFLOAD_CODEC_PADDING_SAMPLES, ParameterKey::OFFLOAD_PADDING_SAMPLES),
+    MakeKey(AUDIO_PARAMETER_DEVICE_CONNECT, ParameterKey::CONNECT),
+    MakeKey(AUDIO_PARAMETER_DEVICE_DISCONNECT, ParameterKey::DISCONNECT),
+    // ALSA address sent along with USB connect events
+    MakeKey("card", ParameterKey::CARD),
+    MakeKey("device", ParameterKey::DEVICE),
+};
+
+struct NameEntry {
+    uint32_t value;
+    const char* name;
+};
+
+constexpr NameEntry FORMAT_NAMES[] = {
+    { AUDIO_FORMAT_PCM_16_BIT, "AUDIO_FORMAT_PCM_16_BIT" },
+    { AUDIO_FORMAT_PCM_24_BIT_PACKED, "AUDIO_FORMAT_PCM_24_BIT_PACKED" },
+    { AUDIO_FORMAT_PCM_8_24_BIT, "AUDIO_FORMAT_PCM_8_24_BIT" },
+    { AUDIO_FORMAT_PCM_FLOAT, "AUDIO_FORMAT_PCM_FLOAT" },
+    { AUDIO_FORMAT_MP3, "AUDIO_FORMAT_MP3" },
+    { AUDIO_FORMAT_AAC, "AUDIO_FORMAT_AAC" },
+    { AUDIO_FORMAT_AAC_LC, "AUDIO_FORMAT_AAC_LC" },
+    { AUDIO_FORMAT_AAC_HE_V1, "AUDIO_FORMAT_AAC_HE_V1" },
+    { AUDIO_FORMAT_AAC_HE_V2, "AUDIO_FORMAT_AAC_HE_V2" },
+};
+
+constexpr NameEntry OUTPUT_CHANNEL_NAMES[] = {
+    { AUDIO_CHANNEL_OUT_MONO, "AUDIO_CHANNEL_OUT_MONO" },
+    { AUDIO_CHANNEL_OUT_STEREO, "AUDIO_CHANNEL_OUT_STEREO" },
+    { AUDIO_CHANNEL_OUT_QUAD, "AUDIO_CHANNEL_OUT_QUAD" },
+    { AUDIO_CHANNEL_OUT_5POINT1, "AUDIO_CHANNEL_OUT_5POINT1" },
+    { AUDIO_CHANNEL_OUT_7POINT1, "AUDIO_CHANNEL_OUT_7POINT1" },
+};
+
+constexpr NameEntry INPUT_CHANNEL_NAMES[] = {
+    { AUDIO_CHANNEL_IN_MONO, "AUDIO_CHANNEL_IN_MONO" },
+    { AUDIO_CHANNEL_IN_STEREO, "AUDIO_CHANNEL_IN_STEREO" },
+    { AUDIO_CHANNEL_IN_VOICE_UPLINK, "AUDIO_CHANNEL_IN_VOICE_UPLINK" },
+    { AUDIO_CHANNEL_IN_VOICE_DNLINK, "AUDIO_CHANNEL_IN_VOICE_DNLINK" },
+};
+
+template <size_t N>
+const char* FindName(const NameEntry (&table)[N], uint32_t value) {
+    for (const NameEntry& entry : table) {
+        if (entry.value == value) {
+            return entry.name;
+        }
+    }
+    return nullptr;
+}
+
+void AppendValue(std::string* response, const char* value) {
+    if (response->back() != '=') {
+        response->push_back('|');
+    }
+    response->append(value);
+}
+
+} // namespace
+
+ParameterParser::ParameterParser(const char* kvpairs)
+    : mRemaining(kvpairs ? kvpairs : "") {
+}
+
+bool ParameterParser::Next(std::string_view* key, std::string_view* value) {
+    while (!mRemaining.empty()) {
+        size_t end = mRemaining.find(';');
+        std::string_view pair = mRemaining.substr(0, end);
+        mRemaining = end == std::string_view::npos ?
+            std::string_view() : mRemaining.substr(end + 1);
+        if (pair.empty()) {
+            continue;
+        }
+
+        size_t separator = pair.find('=');
+        *key = pair.substr(0, separator);
+        *value = separator == std::string_view::npos ?
+            std::string_view() : pair.substr(separator + 1);
+        return true;
+    }
+    return false;
+}
+
+bool ParameterParser::ParseUint32(std::string_view value, uint32_t* result) {
+    long long parsed;
+    const char* end = value.data() + value.size();
+    auto [ptr, ec] = std::from_chars(value.data(), end, parsed);
+    if (ec != std::errc() || ptr != end || parsed < INT32_MIN || parsed > UINT32_MAX) {
+        return false;
+    }
+    *result = static_cast<uint32_t>(parsed);
+    return true;
+}
+
+ParameterKey LookupParameterKey(std::string_view key) {
+    const uint32_t hash = KeyHash(key);
+    for (const KeyEntry& entry : KEYS) {
+        if (entry.hash == hash && entry.name == key) {
+            return entry.key;
+        }
+    }
+    return ParameterKey::UNKNOWN;
+}
+
+char* CapabilityResponses::Reply(const char* keys) const {
+    const std::string* fields[] = { &sampleRates, &formats, &channelMasks };
+    const std::string* parts[3];
+    bool seen[3] = {};
+    size_t count = 0;
+    size_t length = 0;
+
+    ParameterParser parser(keys);
+    std::string_view key;
+    std::string_view value;
+    while (parser.Next(&key, &value)) {
+        int index;
+        switch (LookupParameterKey(key)) {
+            case ParameterKey::SUP_SAMPLING_RATES:
+                index = 0;
+                break;
+            case ParameterKey::SUP_FORMATS:
+                index = 1;
+                break;
+            case ParameterKey::SUP_CHANNELS:
+                index = 2;
+                break;
+            default:
+                continue;
+        }
+        if (!seen[index]) {
+            seen[index] = true;
+            parts[count++] = fields[index];
+            length += fields[index]->size() + 1;
+        }
+    }
+
+    char* reply = static_cast<char*>(malloc(length + 1));
+    if (!reply) {
+        return nullptr;
+    }
+    char* cursor = reply;
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            *cursor++ = ';';
+        }
+        memcpy(cursor, parts[i]->data(), parts[i]->size());
+        cursor += parts[i]->size();
+    }
+    *cursor = '\0';
+    return reply;
+}
+
+std::string BuildSampleRatesResponse(const uint32_t* rates, size_t count) {
+    std::string response = AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES "=";
+    for (size_t i = 0; i < count; i++) {
+        AppendValue(&response, std::to_string(rates[i]).c_str());
+    }
+    return response;
+}
+
+std::string BuildFormatsResponse(const audio_format_t* formats, size_t count) {
+    std::string response = AUDIO_PARAMETER_STREAM_SUP_FORMATS "=";
+    for (size_t i = 0; i < count; i++) {
+        const char* name = FindName(FORMAT_NAMES, formats[i]);
+        if (name) {
+            AppendValue(&response, name);
+        }
+    }
+    return response;
+}
+
+std::string BuildOutputChannelsResponse(audio_channel_mask_t supported) {
+    std::string response = AUDIO_PARAMETER_STREAM_SUP_CHANNELS "=";
+    for (const NameEntry& entry : OUTPUT_CHANNEL_NAMES) {
+        if ((entry.value & supported) == entry.value) {
+            AppendValue(&response, entry.name);
+        }
+    }
+    return response;
+}
+
+std::string BuildInputChannelsResponse(const audio_channel_mask_t* masks, size_t count) {
+    std::string response = AUDIO_PARAMETER_STREAM_SUP_CHANNELS "=";
+    for (size_t i = 0; i < count; i++) {
+        const char* name = FindName(INPUT_CHANNEL_NAMES, masks[i]);
+        if (name) {
+            AppendValue(&response, name);
+        }
+    }
+    return response;
+}
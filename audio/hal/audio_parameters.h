@@ -0,0 +1,66 @@
+#ifndef AUDIO_PARAMETERS_H
+#define AUDIO_PARAMETERS_H
+
+#include <system/audio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+
+// Keys the HAL acts on. Anything else is ignored.
+enum class ParameterKey {
+    UNKNOWN,
+    ROUTING,
+    SUP_SAMPLING_RATES,
+    SUP_FORMATS,
+    SUP_CHANNELS,
+    OFFLOAD_DELAY_SAMPLES,
+    OFFLOAD_PADDING_SAMPLES,
+    CONNECT,
+    DISCONNECT,
+    CARD,
+    DEVICE,
+};
+
+// Walks "key1=value1;key2;key3=value3" in place. Keys and values are views
+// into the caller's string, so parsing never allocates.
+class ParameterParser {
+public:
+    explicit ParameterParser(const char* kvpairs);
+
+    // Returns false once all pairs were consumed. value is empty for keys
+    // without '=', as in GetParameters queries.
+    bool Next(std::string_view* key, std::string_view* value);
+
+    // Accepts both signed and unsigned 32-bit spellings, since device
+    // masks with the input bit set arrive as negative numbers.
+    static bool ParseUint32(std::string_view value, uint32_t* result);
+
+private:
+    std::string_view mRemaining;
+};
+
+// Resolves a key through a table hashed at compile time.
+ParameterKey LookupParameterKey(std::string_view key);
+
+// "key=v1|v2|..." responses for the read-only capability queries, built
+// once so GetParameters only concatenates.
+struct CapabilityResponses {
+    std::string sampleRates;
+    std::string formats;
+    std::string channelMasks;
+
+    // Returns a malloc'd "k=v;k=v" reply for the capability keys in keys,
+    // as get_parameters callers expect to free it.
+    char* Reply(const char* keys) const;
+};
+
+// Builders for the CapabilityResponses fields. Output channel masks are
+// given as the union the HAL accepts; every named layout inside it is
+// listed.
+std::string BuildSampleRatesResponse(const uint32_t* rates, size_t count);
+std::string BuildFormatsResponse(const audio_format_t* formats, size_t count);
+std::string BuildOutputChannelsResponse(audio_channel_mask_t supported);
+std::string BuildInputChannelsResponse(const audio_channel_mask_t* masks, size_t count);
+
+#endif // AUDIO_PARAMETERS_H
@@ -0,0 +1,262 @@
+#define LOG_TAG "audio_hal_sm8650"
+
+#include <log/log.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include "audio_resampler.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RESAMPLER_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define RESAMPLER_SSE2 1
+#endif
+
+namespace {
+
+constexpr double PI = 3.14159265358979323846;
+
+constexpr double ConstSin(double x) {
+    while (x > PI) {
+        x -= 2.0 * PI;
+    }
+    while (x < -PI) {
+        x += 2.0 * PI;
+    }
+    double term = x;
+    double sum = x;
+    for (int n = 1; n < 14; n++) {
+        term *= -x * x / ((2.0 * n) * (2.0 * n + 1.0));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double ConstCos(double x) {
+    return ConstSin(x + PI / 2.0);
+}
+
+// Phase-major polyphase bank: coefs[p] holds the taps of phase p in input
+// order (oldest sample first) so a phase is one contiguous dot product.
+template <uint32_t L, uint32_t T>
+struct FilterBank {
+    float coefs[L][T];
+};
+
+// Windowed-sinc lowpass at the lower of the two Nyquist rates, split into L
+// phases of T taps. The sines and window cosines advance by angle-addition
+// recurrences so the whole bank costs two series evaluations, which keeps
+// compile-time evaluation well inside the compilers' constexpr step limits.
+// LOW uses a Blackman window, HIGH a 4-term Blackman-Harris.
+template <uint32_t L, uint32_t M, uint32_t T, bool HIGH>
+constexpr FilterBank<L, T> DesignFilterBank() {
+    FilterBank<L, T> bank{};
+    constexpr uint32_t N = L * T;
+    const double rolloff = HIGH ? 0.95 : 0.85;
+    const double fc = 0.5 * rolloff / (L > M ? L : M);
+    const double center = (N - 1) / 2.0;
+
+    const double sincStep = 2.0 * PI * fc;
+    double s = ConstSin(-sincStep * center);
+    double c = ConstCos(-sincStep * center);
+    const double sinStep = ConstSin(sincStep);
+    const double cosStep = ConstCos(sincStep);
+
+    const double windowStep = 2.0 * PI / (N - 1);
+    double ws = 0.0;
+    double wc = 1.0;
+    const double wSinStep = ConstSin(windowStep);
+    const double wCosStep = ConstCos(windowStep);
+
+    double phaseSum[L] = {};
+    for (uint32_t i = 0; i < N; i++) {
+        double x = i - center;
+        double h = (x > -1e-9 && x < 1e-9) ? 2.0 * fc : s / (PI * x);
+
+        double c2 = 2.0 * wc * wc - 1.0;
+        double c3 = 4.0 * wc * wc * wc - 3.0 * wc;
+        double w = HIGH ? 0.35875 - 0.48829 * wc + 0.14128 * c2 - 0.01168 * c3
+                        : 0.42 - 0.5 * wc + 0.08 * c2;
+
+        uint32_t phase = i % L;
+        uint32_t tap = T - 1 - i / L;
+        bank.coefs[phase][tap] = static_cast<float>(h * w);
+        phaseSum[phase] += h * w;
+
+        double ns = s * cosStep + c * sinStep;
+        c = c * cosStep - s * sinStep;
+        s = ns;
+        double nws = ws * wCosStep + wc * wSinStep;
+        wc = wc * wCosStep - ws * wSinStep;
+        ws = nws;
+    }
+
+    // Unity DC gain on every phase
+    for (uint32_t p = 0; p < L; p++) {
+        for (uint32_t t = 0; t < T; t++) {
+            bank.coefs[p][t] = static_cast<float>(bank.coefs[p][t] / phaseSum[p]);
+        }
+    }
+    return bank;
+}
+
+// Taps per phase are scaled by the decimation factor so the transition band
+// stays the same width relative to the output rate.
+constexpr uint32_t LOW_TAPS = 8;
+constexpr uint32_t HIGH_TAPS = 32;
+
+constexpr auto BANK_44K_LOW = DesignFilterBank<160, 147, LOW_TAPS, false>();
+constexpr auto BANK_44K_HIGH = DesignFilterBank<160, 147, HIGH_TAPS, true>();
+constexpr auto BANK_96K_LOW = DesignFilterBank<1, 2, LOW_TAPS * 2, false>();
+constexpr auto BANK_96K_HIGH = DesignFilterBank<1, 2, HIGH_TAPS * 2, true>();
+constexpr auto BANK_192K_LOW = DesignFilterBank<1, 4, LOW_TAPS * 4, false>();
+constexpr auto BANK_192K_HIGH = DesignFilterBank<1, 4, HIGH_TAPS * 4, true>();
+
+struct RatioTable {
+    uint32_t inRate;
+    uint32_t outRate;
+    uint32_t interpolation;
+    uint32_t decimation;
+    const float* low;
+    uint32_t lowTaps;
+    const float* high;
+    uint32_t highTaps;
+};
+
+constexpr RatioTable RATIO_TABLES[] = {
+    { 44100, 48000, 160, 147,
+      &BANK_44K_LOW.coefs[0][0], LOW_TAPS, &BANK_44K_HIGH.coefs[0][0], HIGH_TAPS },
+    { 96000, 48000, 1, 2,
+      &BANK_96K_LOW.coefs[0][0], LOW_TAPS * 2, &BANK_96K_HIGH.coefs[0][0], HIGH_TAPS * 2 },
+    { 192000, 48000, 1, 4,
+      &BANK_192K_LOW.coefs[0][0], LOW_TAPS * 4, &BANK_192K_HIGH.coefs[0][0], HIGH_TAPS * 4 },
+};
+
+const RatioTable* FindRatio(uint32_t inRate, uint32_t outRate) {
+    for (const RatioTable& table : RATIO_TABLES) {
+        if (table.inRate == inRate && table.outRate == outRate) {
+            return &table;
+        }
+    }
+    return nullptr;
+}
+
+// taps is always a multiple of four
+inline float Dot(const float* a, const float* b, uint32_t taps) {
+#if RESAMPLER_NEON
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (uint32_t i = 0; i < taps; i += 4) {
+        acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+#if defined(__aarch64__)
+    return vaddvq_f32(acc);
+#else
+    float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#endif
+#elif RESAMPLER_SSE2
+    __m128 acc = _mm_setzero_ps();
+    for (uint32_t i = 0; i < taps; i += 4) {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc);
+#else
+    float acc = 0.0f;
+    for (uint32_t i = 0; i < taps; i++) {
+        acc += a[i] * b[i];
+    }
+    return acc;
+#endif
+}
+
+} // namespace
+
+Resampler::Resampler()
+    : mCoefs(nullptr)
+    , mInterpolation(1)
+    , mDecimation(1)
+    , mTaps(0)
+    , mChannels(0)
+    , mMaxInputFrames(0)
+    , mChannelStride(0)
+    , mPosition(0) {
+}
+
+int Resampler::Init(uint32_t inRate, uint32_t outRate, uint32_t channels,
+                    Quality quality, size_t maxInputFrames) {
+    mCoefs = nullptr;
+    mHistory.clear();
+    if (inRate == outRate) {
+        return 0;
+    }
+
+    const RatioTable* table = FindRatio(inRate, outRate);
+    if (!table) {
+        ALOGE("Unsupported resampling ratio: %u -> %u", inRate, outRate);
+        return -EINVAL;
+    }
+
+    bool high = quality == Quality::HIGH;
+    mCoefs = high ? table->high : table->low;
+    mTaps = high ? table->highTaps : table->lowTaps;
+    mInterpolation = table->interpolation;
+    mDecimation = table->decimation;
+    mChannels = channels;
+    mMaxInputFrames = maxInputFrames;
+    mChannelStride = mTaps - 1 + maxInputFrames;
+    mHistory.assign(mChannelStride * channels, 0.0f);
+    mPosition = 0;
+    return 0;
+}
+
+size_t Resampler::GetMaxOutputFrames(size_t inFrames) const {
+    if (!IsActive()) {
+        return inFrames;
+    }
+    return (inFrames * mInterpolation + mDecimation - 1) / mDecimation + 1;
+}
+
+size_t Resampler::Process(float* out, const float* in, size_t inFrames) {
+    const uint32_t channels = mChannels;
+    const uint32_t taps = mTaps;
+    inFrames = std::min(inFrames, mMaxInputFrames);
+
+    // Deinterleave behind the taps - 1 frames of history kept per channel.
+    for (uint32_t ch = 0; ch < channels; ch++) {
+        float* history = mHistory.data() + ch * mChannelStride + taps - 1;
+        for (size_t f = 0; f < inFrames; f++) {
+            history[f] = in[f * channels + ch];
+        }
+    }
+
+    size_t produced = 0;
+    const uint64_t end = static_cast<uint64_t>(inFrames) * mInterpolation;
+    for (; mPosition < end; mPosition += mDecimation, produced++) {
+        size_t index = mPosition / mInterpolation;
+        const float* coefs = mCoefs + (mPosition % mInterpolation) * taps;
+        for (uint32_t ch = 0; ch < channels; ch++) {
+            out[produced * channels + ch] =
+                Dot(coefs, mHistory.data() + ch * mChannelStride + index, taps);
+        }
+    }
+    mPosition -= end;
+
+    for (uint32_t ch = 0; ch < channels; ch++) {
+        float* history = mHistory.data() + ch * mChannelStride;
+        memmove(history, history + inFrames, (taps - 1) * sizeof(float));
+    }
+    return produced;
+}
+
+void Resampler::Reset() {
+    std::fill(mHistory.begin(), mHistory.end(), 0.0f);
+    mPosition = 0;
+}
+
+bool Resampler::IsSupported(uint32_t inRate, uint32_t outRate) {
+    return inRate == outRate || FindRatio(inRate, outRate) != nullptr;
+}
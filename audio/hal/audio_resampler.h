@@ -0,0 +1,51 @@
+#ifndef AUDIO_RESAMPLER_H
+#define AUDIO_RESAMPLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Polyphase rational resampler for interleaved float frames.
+//
+// Filter banks for the supported stream rates are designed at compile time
+// (windowed sinc, one bank per rate ratio and quality tier), so Init only
+// selects a table and sizes the history buffer. Each output sample is one
+// contiguous dot product over a planar per-channel history.
+class Resampler {
+public:
+    enum class Quality {
+        LOW,    // short filters for the fast path
+        HIGH,   // long filters and a steeper transition band for deep buffer
+    };
+
+    Resampler();
+
+    // maxInputFrames bounds the frames passed to a single Process call.
+    int Init(uint32_t inRate, uint32_t outRate, uint32_t channels,
+             Quality quality, size_t maxInputFrames);
+
+    bool IsActive() const { return mCoefs != nullptr; }
+
+    // Upper bound of frames produced for inFrames input frames
+    size_t GetMaxOutputFrames(size_t inFrames) const;
+
+    // Consumes all inFrames and returns the number of frames written to out.
+    size_t Process(float* out, const float* in, size_t inFrames);
+
+    void Reset();
+
+    static bool IsSupported(uint32_t inRate, uint32_t outRate);
+
+private:
+    const float* mCoefs;
+    uint32_t mInterpolation;    // L
+    uint32_t mDecimation;       // M
+    uint32_t mTaps;             // taps per phase
+    uint32_t mChannels;
+    size_t mMaxInputFrames;
+    size_t mChannelStride;
+    uint64_t mPosition;         // next output position in 1/L input samples
+    std::vector<float> mHistory;
+};
+
+#endif // AUDIO_RESAMPLER_H
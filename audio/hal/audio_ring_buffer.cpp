@@ -0,0 +1,75 @@
+#define LOG_TAG "audio_hal_sm8650"
+
+#include <log/log.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include "audio_ring_buffer.h"
+
+RingBuffer::RingBuffer()
+    : mFrameSize(0)
+    , mMask(0)
+    , mWritePos(0)
+    , mReadPos(0) {
+}
+
+int RingBuffer::Init(size_t frames, size_t frameSize) {
+    if (frames == 0 || frameSize == 0) {
+        return -EINVAL;
+    }
+
+    size_t capacity = 1;
+    while (capacity < frames) {
+        capacity <<= 1;
+    }
+
+    mBuffer.assign(capacity * frameSize, 0);
+    mFrameSize = frameSize;
+    mMask = capacity - 1;
+    Reset();
+    return 0;
+}
+
+size_t RingBuffer::Write(const void* data, size_t frames) {
+    uint64_t writePos = mWritePos.load(std::memory_order_relaxed);
+    uint64_t readPos = mReadPos.load(std::memory_order_acquire);
+    frames = std::min(frames, GetCapacity() - static_cast<size_t>(writePos - readPos));
+
+    size_t offset = writePos & mMask;
+    size_t first = std::min(frames, GetCapacity() - offset);
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    memcpy(&mBuffer[offset * mFrameSize], src, first * mFrameSize);
+    memcpy(&mBuffer[0], src + first * mFrameSize, (frames - first) * mFrameSize);
+
+    mWritePos.store(writePos + frames, std::memory_order_release);
+    return frames;
+}
+
+size_t RingBuffer::Read(void* data, size_t frames) {
+    uint64_t readPos = mReadPos.load(std::memory_order_relaxed);
+    uint64_t writePos = mWritePos.load(std::memory_order_acquire);
+    frames = std::min(frames, static_cast<size_t>(writePos - readPos));
+
+    size_t offset = readPos & mMask;
+    size_t first = std::min(frames, GetCapacity() - offset);
+    uint8_t* dst = static_cast<uint8_t*>(data);
+    memcpy(dst, &mBuffer[offset * mFrameSize], first * mFrameSize);
+    memcpy(dst + first * mFrameSize, &mBuffer[0], (frames - first) * mFrameSize);
+
+    mReadPos.store(readPos + frames, std::memory_order_release);
+    return frames;
+}
+
+size_t RingBuffer::GetReadAvailable() const {
+    return mWritePos.load(std::memory_order_acquire) -
+        mReadPos.load(std::memory_order_acquire);
+}
+
+size_t RingBuffer::GetWriteAvailable() const {
+    return GetCapacity() - GetReadAvailable();
+}
+
+void RingBuffer::Reset() {
+    mWritePos.store(0, std::memory_order_relaxed);
+    mReadPos.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,41 @@
+#ifndef AUDIO_RING_BUFFER_H
+#define AUDIO_RING_BUFFER_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Single-producer / single-consumer lock-free ring of audio frames.
+//
+// The producer only advances mWritePos and the consumer only advances
+// mReadPos, so neither side takes a lock or makes a syscall. Capacity is
+// rounded up to a power of two frames so wrapping is a mask.
+class RingBuffer {
+public:
+    RingBuffer();
+
+    int Init(size_t frames, size_t frameSize);
+
+    // Producer side. Returns the frames written, less than frames when full.
+    size_t Write(const void* data, size_t frames);
+
+    // Consumer side. Returns the frames read, less than frames when empty.
+    size_t Read(void* data, size_t frames);
+
+    size_t GetReadAvailable() const;
+    size_t GetWriteAvailable() const;
+    size_t GetCapacity() const { return mMask + 1; }
+
+    // Only valid while neither side is running.
+    void Reset();
+
+private:
+    std::vector<uint8_t> mBuffer;
+    size_t mFrameSize;
+    size_t mMask;
+    alignas(64) std::atomic<uint64_t> mWritePos;
+    alignas(64) std::atomic<uint64_t> mReadPos;
+};
+
+#endif // AUDIO_RING_BUFFER_H
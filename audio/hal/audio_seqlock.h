@@ -0,0 +1,64 @@
+#ifndef AUDIO_SEQLOCK_H
+#define AUDIO_SEQLOCK_H
+
+#include <atomic>
+#include <string.h>
+#include <stdint.h>
+#include <type_traits>
+
+// Single-writer sequence lock for small trivially copyable snapshots.
+//
+// Readers never block the writer: Load retries while a Store is in flight.
+// The payload is held in relaxed atomic words so concurrent access stays
+// well defined.
+template <typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "SeqLock payload must be trivially copyable");
+
+public:
+    SeqLock() : mSeq(0) {
+        for (auto& word : mWords) {
+            word.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void Store(const T& value) {
+        uint64_t words[WORDS] = {};
+        memcpy(words, &value, sizeof(T));
+
+        uint32_t seq = mSeq.load(std::memory_order_relaxed);
+        mSeq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; i++) {
+            mWords[i].store(words[i], std::memory_order_relaxed);
+        }
+        mSeq.store(seq + 2, std::memory_order_release);
+    }
+
+    T Load() const {
+        uint64_t words[WORDS];
+        uint32_t begin;
+        uint32_t end;
+        do {
+            begin = mSeq.load(std::memory_order_acquire);
+            for (size_t i = 0; i < WORDS; i++) {
+                words[i] = mWords[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            end = mSeq.load(std::memory_order_relaxed);
+        } while ((begin & 1) || begin != end);
+
+        T value;
+        memcpy(&value, words, sizeof(T));
+        return value;
+    }
+
+private:
+    static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    std::atomic<uint32_t> mSeq;
+    std::atomic<uint64_t> mWords[WORDS];
+};
+
+#endif // AUDIO_SEQLOCK_H
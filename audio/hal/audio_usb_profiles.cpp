@@ -0,0 +1,251 @@
+#define LOG_TAG "audio_hal_sm8650"
+
+#include <log/log.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "audio_usb_profiles.h"
+
+namespace {
+
+struct UsbFormat {
+    const char* name;
+    audio_format_t format;
+    enum pcm_format pcmFormat;
+};
+
+// Sample formats the output pipeline can convert to
+constexpr UsbFormat USB_FORMATS[] = {
+    { "S16_LE", AUDIO_FORMAT_PCM_16_BIT, PCM_FORMAT_S16_LE },
+    { "S24_3LE", AUDIO_FORMAT_PCM_24_BIT_PACKED, PCM_FORMAT_S24_3LE },
+    { "S24_LE", AUDIO_FORMAT_PCM_8_24_BIT, PCM_FORMAT_S24_LE },
+};
+
+const UsbFormat* FindUsbFormat(const char* name) {
+    for (const UsbFormat& format : USB_FORMATS) {
+        if (strcmp(format.name, name) == 0) {
+            return &format;
+        }
+    }
+    return nullptr;
+}
+
+// Precision in bits; float sources are served best by 24-bit DACs.
+uint32_t FormatBits(audio_format_t format) {
+    return format == AUDIO_FORMAT_PCM_16_BIT ? 16 : 24;
+}
+
+// Returns the text after "<field>: " in line, or nullptr.
+const char* FieldValue(const char* line, const char* field) {
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    size_t length = strlen(field);
+    if (strncmp(line, field, length) != 0 || strncmp(line + length, ": ", 2) != 0) {
+        return nullptr;
+    }
+    return line + length + 2;
+}
+
+void ParseRates(const char* value, UsbFormatProfile* profile) {
+    // Either "44100, 48000, 96000" or "8000 - 96000 (continuous)"
+    if (strstr(value, "continuous")) {
+        char* end;
+        profile->minRate = strtoul(value, &end, 10);
+        const char* dash = strchr(end, '-');
+        profile->maxRate = dash ? strtoul(dash + 1, nullptr, 10) : profile->minRate;
+        return;
+    }
+
+    char* end;
+    for (unsigned long rate = strtoul(value, &end, 10); end != value;
+            rate = strtoul(value, &end, 10)) {
+        profile->rates.push_back(rate);
+        value = end;
+        while (*value == ',' || *value == ' ') {
+            value++;
+        }
+    }
+    if (!profile->rates.empty()) {
+        profile->minRate = *std::min_element(profile->rates.begin(), profile->rates.end());
+        profile->maxRate = *std::max_element(profile->rates.begin(), profile->rates.end());
+    }
+}
+
+} // namespace
+
+bool UsbFormatProfile::SupportsRate(uint32_t rate) const {
+    if (rates.empty()) {
+        return rate >= minRate && rate <= maxRate;
+    }
+    return std::find(rates.begin(), rates.end(), rate) != rates.end();
+}
+
+UsbProfileCache::UsbProfileCache(const char* procRoot)
+    : mProcRoot(procRoot)
+    , mProbes(0)
+    , mHits(0) {
+}
+
+std::shared_ptr<const UsbCapabilities> UsbProfileCache::Probe(unsigned int card) {
+    std::string identity = ReadIdentity(card);
+    if (identity.empty()) {
+        return nullptr;
+    }
+
+    for (auto it = mEntries.begin(); it != mEntries.end(); ++it) {
+        if (it->identity == identity) {
+            Entry entry = std::move(*it);
+            mEntries.erase(it);
+            mEntries.push_back(std::move(entry));
+            mHits++;
+            return mEntries.back().caps;
+        }
+    }
+
+    std::string path = mProcRoot + "/card" + std::to_string(card) + "/stream0";
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file) {
+        ALOGE("Failed to open %s: %s", path.c_str(), strerror(errno));
+        return nullptr;
+    }
+    auto caps = std::make_shared<UsbCapabilities>();
+    int ret = ParseStreamFile(file, caps.get());
+    fclose(file);
+    if (ret != 0) {
+        return nullptr;
+    }
+    mProbes++;
+
+    if (mEntries.size() == MAX_ENTRIES) {
+        mEntries.erase(mEntries.begin());
+    }
+    mEntries.push_back({ identity, caps });
+    return caps;
+}
+
+std::string UsbProfileCache::ReadIdentity(unsigned int card) const {
+    std::string cardRoot = mProcRoot + "/card" + std::to_string(card);
+    char usbId[32] = {};
+    char name[256] = {};
+
+    FILE* file = fopen((cardRoot + "/usbid").c_str(), "r");
+    if (!file) {
+        return std::string();
+    }
+    bool valid = fgets(usbId, sizeof(usbId), file) != nullptr;
+    fclose(file);
+
+    // First line of stream0: "<product> at <bus path>, <speed>"
+    file = fopen((cardRoot + "/stream0").c_str(), "r");
+    if (!file) {
+        return std::string();
+    }
+    valid = valid && fgets(name, sizeof(name), file) != nullptr;
+    fclose(file);
+    if (!valid) {
+        return std::string();
+    }
+
+    usbId[strcspn(usbId, "\n")] = '\0';
+    char* at = strstr(name, " at ");
+    name[at ? at - name : strcspn(name, "\n")] = '\0';
+    return std::string(usbId) + " " + name;
+}
+
+int UsbProfileCache::ParseStreamFile(FILE* file, UsbCapabilities* caps) {
+    std::vector<UsbFormatProfile>* section = nullptr;
+    UsbFormatProfile* profile = nullptr;
+    char line[256];
+
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = '\0';
+        const char* value;
+
+        if (strncmp(line, "Playback:", 9) == 0) {
+            section = &caps->playback;
+            profile = nullptr;
+        } else if (strncmp(line, "Capture:", 8) == 0) {
+            section = &caps->capture;
+            profile = nullptr;
+        } else if (!section) {
+            continue;
+        } else if (strstr(line, "Altset ") && !strchr(line, '=')) {
+            // "Altset = N" lines belong to the running status, not a descriptor
+            section->push_back(UsbFormatProfile());
+            profile = &section->back();
+            profile->format = AUDIO_FORMAT_DEFAULT;
+            profile->pcmFormat = PCM_FORMAT_S16_LE;
+            profile->channels = 0;
+            profile->minRate = 0;
+            profile->maxRate = 0;
+        } else if (!profile) {
+            continue;
+        } else if ((value = FieldValue(line, "Format"))) {
+            const UsbFormat* format = FindUsbFormat(value);
+            if (format) {
+                profile->format = format->format;
+                profile->pcmFormat = format->pcmFormat;
+            }
+        } else if ((value = FieldValue(line, "Channels"))) {
+            profile->channels = strtoul(value, nullptr, 10);
+        } else if ((value = FieldValue(line, "Rates"))) {
+            ParseRates(value, profile);
+        }
+    }
+
+    // Drop unsupported formats and incomplete descriptors.
+    for (auto* list : { &caps->playback, &caps->capture }) {
+        list->erase(std::remove_if(list->begin(), list->end(),
+            [](const UsbFormatProfile& p) {
+                return p.format == AUDIO_FORMAT_DEFAULT || p.channels == 0 || p.maxRate == 0;
+            }), list->end());
+    }
+
+    if (caps->playback.empty() && caps->capture.empty()) {
+        ALOGE("No usable USB stream descriptors");
+        return -ENODEV;
+    }
+    return 0;
+}
+
+int UsbProfileCache::SelectConfig(const std::vector<UsbFormatProfile>& profiles,
+                                  uint32_t rate, audio_format_t format, uint32_t channels,
+                                  UsbStreamConfig* config) {
+    const uint32_t sourceBits = FormatBits(format);
+    const UsbFormatProfile* best = nullptr;
+    int bestScore = 0;
+
+    for (const UsbFormatProfile& profile : profiles) {
+        if (!profile.SupportsRate(rate)) {
+            continue;
+        }
+        // Precision first: the smallest depth that holds the source, else
+        // the deepest. Then the channel count: exact, else the smallest
+        // that holds every channel, else the widest.
+        uint32_t bits = FormatBits(profile.format);
+        int score = bits >= sourceBits ? 2000 - bits : 1000 + bits;
+        score *= 100;
+        if (profile.channels == channels) {
+            score += 99;
+        } else if (profile.channels > channels) {
+            score += 90 - std::min(profile.channels, 32u);
+        } else {
+            score += profile.channels;
+        }
+        if (!best || score > bestScore) {
+            best = &profile;
+            bestScore = score;
+        }
+    }
+
+    if (!best) {
+        return -EINVAL;
+    }
+    config->sampleRate = rate;
+    config->format = best->format;
+    config->pcmFormat = best->pcmFormat;
+    config->channels = best->channels;
+    return 0;
+}
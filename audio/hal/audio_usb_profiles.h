@@ -0,0 +1,79 @@
+#ifndef AUDIO_USB_PROFILES_H
+#define AUDIO_USB_PROFILES_H
+
+#include <system/audio.h>
+#include <tinyalsa/asoundlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+// One USB alternate setting as described in /proc/asound/cardN/stream0
+struct UsbFormatProfile {
+    audio_format_t format;
+    enum pcm_format pcmFormat;
+    uint32_t channels;
+    std::vector<uint32_t> rates;    // discrete rates, empty when continuous
+    uint32_t minRate;
+    uint32_t maxRate;
+
+    bool SupportsRate(uint32_t rate) const;
+};
+
+struct UsbCapabilities {
+    std::vector<UsbFormatProfile> playback;
+    std::vector<UsbFormatProfile> capture;
+};
+
+// Native configuration selected for a stream
+struct UsbStreamConfig {
+    uint32_t sampleRate;
+    audio_format_t format;
+    enum pcm_format pcmFormat;
+    uint32_t channels;
+};
+
+// Capability tables of USB audio cards, cached per device identity.
+//
+// Probe identifies the card by its USB vendor/product id and product name,
+// which stay the same across replugs while the card number and bus address
+// do not, and only parses the stream descriptors of a device it has not
+// seen before. Alternate settings in sample formats the HAL cannot
+// produce are dropped while parsing.
+class UsbProfileCache {
+public:
+    explicit UsbProfileCache(const char* procRoot = "/proc/asound");
+
+    // Returns nullptr if card has no USB stream descriptors.
+    std::shared_ptr<const UsbCapabilities> Probe(unsigned int card);
+
+    size_t GetProbeCount() const { return mProbes; }
+    size_t GetHitCount() const { return mHits; }
+
+    static int ParseStreamFile(FILE* file, UsbCapabilities* caps);
+
+    // Picks the profile that plays rate natively with the closest format
+    // at or above the source precision and the closest channel count.
+    // Returns -EINVAL if no profile supports rate.
+    static int SelectConfig(const std::vector<UsbFormatProfile>& profiles,
+                            uint32_t rate, audio_format_t format, uint32_t channels,
+                            UsbStreamConfig* config);
+
+private:
+    struct Entry {
+        std::string identity;
+        std::shared_ptr<const UsbCapabilities> caps;
+    };
+
+    static constexpr size_t MAX_ENTRIES = 8;
+
+    std::string ReadIdentity(unsigned int card) const;
+
+    std::string mProcRoot;
+    std::vector<Entry> mEntries;    // least recently used first
+    size_t mProbes;
+    size_t mHits;
+};
+
+#endif // AUDIO_USB_PROFILES_H
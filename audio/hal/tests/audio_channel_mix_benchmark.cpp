@@ -0,0 +1,95 @@
+#include <benchmark/benchmark.h>
+#include <system/audio.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "audio_channel_mix.h"
+
+namespace {
+
+constexpr size_t FRAMES = 1024;     // one primary period
+
+// The same matrix as a plain scalar loop over every coefficient, the
+// baseline the vector kernels have to beat.
+struct NaiveDownmix {
+    uint32_t inChannels;
+    uint32_t outChannels;
+    std::vector<float> gains;   // gains[i * outChannels + o]
+
+    // Reads the mixer's coefficients back one input channel at a time
+    explicit NaiveDownmix(const ChannelMixer& mixer)
+        : inChannels(mixer.GetInputChannels())
+        , outChannels(mixer.GetOutputChannels())
+        , gains(inChannels * outChannels) {
+        std::vector<float> impulse(inChannels);
+        for (uint32_t i = 0; i < inChannels; i++) {
+            std::fill(impulse.begin(), impulse.end(), 0.0f);
+            impulse[i] = 1.0f;
+            mixer.Process(&gains[i * outChannels], impulse.data(), 1);
+        }
+    }
+
+    void Process(float* out, const float* in, size_t frames) const {
+        for (size_t f = 0; f < frames; f++) {
+            for (uint32_t o = 0; o < outChannels; o++) {
+                float sum = 0.0f;
+                for (uint32_t i = 0; i < inChannels; i++) {
+                    sum += in[f * inChannels + i] * gains[i * outChannels + o];
+                }
+                out[f * outChannels + o] = sum;
+            }
+        }
+    }
+};
+
+std::vector<float> MakeInput(uint32_t channels) {
+    std::vector<float> in(FRAMES * channels);
+    for (size_t i = 0; i < in.size(); i++) {
+        in[i] = sinf(static_cast<float>(i) * 0.01f);
+    }
+    return in;
+}
+
+void BM_ChannelMixer(benchmark::State& state, audio_channel_mask_t mask) {
+    ChannelMixer mixer;
+    if (mixer.Init(mask, 2) != 0) {
+        state.SkipWithError("unsupported mask");
+        return;
+    }
+    std::vector<float> in = MakeInput(mixer.GetInputChannels());
+    std::vector<float> out(FRAMES * 2);
+    for (auto _ : state) {
+        mixer.Process(out.data(), in.data(), FRAMES);
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * FRAMES);
+}
+
+void BM_NaiveDownmix(benchmark::State& state, audio_channel_mask_t mask) {
+    ChannelMixer mixer;
+    if (mixer.Init(mask, 2) != 0) {
+        state.SkipWithError("unsupported mask");
+        return;
+    }
+    NaiveDownmix naive(mixer);
+    std::vector<float> in = MakeInput(naive.inChannels);
+    std::vector<float> out(FRAMES * 2);
+    for (auto _ : state) {
+        naive.Process(out.data(), in.data(), FRAMES);
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * FRAMES);
+}
+
+BENCHMARK_CAPTURE(BM_ChannelMixer, 5point1_to_stereo, AUDIO_CHANNEL_OUT_5POINT1);
+BENCHMARK_CAPTURE(BM_NaiveDownmix, 5point1_to_stereo, AUDIO_CHANNEL_OUT_5POINT1);
+BENCHMARK_CAPTURE(BM_ChannelMixer, 7point1_to_stereo, AUDIO_CHANNEL_OUT_7POINT1);
+BENCHMARK_CAPTURE(BM_NaiveDownmix, 7point1_to_stereo, AUDIO_CHANNEL_OUT_7POINT1);
+BENCHMARK_CAPTURE(BM_ChannelMixer, quad_to_stereo, AUDIO_CHANNEL_OUT_QUAD);
+BENCHMARK_CAPTURE(BM_NaiveDownmix, quad_to_stereo, AUDIO_CHANNEL_OUT_QUAD);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,53 @@
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <system/audio.h>
+#include <vector>
+#include "audio_channel_mix.h"
+
+namespace {
+
+TEST(ChannelMixerTest, RejectsUnsupportedChannelCounts) {
+    ChannelMixer mixer;
+    EXPECT_EQ(-EINVAL, mixer.Init(AUDIO_CHANNEL_OUT_5POINT1, 0));
+    EXPECT_EQ(-EINVAL, mixer.Init(AUDIO_CHANNEL_OUT_5POINT1, ChannelMixer::MAX_CHANNELS + 1));
+    EXPECT_EQ(-EINVAL, mixer.Init(AUDIO_CHANNEL_NONE, 2));
+    EXPECT_FALSE(mixer.IsActive());
+}
+
+TEST(ChannelMixerTest, OutputCountsNeedALayout) {
+    // Counts the platform has no channel layout for would leave the front
+    // pair unplaced.
+    for (uint32_t count = 1; count <= ChannelMixer::MAX_CHANNELS; count++) {
+        ChannelMixer mixer;
+        int expected = audio_channel_out_mask_from_count(count) != 0 ? 0 : -EINVAL;
+        EXPECT_EQ(expected, mixer.Init(AUDIO_CHANNEL_OUT_5POINT1, count)) << count;
+        EXPECT_EQ(expected, mixer.Init(AUDIO_CHANNEL_OUT_MONO, count)) << count;
+    }
+}
+
+TEST(ChannelMixerTest, Downmixes51ToStereo) {
+    ChannelMixer mixer;
+    ASSERT_EQ(0, mixer.Init(AUDIO_CHANNEL_OUT_5POINT1, 2));
+    EXPECT_TRUE(mixer.IsActive());
+
+    // Left, right, center, LFE, back left, back right
+    const std::vector<float> in = { 0.5f, 0.0f, 0.5f, 1.0f, 0.0f, 0.0f };
+    std::vector<float> out(2);
+    mixer.Process(out.data(), in.data(), 1);
+    EXPECT_GT(out[0], out[1]);
+    EXPECT_GT(out[1], 0.0f);
+    EXPECT_LE(out[0], 1.0f);
+}
+
+TEST(ChannelMixerTest, MonoGoesToBothFrontChannels) {
+    ChannelMixer mixer;
+    ASSERT_EQ(0, mixer.Init(AUDIO_CHANNEL_OUT_MONO, 2));
+
+    const float in = 0.25f;
+    std::vector<float> out(2);
+    mixer.Process(out.data(), &in, 1);
+    EXPECT_FLOAT_EQ(0.25f, out[0]);
+    EXPECT_FLOAT_EQ(0.25f, out[1]);
+}
+
+} // namespace
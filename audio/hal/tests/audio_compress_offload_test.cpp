@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "audio_compress_offload.h"
+#include "fake_tinycompress.h"
+
+namespace {
+
+constexpr size_t BUFFER_BYTES = 4 * 4096;
+constexpr int TIMEOUT_MS = 2000;
+
+class CompressOffloadTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        FakeCompress::Reset(BUFFER_BYTES);
+        CompressOffload::Config config = {};
+        config.format = AUDIO_FORMAT_MP3;
+        config.sampleRate = 48000;
+        config.channels = 2;
+        config.bitRate = 320000;
+        config.fragmentSize = 4096;
+        config.fragments = 4;
+        ASSERT_EQ(0, mOffload.Init(config));
+        mOffload.SetCallback(OnEvent, this);
+        ASSERT_EQ(0, mOffload.Open(0, 1));
+    }
+
+    static void OnEvent(CompressOffload::Event event, void* cookie) {
+        CompressOffloadTest* test = static_cast<CompressOffloadTest*>(cookie);
+        std::lock_guard<std::mutex> lock(test->mEventLock);
+        test->mEvents.push_back(event);
+        test->mEventReady.notify_all();
+    }
+
+    bool WaitForEvent(CompressOffload::Event event) {
+        std::unique_lock<std::mutex> lock(mEventLock);
+        return mEventReady.wait_for(lock, std::chrono::milliseconds(TIMEOUT_MS), [&] {
+            return std::find(mEvents.begin(), mEvents.end(), event) != mEvents.end();
+        });
+    }
+
+    std::vector<CompressOffload::Event> GetEvents() {
+        std::lock_guard<std::mutex> lock(mEventLock);
+        return mEvents;
+    }
+
+    // Closes on another thread so a hang fails the test instead of the run
+    bool CloseWithin(int timeoutMs) {
+        std::packaged_task<void()> close([this] { mOffload.Close(); });
+        std::future<void> done = close.get_future();
+        std::thread(std::move(close)).detach();
+        return done.wait_for(std::chrono::milliseconds(timeoutMs)) == std::future_status::ready;
+    }
+
+    CompressOffload mOffload;
+    std::mutex mEventLock;
+    std::condition_variable mEventReady;
+    std::vector<CompressOffload::Event> mEvents;
+};
+
+TEST_F(CompressOffloadTest, FirstWriteStartsPlayback) {
+    std::vector<uint8_t> data(4096);
+    EXPECT_EQ(4096, mOffload.Write(data.data(), data.size()));
+    EXPECT_TRUE(FakeCompress::IsRunning());
+    EXPECT_EQ(4096u, FakeCompress::GetQueuedBytes());
+}
+
+TEST_F(CompressOffloadTest, ShortWriteReportsWriteReadyOnceSpaceFrees) {
+    std::vector<uint8_t> data(BUFFER_BYTES + 4096);
+    EXPECT_EQ(static_cast<ssize_t>(BUFFER_BYTES), mOffload.Write(data.data(), data.size()));
+    ASSERT_TRUE(FakeCompress::WaitForBlockedCall(TIMEOUT_MS));
+    EXPECT_TRUE(GetEvents().empty());
+
+    FakeCompress::Consume(4096);
+    EXPECT_TRUE(WaitForEvent(CompressOffload::Event::WRITE_READY));
+}
+
+TEST_F(CompressOffloadTest, DrainReportsDrainReadyOncePlayedOut) {
+    std::vector<uint8_t> data(4096);
+    ASSERT_EQ(4096, mOffload.Write(data.data(), data.size()));
+    ASSERT_EQ(0, mOffload.Drain(false));
+    ASSERT_TRUE(FakeCompress::WaitForBlockedCall(TIMEOUT_MS));
+    EXPECT_TRUE(GetEvents().empty());
+
+    FakeCompress::Consume(4096);
+    EXPECT_TRUE(WaitForEvent(CompressOffload::Event::DRAIN_READY));
+}
+
+TEST_F(CompressOffloadTest, DrainBeforeStartIsRejected) {
+    EXPECT_EQ(-ENOSYS, mOffload.Drain(false));
+}
+
+TEST_F(CompressOffloadTest, PauseFlushResume) {
+    std::vector<uint8_t> data(4096);
+    ASSERT_EQ(4096, mOffload.Write(data.data(), data.size()));
+    EXPECT_EQ(-ENOSYS, mOffload.Flush());
+    ASSERT_EQ(0, mOffload.Pause());
+    EXPECT_FALSE(FakeCompress::IsRunning());
+    ASSERT_EQ(0, mOffload.Flush());
+    EXPECT_EQ(0u, FakeCompress::GetQueuedBytes());
+    // Flushed back to idle: the next write starts the device again
+    EXPECT_EQ(-ENOSYS, mOffload.Resume());
+    EXPECT_EQ(4096, mOffload.Write(data.data(), data.size()));
+    EXPECT_TRUE(FakeCompress::IsRunning());
+}
+
+TEST_F(CompressOffloadTest, CloseWhileWaitingOnRunningDevice) {
+    std::vector<uint8_t> data(BUFFER_BYTES + 4096);
+    ASSERT_EQ(static_cast<ssize_t>(BUFFER_BYTES), mOffload.Write(data.data(), data.size()));
+    ASSERT_TRUE(FakeCompress::WaitForBlockedCall(TIMEOUT_MS));
+
+    ASSERT_TRUE(CloseWithin(TIMEOUT_MS));
+    EXPECT_FALSE(FakeCompress::IsOpen());
+    EXPECT_TRUE(GetEvents().empty());
+}
+
+TEST_F(CompressOffloadTest, CloseWhileWaitingOnIdleDevice) {
+    // A full DSP buffer before the first write: nothing is accepted, the
+    // device never starts and compress_stop cannot wake the wait.
+    FakeCompress::Reset(0);
+    mOffload.Close();
+    ASSERT_EQ(0, mOffload.Open(0, 1));
+
+    std::vector<uint8_t> data(4096);
+    ASSERT_EQ(0, mOffload.Write(data.data(), data.size()));
+    EXPECT_FALSE(FakeCompress::IsRunning());
+    ASSERT_TRUE(FakeCompress::WaitForBlockedCall(TIMEOUT_MS));
+
+    ASSERT_TRUE(CloseWithin(TIMEOUT_MS));
+    EXPECT_FALSE(FakeCompress::IsOpen());
+    EXPECT_TRUE(GetEvents().empty());
+}
+
+TEST_F(CompressOffloadTest, CloseWhileDraining) {
+    std::vector<uint8_t> data(4096);
+    ASSERT_EQ(4096, mOffload.Write(data.data(), data.size()));
+    ASSERT_EQ(0, mOffload.Drain(true));
+    ASSERT_TRUE(FakeCompress::WaitForBlockedCall(TIMEOUT_MS));
+
+    ASSERT_TRUE(CloseWithin(TIMEOUT_MS));
+    EXPECT_TRUE(GetEvents().empty());
+}
+
+} // namespace
@@ -0,0 +1,94 @@
+#include <benchmark/benchmark.h>
+#include <hardware/audio_effect.h>
+#include <errno.h>
+#include <vector>
+#include "audio_effects_chain.h"
+
+namespace {
+
+constexpr uint32_t CHANNELS = 2;
+constexpr size_t PERIOD_FRAMES = 1024;      // primary period
+constexpr size_t BLOCK_FRAMES = 256;
+
+// A Q15 gain, about the cheapest effect a vendor library ships
+int32_t GainProcess(effect_handle_t, audio_buffer_t* in, audio_buffer_t* out) {
+    constexpr int32_t GAIN = 29205;     // -1 dB
+    size_t samples = in->frameCount * CHANNELS;
+    for (size_t i = 0; i < samples; i++) {
+        out->s16[i] = static_cast<int16_t>((in->s16[i] * GAIN) >> 15);
+    }
+    return 0;
+}
+
+int32_t Command(effect_handle_t, uint32_t, uint32_t, void*, uint32_t*, void*) {
+    return -ENOSYS;
+}
+
+struct FakeEffects {
+    effect_interface_s interface;
+    std::vector<effect_interface_s*> handles;
+
+    explicit FakeEffects(size_t count)
+        : interface()
+        , handles(count, &interface) {
+        interface.process = GainProcess;
+        interface.command = Command;
+    }
+
+    effect_handle_t Get(size_t i) { return &handles[i]; }
+};
+
+// Frames per second, and the time per BLOCK_FRAMES block
+void ReportBlocks(benchmark::State& state) {
+    state.SetItemsProcessed(state.iterations() * PERIOD_FRAMES);
+    state.counters["per_block"] = benchmark::Counter(
+        static_cast<double>(state.iterations() * (PERIOD_FRAMES / BLOCK_FRAMES)),
+        benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+// One primary period through a chain of range(0) effects
+void BM_EffectsChain(benchmark::State& state) {
+    const size_t count = static_cast<size_t>(state.range(0));
+    FakeEffects effects(count);
+    EffectsChain chain;
+    chain.Init(CHANNELS, BLOCK_FRAMES);
+    for (size_t i = 0; i < count; i++) {
+        chain.Add(effects.Get(i));
+    }
+
+    std::vector<int16_t> data(PERIOD_FRAMES * CHANNELS, 1000);
+    for (auto _ : state) {
+        chain.Process(data.data(), PERIOD_FRAMES);
+        benchmark::ClobberMemory();
+    }
+    ReportBlocks(state);
+}
+
+// The same effects called directly, so the difference is the cost of the
+// chain itself: the epoch updates and the indirect calls per block
+void BM_DirectCalls(benchmark::State& state) {
+    const size_t count = static_cast<size_t>(state.range(0));
+    FakeEffects effects(count);
+
+    std::vector<int16_t> data(PERIOD_FRAMES * CHANNELS, 1000);
+    for (auto _ : state) {
+        for (size_t offset = 0; offset < PERIOD_FRAMES; offset += BLOCK_FRAMES) {
+            audio_buffer_t buffer;
+            buffer.frameCount = BLOCK_FRAMES;
+            buffer.s16 = data.data() + offset * CHANNELS;
+            for (size_t i = 0; i < count; i++) {
+                effect_handle_t effect = effects.Get(i);
+                (*effect)->process(effect, &buffer, &buffer);
+            }
+        }
+        benchmark::ClobberMemory();
+    }
+    ReportBlocks(state);
+}
+
+BENCHMARK(BM_EffectsChain)->DenseRange(0, EffectsChain::MAX_EFFECTS, 2);
+BENCHMARK(BM_DirectCalls)->DenseRange(0, EffectsChain::MAX_EFFECTS, 2);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,80 @@
+#include <benchmark/benchmark.h>
+#include <system/audio.h>
+#include <string>
+#include <vector>
+#include "audio_format_conv.h"
+
+namespace {
+
+const audio_format_t FORMATS[] = {
+    AUDIO_FORMAT_PCM_16_BIT,
+    AUDIO_FORMAT_PCM_24_BIT_PACKED,
+    AUDIO_FORMAT_PCM_8_24_BIT,
+    AUDIO_FORMAT_PCM_FLOAT,
+};
+
+const char* FormatName(audio_format_t format) {
+    switch (format) {
+        case AUDIO_FORMAT_PCM_16_BIT:
+            return "s16";
+        case AUDIO_FORMAT_PCM_24_BIT_PACKED:
+            return "p24";
+        case AUDIO_FORMAT_PCM_8_24_BIT:
+            return "q8_24";
+        default:
+            return "float";
+    }
+}
+
+// Fills count samples of format with a full-scale ramp
+void FillRamp(std::vector<uint8_t>* buffer, audio_format_t format, size_t count) {
+    FormatConverter toFormat;
+    std::vector<float> ramp(count);
+    for (size_t i = 0; i < count; i++) {
+        ramp[i] = static_cast<float>(i % 2001) / 1000.0f - 1.0f;
+    }
+    toFormat.Init(AUDIO_FORMAT_PCM_FLOAT, format);
+    toFormat.Convert(buffer->data(), ramp.data(), count);
+}
+
+// One primary period (1024 stereo frames) per iteration; the items rate
+// is samples per second for the kernel.
+void BM_Convert(benchmark::State& state, audio_format_t src, audio_format_t dst) {
+    const size_t count = static_cast<size_t>(state.range(0));
+    std::vector<uint8_t> in(count * sizeof(float));
+    std::vector<uint8_t> out(count * sizeof(float));
+    FillRamp(&in, src, count);
+
+    FormatConverter converter;
+    if (converter.Init(src, dst)) {
+        state.SkipWithError("unsupported conversion");
+        return;
+    }
+    for (auto _ : state) {
+        converter.Convert(out.data(), in.data(), count);
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(count));
+    state.SetBytesProcessed(state.iterations() *
+                            static_cast<int64_t>(count * audio_bytes_per_sample(src)));
+}
+
+int RegisterKernels() {
+    for (audio_format_t src : FORMATS) {
+        for (audio_format_t dst : FORMATS) {
+            std::string name = std::string("BM_Convert/") + FormatName(src) + "_to_" +
+                               FormatName(dst);
+            benchmark::RegisterBenchmark(name.c_str(), BM_Convert, src, dst)
+                ->Arg(2048)
+                ->Arg(2048 * 8);
+        }
+    }
+    return 0;
+}
+
+const int KERNELS_REGISTERED = RegisterKernels();
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,139 @@
+#include <benchmark/benchmark.h>
+#include <hardware/audio.h>
+#include <time.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "audio_hw.h"
+#include "audio_latency_histogram.h"
+#include "fake_tinyalsa.h"
+
+namespace {
+
+// Time runs this many times faster than real time, so a cycle of a few
+// seconds of audio takes well under one.
+constexpr double SPEED = 8.0;
+
+// One playback cycle: open, play, change route twice mid-stream, go to
+// standby, play again and close, the way AudioFlinger drives a track.
+constexpr int PERIODS_PER_PLAY = 100;
+constexpr int ROUTE_CHANGE_PERIOD = PERIODS_PER_PLAY / 2;
+constexpr auto STANDBY_TIME = std::chrono::milliseconds(20);
+
+int64_t CpuNs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct CycleStats {
+    LatencyHistogram writeLatency;
+    LatencyHistogram standbyExitLatency;
+    int64_t writeCpuNs = 0;
+    uint64_t frames = 0;
+};
+
+int TimedWrite(audio_stream_out* out, const std::vector<char>& buffer,
+               LatencyHistogram* histogram, CycleStats* stats) {
+    int64_t cpuStart = CpuNs(CLOCK_THREAD_CPUTIME_ID);
+    auto start = std::chrono::steady_clock::now();
+    ssize_t written = out->write(out, buffer.data(), buffer.size());
+    histogram->Record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    stats->writeCpuNs += CpuNs(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+    return written < 0 ? static_cast<int>(written) : 0;
+}
+
+int Play(audio_stream_out* out, const std::vector<char>& buffer, size_t frameSize,
+         CycleStats* stats) {
+    // The first write after open or standby starts the stream
+    int ret = TimedWrite(out, buffer, &stats->standbyExitLatency, stats);
+    for (int i = 1; ret == 0 && i < PERIODS_PER_PLAY; i++) {
+        if (i == ROUTE_CHANGE_PERIOD) {
+            out->common.set_parameters(&out->common, "routing=4");
+        } else if (i == ROUTE_CHANGE_PERIOD + 1) {
+            out->common.set_parameters(&out->common, "routing=2");
+        }
+        ret = TimedWrite(out, buffer, &stats->writeLatency, stats);
+    }
+    stats->frames += PERIODS_PER_PLAY * buffer.size() / frameSize;
+    return ret;
+}
+
+// Playback cycles on the primary output at range(0) Hz with the
+// range(1) channel mask and range(2) format. Reports the write and
+// standby-exit latency percentiles, the CPU time of the writing thread
+// and of the whole process (mixer thread included) per second of audio,
+// and the underruns of the mixer PCM.
+void BM_PlaybackCycle(benchmark::State& state) {
+    FakeAlsa::Reset();
+    FakeAlsa::SetSpeed(SPEED);
+    struct hw_module_t module = {};
+    audio_hw_device_t* device = nullptr;
+    if (AudioHAL::CreateInstance(&module, &device) != 0) {
+        state.SkipWithError("no device");
+        return;
+    }
+    audio_config_t config = {};
+    config.sample_rate = state.range(0);
+    config.channel_mask = static_cast<audio_channel_mask_t>(state.range(1));
+    config.format = static_cast<audio_format_t>(state.range(2));
+    size_t frameSize = audio_channel_count_from_out_mask(config.channel_mask) *
+        audio_bytes_per_sample(config.format);
+
+    CycleStats stats;
+    unsigned int xruns = FakeAlsa::GetPcmStats(0, 0).xruns;
+    int64_t processCpuStart = CpuNs(CLOCK_PROCESS_CPUTIME_ID);
+    for (auto _ : state) {
+        audio_stream_out* out = nullptr;
+        audio_config_t streamConfig = config;
+        if (device->open_output_stream(device, 1, AUDIO_DEVICE_OUT_SPEAKER,
+                                       AUDIO_OUTPUT_FLAG_PRIMARY, &streamConfig, &out,
+                                       "") != 0) {
+            state.SkipWithError("no output stream");
+            break;
+        }
+        std::vector<char> buffer(out->common.get_buffer_size(&out->common));
+        int ret = Play(out, buffer, frameSize, &stats);
+        out->common.standby(&out->common);
+        std::this_thread::sleep_for(STANDBY_TIME);
+        if (ret == 0) {
+            ret = Play(out, buffer, frameSize, &stats);
+        }
+        device->close_output_stream(device, out);
+        if (ret != 0) {
+            state.SkipWithError("write failed");
+            break;
+        }
+    }
+    double processCpuMs = (CpuNs(CLOCK_PROCESS_CPUTIME_ID) - processCpuStart) / 1e6;
+    double audioSeconds = static_cast<double>(stats.frames) / config.sample_rate;
+
+    state.counters["write_p50_us"] = stats.writeLatency.GetPercentileUs(50);
+    state.counters["write_p90_us"] = stats.writeLatency.GetPercentileUs(90);
+    state.counters["write_p99_us"] = stats.writeLatency.GetPercentileUs(99);
+    state.counters["write_max_us"] = stats.writeLatency.GetMaxUs();
+    state.counters["standby_exit_p50_us"] = stats.standbyExitLatency.GetPercentileUs(50);
+    state.counters["standby_exit_max_us"] = stats.standbyExitLatency.GetMaxUs();
+    if (audioSeconds > 0) {
+        state.counters["write_cpu_ms_per_s"] = stats.writeCpuNs / 1e6 / audioSeconds;
+        state.counters["cpu_ms_per_s"] = processCpuMs / audioSeconds;
+    }
+    state.counters["underruns"] = FakeAlsa::GetPcmStats(0, 0).xruns - xruns;
+
+    device->common.close(&device->common);
+    FakeAlsa::SetSpeed(1.0);
+}
+BENCHMARK(BM_PlaybackCycle)
+    ->ArgNames({ "rate", "mask", "format" })
+    ->Args({ 48000, AUDIO_CHANNEL_OUT_STEREO, AUDIO_FORMAT_PCM_16_BIT })
+    ->Args({ 48000, AUDIO_CHANNEL_OUT_STEREO, AUDIO_FORMAT_PCM_FLOAT })
+    ->Args({ 44100, AUDIO_CHANNEL_OUT_STEREO, AUDIO_FORMAT_PCM_16_BIT })
+    ->Args({ 48000, AUDIO_CHANNEL_OUT_5POINT1, AUDIO_FORMAT_PCM_16_BIT })
+    ->Iterations(4)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,138 @@
+#include <benchmark/benchmark.h>
+#include <hardware/audio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "audio_hw.h"
+#include "audio_latency_histogram.h"
+#include "fake_tinyalsa.h"
+
+namespace {
+
+// Contenders running next to the measured playback stream
+enum Contender {
+    CAPTURE = 1 << 0,       // a 48 kHz stereo input stream reading periods
+    PARAMETERS = 1 << 1,    // route changes, parameter queries and positions
+};
+
+void RunCapture(audio_hw_device_t* device, const std::atomic<bool>* stop) {
+    audio_config_t config = {};
+    config.sample_rate = 48000;
+    config.channel_mask = AUDIO_CHANNEL_IN_STEREO;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+    audio_stream_in* in = nullptr;
+    if (device->open_input_stream(device, 2, AUDIO_DEVICE_IN_BUILTIN_MIC, &config, &in,
+                                  AUDIO_INPUT_FLAG_NONE, "", AUDIO_SOURCE_MIC) != 0) {
+        return;
+    }
+    std::vector<char> buffer(in->common.get_buffer_size(&in->common));
+    while (!stop->load()) {
+        in->read(in, buffer.data(), buffer.size());
+    }
+    device->close_input_stream(device, in);
+}
+
+// What the framework does around a playing track: alternating routes,
+// capability queries and position polls, with no pause in between
+void RunParameters(audio_hw_device_t* device, audio_stream_out* out,
+                   const std::atomic<bool>* stop) {
+    const char* const routes[] = { "routing=2", "routing=4" };
+    for (unsigned int i = 0; !stop->load(); i++) {
+        out->common.set_parameters(&out->common, routes[i % 2]);
+        free(out->common.get_parameters(&out->common, AUDIO_PARAMETER_STREAM_SUP_FORMATS));
+        free(device->get_parameters(device, "screen_state"));
+        uint64_t frames;
+        struct timespec timestamp;
+        out->get_presentation_position(out, &frames, &timestamp);
+        uint32_t dspFrames;
+        out->get_render_position(out, &dspFrames);
+    }
+}
+
+// Time spent in one period-sized write on the primary output, with the
+// contenders in range(0) running. The writer keeps SLACK_PERIODS of room
+// in the pipeline and writes once per period, like a mixer thread woken
+// on time, so a write that does not wait on a lock never blocks and its
+// latency is the HAL's own cost. Time runs at SPEED times real time.
+constexpr double SPEED = 4.0;
+constexpr int SLACK_PERIODS = 2;
+
+void BM_WriteLatency(benchmark::State& state) {
+    FakeAlsa::Reset();
+    FakeAlsa::SetSpeed(SPEED);
+    struct hw_module_t module = {};
+    audio_hw_device_t* device = nullptr;
+    if (AudioHAL::CreateInstance(&module, &device) != 0) {
+        state.SkipWithError("no device");
+        return;
+    }
+    audio_config_t config = {};
+    config.sample_rate = 48000;
+    config.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+    audio_stream_out* out = nullptr;
+    if (device->open_output_stream(device, 1, AUDIO_DEVICE_OUT_SPEAKER,
+                                   AUDIO_OUTPUT_FLAG_PRIMARY, &config, &out, "") != 0) {
+        device->common.close(&device->common);
+        state.SkipWithError("no output stream");
+        return;
+    }
+    std::vector<char> period(out->common.get_buffer_size(&out->common));
+    auto periodTime = std::chrono::nanoseconds(static_cast<int64_t>(
+        period.size() / (2 * sizeof(int16_t)) * 1e9 / config.sample_rate / SPEED));
+
+    // Fill the pipeline, then let it drain the slack
+    for (int i = 0; i < 8; i++) {
+        out->write(out, period.data(), period.size());
+    }
+    auto deadline = std::chrono::steady_clock::now() + SLACK_PERIODS * periodTime;
+
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> contenders;
+    if (state.range(0) & CAPTURE) {
+        contenders.emplace_back(RunCapture, device, &stop);
+    }
+    if (state.range(0) & PARAMETERS) {
+        contenders.emplace_back(RunParameters, device, out, &stop);
+    }
+
+    LatencyHistogram histogram;
+    unsigned int xruns = FakeAlsa::GetPcmStats(0, 0).xruns;
+    for (auto _ : state) {
+        std::this_thread::sleep_until(deadline);
+        deadline += periodTime;
+        auto start = std::chrono::steady_clock::now();
+        ssize_t written = out->write(out, period.data(), period.size());
+        histogram.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+        benchmark::DoNotOptimize(written);
+    }
+
+    stop = true;
+    for (std::thread& thread : contenders) {
+        thread.join();
+    }
+    state.counters["p50_us"] = histogram.GetPercentileUs(50);
+    state.counters["p99_us"] = histogram.GetPercentileUs(99);
+    state.counters["max_us"] = histogram.GetMaxUs();
+    state.counters["underruns"] = FakeAlsa::GetPcmStats(0, 0).xruns - xruns;
+    FakeAlsa::SetSpeed(1.0);
+
+    device->close_output_stream(device, out);
+    device->common.close(&device->common);
+}
+BENCHMARK(BM_WriteLatency)
+    ->ArgName("contenders")
+    ->Arg(0)
+    ->Arg(CAPTURE)
+    ->Arg(PARAMETERS)
+    ->Arg(CAPTURE | PARAMETERS)
+    ->Iterations(1000)
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,303 @@
+#include <gtest/gtest.h>
+#include <hardware/audio.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "audio_hw.h"
+#include "fake_tinyalsa.h"
+
+namespace {
+
+class AudioHwTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        FakeAlsa::Reset();
+        FakeAlsa::SetSpeed(8.0);
+        ASSERT_EQ(0, AudioHAL::CreateInstance(&mModule, &mDevice, mUsbProcRoot.c_str()));
+        ASSERT_NE(nullptr, mDevice);
+    }
+
+    void TearDown() override {
+        if (mDevice) {
+            EXPECT_EQ(0, mDevice->common.close(&mDevice->common));
+        }
+    }
+
+    int OpenOutput(audio_channel_mask_t mask, audio_stream_out** out,
+                   audio_output_flags_t flags = AUDIO_OUTPUT_FLAG_PRIMARY,
+                   audio_devices_t devices = AUDIO_DEVICE_OUT_SPEAKER) {
+        audio_config_t config = {};
+        config.sample_rate = 48000;
+        config.channel_mask = mask;
+        config.format = AUDIO_FORMAT_PCM_16_BIT;
+        return mDevice->open_output_stream(mDevice, 1, devices, flags, &config, out, "");
+    }
+
+    // Writes periods of a constant, non-silent sample.
+    static void WritePeriods(audio_stream_out* out, int count) {
+        std::vector<int16_t> period(out->common.get_buffer_size(&out->common) /
+                                    sizeof(int16_t), 8000);
+        for (int i = 0; i < count; i++) {
+            ASSERT_EQ(static_cast<ssize_t>(period.size() * sizeof(int16_t)),
+                      out->write(out, period.data(), period.size() * sizeof(int16_t)));
+        }
+    }
+
+    std::string Dump() {
+        FILE* file = tmpfile();
+        mDevice->dump(mDevice, fileno(file));
+        std::string text;
+        rewind(file);
+        char line[256];
+        while (fgets(line, sizeof(line), file)) {
+            text += line;
+        }
+        fclose(file);
+        return text;
+    }
+
+    std::string mUsbProcRoot = "/proc/asound";
+    struct hw_module_t mModule = {};
+    audio_hw_device_t* mDevice = nullptr;
+};
+
+// A stereo 16-bit DAC on card 1 of a /proc/asound lookalike, so USB streams
+// open their own PCM instead of going through the mixer.
+class AudioHwUsbTest : public AudioHwTest {
+protected:
+    void SetUp() override {
+        mUsbProcRoot = ::testing::TempDir() + "audio_hw_test." + std::to_string(getpid());
+        ASSERT_EQ(0, mkdir(mUsbProcRoot.c_str(), 0700));
+        ASSERT_EQ(0, mkdir((mUsbProcRoot + "/card1").c_str(), 0700));
+        WriteFile("/card1/usbid", "0d8c:0014\n");
+        WriteFile("/card1/stream0",
+                  "USB DAC at usb-xhci-hcd.1.auto-1, high speed : USB Audio\n"
+                  "\n"
+                  "Playback:\n"
+                  "  Interface 1\n"
+                  "    Altset 1\n"
+                  "    Format: S16_LE\n"
+                  "    Channels: 2\n"
+                  "    Endpoint: 1 OUT (ASYNC)\n"
+                  "    Rates: 48000\n");
+        AudioHwTest::SetUp();
+        std::string connect = "connect=" + std::to_string(AUDIO_DEVICE_OUT_USB_DEVICE) +
+            ";card=1;device=0";
+        ASSERT_EQ(0, mDevice->set_parameters(mDevice, connect.c_str()));
+    }
+
+    void TearDown() override {
+        AudioHwTest::TearDown();
+        unlink((mUsbProcRoot + "/card1/usbid").c_str());
+        unlink((mUsbProcRoot + "/card1/stream0").c_str());
+        rmdir((mUsbProcRoot + "/card1").c_str());
+        rmdir(mUsbProcRoot.c_str());
+    }
+
+    void WriteFile(const char* name, const char* text) {
+        FILE* file = fopen((mUsbProcRoot + name).c_str(), "w");
+        ASSERT_NE(nullptr, file);
+        fputs(text, file);
+        fclose(file);
+    }
+};
+
+TEST_F(AudioHwTest, InstallsDeviceHooks) {
+    EXPECT_EQ(static_cast<uint32_t>(HARDWARE_DEVICE_TAG), mDevice->common.tag);
+    EXPECT_EQ(&mModule, mDevice->common.module);
+    EXPECT_NE(nullptr, mDevice->common.close);
+    EXPECT_NE(nullptr, mDevice->set_mode);
+    EXPECT_NE(nullptr, mDevice->set_parameters);
+    EXPECT_NE(nullptr, mDevice->get_parameters);
+    EXPECT_NE(nullptr, mDevice->get_input_buffer_size);
+    EXPECT_NE(nullptr, mDevice->open_output_stream);
+    EXPECT_NE(nullptr, mDevice->close_output_stream);
+    EXPECT_NE(nullptr, mDevice->open_input_stream);
+    EXPECT_NE(nullptr, mDevice->close_input_stream);
+    EXPECT_NE(nullptr, mDevice->dump);
+    EXPECT_EQ(0, mDevice->init_check(mDevice));
+}
+
+TEST_F(AudioHwTest, OutputStreamPlaysThroughTheHooks) {
+    audio_stream_out* out = nullptr;
+    ASSERT_EQ(0, OpenOutput(AUDIO_CHANNEL_OUT_STEREO, &out));
+    ASSERT_NE(nullptr, out);
+    EXPECT_EQ(48000u, out->common.get_sample_rate(&out->common));
+
+    std::vector<int16_t> period(out->common.get_buffer_size(&out->common) / sizeof(int16_t));
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(static_cast<ssize_t>(period.size() * sizeof(int16_t)),
+                  out->write(out, period.data(), period.size() * sizeof(int16_t)));
+    }
+    EXPECT_NE(std::string::npos, Dump().find("Output stream"));
+    mDevice->close_output_stream(mDevice, out);
+    EXPECT_EQ(std::string::npos, Dump().find("Output stream"));
+}
+
+TEST_F(AudioHwTest, MixerStartsOnTheFirstWrittenPeriod) {
+    audio_stream_out* out = nullptr;
+    ASSERT_EQ(0, OpenOutput(AUDIO_CHANNEL_OUT_STEREO, &out));
+    std::vector<int16_t> period(out->common.get_buffer_size(&out->common) / sizeof(int16_t),
+                                8000);
+
+    // A cold start, then a warm one after standby, each writing enough to
+    // block on the mixer so it has started before standby
+    for (int start = 0; start < 2; start++) {
+        for (int i = 0; i < 16; i++) {
+            ASSERT_EQ(static_cast<ssize_t>(period.size() * sizeof(int16_t)),
+                      out->write(out, period.data(), period.size() * sizeof(int16_t)));
+        }
+        EXPECT_EQ(0u, FakeAlsa::GetPcmStats(0, 0).silentStartFrames);
+        EXPECT_EQ(0, out->common.standby(&out->common));
+        usleep(20000);  // until the mixer idles
+    }
+    std::string dump = Dump();
+    EXPECT_NE(std::string::npos, dump.find("mixer starts: 1 warm, 1 cold")) << dump;
+    mDevice->close_output_stream(mDevice, out);
+}
+
+TEST_F(AudioHwTest, IdleFastTrackLeavesTheMixerAtTheDeepBufferPeriod) {
+    // AudioPolicyManager keeps the fast output open for the whole session.
+    audio_stream_out* fast = nullptr;
+    audio_stream_out* deep = nullptr;
+    ASSERT_EQ(0, OpenOutput(AUDIO_CHANNEL_OUT_STEREO, &fast, AUDIO_OUTPUT_FLAG_FAST));
+    ASSERT_EQ(0, OpenOutput(AUDIO_CHANNEL_OUT_STEREO, &deep, AUDIO_OUTPUT_FLAG_DEEP_BUFFER));
+
+    WritePeriods(deep, 8);
+    FakeAlsa::PcmStats stats = FakeAlsa::GetPcmStats(0, 0);
+    EXPECT_EQ(1920u, stats.lastConfig.period_size);
+    EXPECT_EQ(4u, stats.lastConfig.period_count);
+
+    // The fast track sets the period while it plays...
+    WritePeriods(fast, 32);
+    stats = FakeAlsa::GetPcmStats(0, 0);
+    EXPECT_EQ(240u, stats.lastConfig.period_size);
+    EXPECT_EQ(2u, stats.lastConfig.period_count);
+
+    // ...and hands it back once it goes to standby.
+    EXPECT_EQ(0, fast->common.standby(&fast->common));
+    WritePeriods(deep, 8);
+    stats = FakeAlsa::GetPcmStats(0, 0);
+    EXPECT_EQ(1920u, stats.lastConfig.period_size);
+    EXPECT_EQ(4u, stats.lastConfig.period_count);
+
+    mDevice->close_output_stream(mDevice, fast);
+    mDevice->close_output_stream(mDevice, deep);
+}
+
+TEST_F(AudioHwUsbTest, DirectOutputCountsAndRecoversUnderruns) {
+    // Real time, so the writes easily keep up with the 85 ms buffer
+    FakeAlsa::SetSpeed(1.0);
+    audio_stream_out* out = nullptr;
+    ASSERT_EQ(0, OpenOutput(AUDIO_CHANNEL_OUT_STEREO, &out, AUDIO_OUTPUT_FLAG_PRIMARY,
+                            AUDIO_DEVICE_OUT_USB_DEVICE));
+
+    WritePeriods(out, 8);
+    EXPECT_EQ(0u, FakeAlsa::GetPcmStats(1, 0).xruns);
+    EXPECT_NE(std::string::npos, Dump().find("underruns: 0"));
+
+    // Let the ring drain, then keep playing on the same PCM
+    usleep(200000);
+    WritePeriods(out, 8);
+    FakeAlsa::PcmStats stats = FakeAlsa::GetPcmStats(1, 0);
+    EXPECT_EQ(1u, stats.xruns);
+    EXPECT_EQ(1u, stats.opens);
+    EXPECT_EQ(16u * 1024, stats.framesWritten);
+    std::string dump = Dump();
+    EXPECT_NE(std::string::npos, dump.find("underruns: 1")) << dump;
+    mDevice->close_output_stream(mDevice, out);
+}
+
+TEST_F(AudioHwTest, PrimaryBackendIsStereoAndDownmixes51) {
+    EXPECT_EQ(2u, FakeAlsa::GetPcmStats(0, 0).lastConfig.channels);
+
+    audio_stream_out* out = nullptr;
+    ASSERT_EQ(0, OpenOutput(AUDIO_CHANNEL_OUT_5POINT1, &out));
+    std::vector<int16_t> period(out->common.get_buffer_size(&out->common) / sizeof(int16_t));
+    ASSERT_EQ(static_cast<ssize_t>(period.size() * sizeof(int16_t)),
+              out->write(out, period.data(), period.size() * sizeof(int16_t)));
+    EXPECT_NE(std::string::npos, Dump().find("channels: 6 -> 2 (mixing: 1)"));
+    EXPECT_EQ(2u, FakeAlsa::GetPcmStats(0, 0).lastConfig.channels);
+    mDevice->close_output_stream(mDevice, out);
+}
+
+TEST_F(AudioHwTest, InputBufferSizeFollowsTheCapturePeriod) {
+    audio_config_t config = {};
+    config.sample_rate = 48000;
+    config.channel_mask = AUDIO_CHANNEL_IN_STEREO;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+    EXPECT_EQ(480u * 2 * sizeof(int16_t), mDevice->get_input_buffer_size(mDevice, &config));
+
+    config.sample_rate = 16000;
+    config.channel_mask = AUDIO_CHANNEL_IN_MONO;
+    EXPECT_EQ(160u * sizeof(int16_t), mDevice->get_input_buffer_size(mDevice, &config));
+
+    config.sample_rate = 12345;
+    EXPECT_EQ(0u, mDevice->get_input_buffer_size(mDevice, &config));
+}
+
+TEST_F(AudioHwTest, InputStreamAndMicMute) {
+    audio_config_t config = {};
+    config.sample_rate = 48000;
+    config.channel_mask = AUDIO_CHANNEL_IN_MONO;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+    audio_stream_in* in = nullptr;
+    ASSERT_EQ(0, mDevice->open_input_stream(mDevice, 2, AUDIO_DEVICE_IN_BUILTIN_MIC, &config,
+                                            &in, AUDIO_INPUT_FLAG_NONE, "",
+                                            AUDIO_SOURCE_MIC));
+    ASSERT_NE(nullptr, in);
+
+    bool muted = true;
+    EXPECT_EQ(0, mDevice->get_mic_mute(mDevice, &muted));
+    EXPECT_FALSE(muted);
+    std::vector<int16_t> buffer(480, 0);
+    ASSERT_EQ(static_cast<ssize_t>(buffer.size() * sizeof(int16_t)),
+              in->read(in, buffer.data(), buffer.size() * sizeof(int16_t)));
+    EXPECT_EQ(0, std::count(buffer.begin(), buffer.end(), 0));
+
+    EXPECT_EQ(0, mDevice->set_mic_mute(mDevice, true));
+    EXPECT_EQ(0, mDevice->get_mic_mute(mDevice, &muted));
+    EXPECT_TRUE(muted);
+    ASSERT_EQ(static_cast<ssize_t>(buffer.size() * sizeof(int16_t)),
+              in->read(in, buffer.data(), buffer.size() * sizeof(int16_t)));
+    EXPECT_EQ(std::vector<int16_t>(480, 0), buffer);
+
+    EXPECT_EQ(0, mDevice->set_mic_mute(mDevice, false));
+    ASSERT_EQ(static_cast<ssize_t>(buffer.size() * sizeof(int16_t)),
+              in->read(in, buffer.data(), buffer.size() * sizeof(int16_t)));
+    EXPECT_EQ(0, std::count(buffer.begin(), buffer.end(), 0));
+    mDevice->close_input_stream(mDevice, in);
+}
+
+TEST_F(AudioHwTest, ModeAndParameters) {
+    EXPECT_EQ(0, mDevice->set_mode(mDevice, AUDIO_MODE_RINGTONE));
+    EXPECT_NE(std::string::npos, Dump().find("mode: 1,"));
+
+    // The device answers no queries; its keys are set-only
+    EXPECT_EQ(0, mDevice->set_parameters(mDevice, "screen_state=on"));
+    char* reply = mDevice->get_parameters(mDevice, "screen_state");
+    ASSERT_NE(nullptr, reply);
+    EXPECT_STREQ("", reply);
+    free(reply);
+
+    audio_stream_out* out = nullptr;
+    ASSERT_EQ(0, OpenOutput(AUDIO_CHANNEL_OUT_STEREO, &out));
+    std::string routing = "routing=" + std::to_string(AUDIO_DEVICE_OUT_WIRED_HEADPHONE);
+    EXPECT_EQ(0, out->common.set_parameters(&out->common, routing.c_str()));
+    std::string dump = Dump();
+    EXPECT_NE(std::string::npos, dump.find("mode: 1, out devices: 8,")) << dump;
+
+    reply = out->common.get_parameters(&out->common,
+                                       "sup_sampling_rates;sup_formats;routing");
+    ASSERT_NE(nullptr, reply);
+    EXPECT_STREQ("sup_sampling_rates=44100|48000|96000|192000;"
+                 "sup_formats=AUDIO_FORMAT_PCM_16_BIT|AUDIO_FORMAT_PCM_24_BIT_PACKED|"
+                 "AUDIO_FORMAT_PCM_8_24_BIT|AUDIO_FORMAT_PCM_FLOAT", reply);
+    free(reply);
+    mDevice->close_output_stream(mDevice, out);
+}
+
+} // namespace
@@ -0,0 +1,184 @@
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "audio_mixer_paths.h"
+#include "fake_tinyalsa.h"
+
+namespace {
+
+const char* const MIXER_PATHS = R"(<?xml version="1.0" encoding="ISO-8859-1"?>
+<mixer>
+    <ctl name="SPK Switch" value="0" />
+    <ctl name="HPH Volume" value="0" />
+    <ctl name="RX Mux" value="ZERO" />
+    <path name="rx">
+        <ctl name="RX Mux" value="AIF1" />
+    </path>
+    <path name="speaker">
+        <path name="rx" />
+        <ctl name="SPK Switch" value="1" />
+    </path>
+    <path name="headphones">
+        <path name="rx" />
+        <ctl name="HPH Volume" value="20" />
+        <ctl name="RX Mux" value="AIF2" />
+    </path>
+    <path name="speaker-and-headphones">
+        <path name="speaker" />
+        <path name="headphones" />
+    </path>
+</mixer>
+)";
+
+class MixerPathsTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        FakeAlsa::Reset();
+        FakeAlsa::AddControl("SPK Switch", 1, 0);
+        FakeAlsa::AddControl("HPH Volume", 2, 0);
+        FakeAlsa::AddEnumControl("RX Mux", { "ZERO", "AIF1", "AIF2" }, 0);
+        mMixer = mixer_open(0);
+    }
+
+    void TearDown() override {
+        mixer_close(mMixer);
+    }
+
+    int Load(const char* xml) {
+        FILE* file = fmemopen(const_cast<char*>(xml), strlen(xml), "r");
+        int ret = mPaths.Load(file, mMixer);
+        fclose(file);
+        return ret;
+    }
+
+    int Apply(const char* name) {
+        int id = mPaths.GetPathId(name);
+        return mPaths.Apply(&id, 1);
+    }
+
+    struct mixer* mMixer = nullptr;
+    MixerPaths mPaths;
+};
+
+TEST_F(MixerPathsTest, LoadsNestedPaths) {
+    ASSERT_EQ(0, Load(MIXER_PATHS));
+    EXPECT_EQ(3u, mPaths.GetControlCount());
+    EXPECT_EQ(4u, mPaths.GetPathCount());
+    EXPECT_EQ(1, mPaths.GetPathId("speaker"));
+    EXPECT_EQ(-1, mPaths.GetPathId("earpiece"));
+}
+
+TEST_F(MixerPathsTest, AppliesOnlyChangedControls) {
+    ASSERT_EQ(0, Load(MIXER_PATHS));
+
+    EXPECT_EQ(2, Apply("speaker"));
+    EXPECT_EQ(1, FakeAlsa::GetControlValue("SPK Switch", 0));
+    EXPECT_EQ(1, FakeAlsa::GetControlValue("RX Mux", 0));
+
+    unsigned int writes = FakeAlsa::GetControlWrites();
+    EXPECT_EQ(0, Apply("speaker"));
+    EXPECT_EQ(writes, FakeAlsa::GetControlWrites());
+
+    // Speaker off, volume on both channels, mux moved from AIF1 to AIF2
+    EXPECT_EQ(3, Apply("headphones"));
+    EXPECT_EQ(0, FakeAlsa::GetControlValue("SPK Switch", 0));
+    EXPECT_EQ(20, FakeAlsa::GetControlValue("HPH Volume", 0));
+    EXPECT_EQ(20, FakeAlsa::GetControlValue("HPH Volume", 1));
+    EXPECT_EQ(2, FakeAlsa::GetControlValue("RX Mux", 0));
+
+    // Nothing active restores the initial settings
+    EXPECT_EQ(2, mPaths.Apply(nullptr, 0));
+    EXPECT_EQ(0, FakeAlsa::GetControlValue("HPH Volume", 0));
+    EXPECT_EQ(0, FakeAlsa::GetControlValue("RX Mux", 0));
+}
+
+TEST_F(MixerPathsTest, LaterIncludesOverrideEarlierOnes) {
+    ASSERT_EQ(0, Load(MIXER_PATHS));
+    EXPECT_EQ(3, Apply("speaker-and-headphones"));
+    EXPECT_EQ(1, FakeAlsa::GetControlValue("SPK Switch", 0));
+    EXPECT_EQ(20, FakeAlsa::GetControlValue("HPH Volume", 0));
+    EXPECT_EQ(2, FakeAlsa::GetControlValue("RX Mux", 0));
+}
+
+TEST_F(MixerPathsTest, RejectsMalformedXml) {
+    EXPECT_EQ(-EINVAL, Load(R"(<mixer>
+    <ctl name="SPK Switch" value="0" />
+    <path name="speaker">
+        <ctl name="SPK Switch" value="1"
+    </path>
+</mixer>
+)"));
+    EXPECT_EQ(0u, mPaths.GetPathCount());
+    EXPECT_EQ(0, mPaths.Apply(nullptr, 0));
+}
+
+TEST_F(MixerPathsTest, RejectsTruncatedXml) {
+    EXPECT_EQ(-EINVAL, Load(R"(<mixer>
+    <path name="speaker">
+        <ctl name="SPK Switch" value="1" />
+)"));
+}
+
+TEST_F(MixerPathsTest, RejectsCyclicPaths) {
+    EXPECT_EQ(-ELOOP, Load(R"(<mixer>
+    <path name="a">
+        <ctl name="SPK Switch" value="1" />
+        <path name="b" />
+    </path>
+    <path name="b">
+        <path name="a" />
+    </path>
+</mixer>
+)"));
+    EXPECT_EQ(0u, mPaths.GetPathCount());
+    EXPECT_EQ(0, mPaths.Apply(nullptr, 0));
+}
+
+TEST_F(MixerPathsTest, RejectsSelfReference) {
+    EXPECT_EQ(-ELOOP, Load(R"(<mixer>
+    <path name="loop">
+        <path name="loop" />
+    </path>
+</mixer>
+)"));
+}
+
+TEST_F(MixerPathsTest, RejectsUnknownPathReference) {
+    EXPECT_EQ(-EINVAL, Load(R"(<mixer>
+    <path name="speaker">
+        <path name="amp" />
+    </path>
+</mixer>
+)"));
+}
+
+TEST_F(MixerPathsTest, SkipsUnknownControls) {
+    ASSERT_EQ(0, Load(R"(<mixer>
+    <ctl name="Missing Switch" value="0" />
+    <path name="speaker">
+        <ctl name="Missing Switch" value="1" />
+        <ctl name="SPK Switch" value="1" />
+    </path>
+</mixer>
+)"));
+    EXPECT_EQ(2u, mPaths.GetControlCount());
+    EXPECT_EQ(1, Apply("speaker"));
+    EXPECT_EQ(1, FakeAlsa::GetControlValue("SPK Switch", 0));
+}
+
+TEST_F(MixerPathsTest, UnknownEnumValueSelectsTheFirst) {
+    ASSERT_EQ(0, Load(R"(<mixer>
+    <ctl name="RX Mux" value="AIF1" />
+    <path name="rx">
+        <ctl name="RX Mux" value="AIF9" />
+    </path>
+</mixer>
+)"));
+    EXPECT_EQ(1, mPaths.Apply(nullptr, 0));
+    EXPECT_EQ(1, FakeAlsa::GetControlValue("RX Mux", 0));
+    EXPECT_EQ(1, Apply("rx"));
+    EXPECT_EQ(0, FakeAlsa::GetControlValue("RX Mux", 0));
+}
+
+} // namespace
@@ -0,0 +1,111 @@
+#include <benchmark/benchmark.h>
+#include <cutils/str_parms.h>
+#include <stdint.h>
+#include <string_view>
+#include "audio_parameters.h"
+
+namespace {
+
+// What AudioFlinger sends on a route change, a USB connect and a gapless
+// track change
+const char* const KVPAIRS[] = {
+    "routing=2",
+    "connect=16384;card=1;device=0",
+    "offload_delay_samples=1105;offload_padding_samples=1152",
+};
+
+struct Parsed {
+    uint32_t routing;
+    uint32_t connect;
+    uint32_t card;
+    uint32_t device;
+    uint32_t delay;
+    uint32_t padding;
+};
+
+void ParseWithParser(const char* kvpairs, Parsed* out) {
+    ParameterParser parser(kvpairs);
+    std::string_view key;
+    std::string_view value;
+    while (parser.Next(&key, &value)) {
+        uint32_t number;
+        if (!ParameterParser::ParseUint32(value, &number)) {
+            continue;
+        }
+        switch (LookupParameterKey(key)) {
+            case ParameterKey::ROUTING:
+                out->routing = number;
+                break;
+            case ParameterKey::CONNECT:
+                out->connect = number;
+                break;
+            case ParameterKey::CARD:
+                out->card = number;
+                break;
+            case ParameterKey::DEVICE:
+                out->device = number;
+                break;
+            case ParameterKey::OFFLOAD_DELAY_SAMPLES:
+                out->delay = number;
+                break;
+            case ParameterKey::OFFLOAD_PADDING_SAMPLES:
+                out->padding = number;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// The str_parms sequence the parser replaced: build the map, then one
+// lookup per key the HAL knows
+void ParseWithStrParms(const char* kvpairs, Parsed* out) {
+    struct str_parms* parms = str_parms_create_str(kvpairs);
+    int value;
+    if (str_parms_get_int(parms, "routing", &value) >= 0) {
+        out->routing = value;
+    }
+    if (str_parms_get_int(parms, "connect", &value) >= 0) {
+        out->connect = value;
+    }
+    if (str_parms_get_int(parms, "card", &value) >= 0) {
+        out->card = value;
+    }
+    if (str_parms_get_int(parms, "device", &value) >= 0) {
+        out->device = value;
+    }
+    if (str_parms_get_int(parms, "offload_delay_samples", &value) >= 0) {
+        out->delay = value;
+    }
+    if (str_parms_get_int(parms, "offload_padding_samples", &value) >= 0) {
+        out->padding = value;
+    }
+    str_parms_destroy(parms);
+}
+
+void BM_ParameterParser(benchmark::State& state) {
+    const char* kvpairs = KVPAIRS[state.range(0)];
+    Parsed parsed = {};
+    for (auto _ : state) {
+        ParseWithParser(kvpairs, &parsed);
+        benchmark::DoNotOptimize(parsed);
+    }
+    state.SetLabel(kvpairs);
+}
+
+void BM_StrParms(benchmark::State& state) {
+    const char* kvpairs = KVPAIRS[state.range(0)];
+    Parsed parsed = {};
+    for (auto _ : state) {
+        ParseWithStrParms(kvpairs, &parsed);
+        benchmark::DoNotOptimize(parsed);
+    }
+    state.SetLabel(kvpairs);
+}
+
+BENCHMARK(BM_ParameterParser)->DenseRange(0, 2);
+BENCHMARK(BM_StrParms)->DenseRange(0, 2);
+
+} // namespace
+
+BENCHMARK_MAIN();
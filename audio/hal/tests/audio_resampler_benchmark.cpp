@@ -0,0 +1,100 @@
+#include <benchmark/benchmark.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include "audio_resampler.h"
+
+namespace {
+
+constexpr uint32_t OUT_RATE = 48000;
+constexpr size_t BLOCK_FRAMES = 1024;
+constexpr double TONE_HZ = 997.0;   // not a divisor of any rate, so the error is not periodic
+
+void MakeTone(std::vector<float>* out, uint32_t rate, uint32_t channels, size_t frames) {
+    out->resize(frames * channels);
+    for (size_t f = 0; f < frames; f++) {
+        float v = 0.5f * static_cast<float>(sin(2.0 * M_PI * TONE_HZ * f / rate));
+        for (uint32_t c = 0; c < channels; c++) {
+            (*out)[f * channels + c] = v;
+        }
+    }
+}
+
+// THD+N of one second of the resampled tone in dB: the least squares fit
+// of the tone is removed and the residual compared with it. The first
+// 100 ms are skipped while the filter history fills.
+double MeasureThdN(uint32_t inRate, Resampler::Quality quality) {
+    std::vector<float> in;
+    MakeTone(&in, inRate, 1, inRate);
+    Resampler resampler;
+    if (resampler.Init(inRate, OUT_RATE, 1, quality, BLOCK_FRAMES) != 0) {
+        return 0.0;
+    }
+    std::vector<float> out;
+    std::vector<float> block(resampler.GetMaxOutputFrames(BLOCK_FRAMES));
+    for (size_t pos = 0; pos < in.size(); pos += BLOCK_FRAMES) {
+        size_t frames = std::min(BLOCK_FRAMES, in.size() - pos);
+        size_t produced = resampler.Process(block.data(), &in[pos], frames);
+        out.insert(out.end(), block.begin(), block.begin() + produced);
+    }
+
+    const size_t skip = OUT_RATE / 10;
+    double ss = 0, sc = 0, cc = 0, ys = 0, yc = 0;
+    for (size_t n = skip; n < out.size(); n++) {
+        double s = sin(2.0 * M_PI * TONE_HZ * n / OUT_RATE);
+        double c = cos(2.0 * M_PI * TONE_HZ * n / OUT_RATE);
+        ss += s * s;
+        sc += s * c;
+        cc += c * c;
+        ys += out[n] * s;
+        yc += out[n] * c;
+    }
+    double det = ss * cc - sc * sc;
+    double a = (ys * cc - yc * sc) / det;
+    double b = (yc * ss - ys * sc) / det;
+    double signal = 0, noise = 0;
+    for (size_t n = skip; n < out.size(); n++) {
+        double fit = a * sin(2.0 * M_PI * TONE_HZ * n / OUT_RATE) +
+                     b * cos(2.0 * M_PI * TONE_HZ * n / OUT_RATE);
+        signal += fit * fit;
+        noise += (out[n] - fit) * (out[n] - fit);
+    }
+    return 10.0 * log10(noise / signal);
+}
+
+// Reports the CPU cost per second of one input channel and the THD+N of
+// the tier. args: input rate, channels, quality
+void BM_Resample(benchmark::State& state) {
+    const uint32_t inRate = static_cast<uint32_t>(state.range(0));
+    const uint32_t channels = static_cast<uint32_t>(state.range(1));
+    const Resampler::Quality quality = state.range(2) ?
+        Resampler::Quality::HIGH : Resampler::Quality::LOW;
+
+    Resampler resampler;
+    if (resampler.Init(inRate, OUT_RATE, channels, quality, BLOCK_FRAMES) != 0) {
+        state.SkipWithError("unsupported ratio");
+        return;
+    }
+    std::vector<float> in;
+    MakeTone(&in, inRate, channels, BLOCK_FRAMES);
+    std::vector<float> out(resampler.GetMaxOutputFrames(BLOCK_FRAMES) * channels);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(resampler.Process(out.data(), in.data(), BLOCK_FRAMES));
+        benchmark::ClobberMemory();
+    }
+
+    double channelSeconds = static_cast<double>(state.iterations()) * BLOCK_FRAMES *
+                            channels / inRate;
+    state.counters["cpu_s_per_channel_s"] = benchmark::Counter(
+        channelSeconds, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+    state.counters["thdn_db"] = MeasureThdN(inRate, quality);
+    state.SetLabel(state.range(2) ? "high" : "low");
+}
+
+BENCHMARK(BM_Resample)
+    ->ArgNames({ "rate", "channels", "high" })
+    ->ArgsProduct({ { 44100, 96000, 192000 }, { 1, 2, 6 }, { 0, 1 } });
+
+} // namespace
+
+BENCHMARK_MAIN();
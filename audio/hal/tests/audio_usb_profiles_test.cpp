@@ -0,0 +1,249 @@
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include "audio_usb_profiles.h"
+
+namespace {
+
+// /proc/asound/card1/stream0 of an AudioQuest DragonFly Red, with an
+// extra 32-bit alternate setting the HAL cannot produce
+const char* const DRAGONFLY_STREAM = R"(AudioQuest DragonFly Red at usb-xhci-hcd.1.auto-1, high speed : USB Audio
+
+Playback:
+  Status: Running
+    Interface = 1
+    Altset = 1
+    Packet Size = 192
+    Momentary freq = 48000 Hz (0x6.0000)
+  Interface 1
+    Altset 1
+    Format: S16_LE
+    Channels: 2
+    Endpoint: 1 OUT (ASYNC)
+    Rates: 44100, 48000, 88200, 96000
+    Bits: 16
+  Interface 1
+    Altset 2
+    Format: S24_3LE
+    Channels: 2
+    Endpoint: 1 OUT (ASYNC)
+    Rates: 44100, 48000, 88200, 96000, 176400, 192000
+    Bits: 24
+  Interface 1
+    Altset 3
+    Format: S32_LE
+    Channels: 2
+    Endpoint: 1 OUT (ASYNC)
+    Rates: 44100, 384000
+
+Capture:
+  Status: Stop
+  Interface 2
+    Altset 1
+    Format: S16_LE
+    Channels: 1
+    Endpoint: 2 IN (ASYNC)
+    Rates: 8000 - 48000 (continuous)
+)";
+
+int Parse(const char* text, UsbCapabilities* caps) {
+    FILE* file = fmemopen(const_cast<char*>(text), strlen(text), "r");
+    int ret = UsbProfileCache::ParseStreamFile(file, caps);
+    fclose(file);
+    return ret;
+}
+
+UsbFormatProfile MakeProfile(audio_format_t format, enum pcm_format pcmFormat,
+                             uint32_t channels, std::vector<uint32_t> rates) {
+    UsbFormatProfile profile = { format, pcmFormat, channels, rates, 0, 0 };
+    profile.minRate = rates.front();
+    profile.maxRate = rates.back();
+    return profile;
+}
+
+TEST(UsbProfilesTest, ParsesStreamDescriptors) {
+    UsbCapabilities caps;
+    ASSERT_EQ(0, Parse(DRAGONFLY_STREAM, &caps));
+
+    // The S32_LE alternate setting is dropped
+    ASSERT_EQ(2u, caps.playback.size());
+    EXPECT_EQ(AUDIO_FORMAT_PCM_16_BIT, caps.playback[0].format);
+    EXPECT_EQ(PCM_FORMAT_S16_LE, caps.playback[0].pcmFormat);
+    EXPECT_EQ(2u, caps.playback[0].channels);
+    EXPECT_EQ((std::vector<uint32_t>{ 44100, 48000, 88200, 96000 }), caps.playback[0].rates);
+    EXPECT_EQ(AUDIO_FORMAT_PCM_24_BIT_PACKED, caps.playback[1].format);
+    EXPECT_EQ(PCM_FORMAT_S24_3LE, caps.playback[1].pcmFormat);
+    EXPECT_EQ(44100u, caps.playback[1].minRate);
+    EXPECT_EQ(192000u, caps.playback[1].maxRate);
+    EXPECT_FALSE(caps.playback[1].SupportsRate(384000));
+
+    ASSERT_EQ(1u, caps.capture.size());
+    EXPECT_EQ(1u, caps.capture[0].channels);
+    EXPECT_TRUE(caps.capture[0].rates.empty());
+    EXPECT_EQ(8000u, caps.capture[0].minRate);
+    EXPECT_EQ(48000u, caps.capture[0].maxRate);
+    EXPECT_TRUE(caps.capture[0].SupportsRate(11025));
+    EXPECT_FALSE(caps.capture[0].SupportsRate(96000));
+}
+
+TEST(UsbProfilesTest, RejectsCardWithoutUsableProfiles) {
+    UsbCapabilities caps;
+    EXPECT_EQ(-ENODEV, Parse("Some Card at usb-1, full speed : USB Audio\n", &caps));
+    EXPECT_EQ(-ENODEV, Parse(R"(DSD Only at usb-1, high speed : USB Audio
+
+Playback:
+  Interface 1
+    Altset 1
+    Format: S32_LE
+    Channels: 2
+    Rates: 44100, 384000
+)", &caps));
+}
+
+TEST(UsbProfilesTest, SelectsClosestFormat) {
+    UsbCapabilities caps;
+    ASSERT_EQ(0, Parse(DRAGONFLY_STREAM, &caps));
+    UsbStreamConfig config;
+
+    ASSERT_EQ(0, UsbProfileCache::SelectConfig(caps.playback, 48000,
+                                               AUDIO_FORMAT_PCM_16_BIT, 2, &config));
+    EXPECT_EQ(48000u, config.sampleRate);
+    EXPECT_EQ(PCM_FORMAT_S16_LE, config.pcmFormat);
+
+    ASSERT_EQ(0, UsbProfileCache::SelectConfig(caps.playback, 48000,
+                                               AUDIO_FORMAT_PCM_FLOAT, 2, &config));
+    EXPECT_EQ(PCM_FORMAT_S24_3LE, config.pcmFormat);
+
+    // Only the 24-bit setting runs at 192 kHz
+    ASSERT_EQ(0, UsbProfileCache::SelectConfig(caps.playback, 192000,
+                                               AUDIO_FORMAT_PCM_16_BIT, 2, &config));
+    EXPECT_EQ(PCM_FORMAT_S24_3LE, config.pcmFormat);
+
+    EXPECT_EQ(-EINVAL, UsbProfileCache::SelectConfig(caps.playback, 384000,
+                                                     AUDIO_FORMAT_PCM_16_BIT, 2, &config));
+    EXPECT_EQ(-EINVAL, UsbProfileCache::SelectConfig(caps.capture, 96000,
+                                                     AUDIO_FORMAT_PCM_16_BIT, 1, &config));
+}
+
+TEST(UsbProfilesTest, SelectsClosestChannelCount) {
+    std::vector<UsbFormatProfile> profiles = {
+        MakeProfile(AUDIO_FORMAT_PCM_16_BIT, PCM_FORMAT_S16_LE, 2, { 48000 }),
+        MakeProfile(AUDIO_FORMAT_PCM_16_BIT, PCM_FORMAT_S16_LE, 8, { 48000 }),
+        MakeProfile(AUDIO_FORMAT_PCM_16_BIT, PCM_FORMAT_S16_LE, 6, { 48000 }),
+    };
+    UsbStreamConfig config;
+
+    ASSERT_EQ(0, UsbProfileCache::SelectConfig(profiles, 48000,
+                                               AUDIO_FORMAT_PCM_16_BIT, 6, &config));
+    EXPECT_EQ(6u, config.channels);
+    ASSERT_EQ(0, UsbProfileCache::SelectConfig(profiles, 48000,
+                                               AUDIO_FORMAT_PCM_16_BIT, 4, &config));
+    EXPECT_EQ(6u, config.channels);
+    ASSERT_EQ(0, UsbProfileCache::SelectConfig(profiles, 48000,
+                                               AUDIO_FORMAT_PCM_16_BIT, 12, &config));
+    EXPECT_EQ(8u, config.channels);
+
+    // Precision outranks channels
+    profiles.push_back(MakeProfile(AUDIO_FORMAT_PCM_24_BIT_PACKED, PCM_FORMAT_S24_3LE,
+                                   2, { 48000 }));
+    ASSERT_EQ(0, UsbProfileCache::SelectConfig(profiles, 48000,
+                                               AUDIO_FORMAT_PCM_FLOAT, 6, &config));
+    EXPECT_EQ(PCM_FORMAT_S24_3LE, config.pcmFormat);
+    EXPECT_EQ(2u, config.channels);
+}
+
+// A /proc/asound lookalike under the test's temporary directory
+class UsbProfileCacheTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        mRoot = ::testing::TempDir() + "usb_profiles_test." + std::to_string(getpid());
+        ASSERT_EQ(0, mkdir(mRoot.c_str(), 0700));
+    }
+
+    void TearDown() override {
+        for (const std::string& path : mFiles) {
+            unlink(path.c_str());
+        }
+        for (auto it = mDirs.rbegin(); it != mDirs.rend(); ++it) {
+            rmdir(it->c_str());
+        }
+        rmdir(mRoot.c_str());
+    }
+
+    void AddCard(unsigned int card, const char* usbId, const char* stream) {
+        std::string dir = mRoot + "/card" + std::to_string(card);
+        mkdir(dir.c_str(), 0700);
+        mDirs.push_back(dir);
+        WriteFile(dir + "/usbid", usbId);
+        WriteFile(dir + "/stream0", stream);
+    }
+
+    void RemoveCard(unsigned int card) {
+        std::string dir = mRoot + "/card" + std::to_string(card);
+        unlink((dir + "/usbid").c_str());
+        unlink((dir + "/stream0").c_str());
+    }
+
+    void WriteFile(const std::string& path, const char* text) {
+        FILE* file = fopen(path.c_str(), "w");
+        ASSERT_NE(nullptr, file);
+        fputs(text, file);
+        fclose(file);
+        mFiles.push_back(path);
+    }
+
+    std::string mRoot;
+    std::vector<std::string> mDirs;
+    std::vector<std::string> mFiles;
+};
+
+TEST_F(UsbProfileCacheTest, ReusesProfilesOfReplugs) {
+    UsbProfileCache cache(mRoot.c_str());
+    AddCard(1, "0d8c:0014\n", DRAGONFLY_STREAM);
+
+    auto first = cache.Probe(1);
+    ASSERT_NE(nullptr, first);
+    EXPECT_EQ(2u, first->playback.size());
+    EXPECT_EQ(1u, cache.GetProbeCount());
+    EXPECT_EQ(0u, cache.GetHitCount());
+
+    // Same device back on another card and port
+    RemoveCard(1);
+    std::string replugged = DRAGONFLY_STREAM;
+    replugged.replace(replugged.find("auto-1"), 6, "auto-2");
+    AddCard(2, "0d8c:0014\n", replugged.c_str());
+
+    auto second = cache.Probe(2);
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(1u, cache.GetProbeCount());
+    EXPECT_EQ(1u, cache.GetHitCount());
+}
+
+TEST_F(UsbProfileCacheTest, ProbesOtherDevices) {
+    UsbProfileCache cache(mRoot.c_str());
+    AddCard(1, "0d8c:0014\n", DRAGONFLY_STREAM);
+    AddCard(2, "0d8c:0015\n", DRAGONFLY_STREAM);
+
+    auto first = cache.Probe(1);
+    auto second = cache.Probe(2);
+    ASSERT_NE(nullptr, first);
+    ASSERT_NE(nullptr, second);
+    EXPECT_NE(first, second);
+    EXPECT_EQ(2u, cache.GetProbeCount());
+    EXPECT_EQ(0u, cache.GetHitCount());
+}
+
+TEST_F(UsbProfileCacheTest, IgnoresCardsWithoutStreams) {
+    UsbProfileCache cache(mRoot.c_str());
+    EXPECT_EQ(nullptr, cache.Probe(0));
+
+    AddCard(3, "0d8c:0016\n", "Empty Card at usb-1, full speed : USB Audio\n");
+    EXPECT_EQ(nullptr, cache.Probe(3));
+    EXPECT_EQ(0u, cache.GetProbeCount());
+}
+
+} // namespace
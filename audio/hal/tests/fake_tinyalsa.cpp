@@ -0,0 +1,445 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include "fake_tinyalsa.h"
+
+// The ALSA states the HAL can observe. SETUP is folded into PREPARED, as
+// tinyalsa prepares a stream itself before writing to it.
+enum PcmState {
+    PCM_STATE_PREPARED,
+    PCM_STATE_RUNNING,
+    PCM_STATE_XRUN,
+};
+
+struct pcm {
+    unsigned int card;
+    unsigned int device;
+    unsigned int flags;
+    struct pcm_config config;
+    bool ready;
+    unsigned int bufferFrames;
+    unsigned int stopThreshold;
+    size_t frameBytes;
+
+    // Frame counters of the ring: appl is where the HAL is, hw where the
+    // DAC or ADC is. hw advances with the clock while running.
+    PcmState state;
+    bool awaitingAudio;     // only silence written since open, stop or prepare
+    uint64_t appl;
+    uint64_t hwAtStart;
+    int64_t startNs;
+};
+
+struct mixer {
+};
+
+struct mixer_ctl {
+    std::string name;
+    enum mixer_ctl_type type;
+    std::vector<int> values;
+    std::vector<std::string> enums;
+};
+
+namespace {
+
+typedef std::pair<unsigned int, unsigned int> PcmId;
+
+struct State {
+    std::mutex lock;
+    double speed = 1.0;
+    std::map<PcmId, unsigned int> maxChannels;
+    std::map<PcmId, FakeAlsa::PcmStats> stats;
+    std::vector<std::unique_ptr<mixer_ctl>> controls;
+    unsigned int controlWrites = 0;
+    struct mixer mixer;
+};
+
+State gState;
+
+int64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+size_t PcmFormatBytes(enum pcm_format format) {
+    switch (format) {
+        case PCM_FORMAT_S16_LE:
+            return 2;
+        case PCM_FORMAT_S24_3LE:
+            return 3;
+        case PCM_FORMAT_S8:
+            return 1;
+        default:
+            return 4;
+    }
+}
+
+// Called with gState.lock held
+uint64_t HwPosition(const struct pcm* pcm, int64_t now) {
+    if (pcm->state != PCM_STATE_RUNNING) {
+        return pcm->hwAtStart;
+    }
+    double elapsed = (now - pcm->startNs) * 1e-9 * gState.speed;
+    return pcm->hwAtStart + static_cast<uint64_t>(elapsed * pcm->config.rate);
+}
+
+// Called with gState.lock held. A playback ring stops in XRUN once
+// stopThreshold frames are free, at the point they became free.
+void CheckXrun(struct pcm* pcm, int64_t now) {
+    if ((pcm->flags & PCM_IN) || pcm->state != PCM_STATE_RUNNING) {
+        return;
+    }
+    // hw + bufferFrames - appl frames are free
+    uint64_t stopAt = pcm->appl + pcm->stopThreshold;
+    if (HwPosition(pcm, now) + pcm->bufferFrames < stopAt) {
+        return;
+    }
+    pcm->state = PCM_STATE_XRUN;
+    pcm->hwAtStart = std::max(pcm->hwAtStart,
+                              stopAt - std::min<uint64_t>(stopAt, pcm->bufferFrames));
+    gState.stats[PcmId(pcm->card, pcm->device)].xruns++;
+}
+
+void Start(struct pcm* pcm, int64_t now) {
+    pcm->state = PCM_STATE_RUNNING;
+    pcm->startNs = now;
+}
+
+// Called with gState.lock held. Queued frames are dropped.
+void Prepare(struct pcm* pcm) {
+    pcm->state = PCM_STATE_PREPARED;
+    pcm->awaitingAudio = true;
+    pcm->hwAtStart = pcm->appl;
+}
+
+void SleepFrames(const struct pcm* pcm, uint64_t frames) {
+    double seconds = static_cast<double>(frames) / pcm->config.rate / gState.speed;
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+}
+
+// Frames of data before the first one with a non-zero byte
+uint64_t CountSilentFrames(const struct pcm* pcm, const void* data, unsigned int bytes) {
+    const uint8_t* bytesIn = static_cast<const uint8_t*>(data);
+    const uint8_t* end = std::find_if(bytesIn, bytesIn + bytes, [](uint8_t b) { return b != 0; });
+    return (end - bytesIn) / pcm->frameBytes;
+}
+
+// A positive sawtooth, every byte of frame n being 0x10 + n % 64, so
+// captured audio is never silent in any format or channel.
+void FillCapture(const struct pcm* pcm, uint64_t first, void* data, uint64_t frames) {
+    uint8_t* out = static_cast<uint8_t*>(data);
+    for (uint64_t i = 0; i < frames; i++) {
+        memset(out + i * pcm->frameBytes, 0x10 + (first + i) % 64, pcm->frameBytes);
+    }
+}
+
+int Write(struct pcm* pcm, const void* data, unsigned int bytes) {
+    uint64_t frames = bytes / pcm->frameBytes;
+    std::unique_lock<std::mutex> lock(gState.lock);
+    while (true) {
+        int64_t now = NowNs();
+        CheckXrun(pcm, now);
+        if (pcm->state == PCM_STATE_XRUN) {
+            // As tinyalsa: hand the xrun to the caller, or recover from it
+            if (pcm->flags & PCM_NORESTART) {
+                return -EPIPE;
+            }
+            Prepare(pcm);
+        }
+        uint64_t queued = pcm->appl - HwPosition(pcm, now);
+        if (queued + frames <= pcm->bufferFrames) {
+            break;
+        }
+        if (pcm->state != PCM_STATE_RUNNING) {
+            // Full before anyone started it: the start threshold
+            Start(pcm, now);
+            continue;
+        }
+        uint64_t wait = queued + frames - pcm->bufferFrames;
+        lock.unlock();
+        SleepFrames(pcm, wait);
+        lock.lock();
+    }
+    pcm->appl += frames;
+    FakeAlsa::PcmStats& stats = gState.stats[PcmId(pcm->card, pcm->device)];
+    stats.framesWritten += frames;
+    if (pcm->awaitingAudio) {
+        uint64_t silent = CountSilentFrames(pcm, data, bytes);
+        stats.silentStartFrames += std::min(silent, frames);
+        pcm->awaitingAudio = silent >= frames;
+    }
+    if (pcm->state != PCM_STATE_RUNNING && pcm->appl - pcm->hwAtStart >= pcm->bufferFrames) {
+        Start(pcm, NowNs());
+    }
+    return 0;
+}
+
+mixer_ctl* AddControlLocked(const char* name, enum mixer_ctl_type type,
+                            unsigned int numValues, int initial) {
+    std::unique_ptr<mixer_ctl> ctl(new mixer_ctl());
+    ctl->name = name;
+    ctl->type = type;
+    ctl->values.assign(numValues, initial);
+    gState.controls.push_back(std::move(ctl));
+    return gState.controls.back().get();
+}
+
+} // namespace
+
+void FakeAlsa::Reset() {
+    std::lock_guard<std::mutex> lock(gState.lock);
+    gState.speed = 1.0;
+    gState.maxChannels.clear();
+    gState.stats.clear();
+    gState.controls.clear();
+    gState.controlWrites = 0;
+}
+
+void FakeAlsa::SetSpeed(double speed) {
+    std::lock_guard<std::mutex> lock(gState.lock);
+    gState.speed = speed;
+}
+
+void FakeAlsa::SetMaxChannels(unsigned int card, unsigned int device,
+                              unsigned int maxChannels) {
+    std::lock_guard<std::mutex> lock(gState.lock);
+    gState.maxChannels[PcmId(card, device)] = maxChannels;
+}
+
+FakeAlsa::PcmStats FakeAlsa::GetPcmStats(unsigned int card, unsigned int device) {
+    std::lock_guard<std::mutex> lock(gState.lock);
+    return gState.stats[PcmId(card, device)];
+}
+
+void FakeAlsa::AddControl(const char* name, unsigned int numValues, int initial) {
+    std::lock_guard<std::mutex> lock(gState.lock);
+    AddControlLocked(name, MIXER_CTL_TYPE_INT, numValues, initial);
+}
+
+void FakeAlsa::AddEnumControl(const char* name, const std::vector<std::string>& values,
+                              int initial) {
+    std::lock_guard<std::mutex> lock(gState.lock);
+    AddControlLocked(name, MIXER_CTL_TYPE_ENUM, 1, initial)->enums = values;
+}
+
+int FakeAlsa::GetControlValue(const char* name, unsigned int index) {
+    std::lock_guard<std::mutex> lock(gState.lock);
+    for (const auto& ctl : gState.controls) {
+        if (ctl->name == name && index < ctl->values.size()) {
+            return ctl->values[index];
+        }
+    }
+    return -1;
+}
+
+unsigned int FakeAlsa::GetControlWrites() {
+    std::lock_guard<std::mutex> lock(gState.lock);
+    return gState.controlWrites;
+}
+
+struct pcm* pcm_open(unsigned int card, unsigned int device, unsigned int flags,
+                     struct pcm_config* config) {
+    std::lock_guard<std::mutex> lock(gState.lock);
+    PcmId id(card, device);
+    struct pcm* pcm = new struct pcm();
+    pcm->card = card;
+    pcm->device = device;
+    pcm->flags = flags;
+    pcm->config = *config;
+    auto limit = gState.maxChannels.find(id);
+    pcm->ready = config->rate > 0 && config->period_size > 0 && config->period_count > 0 &&
+        (limit == gState.maxChannels.end() || limit->second == 0 ||
+         config->channels <= limit->second);
+    pcm->bufferFrames = config->period_size * config->period_count;
+    // tinyalsa's default stop threshold is the whole buffer
+    pcm->stopThreshold = config->stop_threshold > 0 &&
+        config->stop_threshold < pcm->bufferFrames ? config->stop_threshold : pcm->bufferFrames;
+    pcm->frameBytes = PcmFormatBytes(config->format) * std::max(config->channels, 1u);
+    pcm->state = PCM_STATE_PREPARED;
+    pcm->awaitingAudio = true;
+    pcm->appl = 0;
+    pcm->hwAtStart = 0;
+    pcm->startNs = 0;
+
+    FakeAlsa::PcmStats& stats = gState.stats[id];
+    stats.opens++;
+    stats.lastConfig = *config;
+    return pcm;
+}
+
+int pcm_close(struct pcm* pcm) {
+    if (!pcm) {
+        return -EINVAL;
+    }
+    {
+        std::lock_guard<std::mutex> lock(gState.lock);
+        gState.stats[PcmId(pcm->card, pcm->device)].closes++;
+    }
+    delete pcm;
+    return 0;
+}
+
+int pcm_is_ready(struct pcm* pcm) {
+    return pcm && pcm->ready;
+}
+
+const char* pcm_get_error(struct pcm* pcm) {
+    return pcm && pcm->ready ? "" : "fake pcm rejected the configuration";
+}
+
+int pcm_write(struct pcm* pcm, const void* data, unsigned int count) {
+    return pcm->ready ? Write(pcm, data, count) : -EBADFD;
+}
+
+int pcm_mmap_write(struct pcm* pcm, const void* data, unsigned int count) {
+    return pcm_write(pcm, data, count);
+}
+
+int pcm_read(struct pcm* pcm, void* data, unsigned int count) {
+    if (!pcm->ready) {
+        return -EBADFD;
+    }
+    uint64_t frames = count / pcm->frameBytes;
+    std::unique_lock<std::mutex> lock(gState.lock);
+    if (pcm->state != PCM_STATE_RUNNING) {
+        Start(pcm, NowNs());
+    }
+    while (true) {
+        uint64_t captured = HwPosition(pcm, NowNs());
+        if (captured >= pcm->appl + frames) {
+            break;
+        }
+        uint64_t wait = pcm->appl + frames - captured;
+        lock.unlock();
+        SleepFrames(pcm, wait);
+        lock.lock();
+    }
+    const uint64_t first = pcm->appl;
+    pcm->appl += frames;
+    gState.stats[PcmId(pcm->card, pcm->device)].framesRead += frames;
+    lock.unlock();
+    FillCapture(pcm, first, data, frames);
+    return 0;
+}
+
+int pcm_mmap_read(struct pcm* pcm, void* data, unsigned int count) {
+    return pcm_read(pcm, data, count);
+}
+
+int pcm_get_htimestamp(struct pcm* pcm, unsigned int* avail, struct timespec* tstamp) {
+    std::lock_guard<std::mutex> lock(gState.lock);
+    int64_t now = NowNs();
+    CheckXrun(pcm, now);
+    // Only a running stream has a position to report
+    if (pcm->state != PCM_STATE_RUNNING) {
+        return -1;
+    }
+    uint64_t hw = HwPosition(pcm, now);
+    if (pcm->flags & PCM_IN) {
+        *avail = static_cast<unsigned int>(std::min<uint64_t>(hw - pcm->appl,
+                                                              pcm->bufferFrames));
+    } else {
+        *avail = static_cast<unsigned int>(pcm->bufferFrames - (pcm->appl - hw));
+    }
+    tstamp->tv_sec = now / 1000000000LL;
+    tstamp->tv_nsec = now % 1000000000LL;
+    return 0;
+}
+
+unsigned int pcm_get_buffer_size(struct pcm* pcm) {
+    return pcm->bufferFrames;
+}
+
+int pcm_start(struct pcm* pcm) {
+    std::lock_guard<std::mutex> lock(gState.lock);
+    if (pcm->state != PCM_STATE_PREPARED) {
+        return -EBADFD;
+    }
+    Start(pcm, NowNs());
+    return 0;
+}
+
+int pcm_stop(struct pcm* pcm) {
+    std::lock_guard<std::mutex> lock(gState.lock);
+    Prepare(pcm);
+    return 0;
+}
+
+int pcm_prepare(struct pcm* pcm) {
+    std::lock_guard<std::mutex> lock(gState.lock);
+    Prepare(pcm);
+    return 0;
+}
+
+unsigned int pcm_frames_to_bytes(struct pcm* pcm, unsigned int frames) {
+    return frames * pcm->frameBytes;
+}
+
+unsigned int pcm_bytes_to_frames(struct pcm* pcm, unsigned int bytes) {
+    return bytes / pcm->frameBytes;
+}
+
+struct mixer* mixer_open(unsigned int) {
+    return &gState.mixer;
+}
+
+void mixer_close(struct mixer*) {
+}
+
+struct mixer_ctl* mixer_get_ctl_by_name(struct mixer*, const char* name) {
+    std::lock_guard<std::mutex> lock(gState.lock);
+    for (const auto& ctl : gState.controls) {
+        if (ctl->name == name) {
+            return ctl.get();
+        }
+    }
+    return nullptr;
+}
+
+unsigned int mixer_ctl_get_num_values(struct mixer_ctl* ctl) {
+    return ctl->values.size();
+}
+
+enum mixer_ctl_type mixer_ctl_get_type(struct mixer_ctl* ctl) {
+    return ctl->type;
+}
+
+int mixer_ctl_get_value(struct mixer_ctl* ctl, unsigned int id) {
+    std::lock_guard<std::mutex> lock(gState.lock);
+    return id < ctl->values.size() ? ctl->values[id] : -EINVAL;
+}
+
+int mixer_ctl_set_value(struct mixer_ctl* ctl, unsigned int id, int value) {
+    std::lock_guard<std::mutex> lock(gState.lock);
+    if (id >= ctl->values.size()) {
+        return -EINVAL;
+    }
+    ctl->values[id] = value;
+    gState.controlWrites++;
+    return 0;
+}
+
+int mixer_ctl_set_enum_by_string(struct mixer_ctl* ctl, const char* string) {
+    for (size_t i = 0; i < ctl->enums.size(); i++) {
+        if (ctl->enums[i] == string) {
+            return mixer_ctl_set_value(ctl, 0, static_cast<int>(i));
+        }
+    }
+    return -EINVAL;
+}
+
+unsigned int mixer_ctl_get_num_enums(struct mixer_ctl* ctl) {
+    return ctl->enums.size();
+}
+
+const char* mixer_ctl_get_enum_string(struct mixer_ctl* ctl, unsigned int enum_id) {
+    return enum_id < ctl->enums.size() ? ctl->enums[enum_id].c_str() : nullptr;
+}
@@ -0,0 +1,57 @@
+#ifndef AUDIO_FAKE_TINYALSA_H
+#define AUDIO_FAKE_TINYALSA_H
+
+#include <tinyalsa/asoundlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// tinyalsa backed by a clock instead of a sound card, linked in place of
+// libtinyalsa so the HAL runs on any device or host.
+//
+// A PCM consumes (or produces) frames at its configured rate from the
+// moment it starts, scaled by SetSpeed. pcm_write blocks while the ring
+// is full and pcm_read until a period was captured, so the HAL sees the
+// same period timing as on hardware. Captured frames are a non-zero
+// sawtooth. A playback PCM left to drain to its stop threshold (the whole
+// buffer by default) stops in XRUN and counts an xrun. The next write
+// then fails with -EPIPE if the PCM was opened with PCM_NORESTART, and
+// otherwise prepares and restarts it, as tinyalsa does.
+// pcm_get_htimestamp fails unless the PCM is running. The mixer is a
+// table of controls added by the test.
+class FakeAlsa {
+public:
+    struct PcmStats {
+        unsigned int opens;
+        unsigned int closes;
+        unsigned int xruns;
+        uint64_t framesWritten;
+        uint64_t framesRead;
+        uint64_t silentStartFrames; // silence written after open, stop or prepare
+                                    // before the first non-zero sample
+        struct pcm_config lastConfig;
+    };
+
+    // Closes nothing, but forgets all counters, controls and failures.
+    static void Reset();
+
+    // Time runs this many times faster than real time. 1 by default.
+    static void SetSpeed(double speed);
+
+    // pcm_open on card/device returns a PCM that is not ready while
+    // config->channels > maxChannels; 0 removes the limit.
+    static void SetMaxChannels(unsigned int card, unsigned int device,
+                               unsigned int maxChannels);
+
+    static PcmStats GetPcmStats(unsigned int card, unsigned int device);
+
+    // Mixer controls of every card
+    static void AddControl(const char* name, unsigned int numValues, int initial);
+    static void AddEnumControl(const char* name, const std::vector<std::string>& values,
+                               int initial);
+    static int GetControlValue(const char* name, unsigned int index);
+    static unsigned int GetControlWrites();
+};
+
+#endif // AUDIO_FAKE_TINYALSA_H
@@ -0,0 +1,209 @@
+#include <tinycompress/tinycompress.h>
+#include <errno.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include "fake_tinycompress.h"
+
+namespace {
+
+enum class DeviceState {
+    CLOSED,
+    PREPARED,
+    RUNNING,
+    PAUSED,
+};
+
+struct Device {
+    std::mutex lock;
+    std::condition_variable changed;
+    DeviceState state = DeviceState::CLOSED;
+    size_t bufferBytes = 0;
+    size_t queuedBytes = 0;
+    unsigned int samples = 0;
+    unsigned int blockedCalls = 0;
+    unsigned int stops = 0;     // wakes calls blocked across a stop
+};
+
+Device gDevice;
+
+// The handle only needs to be unique; all state lives in gDevice.
+struct compress* DeviceHandle() {
+    return reinterpret_cast<struct compress*>(&gDevice);
+}
+
+int Fail(int error) {
+    errno = error;
+    return -1;
+}
+
+int Drain() {
+    std::unique_lock<std::mutex> lock(gDevice.lock);
+    if (gDevice.state != DeviceState::RUNNING && gDevice.state != DeviceState::PAUSED) {
+        return Fail(EPERM);
+    }
+    unsigned int stops = gDevice.stops;
+    gDevice.blockedCalls++;
+    gDevice.changed.notify_all();
+    gDevice.changed.wait(lock, [stops] {
+        return gDevice.queuedBytes == 0 || gDevice.stops != stops;
+    });
+    gDevice.blockedCalls--;
+    return 0;
+}
+
+} // namespace
+
+void FakeCompress::Reset(size_t bufferBytes) {
+    std::lock_guard<std::mutex> lock(gDevice.lock);
+    gDevice.state = DeviceState::CLOSED;
+    gDevice.bufferBytes = bufferBytes;
+    gDevice.queuedBytes = 0;
+    gDevice.samples = 0;
+    gDevice.blockedCalls = 0;
+}
+
+void FakeCompress::Consume(size_t bytes) {
+    std::lock_guard<std::mutex> lock(gDevice.lock);
+    if (gDevice.state != DeviceState::RUNNING) {
+        return;
+    }
+    bytes = std::min(bytes, gDevice.queuedBytes);
+    gDevice.queuedBytes -= bytes;
+    gDevice.samples += bytes / 4;
+    gDevice.changed.notify_all();
+}
+
+size_t FakeCompress::GetQueuedBytes() {
+    std::lock_guard<std::mutex> lock(gDevice.lock);
+    return gDevice.queuedBytes;
+}
+
+bool FakeCompress::IsRunning() {
+    std::lock_guard<std::mutex> lock(gDevice.lock);
+    return gDevice.state == DeviceState::RUNNING;
+}
+
+bool FakeCompress::IsOpen() {
+    std::lock_guard<std::mutex> lock(gDevice.lock);
+    return gDevice.state != DeviceState::CLOSED;
+}
+
+bool FakeCompress::WaitForBlockedCall(int timeoutMs) {
+    std::unique_lock<std::mutex> lock(gDevice.lock);
+    return gDevice.changed.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                                    [] { return gDevice.blockedCalls > 0; });
+}
+
+struct compress* compress_open(unsigned int, unsigned int, unsigned int,
+                               struct compr_config*) {
+    std::lock_guard<std::mutex> lock(gDevice.lock);
+    gDevice.state = DeviceState::PREPARED;
+    gDevice.queuedBytes = 0;
+    gDevice.samples = 0;
+    return DeviceHandle();
+}
+
+void compress_close(struct compress*) {
+    std::lock_guard<std::mutex> lock(gDevice.lock);
+    gDevice.state = DeviceState::CLOSED;
+}
+
+int is_compress_ready(struct compress*) {
+    return 1;
+}
+
+const char* compress_get_error(struct compress*) {
+    return "fake compress error";
+}
+
+void compress_nonblock(struct compress*, int) {
+}
+
+int compress_write(struct compress*, const void*, unsigned int size) {
+    std::lock_guard<std::mutex> lock(gDevice.lock);
+    size_t accepted = std::min<size_t>(size, gDevice.bufferBytes - gDevice.queuedBytes);
+    gDevice.queuedBytes += accepted;
+    return static_cast<int>(accepted);
+}
+
+int compress_start(struct compress*) {
+    std::lock_guard<std::mutex> lock(gDevice.lock);
+    if (gDevice.state != DeviceState::PREPARED) {
+        return Fail(EPERM);
+    }
+    gDevice.state = DeviceState::RUNNING;
+    return 0;
+}
+
+int compress_stop(struct compress*) {
+    std::lock_guard<std::mutex> lock(gDevice.lock);
+    if (gDevice.state != DeviceState::RUNNING && gDevice.state != DeviceState::PAUSED) {
+        return Fail(EPERM);
+    }
+    gDevice.state = DeviceState::PREPARED;
+    gDevice.queuedBytes = 0;
+    gDevice.stops++;
+    gDevice.changed.notify_all();
+    return 0;
+}
+
+int compress_pause(struct compress*) {
+    std::lock_guard<std::mutex> lock(gDevice.lock);
+    if (gDevice.state != DeviceState::RUNNING) {
+        return Fail(EPERM);
+    }
+    gDevice.state = DeviceState::PAUSED;
+    return 0;
+}
+
+int compress_resume(struct compress*) {
+    std::lock_guard<std::mutex> lock(gDevice.lock);
+    if (gDevice.state != DeviceState::PAUSED) {
+        return Fail(EPERM);
+    }
+    gDevice.state = DeviceState::RUNNING;
+    return 0;
+}
+
+int compress_wait(struct compress*, int timeoutMs) {
+    std::unique_lock<std::mutex> lock(gDevice.lock);
+    unsigned int stops = gDevice.stops;
+    auto ready = [stops] {
+        return gDevice.queuedBytes < gDevice.bufferBytes || gDevice.stops != stops;
+    };
+    gDevice.blockedCalls++;
+    gDevice.changed.notify_all();
+    bool woken = true;
+    if (timeoutMs < 0) {
+        gDevice.changed.wait(lock, ready);
+    } else {
+        woken = gDevice.changed.wait_for(lock, std::chrono::milliseconds(timeoutMs), ready);
+    }
+    gDevice.blockedCalls--;
+    return woken ? 0 : Fail(ETIME);
+}
+
+int compress_drain(struct compress*) {
+    return Drain();
+}
+
+int compress_partial_drain(struct compress*) {
+    return Drain();
+}
+
+int compress_next_track(struct compress*) {
+    return 0;
+}
+
+int compress_set_gapless_metadata(struct compress*, struct compr_gapless_mdata*) {
+    return 0;
+}
+
+int compress_get_tstamp(struct compress*, unsigned int* samples, unsigned int* samplingRate) {
+    std::lock_guard<std::mutex> lock(gDevice.lock);
+    *samples = gDevice.samples;
+    *samplingRate = 48000;
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef AUDIO_FAKE_TINYCOMPRESS_H
+#define AUDIO_FAKE_TINYCOMPRESS_H
+
+#include <stddef.h>
+
+// A tinycompress device backed by a byte counter instead of a DSP, linked
+// in place of libtinycompress. It follows the kernel's rules for the calls
+// CompressOffload makes: writes take what fits, waits and drains block
+// until the test plays queued bytes, stop only wakes a running device and
+// empties it, and a wait for space on a device that is not running never
+// ends before its timeout.
+class FakeCompress {
+public:
+    // Forgets all state; the next device opened buffers bufferBytes.
+    static void Reset(size_t bufferBytes);
+
+    // Plays bytes from the DSP buffer if running, waking waits and drains.
+    static void Consume(size_t bytes);
+
+    static size_t GetQueuedBytes();
+    static bool IsRunning();
+    static bool IsOpen();
+
+    // Waits until a thread blocks in compress_wait or compress_drain.
+    static bool WaitForBlockedCall(int timeoutMs);
+};
+
+#endif // AUDIO_FAKE_TINYCOMPRESS_H
@@ -0,0 +1,258 @@
+#define LOG_TAG "gralloc_sm8650"
+
+#include <log/log.h>
+#include <hardware/gralloc1.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "gralloc_allocator.h"
+
+namespace {
+
+constexpr const char* DMA_HEAP_PATH = "/dev/dma_heap/system";
+
+} // namespace
+
+GrallocAllocator::GrallocAllocator()
+    : mHeapFd(open(DMA_HEAP_PATH, O_RDONLY | O_CLOEXEC))
+    , mBytesHeld(0)
+    , mAllocations(0)
+    , mPoolHits(0)
+    , mHeapAllocations(0) {
+    if (mHeapFd < 0) {
+        ALOGW("No %s (%s), allocating from memfd", DMA_HEAP_PATH, strerror(errno));
+    }
+}
+
+GrallocAllocator::~GrallocAllocator() {
+    Trim();
+    if (mHeapFd >= 0) {
+        close(mHeapFd);
+    }
+}
+
+size_t GrallocAllocator::SizeClass(size_t size) {
+    size = (size + PAGE_SIZE_BYTES - 1) & ~(PAGE_SIZE_BYTES - 1);
+    if (size <= 8 * PAGE_SIZE_BYTES) {
+        return size;
+    }
+    int exponent = 63 - __builtin_clzll(static_cast<uint64_t>(size));
+    size_t step = size_t(1) << (exponent - 3);
+    return (size + step - 1) & ~(step - 1);
+}
+
+int GrallocAllocator::Allocate(size_t size, uint64_t producerUsage, uint64_t consumerUsage,
+                               size_t* outSize) {
+    if (size == 0) {
+        return -EINVAL;
+    }
+    size = SizeClass(size);
+
+    // The fdinfo read behind IsShared runs outside the pool lock. Each
+    // candidate is taken out of the pool first, so no other allocation or
+    // trim can touch it while it is checked.
+    int fd = -1;
+    std::vector<PoolEntry> shared;
+    for (;;) {
+        PoolEntry candidate = { -1, 0, 0, 0 };
+        {
+            std::lock_guard<Mutex> lock(mPoolLock);
+            for (size_t i = mPool.size(); i-- > 0;) {
+                const PoolEntry& entry = mPool[i];
+                if (entry.size == size && entry.producerUsage == producerUsage &&
+                        entry.consumerUsage == consumerUsage) {
+                    candidate = entry;
+                    mBytesHeld -= entry.size;
+                    mPool.erase(mPool.begin() + i);
+                    break;
+                }
+            }
+        }
+        if (candidate.fd < 0) {
+            break;
+        }
+        if (!IsShared(candidate.fd)) {
+            fd = candidate.fd;
+            break;
+        }
+        shared.push_back(candidate);
+    }
+
+    std::vector<int> evicted;
+    {
+        std::lock_guard<Mutex> lock(mPoolLock);
+        mAllocations++;
+        if (fd >= 0) {
+            mPoolHits++;
+        }
+        // Buffers an importer still holds go back as the oldest, first to be
+        // trimmed.
+        for (const PoolEntry& entry : shared) {
+            mBytesHeld += entry.size;
+        }
+        mPool.insert(mPool.begin(), shared.begin(), shared.end());
+        TrimLocked(MAX_POOL_BUFFERS, MAX_POOL_BYTES, &evicted);
+    }
+    for (int evictedFd : evicted) {
+        close(evictedFd);
+    }
+
+    if (fd >= 0) {
+        // The previous owner's contents must not leak into the next one.
+        if (ClearBuffer(fd, size) == 0) {
+            *outSize = size;
+            return fd;
+        }
+        close(fd);
+    }
+
+    fd = mHeapFd >= 0 ? AllocateFromHeap(size) : AllocateFromMemfd(size);
+    if (fd < 0) {
+        // Pooled buffers of other shapes may be what is exhausting memory.
+        Trim();
+        fd = mHeapFd >= 0 ? AllocateFromHeap(size) : AllocateFromMemfd(size);
+        if (fd < 0) {
+            return fd;
+        }
+    }
+    {
+        std::lock_guard<Mutex> lock(mPoolLock);
+        mHeapAllocations++;
+    }
+    *outSize = size;
+    return fd;
+}
+
+void GrallocAllocator::Free(int fd, size_t size, uint64_t producerUsage,
+                            uint64_t consumerUsage) {
+    if (fd < 0) {
+        return;
+    }
+    if (mHeapFd < 0 || (producerUsage & GRALLOC1_PRODUCER_USAGE_PROTECTED) ||
+            size > MAX_POOL_BYTES) {
+        close(fd);
+        return;
+    }
+
+    std::vector<int> evicted;
+    {
+        std::lock_guard<Mutex> lock(mPoolLock);
+        mPool.push_back({ fd, size, producerUsage, consumerUsage });
+        mBytesHeld += size;
+        TrimLocked(MAX_POOL_BUFFERS, MAX_POOL_BYTES, &evicted);
+    }
+    for (int evictedFd : evicted) {
+        close(evictedFd);
+    }
+}
+
+void GrallocAllocator::Trim() {
+    std::vector<int> evicted;
+    {
+        std::lock_guard<Mutex> lock(mPoolLock);
+        TrimLocked(0, 0, &evicted);
+    }
+    for (int fd : evicted) {
+        close(fd);
+    }
+}
+
+void GrallocAllocator::TrimLocked(size_t maxBuffers, size_t maxBytes,
+                                  std::vector<int>* evicted) {
+    size_t count = 0;
+    while (count < mPool.size() &&
+            (mPool.size() - count > maxBuffers || mBytesHeld > maxBytes)) {
+        evicted->push_back(mPool[count].fd);
+        mBytesHeld -= mPool[count].size;
+        count++;
+    }
+    mPool.erase(mPool.begin(), mPool.begin() + count);
+}
+
+GrallocAllocator::Stats GrallocAllocator::GetStats() const {
+    std::lock_guard<Mutex> lock(mPoolLock);
+    Stats stats;
+    stats.allocations = mAllocations;
+    stats.poolHits = mPoolHits;
+    stats.heapAllocations = mHeapAllocations;
+    stats.buffersHeld = mPool.size();
+    stats.bytesHeld = mBytesHeld;
+    return stats;
+}
+
+// dma-buf fdinfo carries the file's reference count, less the one procfs
+// takes to print it. Dups in other processes, fds in flight over binder,
+// mappings and device attachments all hold one.
+bool GrallocAllocator::IsShared(int fd) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", fd);
+    FILE* file = fopen(path, "re");
+    if (!file) {
+        return true;
+    }
+    long count = -1;
+    char line[128];
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "count: %ld", &count) == 1) {
+            break;
+        }
+    }
+    fclose(file);
+    return count != 1;
+}
+
+int GrallocAllocator::AllocateFromHeap(size_t size) {
+    struct dma_heap_allocation_data data;
+    memset(&data, 0, sizeof(data));
+    data.len = size;
+    data.fd_flags = O_RDWR | O_CLOEXEC;
+    if (ioctl(mHeapFd, DMA_HEAP_IOCTL_ALLOC, &data) < 0) {
+        int err = errno;
+        ALOGE("dma-heap allocation of %zu bytes failed: %s", size, strerror(err));
+        return -err;
+    }
+    return data.fd;
+}
+
+int GrallocAllocator::AllocateFromMemfd(size_t size) {
+    int fd = memfd_create("gralloc-buffer", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        int err = errno;
+        ALOGE("memfd_create failed: %s", strerror(err));
+        return -err;
+    }
+    // Importers must not be able to resize a buffer under its other users.
+    if (ftruncate(fd, size) < 0 ||
+            fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        int err = errno;
+        ALOGE("Failed to size memfd to %zu bytes: %s", size, strerror(err));
+        close(fd);
+        return -err;
+    }
+    return fd;
+}
+
+int GrallocAllocator::ClearBuffer(int fd, size_t size) {
+    void* addr = mmap(nullptr, size, PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        int err = errno;
+        ALOGE("Failed to map pooled buffer: %s", strerror(err));
+        return -err;
+    }
+
+    // Sync calls fail with ENOTTY on memfds, which need none.
+    struct dma_buf_sync sync = { DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE };
+    ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+    memset(addr, 0, size);
+    sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE;
+    ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+    munmap(addr, size);
+    return 0;
+}
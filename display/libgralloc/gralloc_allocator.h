@@ -0,0 +1,86 @@
+#ifndef GRALLOC_ALLOCATOR_H
+#define GRALLOC_ALLOCATOR_H
+
+#include <utils/Mutex.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+using namespace android;
+
+// Backing memory for gralloc buffers.
+//
+// Buffers come from the dma-buf system heap, or from sealed memfds where
+// /dev/dma_heap is missing. Sizes are rounded up to a size class, and a
+// released dma-buf is parked in a free pool keyed by size class and usage,
+// so the steady allocate/release churn of a BufferQueue is served without
+// a kernel allocation. Importers hold dups of a buffer's fd long after
+// gralloc releases it, so a parked buffer is only reused once the kernel
+// reports the pool's fd as its last reference. Reused buffers are cleared
+// before they are handed out; protected buffers cannot be cleared from the
+// CPU and memfds do not report their references, so neither is pooled.
+// The pool is bounded by MAX_POOL_BUFFERS and MAX_POOL_BYTES and evicts
+// the longest-parked buffer first.
+class GrallocAllocator {
+public:
+    struct Stats {
+        uint64_t allocations;
+        uint64_t poolHits;
+        uint64_t heapAllocations;   // served by dma-buf heap or memfd
+        size_t buffersHeld;         // parked in the pool
+        size_t bytesHeld;
+    };
+
+    GrallocAllocator();
+    ~GrallocAllocator();
+
+    // Returns an fd backing at least size bytes, or a negative errno.
+    // outSize receives the size class actually allocated.
+    int Allocate(size_t size, uint64_t producerUsage, uint64_t consumerUsage,
+                 size_t* outSize);
+
+    // Takes ownership of fd, which must come from Allocate with the same
+    // usage; size is the size class Allocate returned.
+    void Free(int fd, size_t size, uint64_t producerUsage, uint64_t consumerUsage);
+
+    // Closes every pooled buffer.
+    void Trim();
+
+    Stats GetStats() const;
+    bool UsesDmaHeap() const { return mHeapFd >= 0; }
+
+    // Rounds size up to a page and then to one of eight steps per power of
+    // two, so at most 12.5% of a buffer is slack.
+    static size_t SizeClass(size_t size);
+
+private:
+    static constexpr size_t PAGE_SIZE_BYTES = 4096;
+    static constexpr size_t MAX_POOL_BUFFERS = 32;
+    static constexpr size_t MAX_POOL_BYTES = 128 * 1024 * 1024;
+
+    struct PoolEntry {
+        int fd;
+        size_t size;
+        uint64_t producerUsage;
+        uint64_t consumerUsage;
+    };
+
+    // True unless fd holds the only reference to its dma-buf
+    static bool IsShared(int fd);
+
+    int AllocateFromHeap(size_t size);
+    int AllocateFromMemfd(size_t size);
+    int ClearBuffer(int fd, size_t size);
+    void TrimLocked(size_t maxBuffers, size_t maxBytes, std::vector<int>* evicted);
+
+    int mHeapFd;
+
+    mutable Mutex mPoolLock;
+    std::vector<PoolEntry> mPool;       // oldest first
+    size_t mBytesHeld;
+    uint64_t mAllocations;
+    uint64_t mPoolHits;
+    uint64_t mHeapAllocations;
+};
+
+#endif // GRALLOC_ALLOCATOR_H
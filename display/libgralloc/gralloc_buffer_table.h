@@ -0,0 +1,183 @@
+#ifndef GRALLOC_BUFFER_TABLE_H
+#define GRALLOC_BUFFER_TABLE_H
+
+#include <utils/Mutex.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+using namespace android;
+
+// Fixed table of live buffers addressed by slot index and generation.
+//
+// Each handle carries the slot and generation it was inserted with, so a
+// lookup is an index and never takes a lock: every slot is a sequence
+// lock over relaxed atomic words, and a reader retries while an insert or
+// remove on the same slot is in flight. Removing a buffer bumps the slot
+// generation, so a stale or double-freed handle misses instead of
+// aliasing the buffer that reuses its slot. Inserts and removes are
+// serialized by mWriteLock.
+template <typename T, uint32_t CAPACITY>
+class GrallocBufferTable {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "GrallocBufferTable entries must be trivially copyable");
+
+public:
+    GrallocBufferTable() : mSlots(new Slot[CAPACITY]) {
+        mFreeSlots.reserve(CAPACITY);
+        for (uint32_t i = CAPACITY; i-- > 0;) {
+            mSlots[i].seq.store(0, std::memory_order_relaxed);
+            mSlots[i].generation.store(0, std::memory_order_relaxed);
+            mSlots[i].lastGeneration = 0;
+            mFreeSlots.push_back(i);
+        }
+    }
+
+    // Returns 0 and the new entry's key, or -ENOMEM when the table is full.
+    int Insert(const T& value, uint32_t* outSlot, uint32_t* outGeneration) {
+        std::lock_guard<Mutex> lock(mWriteLock);
+        if (mFreeSlots.empty()) {
+            return -ENOMEM;
+        }
+        uint32_t index = mFreeSlots.back();
+        mFreeSlots.pop_back();
+
+        Slot& slot = mSlots[index];
+        // Generation 0 marks a free slot.
+        uint32_t generation = slot.lastGeneration + 1;
+        if (generation == 0) {
+            generation = 1;
+        }
+        slot.lastGeneration = generation;
+        Write(&slot, &value, generation);
+
+        *outSlot = index;
+        *outGeneration = generation;
+        return 0;
+    }
+
+    // Copies the entry out and frees the slot; false if the key is stale.
+    bool Remove(uint32_t index, uint32_t generation, T* outValue) {
+        std::lock_guard<Mutex> lock(mWriteLock);
+        if (!Lookup(index, generation, outValue)) {
+            return false;
+        }
+        Write(&mSlots[index], nullptr, 0);
+        mFreeSlots.push_back(index);
+        return true;
+    }
+
+    // Lock-free; false if the key does not name a live entry.
+    bool Lookup(uint32_t index, uint32_t generation, T* outValue) const {
+        if (index >= CAPACITY || generation == 0) {
+            return false;
+        }
+        const Slot& slot = mSlots[index];
+        uint64_t words[WORDS];
+        uint32_t begin;
+        uint32_t end;
+        uint32_t current;
+        do {
+            begin = slot.seq.load(std::memory_order_acquire);
+            current = slot.generation.load(std::memory_order_relaxed);
+            if (current != generation) {
+                // Either stale or mid-update; a retry cannot turn a stale
+                // key live, so only spin while a write is in flight.
+                if (begin & 1) {
+                    continue;
+                }
+                return false;
+            }
+            for (size_t i = 0; i < WORDS; i++) {
+                words[i] = slot.words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            end = slot.seq.load(std::memory_order_relaxed);
+        } while ((begin & 1) || begin != end);
+
+        memcpy(outValue, words, sizeof(T));
+        return true;
+    }
+
+    // Calls visit(slot, generation, value) for every live entry with
+    // inserts and removes held off; for dumps.
+    template <typename Visitor>
+    void ForEach(Visitor visit) const {
+        std::lock_guard<Mutex> lock(mWriteLock);
+        for (uint32_t index = 0; index < CAPACITY; index++) {
+            T value;
+            uint32_t generation = ReadLocked(index, &value);
+            if (generation) {
+                visit(index, generation, value);
+            }
+        }
+    }
+
+    // Removes every live entry; for teardown.
+    void Drain(std::vector<T>* outValues) {
+        std::lock_guard<Mutex> lock(mWriteLock);
+        for (uint32_t index = 0; index < CAPACITY; index++) {
+            T value;
+            if (ReadLocked(index, &value)) {
+                outValues->push_back(value);
+                Write(&mSlots[index], nullptr, 0);
+                mFreeSlots.push_back(index);
+            }
+        }
+    }
+
+    size_t GetLiveCount() const {
+        std::lock_guard<Mutex> lock(mWriteLock);
+        return CAPACITY - mFreeSlots.size();
+    }
+
+private:
+    static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    struct Slot {
+        std::atomic<uint32_t> seq;          // odd while a write is in flight
+        std::atomic<uint32_t> generation;   // 0 while free
+        uint32_t lastGeneration;            // guarded by mWriteLock
+        std::atomic<uint64_t> words[WORDS];
+    };
+
+    // Returns the slot generation, 0 if free; caller holds mWriteLock.
+    uint32_t ReadLocked(uint32_t index, T* outValue) const {
+        const Slot& slot = mSlots[index];
+        uint32_t generation = slot.generation.load(std::memory_order_relaxed);
+        if (generation) {
+            uint64_t words[WORDS];
+            for (size_t i = 0; i < WORDS; i++) {
+                words[i] = slot.words[i].load(std::memory_order_relaxed);
+            }
+            memcpy(outValue, words, sizeof(T));
+        }
+        return generation;
+    }
+
+    // Publishes value under generation, or clears the slot when value is null.
+    static void Write(Slot* slot, const T* value, uint32_t generation) {
+        uint64_t words[WORDS] = {};
+        if (value) {
+            memcpy(words, value, sizeof(T));
+        }
+        uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+        slot->seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot->generation.store(generation, std::memory_order_relaxed);
+        for (size_t i = 0; i < WORDS; i++) {
+            slot->words[i].store(words[i], std::memory_order_relaxed);
+        }
+        slot->seq.store(seq + 2, std::memory_order_release);
+    }
+
+    std::unique_ptr<Slot[]> mSlots;
+    mutable Mutex mWriteLock;
+    std::vector<uint32_t> mFreeSlots;
+};
+
+#endif // GRALLOC_BUFFER_TABLE_H
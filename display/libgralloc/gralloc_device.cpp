@@ -1,17 +1,52 @@
 #define LOG_TAG "gralloc_sm8650"
 
 #include <log/log.h>
+#include <sync/sync.h>
+#include <utils/Timers.h>
+#include <linux/dma-buf.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
 #include "gralloc_device.h"
 
-GrallocDevice::GrallocDevice() {
+GrallocDevice::GrallocDevice()
+    : gralloc1_device_t()
+    , mNextDescriptor(1)
+    , mMappings(new Mapping[MAX_BUFFERS]()) {
 }
 
 GrallocDevice::~GrallocDevice() {
-    // Clean up any remaining buffers
-    std::lock_guard<Mutex> lock(mBufferLock);
-    mBuffers.clear();
+    // Clean up any remaining buffers; each one is a client leak.
+    std::vector<Buffer> buffers;
+    mBuffers.Drain(&buffers);
+    if (!buffers.empty()) {
+        size_t bytes = 0;
+        for (const Buffer& buffer : buffers) {
+            bytes += buffer.size;
+            ALOGW("Leaked buffer %ux%u format %#x, %zu bytes, allocated by %d/%d",
+                  buffer.desc.width, buffer.desc.height, buffer.desc.format, buffer.size,
+                  buffer.record.pid, buffer.record.tid);
+        }
+        ALOGW("%zu buffers (%zu KiB) still allocated at close", buffers.size(), bytes / 1024);
+    }
+    {
+        std::lock_guard<Mutex> lock(mMappingLock);
+        for (uint32_t slot = 0; slot < MAX_BUFFERS; slot++) {
+            UnmapLocked(slot);
+        }
+    }
+    for (const Buffer& buffer : buffers) {
+        GrallocMetadataAccess::Unmap(buffer.metadata);
+        close(buffer.metadataFd);
+        close(buffer.fd);
+        native_handle_delete(buffer.handle);
+    }
+
+    std::lock_guard<Mutex> lock(mDescriptorLock);
+    mDescriptors.clear();
 }
 
 int GrallocDevice::HookDevOpen(const struct hw_module_t* module, const char* name,
@@ -21,62 +56,226 @@ int GrallocDevice::HookDevOpen(const struct hw_module_t* module, const char* nam
         return -EINVAL;
     }
 
+    // The hooks recover the device from the gralloc1_device_t it derives from.
     GrallocDevice* dev = new GrallocDevice();
     if (!dev) {
         ALOGE("Failed to allocate GrallocDevice");
         return -ENOMEM;
     }
 
-    gralloc1_device_t* gralloc1_dev = new gralloc1_device_t();
-    if (!gralloc1_dev) {
-        delete dev;
-        return -ENOMEM;
-    }
-
-    gralloc1_dev->common.tag = HARDWARE_DEVICE_TAG;
-    gralloc1_dev->common.version = GRALLOC1_DEVICE_API_VERSION_1_0;
-    gralloc1_dev->common.module = const_cast<hw_module_t*>(module);
-    gralloc1_dev->common.close = nullptr;  // Will be set by framework
+    dev->common.tag = HARDWARE_DEVICE_TAG;
+    dev->common.version = GRALLOC1_DEVICE_API_VERSION_1_0;
+    dev->common.module = const_cast<hw_module_t*>(module);
+    dev->common.close = CloseDevice;
 
     // Set function hooks
-    gralloc1_dev->createBuffer = CreateBuffer;
-    gralloc1_dev->releaseBuffer = ReleaseBuffer;
-    gralloc1_dev->getBufferProperties = GetBufferProperties;
+    dev->createDescriptor = CreateDescriptor;
+    dev->destroyDescriptor = DestroyDescriptor;
+    dev->setDimensions = SetDimensions;
+    dev->setFormat = SetFormat;
+    dev->setProducerUsage = SetProducerUsage;
+    dev->setConsumerUsage = SetConsumerUsage;
+    dev->createBuffer = CreateBuffer;
+    dev->releaseBuffer = ReleaseBuffer;
+    dev->getBufferProperties = GetBufferProperties;
+    dev->lock = Lock;
+    dev->lockFlex = LockFlex;
+    dev->unlock = Unlock;
+    dev->dump = Dump;
 
-    *device = &gralloc1_dev->common;
+    *device = &dev->common;
     return 0;
 }
 
+int GrallocDevice::CloseDevice(struct hw_device_t* device) {
+    delete reinterpret_cast<GrallocDevice*>(device);
+    return 0;
+}
+
+GrallocDevice::BufferDescriptor* GrallocDevice::FindDescriptorLocked(
+        gralloc1_buffer_descriptor_t descriptor) {
+    auto it = mDescriptors.find(descriptor);
+    return it == mDescriptors.end() ? nullptr : &it->second;
+}
+
+bool GrallocDevice::DecodeHandle(buffer_handle_t buffer, uint32_t* slot,
+                                 uint32_t* generation) {
+    if (!buffer || buffer->numFds != HANDLE_NUM_FDS || buffer->numInts < HANDLE_NUM_INTS) {
+        return false;
+    }
+    const int* ints = &buffer->data[buffer->numFds];
+    *slot = static_cast<uint32_t>(ints[HANDLE_SLOT]);
+    *generation = static_cast<uint32_t>(ints[HANDLE_GENERATION]);
+    return true;
+}
+
+gralloc1_error_t GrallocDevice::CreateDescriptor(gralloc1_device_t* device,
+                                               gralloc1_buffer_descriptor_t* outDescriptor) {
+    GrallocDevice* dev = static_cast<GrallocDevice*>(device);
+    if (!outDescriptor) {
+        return GRALLOC1_ERROR_BAD_VALUE;
+    }
+
+    std::lock_guard<Mutex> lock(dev->mDescriptorLock);
+    gralloc1_buffer_descriptor_t descriptor = dev->mNextDescriptor++;
+    dev->mDescriptors[descriptor] = BufferDescriptor();
+    *outDescriptor = descriptor;
+    return GRALLOC1_ERROR_NONE;
+}
+
+gralloc1_error_t GrallocDevice::DestroyDescriptor(gralloc1_device_t* device,
+                                                gralloc1_buffer_descriptor_t descriptor) {
+    GrallocDevice* dev = static_cast<GrallocDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mDescriptorLock);
+    return dev->mDescriptors.erase(descriptor) ? GRALLOC1_ERROR_NONE
+                                               : GRALLOC1_ERROR_BAD_DESCRIPTOR;
+}
+
+gralloc1_error_t GrallocDevice::SetDimensions(gralloc1_device_t* device,
+                                            gralloc1_buffer_descriptor_t descriptor,
+                                            uint32_t width, uint32_t height) {
+    GrallocDevice* dev = static_cast<GrallocDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mDescriptorLock);
+    BufferDescriptor* desc = dev->FindDescriptorLocked(descriptor);
+    if (!desc) {
+        return GRALLOC1_ERROR_BAD_DESCRIPTOR;
+    }
+    desc->width = width;
+    desc->height = height;
+    return GRALLOC1_ERROR_NONE;
+}
+
+gralloc1_error_t GrallocDevice::SetFormat(gralloc1_device_t* device,
+                                        gralloc1_buffer_descriptor_t descriptor,
+                                        int32_t format) {
+    GrallocDevice* dev = static_cast<GrallocDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mDescriptorLock);
+    BufferDescriptor* desc = dev->FindDescriptorLocked(descriptor);
+    if (!desc) {
+        return GRALLOC1_ERROR_BAD_DESCRIPTOR;
+    }
+    desc->format = format;
+    return GRALLOC1_ERROR_NONE;
+}
+
+gralloc1_error_t GrallocDevice::SetProducerUsage(gralloc1_device_t* device,
+                                               gralloc1_buffer_descriptor_t descriptor,
+                                               uint64_t usage) {
+    GrallocDevice* dev = static_cast<GrallocDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mDescriptorLock);
+    BufferDescriptor* desc = dev->FindDescriptorLocked(descriptor);
+    if (!desc) {
+        return GRALLOC1_ERROR_BAD_DESCRIPTOR;
+    }
+    desc->producerUsage = usage;
+    return GRALLOC1_ERROR_NONE;
+}
+
+gralloc1_error_t GrallocDevice::SetConsumerUsage(gralloc1_device_t* device,
+                                               gralloc1_buffer_descriptor_t descriptor,
+                                               uint64_t usage) {
+    GrallocDevice* dev = static_cast<GrallocDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mDescriptorLock);
+    BufferDescriptor* desc = dev->FindDescriptorLocked(descriptor);
+    if (!desc) {
+        return GRALLOC1_ERROR_BAD_DESCRIPTOR;
+    }
+    desc->consumerUsage = usage;
+    return GRALLOC1_ERROR_NONE;
+}
+
 gralloc1_error_t GrallocDevice::CreateBuffer(gralloc1_device_t* device,
                                            gralloc1_buffer_descriptor_t descriptor,
                                            buffer_handle_t* outBuffer) {
     GrallocDevice* dev = static_cast<GrallocDevice*>(device);
-    
-    // Validate descriptor
+    if (!outBuffer) {
+        return GRALLOC1_ERROR_BAD_VALUE;
+    }
+
     BufferDescriptor desc;
+    {
+        std::lock_guard<Mutex> lock(dev->mDescriptorLock);
+        const BufferDescriptor* found = dev->FindDescriptorLocked(descriptor);
+        if (!found) {
+            return GRALLOC1_ERROR_BAD_DESCRIPTOR;
+        }
+        desc = *found;
+    }
+
+    // Validate descriptor
+    if (desc.width == 0 || desc.height == 0) {
+        ALOGE("Buffer dimensions not set");
+        return GRALLOC1_ERROR_BAD_DESCRIPTOR;
+    }
     if (desc.width > MAX_BUFFER_WIDTH || desc.height > MAX_BUFFER_HEIGHT) {
         ALOGE("Buffer dimensions exceed maximum supported size");
         return GRALLOC1_ERROR_BAD_VALUE;
     }
 
     // Validate usage flags
-    if ((desc.producerUsage | desc.consumerUsage) & ~SUPPORTED_USAGE) {
+    if ((desc.producerUsage & ~SUPPORTED_PRODUCER_USAGE) ||
+            (desc.consumerUsage & ~SUPPORTED_CONSUMER_USAGE)) {
         ALOGE("Unsupported buffer usage flags requested");
         return GRALLOC1_ERROR_BAD_VALUE;
     }
 
-    // Allocate buffer handle (simplified implementation)
-    native_handle_t* handle = native_handle_create(1, 3); // 1 fd, 3 ints
+    GrallocLayout layout;
+    if (GrallocLayoutEngine::Compute(desc.format, desc.width, desc.height, desc.producerUsage,
+                                     desc.consumerUsage, &layout) != 0) {
+        ALOGE("Unsupported buffer format %u", desc.format);
+        return GRALLOC1_ERROR_UNSUPPORTED;
+    }
+
+    Buffer buffer = {};
+    buffer.desc = desc;
+    buffer.layout = layout;
+    buffer.fd = dev->mAllocator.Allocate(layout.size, desc.producerUsage, desc.consumerUsage,
+                                         &buffer.size);
+    buffer.metadataFd = dev->mAllocator.Allocate(GRALLOC_METADATA_SIZE, 0, 0,
+                                                 &buffer.metadataSize);
+    if (buffer.fd < 0 || buffer.metadataFd < 0) {
+        dev->FreeBuffer(buffer);
+        return GRALLOC1_ERROR_NO_RESOURCES;
+    }
+
+    void* metadata = mmap(nullptr, GRALLOC_METADATA_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          buffer.metadataFd, 0);
+    if (metadata == MAP_FAILED) {
+        ALOGE("Failed to map buffer metadata: %s", strerror(errno));
+        dev->FreeBuffer(buffer);
+        return GRALLOC1_ERROR_NO_RESOURCES;
+    }
+    buffer.metadata = static_cast<GrallocMetadata*>(metadata);
+    GrallocMetadataAccess::Init(buffer.metadata, desc.width, desc.height, desc.format, layout);
+
+    native_handle_t* handle = native_handle_create(HANDLE_NUM_FDS, HANDLE_NUM_INTS);
     if (!handle) {
         ALOGE("Failed to create buffer handle");
+        dev->FreeBuffer(buffer);
         return GRALLOC1_ERROR_NO_RESOURCES;
     }
+    buffer.handle = handle;
+    handle->data[0] = buffer.fd;
+    handle->data[GRALLOC_METADATA_FD_INDEX] = buffer.metadataFd;
+    int* ints = &handle->data[handle->numFds];
+    ints[HANDLE_SIZE_LO] = static_cast<int>(static_cast<uint64_t>(buffer.size) & 0xffffffff);
+    ints[HANDLE_SIZE_HI] = static_cast<int>(static_cast<uint64_t>(buffer.size) >> 32);
+    ints[HANDLE_FORMAT] = static_cast<int>(desc.format);
+    ints[HANDLE_FLAGS] = layout.type == GRALLOC_LAYOUT_UBWC ? HANDLE_FLAG_UBWC : 0;
 
     // Store buffer information
-    {
-        std::lock_guard<Mutex> lock(dev->mBufferLock);
-        dev->mBuffers[handle] = desc;
+    uint32_t slot;
+    uint32_t generation;
+    buffer.record = GrallocTracker::MakeRecord();
+    if (dev->mBuffers.Insert(buffer, &slot, &generation) != 0) {
+        ALOGE("Buffer table full (%u buffers)", MAX_BUFFERS);
+        dev->FreeBuffer(buffer);
+        return GRALLOC1_ERROR_NO_RESOURCES;
     }
+    dev->mTracker.OnCreate(TrackerKey(slot, generation), buffer.size, desc.producerUsage,
+                           desc.consumerUsage, layout.type == GRALLOC_LAYOUT_UBWC);
+    ints[HANDLE_SLOT] = static_cast<int>(slot);
+    ints[HANDLE_GENERATION] = static_cast<int>(generation);
 
     *outBuffer = handle;
     return GRALLOC1_ERROR_NONE;
@@ -86,48 +285,365 @@ gralloc1_error_t GrallocDevice::ReleaseBuffer(gralloc1_device_t* device,
                                             buffer_handle_t buffer) {
     GrallocDevice* dev = static_cast<GrallocDevice*>(device);
     
-    if (!buffer) {
+    uint32_t slot;
+    uint32_t generation;
+    if (!DecodeHandle(buffer, &slot, &generation)) {
         return GRALLOC1_ERROR_BAD_HANDLE;
     }
 
+    // The buffer leaves the table under the mapping lock, so a concurrent
+    // lock either maps it before this or finds it gone.
+    Buffer released;
     {
-        std::lock_guard<Mutex> lock(dev->mBufferLock);
-        auto it = dev->mBuffers.find(buffer);
-        if (it == dev->mBuffers.end()) {
+        std::lock_guard<Mutex> lock(dev->mMappingLock);
+        Mapping& mapping = dev->mMappings[slot];
+        if (mapping.generation == generation && mapping.lockCount) {
+            ALOGE("Refusing to release buffer in slot %u while locked", slot);
+            return GRALLOC1_ERROR_BAD_VALUE;
+        }
+        if (!dev->mBuffers.Remove(slot, generation, &released)) {
             return GRALLOC1_ERROR_BAD_HANDLE;
         }
-        dev->mBuffers.erase(it);
+        // The slot may already belong to a new buffer with its own mapping.
+        if (mapping.generation == generation) {
+            dev->UnmapLocked(slot);
+        }
     }
+    dev->mTracker.OnRelease(TrackerKey(slot, generation), released.size,
+                            released.desc.producerUsage, released.desc.consumerUsage,
+                            released.layout.type == GRALLOC_LAYOUT_UBWC);
 
-    native_handle_delete(const_cast<native_handle_t*>(buffer));
+    dev->FreeBuffer(released);
     return GRALLOC1_ERROR_NONE;
 }
 
+// Returns the fds to the allocator's pool and frees the handle.
+void GrallocDevice::FreeBuffer(const Buffer& buffer) {
+    GrallocMetadataAccess::Unmap(buffer.metadata);
+    if (buffer.metadataFd >= 0) {
+        mAllocator.Free(buffer.metadataFd, buffer.metadataSize, 0, 0);
+    }
+    if (buffer.fd >= 0) {
+        mAllocator.Free(buffer.fd, buffer.size, buffer.desc.producerUsage,
+                        buffer.desc.consumerUsage);
+    }
+    if (buffer.handle) {
+        native_handle_delete(buffer.handle);
+    }
+}
+
 gralloc1_error_t GrallocDevice::GetBufferProperties(gralloc1_device_t* device,
                                                   buffer_handle_t buffer,
                                                   uint32_t* outWidth,
                                                   uint32_t* outHeight,
                                                   uint32_t* outFormat,
                                                   uint64_t* outProducerUsage,
-                                                  uint64_t* outConsumerUsage) {
+                                                  uint64_t* outConsumerUsage,
+                                                  GrallocLayout* outLayout) {
     GrallocDevice* dev = static_cast<GrallocDevice*>(device);
     
-    if (!buffer) {
+    uint32_t slot;
+    uint32_t generation;
+    Buffer entry;
+    if (!DecodeHandle(buffer, &slot, &generation) ||
+            !dev->mBuffers.Lookup(slot, generation, &entry)) {
         return GRALLOC1_ERROR_BAD_HANDLE;
     }
 
-    std::lock_guard<Mutex> lock(dev->mBufferLock);
-    auto it = dev->mBuffers.find(buffer);
-    if (it == dev->mBuffers.end()) {
-        return GRALLOC1_ERROR_BAD_HANDLE;
-    }
-
-    const BufferDescriptor& desc = it->second;
+    const BufferDescriptor& desc = entry.desc;
     if (outWidth) *outWidth = desc.width;
     if (outHeight) *outHeight = desc.height;
     if (outFormat) *outFormat = desc.format;
     if (outProducerUsage) *outProducerUsage = desc.producerUsage;
     if (outConsumerUsage) *outConsumerUsage = desc.consumerUsage;
+    if (outLayout) *outLayout = entry.layout;
 
     return GRALLOC1_ERROR_NONE;
-} 
\ No newline at end of file
+} 
+void GrallocDevice::UnmapLocked(uint32_t slot) {
+    Mapping& mapping = mMappings[slot];
+    if (mapping.base) {
+        munmap(mapping.base, mapping.size);
+    }
+    mapping = Mapping();
+}
+
+gralloc1_error_t GrallocDevice::LockBuffer(buffer_handle_t buffer, uint64_t producerUsage,
+                                           uint64_t consumerUsage,
+                                           const gralloc1_rect_t* accessRegion,
+                                           int32_t acquireFence, Buffer* outEntry,
+                                           uint8_t** outBase) {
+    uint32_t slot;
+    uint32_t generation;
+    if (!DecodeHandle(buffer, &slot, &generation) ||
+            !mBuffers.Lookup(slot, generation, outEntry)) {
+        if (acquireFence >= 0) {
+            close(acquireFence);
+        }
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    }
+
+    // Protected and compressed buffers never get a CPU mapping, and a lock
+    // may only ask for the CPU access the buffer was allocated with.
+    const BufferDescriptor& desc = outEntry->desc;
+    uint64_t producerCpu = producerUsage & PRODUCER_CPU_USAGE;
+    uint64_t consumerCpu = consumerUsage & CONSUMER_CPU_USAGE;
+    bool read = consumerCpu || (producerCpu & (GRALLOC1_PRODUCER_USAGE_CPU_READ |
+                                               GRALLOC1_PRODUCER_USAGE_CPU_READ_OFTEN));
+    bool write = producerCpu & (GRALLOC1_PRODUCER_USAGE_CPU_WRITE |
+                                GRALLOC1_PRODUCER_USAGE_CPU_WRITE_OFTEN);
+    if ((!read && !write) || (desc.producerUsage & GRALLOC1_PRODUCER_USAGE_PROTECTED) ||
+            outEntry->layout.type == GRALLOC_LAYOUT_UBWC ||
+            (producerCpu & ~desc.producerUsage) || (consumerCpu & ~desc.consumerUsage)) {
+        if (acquireFence >= 0) {
+            close(acquireFence);
+        }
+        return GRALLOC1_ERROR_BAD_VALUE;
+    }
+
+    // The region is a hint, but it must lie inside the buffer.
+    if (accessRegion && (accessRegion->left < 0 || accessRegion->top < 0 ||
+            accessRegion->width < 0 || accessRegion->height < 0 ||
+            uint64_t(accessRegion->left) + accessRegion->width > desc.width ||
+            uint64_t(accessRegion->top) + accessRegion->height > desc.height)) {
+        if (acquireFence >= 0) {
+            close(acquireFence);
+        }
+        return GRALLOC1_ERROR_BAD_VALUE;
+    }
+
+    if (acquireFence >= 0) {
+        int ret = sync_wait(acquireFence, -1);
+        close(acquireFence);
+        if (ret < 0) {
+            ALOGE("Failed to wait for acquire fence: %s", strerror(errno));
+            return GRALLOC1_ERROR_UNDEFINED;
+        }
+    }
+
+    // Look the buffer up again now that no release can run: it may have
+    // been released while the fence was waited on, and its fd closed.
+    std::lock_guard<Mutex> lock(mMappingLock);
+    if (!mBuffers.Lookup(slot, generation, outEntry)) {
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    }
+    Mapping& mapping = mMappings[slot];
+    if (!mapping.base || mapping.generation != generation) {
+        UnmapLocked(slot);
+        void* base = mmap(nullptr, outEntry->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          outEntry->fd, 0);
+        if (base == MAP_FAILED) {
+            ALOGE("Failed to map buffer: %s", strerror(errno));
+            return GRALLOC1_ERROR_NO_RESOURCES;
+        }
+        mapping.generation = generation;
+        mapping.base = static_cast<uint8_t*>(base);
+        mapping.size = outEntry->size;
+    }
+
+    // memfd buffers are coherent; dma-buf ones need cache maintenance.
+    uint64_t syncFlags = (read ? DMA_BUF_SYNC_READ : 0) | (write ? DMA_BUF_SYNC_WRITE : 0);
+    if (mAllocator.UsesDmaHeap()) {
+        struct dma_buf_sync sync = { DMA_BUF_SYNC_START | syncFlags };
+        if (ioctl(outEntry->fd, DMA_BUF_IOCTL_SYNC, &sync) < 0) {
+            ALOGW("DMA_BUF_SYNC_START failed: %s", strerror(errno));
+        }
+    }
+    mapping.syncFlags |= syncFlags;
+    mapping.lockCount++;
+    *outBase = mapping.base;
+    return GRALLOC1_ERROR_NONE;
+}
+
+gralloc1_error_t GrallocDevice::Lock(gralloc1_device_t* device, buffer_handle_t buffer,
+                                   uint64_t producerUsage, uint64_t consumerUsage,
+                                   const gralloc1_rect_t* accessRegion, void** outData,
+                                   int32_t acquireFence) {
+    GrallocDevice* dev = static_cast<GrallocDevice*>(device);
+    if (!outData) {
+        if (acquireFence >= 0) {
+            close(acquireFence);
+        }
+        return GRALLOC1_ERROR_BAD_VALUE;
+    }
+
+    Buffer entry;
+    uint8_t* base;
+    gralloc1_error_t err = dev->LockBuffer(buffer, producerUsage, consumerUsage,
+                                           accessRegion, acquireFence, &entry, &base);
+    if (err != GRALLOC1_ERROR_NONE) {
+        return err;
+    }
+    *outData = base;
+    return GRALLOC1_ERROR_NONE;
+}
+
+gralloc1_error_t GrallocDevice::LockFlex(gralloc1_device_t* device, buffer_handle_t buffer,
+                                       uint64_t producerUsage, uint64_t consumerUsage,
+                                       const gralloc1_rect_t* accessRegion,
+                                       struct android_ycbcr* outYcbcr, int32_t acquireFence) {
+    GrallocDevice* dev = static_cast<GrallocDevice*>(device);
+    if (!outYcbcr) {
+        if (acquireFence >= 0) {
+            close(acquireFence);
+        }
+        return GRALLOC1_ERROR_BAD_VALUE;
+    }
+
+    Buffer entry;
+    uint8_t* base;
+    gralloc1_error_t err = dev->LockBuffer(buffer, producerUsage, consumerUsage,
+                                           accessRegion, acquireFence, &entry, &base);
+    if (err != GRALLOC1_ERROR_NONE) {
+        return err;
+    }
+
+    const GrallocLayout& layout = entry.layout;
+    uint8_t* chroma = base + layout.planes[1].offset;
+    memset(outYcbcr, 0, sizeof(*outYcbcr));
+    outYcbcr->y = base + layout.planes[0].offset;
+    outYcbcr->ystride = layout.planes[0].stride;
+    outYcbcr->cstride = layout.planes[1].stride;
+    switch (entry.desc.format) {
+        case HAL_PIXEL_FORMAT_NV12_ENCODEABLE:
+        case HAL_PIXEL_FORMAT_YCBCR_420_888:
+            outYcbcr->cb = chroma;
+            outYcbcr->cr = chroma + 1;
+            outYcbcr->chroma_step = 2;
+            break;
+        case HAL_PIXEL_FORMAT_YCRCB_420_SP:
+            outYcbcr->cr = chroma;
+            outYcbcr->cb = chroma + 1;
+            outYcbcr->chroma_step = 2;
+            break;
+        case HAL_PIXEL_FORMAT_YCBCR_P010:
+            outYcbcr->cb = chroma;
+            outYcbcr->cr = chroma + 2;
+            outYcbcr->chroma_step = 4;
+            break;
+        case HAL_PIXEL_FORMAT_YV12:
+            outYcbcr->cr = chroma;
+            outYcbcr->cb = base + layout.planes[2].offset;
+            outYcbcr->chroma_step = 1;
+            break;
+        default:
+            Unlock(device, buffer, nullptr);
+            return GRALLOC1_ERROR_UNSUPPORTED;
+    }
+    return GRALLOC1_ERROR_NONE;
+}
+
+gralloc1_error_t GrallocDevice::Unlock(gralloc1_device_t* device, buffer_handle_t buffer,
+                                     int32_t* outReleaseFence) {
+    GrallocDevice* dev = static_cast<GrallocDevice*>(device);
+
+    uint32_t slot;
+    uint32_t generation;
+    Buffer entry;
+    if (!DecodeHandle(buffer, &slot, &generation) ||
+            !dev->mBuffers.Lookup(slot, generation, &entry)) {
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    }
+
+    std::lock_guard<Mutex> lock(dev->mMappingLock);
+    Mapping& mapping = dev->mMappings[slot];
+    if (mapping.generation != generation || mapping.lockCount == 0) {
+        return GRALLOC1_ERROR_BAD_VALUE;
+    }
+    // Caches are flushed once the last CPU user is done; the mapping stays.
+    if (--mapping.lockCount == 0) {
+        if (dev->mAllocator.UsesDmaHeap()) {
+            struct dma_buf_sync sync = { DMA_BUF_SYNC_END | mapping.syncFlags };
+            if (ioctl(entry.fd, DMA_BUF_IOCTL_SYNC, &sync) < 0) {
+                ALOGW("DMA_BUF_SYNC_END failed: %s", strerror(errno));
+            }
+        }
+        mapping.syncFlags = 0;
+    }
+
+    // CPU access is complete on return.
+    if (outReleaseFence) {
+        *outReleaseFence = -1;
+    }
+    return GRALLOC1_ERROR_NONE;
+}
+
+void GrallocDevice::Dump(gralloc1_device_t* device, uint32_t* outSize, char* outBuffer) {
+    GrallocDevice* dev = static_cast<GrallocDevice*>(device);
+    if (!outSize) {
+        return;
+    }
+
+    std::lock_guard<Mutex> lock(dev->mDumpLock);
+    if (!outBuffer) {
+        dev->mDumpCache.clear();
+        dev->Dump(&dev->mDumpCache);
+        *outSize = dev->mDumpCache.size();
+        return;
+    }
+    if (dev->mDumpCache.empty()) {
+        dev->Dump(&dev->mDumpCache);
+    }
+    size_t copied = std::min<size_t>(*outSize, dev->mDumpCache.size());
+    memcpy(outBuffer, dev->mDumpCache.data(), copied);
+    *outSize = copied;
+    dev->mDumpCache.clear();
+}
+
+void GrallocDevice::Dump(std::string* out) const {
+    char line[256];
+    const int64_t nowNs = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    out->append("GrallocDevice:\n");
+    mTracker.AppendSummary(out);
+
+    GrallocAllocator::Stats pool = mAllocator.GetStats();
+    snprintf(line, sizeof(line),
+             "  pool: %llu of %llu allocations reused (%.1f%%), %llu from the kernel, "
+             "%zu buffers %zu KiB held, backend %s\n",
+             static_cast<unsigned long long>(pool.poolHits),
+             static_cast<unsigned long long>(pool.allocations),
+             pool.allocations ? 100.0 * pool.poolHits / pool.allocations : 0.0,
+             static_cast<unsigned long long>(pool.heapAllocations),
+             pool.buffersHeld, pool.bytesHeld / 1024,
+             mAllocator.UsesDmaHeap() ? "dma-heap" : "memfd");
+    out->append(line);
+
+    // Copy the live entries out so the table lock is held only for the
+    // scan, not for formatting and symbolizing.
+    struct Entry {
+        uint32_t slot;
+        uint32_t generation;
+        Buffer buffer;
+    };
+    std::vector<Entry> entries;
+    entries.reserve(mBuffers.GetLiveCount());
+    mBuffers.ForEach([&](uint32_t slot, uint32_t generation, const Buffer& buffer) {
+        entries.push_back({ slot, generation, buffer });
+    });
+
+    std::string buffers;
+    size_t suspects = 0;
+    for (const Entry& entry : entries) {
+        const Buffer& buffer = entry.buffer;
+        bool suspect = mTracker.IsLeakSuspect(buffer.record, nowNs);
+        suspects += suspect;
+        snprintf(line, sizeof(line),
+                 "    [%u:%u] %ux%u fmt %#x %s %s %zu KiB, age %llds, pid %d tid %d%s\n",
+                 entry.slot, entry.generation, buffer.desc.width, buffer.desc.height,
+                 buffer.desc.format,
+                 GrallocTracker::UsageClassName(GrallocTracker::Classify(
+                     buffer.desc.producerUsage, buffer.desc.consumerUsage)),
+                 buffer.layout.type == GRALLOC_LAYOUT_UBWC ? "ubwc" : "linear",
+                 buffer.size / 1024,
+                 static_cast<long long>((nowNs - buffer.record.createdNs) / 1000000000),
+                 buffer.record.pid, buffer.record.tid, suspect ? " LEAK?" : "");
+        buffers.append(line);
+        mTracker.AppendBacktrace(TrackerKey(entry.slot, entry.generation), &buffers);
+    }
+
+    snprintf(line, sizeof(line), "  buffers (%zu older than %llds):\n", suspects,
+             static_cast<long long>(mTracker.GetLeakThresholdNs() / 1000000000));
+    out->append(line);
+    out->append(buffers);
+}
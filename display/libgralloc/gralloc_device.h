@@ -4,10 +4,27 @@
 #include <hardware/gralloc1.h>
 #include <utils/Mutex.h>
 #include <map>
+#include <memory>
+#include <string>
+#include "gralloc_allocator.h"
+#include "gralloc_buffer_table.h"
+#include "gralloc_layout.h"
+#include "gralloc_metadata.h"
+#include "gralloc_tracker.h"
 
 using namespace android;
 
-class GrallocDevice {
+// The gralloc1 device. Buffers are described by a descriptor built up with
+// the set* hooks and are backed by GrallocAllocator; each handle carries
+// the buffer fd, its size and format, and the slot and generation that key
+// it in the buffer table, so per-frame property queries take no lock.
+// A second fd holds the shared GrallocMetadata page, which other HALs map
+// once at import and then read without going through the device.
+// A CPU mapping is created on the first lock of a buffer and kept until it
+// is released, so lock/unlock per frame costs two cache-sync ioctls rather
+// than an mmap and munmap. Strides, plane offsets and size
+// are computed once at allocation and handed out by GetBufferProperties.
+class GrallocDevice : public gralloc1_device_t {
 public:
     static int HookDevOpen(const struct hw_module_t* module, const char* name,
                           struct hw_device_t** device);
@@ -16,6 +33,30 @@ public:
     ~GrallocDevice();
 
     // Gralloc1 function hooks
+    static int CloseDevice(struct hw_device_t* device);
+
+    static gralloc1_error_t CreateDescriptor(gralloc1_device_t* device,
+                                           gralloc1_buffer_descriptor_t* outDescriptor);
+
+    static gralloc1_error_t DestroyDescriptor(gralloc1_device_t* device,
+                                            gralloc1_buffer_descriptor_t descriptor);
+
+    static gralloc1_error_t SetDimensions(gralloc1_device_t* device,
+                                        gralloc1_buffer_descriptor_t descriptor,
+                                        uint32_t width, uint32_t height);
+
+    static gralloc1_error_t SetFormat(gralloc1_device_t* device,
+                                    gralloc1_buffer_descriptor_t descriptor,
+                                    int32_t format);
+
+    static gralloc1_error_t SetProducerUsage(gralloc1_device_t* device,
+                                           gralloc1_buffer_descriptor_t descriptor,
+                                           uint64_t usage);
+
+    static gralloc1_error_t SetConsumerUsage(gralloc1_device_t* device,
+                                           gralloc1_buffer_descriptor_t descriptor,
+                                           uint64_t usage);
+
     static gralloc1_error_t CreateBuffer(gralloc1_device_t* device,
                                        gralloc1_buffer_descriptor_t descriptor,
                                        buffer_handle_t* outBuffer);
@@ -29,7 +70,34 @@ public:
                                               uint32_t* outHeight,
                                               uint32_t* outFormat,
                                               uint64_t* outProducerUsage,
-                                              uint64_t* outConsumerUsage);
+                                              uint64_t* outConsumerUsage,
+                                              GrallocLayout* outLayout);
+
+    // The CPU usage asked for must be a subset of the buffer's own;
+    // anything else fails with GRALLOC1_ERROR_BAD_VALUE.
+    static gralloc1_error_t Lock(gralloc1_device_t* device, buffer_handle_t buffer,
+                               uint64_t producerUsage, uint64_t consumerUsage,
+                               const gralloc1_rect_t* accessRegion, void** outData,
+                               int32_t acquireFence);
+
+    // Plane pointers for the YUV formats
+    static gralloc1_error_t LockFlex(gralloc1_device_t* device, buffer_handle_t buffer,
+                                   uint64_t producerUsage, uint64_t consumerUsage,
+                                   const gralloc1_rect_t* accessRegion,
+                                   struct android_ycbcr* outYcbcr, int32_t acquireFence);
+
+    static gralloc1_error_t Unlock(gralloc1_device_t* device, buffer_handle_t buffer,
+                                 int32_t* outReleaseFence);
+
+    // gralloc1 dump: with a null outBuffer, renders the report and returns
+    // its size; otherwise copies up to *outSize bytes of that report.
+    static void Dump(gralloc1_device_t* device, uint32_t* outSize, char* outBuffer);
+
+    GrallocAllocator::Stats GetAllocatorStats() const { return mAllocator.GetStats(); }
+
+    // Usage classes, pool state and every live buffer, with suspected leaks
+    // and allocation backtraces when they are tracked
+    void Dump(std::string* out) const;
 
 private:
     struct BufferDescriptor {
@@ -40,17 +108,99 @@ private:
         uint64_t consumerUsage;
     };
 
+    struct Buffer {
+        native_handle_t* handle;
+        BufferDescriptor desc;
+        GrallocLayout layout;
+        int fd;
+        size_t size;            // allocated, at least layout.size
+        int metadataFd;
+        size_t metadataSize;
+        GrallocMetadata* metadata;
+        GrallocTracker::Record record;
+    };
+
+    static constexpr int HANDLE_NUM_FDS = 2;   // buffer, metadata page
+
+    // Integers following the fds in every handle
+    enum HandleInt {
+        HANDLE_SIZE_LO = 0,
+        HANDLE_SIZE_HI,
+        HANDLE_FORMAT,
+        HANDLE_FLAGS,
+        HANDLE_SLOT,
+        HANDLE_GENERATION,
+        HANDLE_NUM_INTS
+    };
+    static_assert(HANDLE_SLOT == GRALLOC_HANDLE_SLOT_INT &&
+                  HANDLE_GENERATION == GRALLOC_HANDLE_GENERATION_INT,
+                  "Importers read the buffer id at the indices in gralloc_metadata.h");
+
+    enum HandleFlag {
+        HANDLE_FLAG_UBWC = 1 << 0,
+    };
+
+    static constexpr uint32_t MAX_BUFFERS = 4096;
+
+    // CPU mapping of a buffer; guarded by mMappingLock
+    struct Mapping {
+        uint32_t generation;    // of the buffer that owns the mapping
+        uint8_t* base;
+        size_t size;
+        uint32_t lockCount;
+        uint64_t syncFlags;     // DMA_BUF_SYNC_* of the outstanding locks
+    };
+
+    // Reads the table key from a handle; false if it is not one of ours.
+    static bool DecodeHandle(buffer_handle_t buffer, uint32_t* slot, uint32_t* generation);
+
+    BufferDescriptor* FindDescriptorLocked(gralloc1_buffer_descriptor_t descriptor);
+    gralloc1_error_t LockBuffer(buffer_handle_t buffer, uint64_t producerUsage,
+                                uint64_t consumerUsage, const gralloc1_rect_t* accessRegion,
+                                int32_t acquireFence, Buffer* outEntry, uint8_t** outBase);
+    void UnmapLocked(uint32_t slot);
+    void FreeBuffer(const Buffer& buffer);
+    static uint64_t TrackerKey(uint32_t slot, uint32_t generation) {
+        return (static_cast<uint64_t>(slot) << 32) | generation;
+    }
+
+    GrallocAllocator mAllocator;
+    GrallocTracker mTracker;
+
     // Buffer management
-    Mutex mBufferLock;
-    std::map<buffer_handle_t, BufferDescriptor> mBuffers;
+    Mutex mDescriptorLock;
+    std::map<gralloc1_buffer_descriptor_t, BufferDescriptor> mDescriptors;
+    gralloc1_buffer_descriptor_t mNextDescriptor;
+    GrallocBufferTable<Buffer, MAX_BUFFERS> mBuffers;
+
+    Mutex mMappingLock;
+    std::unique_ptr<Mapping[]> mMappings;     // indexed by buffer slot
+
+    // Report rendered by the size query of the two-call dump
+    Mutex mDumpLock;
+    std::string mDumpCache;
 
     // Device capabilities
     static constexpr uint32_t MAX_BUFFER_WIDTH = 4096;
     static constexpr uint32_t MAX_BUFFER_HEIGHT = 4096;
-    static constexpr uint64_t SUPPORTED_USAGE = GRALLOC1_CONSUMER_USAGE_HWCOMPOSER |
-                                               GRALLOC1_CONSUMER_USAGE_CPU_READ |
-                                               GRALLOC1_PRODUCER_USAGE_CPU_WRITE |
-                                               GRALLOC1_PRODUCER_USAGE_GPU_RENDER_TARGET;
+    // Producer and consumer usage bits overlap, so each is checked on its own.
+    static constexpr uint64_t PRODUCER_CPU_USAGE = GRALLOC1_PRODUCER_USAGE_CPU_READ |
+                                                   GRALLOC1_PRODUCER_USAGE_CPU_READ_OFTEN |
+                                                   GRALLOC1_PRODUCER_USAGE_CPU_WRITE |
+                                                   GRALLOC1_PRODUCER_USAGE_CPU_WRITE_OFTEN;
+    static constexpr uint64_t CONSUMER_CPU_USAGE = GRALLOC1_CONSUMER_USAGE_CPU_READ |
+                                                   GRALLOC1_CONSUMER_USAGE_CPU_READ_OFTEN;
+    static constexpr uint64_t SUPPORTED_PRODUCER_USAGE = PRODUCER_CPU_USAGE |
+                                               GRALLOC1_PRODUCER_USAGE_GPU_RENDER_TARGET |
+                                               GRALLOC1_PRODUCER_USAGE_VIDEO_DECODER |
+                                               GRALLOC1_PRODUCER_USAGE_CAMERA |
+                                               GRALLOC1_PRODUCER_USAGE_PROTECTED;
+    static constexpr uint64_t SUPPORTED_CONSUMER_USAGE = CONSUMER_CPU_USAGE |
+                                               GRALLOC1_CONSUMER_USAGE_HWCOMPOSER |
+                                               GRALLOC1_CONSUMER_USAGE_CLIENT_TARGET |
+                                               GRALLOC1_CONSUMER_USAGE_CURSOR |
+                                               GRALLOC1_CONSUMER_USAGE_GPU_TEXTURE |
+                                               GRALLOC1_CONSUMER_USAGE_VIDEO_ENCODER;
 };
 
 #endif // GRALLOC_DEVICE_H 
\ No newline at end of file
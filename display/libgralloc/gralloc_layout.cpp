@@ -0,0 +1,227 @@
+#include <hardware/gralloc1.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <numeric>
+#include "gralloc_layout.h"
+
+namespace {
+
+struct PlaneFormat {
+    uint8_t bitsPerPixel;   // at the plane's own resolution
+    uint8_t hSubsample;
+    uint8_t vSubsample;
+};
+
+struct FormatLayout {
+    uint32_t format;
+    uint32_t planeCount;
+    PlaneFormat planes[3];
+};
+
+constexpr FormatLayout FORMAT_LAYOUTS[] = {
+    { HAL_PIXEL_FORMAT_RGBA_8888,       1, { { 32, 1, 1 } } },
+    { HAL_PIXEL_FORMAT_RGBX_8888,       1, { { 32, 1, 1 } } },
+    { HAL_PIXEL_FORMAT_BGRA_8888,       1, { { 32, 1, 1 } } },
+    { HAL_PIXEL_FORMAT_RGB_888,         1, { { 24, 1, 1 } } },
+    { HAL_PIXEL_FORMAT_RGB_565,         1, { { 16, 1, 1 } } },
+    { HAL_PIXEL_FORMAT_NV12_ENCODEABLE, 2, { { 8, 1, 1 }, { 16, 2, 2 } } },
+    { HAL_PIXEL_FORMAT_YCBCR_420_888,   2, { { 8, 1, 1 }, { 16, 2, 2 } } },
+    { HAL_PIXEL_FORMAT_YCRCB_420_SP,    2, { { 8, 1, 1 }, { 16, 2, 2 } } },
+    { HAL_PIXEL_FORMAT_YCBCR_P010,      2, { { 16, 1, 1 }, { 32, 2, 2 } } },
+    { HAL_PIXEL_FORMAT_YV12,            3, { { 8, 1, 1 }, { 8, 2, 2 }, { 8, 2, 2 } } },
+    { HAL_PIXEL_FORMAT_RAW16,           1, { { 16, 1, 1 } } },
+    { HAL_PIXEL_FORMAT_RAW12,           1, { { 12, 1, 1 } } },
+    { HAL_PIXEL_FORMAT_RAW10,           1, { { 10, 1, 1 } } },
+};
+
+struct UsageAlignment {
+    uint64_t producerUsage;     // rule applies if any of these bits is set
+    uint64_t consumerUsage;
+    uint32_t strideBytes;
+    uint32_t scanlines;         // luma rows; chroma rows divide by vSubsample
+    uint32_t planeBytes;
+};
+
+// Applies to every buffer; 16-byte rows are what YV12 requires.
+constexpr UsageAlignment DEFAULT_ALIGNMENT = { 0, 0, 16, 1, 1 };
+
+constexpr UsageAlignment USAGE_ALIGNMENTS[] = {
+    { GRALLOC1_PRODUCER_USAGE_GPU_RENDER_TARGET, GRALLOC1_CONSUMER_USAGE_GPU_TEXTURE,
+      64, 1, 64 },
+    { 0, GRALLOC1_CONSUMER_USAGE_HWCOMPOSER | GRALLOC1_CONSUMER_USAGE_CLIENT_TARGET |
+          GRALLOC1_CONSUMER_USAGE_CURSOR,
+      128, 1, 4096 },
+    { GRALLOC1_PRODUCER_USAGE_VIDEO_DECODER | GRALLOC1_PRODUCER_USAGE_CAMERA,
+      GRALLOC1_CONSUMER_USAGE_VIDEO_ENCODER,
+      128, 32, 4096 },
+};
+
+// Usage of the blocks that read and write UBWC; anything else, including
+// the CPU, forces a linear layout.
+constexpr uint64_t UBWC_PRODUCER_USAGE = GRALLOC1_PRODUCER_USAGE_GPU_RENDER_TARGET |
+                                         GRALLOC1_PRODUCER_USAGE_VIDEO_DECODER;
+constexpr uint64_t UBWC_CONSUMER_USAGE = GRALLOC1_CONSUMER_USAGE_GPU_TEXTURE |
+                                         GRALLOC1_CONSUMER_USAGE_HWCOMPOSER |
+                                         GRALLOC1_CONSUMER_USAGE_CLIENT_TARGET |
+                                         GRALLOC1_CONSUMER_USAGE_VIDEO_ENCODER;
+
+// Tile geometry: data planes are stored in tiles of tileWidth x tileHeight
+// pixels, each described by one metadata byte.
+struct UbwcPlane {
+    uint32_t bytesPerPixel;     // at the plane's resolution
+    uint32_t hSubsample;
+    uint32_t vSubsample;
+    uint32_t strideAlign;       // bytes
+    uint32_t scanlineAlign;
+    uint32_t tileWidth;
+    uint32_t tileHeight;
+};
+
+constexpr uint32_t UBWC_META_STRIDE_ALIGN = 64;
+constexpr uint32_t UBWC_META_SCANLINE_ALIGN = 16;
+constexpr uint32_t UBWC_PLANE_ALIGN = 4096;
+
+constexpr UbwcPlane UBWC_RGBA_PLANE = { 4, 1, 1, 256, 16, 16, 4 };
+constexpr UbwcPlane UBWC_NV12_PLANES[] = {
+    { 1, 1, 1, 128, 32, 32, 8 },
+    { 2, 2, 2, 128, 32, 16, 8 },
+};
+
+const FormatLayout* FindFormat(uint32_t format) {
+    for (const FormatLayout& layout : FORMAT_LAYOUTS) {
+        if (layout.format == format) {
+            return &layout;
+        }
+    }
+    return nullptr;
+}
+
+constexpr uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+void ComputeUbwc(const UbwcPlane* planes, uint32_t planeCount, uint32_t width,
+                 uint32_t height, GrallocLayout* outLayout) {
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < planeCount; i++) {
+        const UbwcPlane& plane = planes[i];
+        uint64_t planeWidth = (width + plane.hSubsample - 1) / plane.hSubsample;
+        uint64_t planeHeight = (height + plane.vSubsample - 1) / plane.vSubsample;
+
+        GrallocPlaneLayout& meta = outLayout->metaPlanes[i];
+        meta.offset = offset;
+        meta.stride = AlignUp((planeWidth + plane.tileWidth - 1) / plane.tileWidth,
+                              UBWC_META_STRIDE_ALIGN);
+        meta.scanlines = AlignUp((planeHeight + plane.tileHeight - 1) / plane.tileHeight,
+                                 UBWC_META_SCANLINE_ALIGN);
+        offset += AlignUp(uint64_t(meta.stride) * meta.scanlines, UBWC_PLANE_ALIGN);
+
+        GrallocPlaneLayout& data = outLayout->planes[i];
+        data.offset = offset;
+        data.stride = AlignUp(planeWidth * plane.bytesPerPixel, plane.strideAlign);
+        data.scanlines = AlignUp(planeHeight, plane.scanlineAlign);
+        offset += AlignUp(uint64_t(data.stride) * data.scanlines, UBWC_PLANE_ALIGN);
+    }
+    outLayout->type = GRALLOC_LAYOUT_UBWC;
+    outLayout->planeCount = planeCount;
+    outLayout->pixelStride = outLayout->planes[0].stride / planes[0].bytesPerPixel;
+    outLayout->size = offset;
+}
+
+} // namespace
+
+bool GrallocLayoutEngine::IsUbwcEligible(uint32_t format, uint64_t producerUsage,
+                                         uint64_t consumerUsage) {
+    switch (format) {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+        case HAL_PIXEL_FORMAT_NV12_ENCODEABLE:
+        case HAL_PIXEL_FORMAT_YCBCR_420_888:
+            break;
+        default:
+            return false;
+    }
+    return (producerUsage | consumerUsage) != 0 &&
+           !(producerUsage & ~UBWC_PRODUCER_USAGE) &&
+           !(consumerUsage & ~UBWC_CONSUMER_USAGE);
+}
+
+bool GrallocLayoutEngine::IsSupported(uint32_t format) {
+    return FindFormat(format) != nullptr;
+}
+
+bool GrallocLayoutEngine::IsYuv(uint32_t format) {
+    const FormatLayout* layout = FindFormat(format);
+    return layout && layout->planeCount > 1;
+}
+
+int GrallocLayoutEngine::Compute(uint32_t format, uint32_t width, uint32_t height,
+                                 uint64_t producerUsage, uint64_t consumerUsage,
+                                 GrallocLayout* outLayout) {
+    const FormatLayout* layout = FindFormat(format);
+    if (!layout || width == 0 || height == 0) {
+        return -EINVAL;
+    }
+
+    uint32_t strideAlign = DEFAULT_ALIGNMENT.strideBytes;
+    uint32_t scanlineAlign = DEFAULT_ALIGNMENT.scanlines;
+    uint32_t planeAlign = DEFAULT_ALIGNMENT.planeBytes;
+    // Consumers derive the YV12 layout from the width and height alone, so
+    // usage must not change it.
+    const bool usageAligned = format != HAL_PIXEL_FORMAT_YV12;
+    for (const UsageAlignment& rule : USAGE_ALIGNMENTS) {
+        if (usageAligned &&
+                ((rule.producerUsage & producerUsage) || (rule.consumerUsage & consumerUsage))) {
+            strideAlign = std::max(strideAlign, rule.strideBytes);
+            scanlineAlign = std::max(scanlineAlign, rule.scanlines);
+            planeAlign = std::max(planeAlign, rule.planeBytes);
+        }
+    }
+
+    memset(outLayout, 0, sizeof(*outLayout));
+    if (IsUbwcEligible(format, producerUsage, consumerUsage)) {
+        if (layout->planeCount == 1) {
+            ComputeUbwc(&UBWC_RGBA_PLANE, 1, width, height, outLayout);
+        } else {
+            ComputeUbwc(UBWC_NV12_PLANES, 2, width, height, outLayout);
+        }
+        return outLayout->size > UINT32_MAX ? -EINVAL : 0;
+    }
+
+    outLayout->type = GRALLOC_LAYOUT_LINEAR;
+    outLayout->planeCount = layout->planeCount;
+
+    const PlaneFormat& luma = layout->planes[0];
+    uint64_t lumaStride = AlignUp((uint64_t(width) * luma.bitsPerPixel + 7) / 8, strideAlign);
+    if (luma.bitsPerPixel % 8 == 0) {
+        // Whole pixels per row, so the stride is expressible in pixels.
+        uint32_t bytesPerPixel = luma.bitsPerPixel / 8;
+        lumaStride = AlignUp(lumaStride, std::lcm(strideAlign, bytesPerPixel));
+        outLayout->pixelStride = lumaStride / bytesPerPixel;
+    }
+    uint64_t lumaScanlines = AlignUp(height, scanlineAlign);
+
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < layout->planeCount; i++) {
+        const PlaneFormat& plane = layout->planes[i];
+        uint64_t stride = lumaStride;
+        uint64_t scanlines = lumaScanlines;
+        if (i > 0) {
+            stride = AlignUp(lumaStride * plane.bitsPerPixel /
+                             (luma.bitsPerPixel * plane.hSubsample), strideAlign);
+            scanlines = AlignUp((lumaScanlines + plane.vSubsample - 1) / plane.vSubsample,
+                                std::max<uint32_t>(1, scanlineAlign / plane.vSubsample));
+        }
+        offset = AlignUp(offset, planeAlign);
+        if (offset + stride * scanlines > UINT32_MAX) {
+            return -EINVAL;
+        }
+        outLayout->planes[i].offset = offset;
+        outLayout->planes[i].stride = stride;
+        outLayout->planes[i].scanlines = scanlines;
+        offset += stride * scanlines;
+    }
+    outLayout->size = AlignUp(offset, planeAlign);
+    return 0;
+}
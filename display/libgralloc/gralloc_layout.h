@@ -0,0 +1,61 @@
+#ifndef GRALLOC_LAYOUT_H
+#define GRALLOC_LAYOUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Vendor NV12 (Y plane then interleaved CbCr); the framework's
+// YCBCR_420_888 resolves to the same layout.
+constexpr uint32_t HAL_PIXEL_FORMAT_NV12_ENCODEABLE = 0x102;
+
+struct GrallocPlaneLayout {
+    uint32_t offset;        // bytes from the start of the buffer
+    uint32_t stride;        // bytes per row
+    uint32_t scanlines;     // rows allocated, at least the plane height
+};
+
+enum GrallocLayoutType : uint32_t {
+    GRALLOC_LAYOUT_LINEAR = 0,
+    GRALLOC_LAYOUT_UBWC,        // bandwidth-compressed tiles plus metadata planes
+};
+
+struct GrallocLayout {
+    GrallocLayoutType type;
+    uint32_t planeCount;
+    GrallocPlaneLayout planes[3];   // YV12 planes are Y, Cr, Cb
+    GrallocPlaneLayout metaPlanes[2];   // UBWC compression metadata per data plane
+    uint32_t pixelStride;   // plane 0 stride in pixels, 0 for packed RAW
+    size_t size;
+};
+
+// Buffer geometry for every format gralloc allocates.
+//
+// Each format is a constexpr list of planes with their bits per pixel and
+// chroma subsampling; each usage adds a stride, scanline and plane-offset
+// alignment, and a buffer takes the strictest of the usages it carries:
+// the GPU fetches 64-byte rows, the display engine 128-byte rows, and the
+// video encoder 128-byte rows of 32-line luma (16-line chroma) with
+// page-aligned planes. Chroma strides follow the luma stride, so NV12 and
+// P010 share one stride across planes. YV12 takes no usage alignment: its
+// consumers compute the layout themselves, as the Android definition
+// gives it, from a 16-byte aligned luma stride, a 16-byte aligned half
+// stride for chroma and Cr right after the last luma row.
+//
+// RGBA/RGBX and NV12 buffers whose every usage is a UBWC-capable block
+// (GPU, display, video) get the compressed layout instead: each data
+// plane is preceded by a metadata plane of one byte per tile, with the
+// tile sizes, alignments and plane order the SM8650 GPU, SDE and video
+// firmware expect. Any CPU usage keeps a buffer linear.
+class GrallocLayoutEngine {
+public:
+    // Returns 0, or -EINVAL for an unknown format or empty dimensions.
+    static int Compute(uint32_t format, uint32_t width, uint32_t height,
+                       uint64_t producerUsage, uint64_t consumerUsage,
+                       GrallocLayout* outLayout);
+
+    static bool IsSupported(uint32_t format);
+    static bool IsYuv(uint32_t format);
+    static bool IsUbwcEligible(uint32_t format, uint64_t producerUsage, uint64_t consumerUsage);
+};
+
+#endif // GRALLOC_LAYOUT_H
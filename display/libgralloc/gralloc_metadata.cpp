@@ -0,0 +1,105 @@
+#define LOG_TAG "gralloc_sm8650"
+
+#include <log/log.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "gralloc_metadata.h"
+
+namespace {
+
+constexpr size_t FRAME_WORDS = (sizeof(GrallocFrameMetadata) + 7) / 8;
+
+} // namespace
+
+const GrallocMetadata* GrallocMetadataAccess::Map(buffer_handle_t buffer) {
+    if (!buffer || buffer->numFds <= GRALLOC_METADATA_FD_INDEX) {
+        return nullptr;
+    }
+    void* addr = mmap(nullptr, GRALLOC_METADATA_SIZE, PROT_READ, MAP_SHARED,
+                      buffer->data[GRALLOC_METADATA_FD_INDEX], 0);
+    if (addr == MAP_FAILED) {
+        ALOGE("Failed to map buffer metadata: %s", strerror(errno));
+        return nullptr;
+    }
+    const GrallocMetadata* metadata = static_cast<const GrallocMetadata*>(addr);
+    if (metadata->magic != GRALLOC_METADATA_MAGIC) {
+        ALOGE("Buffer metadata has bad magic %#x", metadata->magic);
+        munmap(addr, GRALLOC_METADATA_SIZE);
+        return nullptr;
+    }
+    return metadata;
+}
+
+void GrallocMetadataAccess::Unmap(const GrallocMetadata* metadata) {
+    if (metadata) {
+        munmap(const_cast<GrallocMetadata*>(metadata), GRALLOC_METADATA_SIZE);
+    }
+}
+
+bool GrallocMetadataAccess::GetBufferId(buffer_handle_t buffer, uint32_t* slot,
+                                        uint32_t* generation) {
+    if (!buffer || buffer->numFds <= GRALLOC_METADATA_FD_INDEX ||
+            buffer->numInts <= GRALLOC_HANDLE_GENERATION_INT) {
+        return false;
+    }
+    const int* ints = &buffer->data[buffer->numFds];
+    *slot = static_cast<uint32_t>(ints[GRALLOC_HANDLE_SLOT_INT]);
+    *generation = static_cast<uint32_t>(ints[GRALLOC_HANDLE_GENERATION_INT]);
+    return true;
+}
+
+void GrallocMetadataAccess::Init(GrallocMetadata* metadata, uint32_t width, uint32_t height,
+                                 uint32_t format, const GrallocLayout& layout) {
+    metadata->version = 1;
+    metadata->width = width;
+    metadata->height = height;
+    metadata->format = format;
+    metadata->layoutType = layout.type;
+    metadata->planeCount = layout.planeCount;
+    metadata->pixelStride = layout.pixelStride;
+    memcpy(metadata->planes, layout.planes, sizeof(metadata->planes));
+    memcpy(metadata->metaPlanes, layout.metaPlanes, sizeof(metadata->metaPlanes));
+    metadata->size = layout.size;
+    metadata->frameSeq.store(0, std::memory_order_relaxed);
+
+    GrallocFrameMetadata frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.crop.right = width;
+    frame.crop.bottom = height;
+    WriteFrame(metadata, frame);
+
+    // Importers check the magic, so it goes in last.
+    std::atomic_thread_fence(std::memory_order_release);
+    metadata->magic = GRALLOC_METADATA_MAGIC;
+}
+
+void GrallocMetadataAccess::ReadFrame(const GrallocMetadata* metadata,
+                                      GrallocFrameMetadata* outFrame) {
+    uint64_t words[FRAME_WORDS];
+    uint32_t begin;
+    uint32_t end;
+    do {
+        begin = metadata->frameSeq.load(std::memory_order_acquire);
+        for (size_t i = 0; i < FRAME_WORDS; i++) {
+            words[i] = metadata->frameWords[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        end = metadata->frameSeq.load(std::memory_order_relaxed);
+    } while ((begin & 1) || begin != end);
+    memcpy(outFrame, words, sizeof(*outFrame));
+}
+
+void GrallocMetadataAccess::WriteFrame(GrallocMetadata* metadata,
+                                       const GrallocFrameMetadata& frame) {
+    uint64_t words[FRAME_WORDS] = {};
+    memcpy(words, &frame, sizeof(frame));
+
+    uint32_t seq = metadata->frameSeq.load(std::memory_order_relaxed);
+    metadata->frameSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < FRAME_WORDS; i++) {
+        metadata->frameWords[i].store(words[i], std::memory_order_relaxed);
+    }
+    metadata->frameSeq.store(seq + 2, std::memory_order_release);
+}
@@ -0,0 +1,112 @@
+#ifndef GRALLOC_METADATA_H
+#define GRALLOC_METADATA_H
+
+#include <cutils/native_handle.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "gralloc_layout.h"
+
+// Index of the metadata page fd in every gralloc handle; the buffer fd is 0.
+constexpr int GRALLOC_METADATA_FD_INDEX = 1;
+// Indices among the ints of every gralloc handle of the buffer table slot
+// and its generation, which name a buffer across imports.
+constexpr int GRALLOC_HANDLE_SLOT_INT = 4;
+constexpr int GRALLOC_HANDLE_GENERATION_INT = 5;
+constexpr size_t GRALLOC_METADATA_SIZE = 4096;
+constexpr uint32_t GRALLOC_METADATA_MAGIC = 0x474d4431;    // "GMD1"
+
+struct GrallocRect {
+    int32_t left;
+    int32_t top;
+    int32_t right;
+    int32_t bottom;
+};
+
+struct GrallocChromaticity {
+    float x;
+    float y;
+};
+
+enum GrallocHdrFlag : uint32_t {
+    GRALLOC_HDR_SMPTE2086 = 1 << 0,
+    GRALLOC_HDR_CTA861_3 = 1 << 1,
+};
+
+struct GrallocHdrStaticMetadata {
+    uint32_t valid;     // GrallocHdrFlag bits
+    // SMPTE ST 2086 mastering display
+    GrallocChromaticity red;
+    GrallocChromaticity green;
+    GrallocChromaticity blue;
+    GrallocChromaticity whitePoint;
+    float maxLuminance;
+    float minLuminance;
+    // CTA-861.3 content light levels
+    float maxContentLightLevel;
+    float maxFrameAverageLightLevel;
+};
+
+// Metadata a producer may change from frame to frame
+struct GrallocFrameMetadata {
+    int32_t dataspace;      // android_dataspace_t
+    GrallocRect crop;
+    GrallocHdrStaticMetadata hdr;
+    uint32_t interlaced;
+};
+
+// Page shared by every process that imports a buffer.
+//
+// Only the allocating gralloc device maps the page writable: it fills the
+// static part before the handle is handed out and is the single writer of
+// the frame part. Importers map it read-only, so no process holding a
+// handle can corrupt the layout other HALs plan with. The frame part is
+// read by HWC, the video HAL and CPU consumers through a sequence lock
+// over relaxed atomic words, so readers never block the writer and nobody
+// needs a syscall once the page is mapped. Every field
+// has a fixed width so 32- and 64-bit processes agree on the layout.
+struct GrallocMetadata {
+    uint32_t magic;
+    uint32_t version;
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t layoutType;    // GrallocLayoutType
+    uint32_t planeCount;
+    uint32_t pixelStride;
+    GrallocPlaneLayout planes[3];
+    GrallocPlaneLayout metaPlanes[2];
+    uint64_t size;
+
+    std::atomic<uint32_t> frameSeq;
+    std::atomic<uint64_t> frameWords[(sizeof(GrallocFrameMetadata) + 7) / 8];
+};
+
+static_assert(sizeof(GrallocMetadata) <= GRALLOC_METADATA_SIZE,
+              "GrallocMetadata must fit its page");
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "Shared metadata needs address-free atomics");
+
+class GrallocMetadataAccess {
+public:
+    // Maps the page of an imported handle read-only; nullptr if it has none.
+    static const GrallocMetadata* Map(buffer_handle_t buffer);
+    static void Unmap(const GrallocMetadata* metadata);
+
+    // Reads the slot and generation of a handle, so importers can tell two
+    // imports of one buffer apart from different buffers; false if the
+    // handle is not a gralloc one.
+    static bool GetBufferId(buffer_handle_t buffer, uint32_t* slot, uint32_t* generation);
+
+    // Fills a freshly allocated page; frame metadata starts as an unknown
+    // dataspace, no HDR, progressive, and a crop of the whole buffer.
+    static void Init(GrallocMetadata* metadata, uint32_t width, uint32_t height,
+                     uint32_t format, const GrallocLayout& layout);
+
+    static void ReadFrame(const GrallocMetadata* metadata, GrallocFrameMetadata* outFrame);
+    // Allocating device only.
+    static void WriteFrame(GrallocMetadata* metadata, const GrallocFrameMetadata& frame);
+};
+
+#endif // GRALLOC_METADATA_H
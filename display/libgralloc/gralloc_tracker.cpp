@@ -0,0 +1,204 @@
+#define LOG_TAG "gralloc_sm8650"
+
+#include <log/log.h>
+#include <cutils/properties.h>
+#include <hardware/gralloc1.h>
+#include <utils/Timers.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <unwind.h>
+#include <algorithm>
+#include "gralloc_tracker.h"
+
+namespace {
+
+constexpr const char* BACKTRACE_PROPERTY = "vendor.gralloc.track_backtraces";
+constexpr const char* LEAK_THRESHOLD_PROPERTY = "vendor.gralloc.leak_threshold_s";
+constexpr int32_t LEAK_THRESHOLD_DEFAULT_S = 600;
+
+constexpr const char* USAGE_CLASS_NAMES[] = {
+    "video", "camera", "display", "gpu", "cpu", "other",
+};
+
+struct UnwindState {
+    uintptr_t* frames;
+    size_t count;
+    size_t max;
+    size_t skip;    // frames inside the tracker
+};
+
+_Unwind_Reason_Code UnwindFrame(struct _Unwind_Context* context, void* arg) {
+    UnwindState* state = static_cast<UnwindState*>(arg);
+    uintptr_t pc = _Unwind_GetIP(context);
+    if (state->skip) {
+        state->skip--;
+    } else if (pc) {
+        state->frames[state->count++] = pc;
+    }
+    return state->count == state->max ? _URC_END_OF_STACK : _URC_NO_REASON;
+}
+
+} // namespace
+
+GrallocTracker::GrallocTracker()
+    : mTotalBytes(0)
+    , mPeakBytes(0)
+    , mLeakThresholdNs(seconds_to_nanoseconds(
+          std::max(0, property_get_int32(LEAK_THRESHOLD_PROPERTY, LEAK_THRESHOLD_DEFAULT_S))))
+    , mBacktraces(property_get_bool(BACKTRACE_PROPERTY, false)) {
+    for (Counter& counter : mClasses) {
+        counter.buffers.store(0, std::memory_order_relaxed);
+        counter.bytes.store(0, std::memory_order_relaxed);
+    }
+    mCompressed.buffers.store(0, std::memory_order_relaxed);
+    mCompressed.bytes.store(0, std::memory_order_relaxed);
+}
+
+GrallocTracker::UsageClass GrallocTracker::Classify(uint64_t producerUsage,
+                                                    uint64_t consumerUsage) {
+    // The most specific block wins: a decoder output shown by HWC is video.
+    if ((producerUsage & GRALLOC1_PRODUCER_USAGE_VIDEO_DECODER) ||
+            (consumerUsage & GRALLOC1_CONSUMER_USAGE_VIDEO_ENCODER)) {
+        return USAGE_CLASS_VIDEO;
+    }
+    if (producerUsage & GRALLOC1_PRODUCER_USAGE_CAMERA) {
+        return USAGE_CLASS_CAMERA;
+    }
+    if (consumerUsage & (GRALLOC1_CONSUMER_USAGE_HWCOMPOSER |
+                         GRALLOC1_CONSUMER_USAGE_CLIENT_TARGET |
+                         GRALLOC1_CONSUMER_USAGE_CURSOR)) {
+        return USAGE_CLASS_DISPLAY;
+    }
+    if ((producerUsage & GRALLOC1_PRODUCER_USAGE_GPU_RENDER_TARGET) ||
+            (consumerUsage & GRALLOC1_CONSUMER_USAGE_GPU_TEXTURE)) {
+        return USAGE_CLASS_GPU;
+    }
+    if (producerUsage || consumerUsage) {
+        return USAGE_CLASS_CPU;
+    }
+    return USAGE_CLASS_OTHER;
+}
+
+const char* GrallocTracker::UsageClassName(UsageClass usageClass) {
+    return usageClass < USAGE_CLASS_COUNT ? USAGE_CLASS_NAMES[usageClass] : "?";
+}
+
+GrallocTracker::Record GrallocTracker::MakeRecord() {
+    Record record;
+    record.createdNs = systemTime(SYSTEM_TIME_MONOTONIC);
+    record.pid = getpid();
+    record.tid = gettid();
+    return record;
+}
+
+void GrallocTracker::OnCreate(uint64_t key, size_t size, uint64_t producerUsage,
+                              uint64_t consumerUsage, bool compressed) {
+    Counter& counter = mClasses[Classify(producerUsage, consumerUsage)];
+    counter.buffers.fetch_add(1, std::memory_order_relaxed);
+    counter.bytes.fetch_add(size, std::memory_order_relaxed);
+    if (compressed) {
+        mCompressed.buffers.fetch_add(1, std::memory_order_relaxed);
+        mCompressed.bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    uint64_t total = mTotalBytes.fetch_add(size, std::memory_order_relaxed) + size;
+    uint64_t peak = mPeakBytes.load(std::memory_order_relaxed);
+    while (total > peak &&
+           !mPeakBytes.compare_exchange_weak(peak, total, std::memory_order_relaxed)) {
+    }
+
+    if (mBacktraces) {
+        uintptr_t frames[MAX_FRAMES];
+        UnwindState state = { frames, 0, MAX_FRAMES, 1 };
+        _Unwind_Backtrace(UnwindFrame, &state);
+        std::lock_guard<Mutex> lock(mBacktraceLock);
+        mBacktraceMap[key].assign(frames, frames + state.count);
+    }
+}
+
+void GrallocTracker::OnRelease(uint64_t key, size_t size, uint64_t producerUsage,
+                               uint64_t consumerUsage, bool compressed) {
+    Counter& counter = mClasses[Classify(producerUsage, consumerUsage)];
+    counter.buffers.fetch_sub(1, std::memory_order_relaxed);
+    counter.bytes.fetch_sub(size, std::memory_order_relaxed);
+    if (compressed) {
+        mCompressed.buffers.fetch_sub(1, std::memory_order_relaxed);
+        mCompressed.bytes.fetch_sub(size, std::memory_order_relaxed);
+    }
+    mTotalBytes.fetch_sub(size, std::memory_order_relaxed);
+
+    if (mBacktraces) {
+        std::lock_guard<Mutex> lock(mBacktraceLock);
+        mBacktraceMap.erase(key);
+    }
+}
+
+GrallocTracker::ClassStats GrallocTracker::GetClassStats(UsageClass usageClass) const {
+    const Counter& counter = mClasses[usageClass];
+    return { counter.buffers.load(std::memory_order_relaxed),
+             counter.bytes.load(std::memory_order_relaxed) };
+}
+
+GrallocTracker::ClassStats GrallocTracker::GetCompressedStats() const {
+    return { mCompressed.buffers.load(std::memory_order_relaxed),
+             mCompressed.bytes.load(std::memory_order_relaxed) };
+}
+
+bool GrallocTracker::IsLeakSuspect(const Record& record, int64_t nowNs) const {
+    return mLeakThresholdNs > 0 && nowNs - record.createdNs > mLeakThresholdNs;
+}
+
+void GrallocTracker::AppendSummary(std::string* out) const {
+    char line[160];
+    uint64_t totalBuffers = 0;
+    for (int i = 0; i < USAGE_CLASS_COUNT; i++) {
+        ClassStats stats = GetClassStats(static_cast<UsageClass>(i));
+        totalBuffers += stats.buffers;
+        snprintf(line, sizeof(line), "  %-8s %6llu buffers %10llu KiB\n",
+                 UsageClassName(static_cast<UsageClass>(i)),
+                 static_cast<unsigned long long>(stats.buffers),
+                 static_cast<unsigned long long>(stats.bytes / 1024));
+        out->append(line);
+    }
+    ClassStats compressed = GetCompressedStats();
+    snprintf(line, sizeof(line),
+             "  total %llu buffers, %llu KiB (peak %llu KiB), UBWC %llu buffers %llu KiB\n",
+             static_cast<unsigned long long>(totalBuffers),
+             static_cast<unsigned long long>(mTotalBytes.load(std::memory_order_relaxed) / 1024),
+             static_cast<unsigned long long>(GetPeakBytes() / 1024),
+             static_cast<unsigned long long>(compressed.buffers),
+             static_cast<unsigned long long>(compressed.bytes / 1024));
+    out->append(line);
+}
+
+void GrallocTracker::AppendBacktrace(uint64_t key, std::string* out) const {
+    if (!mBacktraces) {
+        return;
+    }
+    // Symbolized unlocked, as dladdr walks the loaded libraries.
+    std::vector<uintptr_t> frames;
+    {
+        std::lock_guard<Mutex> lock(mBacktraceLock);
+        auto it = mBacktraceMap.find(key);
+        if (it == mBacktraceMap.end()) {
+            return;
+        }
+        frames = it->second;
+    }
+
+    char line[256];
+    for (size_t i = 0; i < frames.size(); i++) {
+        uintptr_t pc = frames[i];
+        Dl_info info;
+        if (dladdr(reinterpret_cast<void*>(pc), &info) && info.dli_fname) {
+            snprintf(line, sizeof(line), "      #%02zu pc %p %s (%s+%#zx)\n", i,
+                     reinterpret_cast<void*>(pc), info.dli_fname,
+                     info.dli_sname ? info.dli_sname : "?",
+                     static_cast<size_t>(pc - reinterpret_cast<uintptr_t>(
+                         info.dli_saddr ? info.dli_saddr : info.dli_fbase)));
+        } else {
+            snprintf(line, sizeof(line), "      #%02zu pc %p\n", i, reinterpret_cast<void*>(pc));
+        }
+        out->append(line);
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef GRALLOC_TRACKER_H
+#define GRALLOC_TRACKER_H
+
+#include <utils/Mutex.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace android;
+
+// Accounting for live gralloc buffers.
+//
+// Every buffer gets a Record (creation time, allocating PID/TID) stored
+// with it in the buffer table, and its bytes are added to one usage class
+// and to the compressed/linear split. The counters are relaxed atomics, so
+// they cost a few adds per allocation and stay on in production builds.
+// With vendor.gralloc.track_backtraces set, each allocation also captures
+// up to MAX_FRAMES return addresses for the dump. Buffers older than
+// vendor.gralloc.leak_threshold_s (0 disables) are reported as suspected
+// leaks.
+class GrallocTracker {
+public:
+    enum UsageClass {
+        USAGE_CLASS_VIDEO = 0,
+        USAGE_CLASS_CAMERA,
+        USAGE_CLASS_DISPLAY,
+        USAGE_CLASS_GPU,
+        USAGE_CLASS_CPU,
+        USAGE_CLASS_OTHER,
+        USAGE_CLASS_COUNT
+    };
+
+    struct Record {
+        int64_t createdNs;
+        int32_t pid;
+        int32_t tid;
+    };
+
+    struct ClassStats {
+        uint64_t buffers;
+        uint64_t bytes;
+    };
+
+    GrallocTracker();
+
+    // Stamps a buffer being created by the calling thread.
+    static Record MakeRecord();
+
+    // key identifies the buffer until OnRelease, e.g. its table slot and
+    // generation.
+    void OnCreate(uint64_t key, size_t size, uint64_t producerUsage, uint64_t consumerUsage,
+                  bool compressed);
+    void OnRelease(uint64_t key, size_t size, uint64_t producerUsage, uint64_t consumerUsage,
+                   bool compressed);
+
+    static UsageClass Classify(uint64_t producerUsage, uint64_t consumerUsage);
+    static const char* UsageClassName(UsageClass usageClass);
+
+    ClassStats GetClassStats(UsageClass usageClass) const;
+    ClassStats GetCompressedStats() const;
+    uint64_t GetPeakBytes() const { return mPeakBytes.load(std::memory_order_relaxed); }
+
+    bool IsLeakSuspect(const Record& record, int64_t nowNs) const;
+    int64_t GetLeakThresholdNs() const { return mLeakThresholdNs; }
+
+    void AppendSummary(std::string* out) const;
+    // Appends the allocation backtrace of a buffer, if one was captured.
+    void AppendBacktrace(uint64_t key, std::string* out) const;
+
+private:
+    static constexpr size_t MAX_FRAMES = 16;
+
+    struct Counter {
+        std::atomic<uint64_t> buffers;
+        std::atomic<uint64_t> bytes;
+    };
+
+    Counter mClasses[USAGE_CLASS_COUNT];
+    Counter mCompressed;
+    std::atomic<uint64_t> mTotalBytes;
+    std::atomic<uint64_t> mPeakBytes;
+
+    int64_t mLeakThresholdNs;
+    bool mBacktraces;
+
+    mutable Mutex mBacktraceLock;
+    std::map<uint64_t, std::vector<uintptr_t>> mBacktraceMap;
+};
+
+#endif // GRALLOC_TRACKER_H
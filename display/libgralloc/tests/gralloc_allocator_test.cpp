@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+#include <hardware/gralloc1.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gralloc_allocator.h"
+
+namespace {
+
+constexpr uint64_t CONSUMER_USAGE = GRALLOC1_CONSUMER_USAGE_HWCOMPOSER;
+
+ino_t Inode(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 ? st.st_ino : 0;
+}
+
+TEST(GrallocAllocatorTest, SizeClasses) {
+    EXPECT_EQ(4096u, GrallocAllocator::SizeClass(1));
+    EXPECT_EQ(8192u, GrallocAllocator::SizeClass(5000));
+    EXPECT_EQ(32768u, GrallocAllocator::SizeClass(32768));
+    // Eight steps per power of two above eight pages
+    EXPECT_EQ(36864u, GrallocAllocator::SizeClass(32769));
+    EXPECT_EQ(1048576u, GrallocAllocator::SizeClass(1000000));
+    EXPECT_EQ(8388608u, GrallocAllocator::SizeClass(1920 * 1080 * 4));
+}
+
+TEST(GrallocAllocatorTest, NeverReusesABufferAnImporterHolds) {
+    GrallocAllocator allocator;
+    size_t size;
+    int fd = allocator.Allocate(1920 * 1080 * 4, 0, CONSUMER_USAGE, &size);
+    ASSERT_GE(fd, 0);
+    ino_t exported = Inode(fd);
+    int imported = dup(fd);
+    allocator.Free(fd, size, 0, CONSUMER_USAGE);
+
+    // The importer still sees the buffer, so the next one is new memory.
+    size_t nextSize;
+    int next = allocator.Allocate(1920 * 1080 * 4, 0, CONSUMER_USAGE, &nextSize);
+    ASSERT_GE(next, 0);
+    EXPECT_NE(exported, Inode(next));
+    EXPECT_EQ(0u, allocator.GetStats().poolHits);
+
+    // Once the importer lets go the parked buffer is free to reuse.
+    close(imported);
+    allocator.Free(next, nextSize, 0, CONSUMER_USAGE);
+    int reused = allocator.Allocate(1920 * 1080 * 4, 0, CONSUMER_USAGE, &size);
+    ASSERT_GE(reused, 0);
+    if (allocator.UsesDmaHeap()) {
+        EXPECT_EQ(1u, allocator.GetStats().poolHits);
+    } else {
+        // memfds cannot report their importers and are never pooled
+        EXPECT_EQ(0u, allocator.GetStats().poolHits);
+        EXPECT_EQ(0u, allocator.GetStats().buffersHeld);
+    }
+    allocator.Free(reused, size, 0, CONSUMER_USAGE);
+}
+
+TEST(GrallocAllocatorTest, NeverPoolsProtectedBuffers) {
+    GrallocAllocator allocator;
+    size_t size;
+    int fd = allocator.Allocate(65536, GRALLOC1_PRODUCER_USAGE_PROTECTED, CONSUMER_USAGE,
+                                &size);
+    ASSERT_GE(fd, 0);
+    ino_t freed = Inode(fd);
+    allocator.Free(fd, size, GRALLOC1_PRODUCER_USAGE_PROTECTED, CONSUMER_USAGE);
+    EXPECT_EQ(0u, allocator.GetStats().buffersHeld);
+
+    // The next protected buffer of the same shape is fresh memory.
+    int next = allocator.Allocate(65536, GRALLOC1_PRODUCER_USAGE_PROTECTED, CONSUMER_USAGE,
+                                  &size);
+    ASSERT_GE(next, 0);
+    EXPECT_NE(freed, Inode(next));
+    EXPECT_EQ(0u, allocator.GetStats().poolHits);
+    allocator.Free(next, size, GRALLOC1_PRODUCER_USAGE_PROTECTED, CONSUMER_USAGE);
+}
+
+} // namespace
@@ -0,0 +1,154 @@
+#include <benchmark/benchmark.h>
+#include <utils/Mutex.h>
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "gralloc_buffer_table.h"
+#include "gralloc_layout.h"
+
+namespace {
+
+// The shape of a GrallocDevice buffer entry, whose type is private
+struct Entry {
+    void* handle;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint64_t producerUsage;
+    uint64_t consumerUsage;
+    GrallocLayout layout;
+    int fd;
+    size_t size;
+};
+
+constexpr uint32_t CAPACITY = 4096;
+// Buffers alive in a busy system: a few BufferQueues of three and the
+// framebuffers, camera and video pools
+constexpr uint32_t LIVE_BUFFERS = 256;
+
+struct Key {
+    uint32_t slot;
+    uint32_t generation;
+};
+
+// What the table replaced: every lookup takes the device mutex.
+class LockedMap {
+public:
+    int Insert(const Entry& value, uint32_t* outSlot, uint32_t* outGeneration) {
+        std::lock_guard<Mutex> lock(mLock);
+        *outSlot = mNextId++;
+        *outGeneration = 1;
+        mEntries[*outSlot] = value;
+        return 0;
+    }
+
+    bool Remove(uint32_t slot, uint32_t, Entry* outValue) {
+        std::lock_guard<Mutex> lock(mLock);
+        auto it = mEntries.find(slot);
+        if (it == mEntries.end()) {
+            return false;
+        }
+        *outValue = it->second;
+        mEntries.erase(it);
+        return true;
+    }
+
+    bool Lookup(uint32_t slot, uint32_t, Entry* outValue) const {
+        std::lock_guard<Mutex> lock(mLock);
+        auto it = mEntries.find(slot);
+        if (it == mEntries.end()) {
+            return false;
+        }
+        *outValue = it->second;
+        return true;
+    }
+
+private:
+    mutable Mutex mLock;
+    std::map<uint32_t, Entry> mEntries;
+    uint32_t mNextId = 0;
+};
+
+// Shared by the threads of one benchmark run; thread 0 sets it up before
+// the start barrier and tears it down after the end one.
+template <typename Table>
+struct Fixture {
+    std::unique_ptr<Table> table;
+    std::vector<Key> keys;
+    std::atomic<bool> stop;
+    std::thread writer;
+};
+
+template <typename Table>
+Fixture<Table> gFixture;
+
+// Allocates and releases buffers of its own, as a BufferQueue resizing or
+// an app starting does, while the readers look up the long-lived ones.
+template <typename Table>
+void Churn(Table* table, const std::atomic<bool>* stop) {
+    Entry entry = {};
+    while (!stop->load(std::memory_order_relaxed)) {
+        Key key;
+        if (table->Insert(entry, &key.slot, &key.generation) == 0) {
+            table->Remove(key.slot, key.generation, &entry);
+        }
+    }
+}
+
+template <typename Table>
+void BM_Lookup(benchmark::State& state) {
+    Fixture<Table>& fixture = gFixture<Table>;
+    const bool churn = state.range(0);
+    if (state.thread_index() == 0) {
+        fixture.table.reset(new Table());
+        fixture.keys.clear();
+        Entry entry = {};
+        for (uint32_t i = 0; i < LIVE_BUFFERS; i++) {
+            Key key;
+            entry.fd = i;
+            fixture.table->Insert(entry, &key.slot, &key.generation);
+            fixture.keys.push_back(key);
+        }
+        fixture.stop = false;
+        if (churn) {
+            fixture.writer = std::thread(Churn<Table>, fixture.table.get(), &fixture.stop);
+        }
+    }
+
+    uint32_t random = 2463534242u + state.thread_index();
+    uint64_t misses = 0;
+    for (auto _ : state) {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        const Key& key = fixture.keys[random % LIVE_BUFFERS];
+        Entry entry;
+        misses += !fixture.table->Lookup(key.slot, key.generation, &entry);
+        benchmark::DoNotOptimize(entry);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["misses"] = benchmark::Counter(misses, benchmark::Counter::kAvgThreads);
+
+    if (state.thread_index() == 0) {
+        fixture.stop = true;
+        if (fixture.writer.joinable()) {
+            fixture.writer.join();
+        }
+        fixture.table.reset();
+    }
+}
+
+// range(0) adds a thread creating and releasing buffers during the lookups.
+BENCHMARK_TEMPLATE(BM_Lookup, GrallocBufferTable<Entry, CAPACITY>)
+    ->ArgName("churn")->Arg(0)->Arg(1)
+    ->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Lookup, LockedMap)
+    ->ArgName("churn")->Arg(0)->Arg(1)
+    ->ThreadRange(1, 8)->UseRealTime();
+
+} // namespace
+
+BENCHMARK_MAIN();
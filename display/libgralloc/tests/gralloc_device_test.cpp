@@ -0,0 +1,61 @@
+#include <gtest/gtest.h>
+#include <hardware/gralloc1.h>
+#include <string.h>
+#include "gralloc_device.h"
+
+namespace {
+
+constexpr uint64_t CPU_USAGE = GRALLOC1_PRODUCER_USAGE_CPU_WRITE_OFTEN;
+
+class GrallocDeviceTest : public testing::Test {
+protected:
+    gralloc1_error_t Allocate(uint64_t producerUsage, buffer_handle_t* outBuffer) {
+        gralloc1_buffer_descriptor_t descriptor;
+        gralloc1_error_t err = GrallocDevice::CreateDescriptor(mDev, &descriptor);
+        if (err != GRALLOC1_ERROR_NONE) {
+            return err;
+        }
+        GrallocDevice::SetDimensions(mDev, descriptor, 256, 256);
+        GrallocDevice::SetFormat(mDev, descriptor, HAL_PIXEL_FORMAT_RGBA_8888);
+        GrallocDevice::SetProducerUsage(mDev, descriptor, producerUsage);
+        GrallocDevice::SetConsumerUsage(mDev, descriptor, GRALLOC1_CONSUMER_USAGE_HWCOMPOSER);
+        err = GrallocDevice::CreateBuffer(mDev, descriptor, outBuffer);
+        GrallocDevice::DestroyDescriptor(mDev, descriptor);
+        return err;
+    }
+
+    gralloc1_error_t Lock(buffer_handle_t buffer, uint8_t** outData) {
+        return GrallocDevice::Lock(mDev, buffer, CPU_USAGE, 0, nullptr,
+                                   reinterpret_cast<void**>(outData), -1);
+    }
+
+    GrallocDevice mDevice;
+    gralloc1_device_t* mDev = &mDevice;
+};
+
+TEST_F(GrallocDeviceTest, LockedBufferIsNotReleased) {
+    buffer_handle_t buffer;
+    ASSERT_EQ(GRALLOC1_ERROR_NONE, Allocate(CPU_USAGE, &buffer));
+    uint8_t* data;
+    ASSERT_EQ(GRALLOC1_ERROR_NONE, Lock(buffer, &data));
+
+    // The mapping stays valid for the CPU user holding the lock.
+    EXPECT_EQ(GRALLOC1_ERROR_BAD_VALUE, GrallocDevice::ReleaseBuffer(mDev, buffer));
+    memset(data, 0x5a, 256 * 4);
+    EXPECT_EQ(GRALLOC1_ERROR_NONE, GrallocDevice::Unlock(mDev, buffer, nullptr));
+
+    EXPECT_EQ(GRALLOC1_ERROR_NONE, GrallocDevice::ReleaseBuffer(mDev, buffer));
+    EXPECT_EQ(GRALLOC1_ERROR_BAD_HANDLE, Lock(buffer, &data));
+}
+
+TEST_F(GrallocDeviceTest, ProtectedBuffersHaveNoCpuMapping) {
+    buffer_handle_t buffer;
+    ASSERT_EQ(GRALLOC1_ERROR_NONE,
+              Allocate(GRALLOC1_PRODUCER_USAGE_PROTECTED | CPU_USAGE, &buffer));
+    uint8_t* data;
+    EXPECT_EQ(GRALLOC1_ERROR_BAD_VALUE, Lock(buffer, &data));
+    EXPECT_EQ(GRALLOC1_ERROR_BAD_VALUE, GrallocDevice::Unlock(mDev, buffer, nullptr));
+    EXPECT_EQ(GRALLOC1_ERROR_NONE, GrallocDevice::ReleaseBuffer(mDev, buffer));
+}
+
+} // namespace
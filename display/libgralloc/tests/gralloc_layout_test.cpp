@@ -0,0 +1,267 @@
+#include <gtest/gtest.h>
+#include <hardware/gralloc1.h>
+#include <errno.h>
+#include <algorithm>
+#include "gralloc_layout.h"
+
+namespace {
+
+struct FormatInfo {
+    uint32_t format;
+    uint32_t planeCount;
+    uint32_t lumaBits;
+};
+
+constexpr FormatInfo FORMATS[] = {
+    { HAL_PIXEL_FORMAT_RGBA_8888, 1, 32 },
+    { HAL_PIXEL_FORMAT_RGBX_8888, 1, 32 },
+    { HAL_PIXEL_FORMAT_BGRA_8888, 1, 32 },
+    { HAL_PIXEL_FORMAT_RGB_888, 1, 24 },
+    { HAL_PIXEL_FORMAT_RGB_565, 1, 16 },
+    { HAL_PIXEL_FORMAT_NV12_ENCODEABLE, 2, 8 },
+    { HAL_PIXEL_FORMAT_YCBCR_420_888, 2, 8 },
+    { HAL_PIXEL_FORMAT_YCRCB_420_SP, 2, 8 },
+    { HAL_PIXEL_FORMAT_YCBCR_P010, 2, 16 },
+    { HAL_PIXEL_FORMAT_YV12, 3, 8 },
+    { HAL_PIXEL_FORMAT_RAW16, 1, 16 },
+    { HAL_PIXEL_FORMAT_RAW12, 1, 12 },
+    { HAL_PIXEL_FORMAT_RAW10, 1, 10 },
+};
+
+struct Usage {
+    const char* name;
+    uint64_t producer;
+    uint64_t consumer;
+    uint32_t strideAlign;   // strictest row alignment, bytes
+    uint32_t scanlineAlign;
+    uint32_t planeAlign;
+};
+
+constexpr uint64_t CPU_PRODUCER = GRALLOC1_PRODUCER_USAGE_CPU_READ |
+                                  GRALLOC1_PRODUCER_USAGE_CPU_WRITE;
+
+constexpr Usage USAGES[] = {
+    { "none", 0, 0, 16, 1, 1 },
+    { "cpu", CPU_PRODUCER, GRALLOC1_CONSUMER_USAGE_CPU_READ, 16, 1, 1 },
+    { "gpu render", GRALLOC1_PRODUCER_USAGE_GPU_RENDER_TARGET, 0, 64, 1, 64 },
+    { "gpu texture", CPU_PRODUCER, GRALLOC1_CONSUMER_USAGE_GPU_TEXTURE, 64, 1, 64 },
+    { "composer", CPU_PRODUCER, GRALLOC1_CONSUMER_USAGE_HWCOMPOSER, 128, 1, 4096 },
+    { "client target", GRALLOC1_PRODUCER_USAGE_GPU_RENDER_TARGET,
+      GRALLOC1_CONSUMER_USAGE_CLIENT_TARGET, 128, 1, 4096 },
+    { "cursor", CPU_PRODUCER, GRALLOC1_CONSUMER_USAGE_CURSOR, 128, 1, 4096 },
+    { "video decoder", GRALLOC1_PRODUCER_USAGE_VIDEO_DECODER,
+      GRALLOC1_CONSUMER_USAGE_CPU_READ, 128, 32, 4096 },
+    { "camera", GRALLOC1_PRODUCER_USAGE_CAMERA, GRALLOC1_CONSUMER_USAGE_GPU_TEXTURE,
+      128, 32, 4096 },
+    { "video encoder", CPU_PRODUCER, GRALLOC1_CONSUMER_USAGE_VIDEO_ENCODER, 128, 32, 4096 },
+    { "gpu composer", GRALLOC1_PRODUCER_USAGE_GPU_RENDER_TARGET,
+      GRALLOC1_CONSUMER_USAGE_GPU_TEXTURE | GRALLOC1_CONSUMER_USAGE_HWCOMPOSER,
+      128, 1, 4096 },
+    { "decoder to composer", GRALLOC1_PRODUCER_USAGE_VIDEO_DECODER,
+      GRALLOC1_CONSUMER_USAGE_HWCOMPOSER, 128, 32, 4096 },
+};
+
+constexpr uint32_t SIZES[][2] = {
+    { 1, 1 }, { 2, 2 }, { 64, 64 }, { 176, 144 }, { 640, 480 }, { 704, 576 },
+    { 720, 480 }, { 1080, 2400 }, { 1920, 1080 }, { 1366, 768 }, { 4096, 2160 },
+    { 4096, 4096 },
+};
+
+uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// The layout the Android YV12 definition gives for every usage
+void ExpectYv12(uint32_t width, uint32_t height, const GrallocLayout& layout) {
+    uint32_t yStride = AlignUp(width, 16);
+    uint32_t cStride = AlignUp(yStride / 2, 16);
+    uint32_t cHeight = (height + 1) / 2;
+    EXPECT_EQ(GRALLOC_LAYOUT_LINEAR, layout.type);
+    ASSERT_EQ(3u, layout.planeCount);
+    EXPECT_EQ(0u, layout.planes[0].offset);
+    EXPECT_EQ(yStride, layout.planes[0].stride);
+    EXPECT_EQ(height, layout.planes[0].scanlines);
+    EXPECT_EQ(yStride * height, layout.planes[1].offset);    // Cr
+    EXPECT_EQ(cStride, layout.planes[1].stride);
+    EXPECT_EQ(cHeight, layout.planes[1].scanlines);
+    EXPECT_EQ(yStride * height + cStride * cHeight, layout.planes[2].offset);    // Cb
+    EXPECT_EQ(cStride, layout.planes[2].stride);
+    EXPECT_EQ(cHeight, layout.planes[2].scanlines);
+    EXPECT_EQ(yStride * height + 2 * cStride * cHeight, layout.size);
+    EXPECT_EQ(yStride, layout.pixelStride);
+}
+
+TEST(GrallocLayoutTest, EveryFormatAndUsage) {
+    for (const FormatInfo& format : FORMATS) {
+        for (const Usage& usage : USAGES) {
+            for (const auto& size : SIZES) {
+                const uint32_t width = size[0];
+                const uint32_t height = size[1];
+                SCOPED_TRACE(testing::Message() << "format " << std::hex << format.format
+                             << std::dec << ", " << usage.name << ", " << width << "x"
+                             << height);
+                GrallocLayout layout;
+                ASSERT_EQ(0, GrallocLayoutEngine::Compute(format.format, width, height,
+                                                          usage.producer, usage.consumer,
+                                                          &layout));
+                if (GrallocLayoutEngine::IsUbwcEligible(format.format, usage.producer,
+                                                        usage.consumer)) {
+                    EXPECT_EQ(GRALLOC_LAYOUT_UBWC, layout.type);
+                    continue;
+                }
+                if (format.format == HAL_PIXEL_FORMAT_YV12) {
+                    ExpectYv12(width, height, layout);
+                    continue;
+                }
+
+                EXPECT_EQ(GRALLOC_LAYOUT_LINEAR, layout.type);
+                ASSERT_EQ(format.planeCount, layout.planeCount);
+                uint64_t end = 0;
+                for (uint32_t i = 0; i < layout.planeCount; i++) {
+                    const GrallocPlaneLayout& plane = layout.planes[i];
+                    uint32_t subsample = i == 0 ? 1 : 2;
+                    uint32_t bits = i == 0 ? format.lumaBits : format.lumaBits * 2;
+                    uint64_t rowBytes = (uint64_t((width + subsample - 1) / subsample) *
+                                         bits + 7) / 8;
+                    EXPECT_EQ(0u, plane.stride % usage.strideAlign) << "plane " << i;
+                    EXPECT_GE(plane.stride, rowBytes) << "plane " << i;
+                    EXPECT_GE(plane.scanlines, (height + subsample - 1) / subsample)
+                        << "plane " << i;
+                    EXPECT_EQ(0u, plane.scanlines * subsample % usage.scanlineAlign)
+                        << "plane " << i;
+                    EXPECT_EQ(0u, plane.offset % usage.planeAlign) << "plane " << i;
+                    EXPECT_GE(plane.offset, end) << "plane " << i;
+                    end = plane.offset + uint64_t(plane.stride) * plane.scanlines;
+                }
+                // Chroma rows of 4:2:0 formats are as long as luma rows
+                if (layout.planeCount == 2) {
+                    EXPECT_EQ(layout.planes[0].stride, layout.planes[1].stride);
+                }
+                EXPECT_GE(layout.size, end);
+                EXPECT_EQ(0u, layout.size % usage.planeAlign);
+                if (format.lumaBits % 8 == 0) {
+                    EXPECT_EQ(layout.planes[0].stride,
+                              layout.pixelStride * (format.lumaBits / 8));
+                } else {
+                    EXPECT_EQ(0u, layout.pixelStride);
+                }
+            }
+        }
+    }
+}
+
+TEST(GrallocLayoutTest, Yv12IgnoresUsageAlignment) {
+    GrallocLayout layout;
+    ASSERT_EQ(0, GrallocLayoutEngine::Compute(HAL_PIXEL_FORMAT_YV12, 704, 576,
+                                              GRALLOC1_PRODUCER_USAGE_GPU_RENDER_TARGET,
+                                              GRALLOC1_CONSUMER_USAGE_GPU_TEXTURE, &layout));
+    EXPECT_EQ(704u, layout.planes[0].stride);
+    EXPECT_EQ(352u, layout.planes[1].stride);
+    EXPECT_EQ(704u * 576, layout.planes[1].offset);
+
+    // 720 / 2 = 360 rounds up to 368
+    ASSERT_EQ(0, GrallocLayoutEngine::Compute(HAL_PIXEL_FORMAT_YV12, 720, 480,
+                                              GRALLOC1_PRODUCER_USAGE_VIDEO_DECODER,
+                                              GRALLOC1_CONSUMER_USAGE_HWCOMPOSER, &layout));
+    EXPECT_EQ(720u, layout.planes[0].stride);
+    EXPECT_EQ(368u, layout.planes[1].stride);
+    EXPECT_EQ(720u * 480, layout.planes[1].offset);
+    EXPECT_EQ(720u * 480 + 368 * 240, layout.planes[2].offset);
+    EXPECT_EQ(720u * 480 + 2 * 368 * 240, layout.size);
+}
+
+TEST(GrallocLayoutTest, LinearReferenceLayouts) {
+    GrallocLayout layout;
+    ASSERT_EQ(0, GrallocLayoutEngine::Compute(HAL_PIXEL_FORMAT_RGB_888, 100, 10,
+                                              CPU_PRODUCER, GRALLOC1_CONSUMER_USAGE_GPU_TEXTURE,
+                                              &layout));
+    // 300 bytes, 64-byte rows of whole pixels
+    EXPECT_EQ(384u, layout.planes[0].stride);
+    EXPECT_EQ(128u, layout.pixelStride);
+
+    ASSERT_EQ(0, GrallocLayoutEngine::Compute(HAL_PIXEL_FORMAT_NV12_ENCODEABLE, 1920, 1080,
+                                              CPU_PRODUCER,
+                                              GRALLOC1_CONSUMER_USAGE_VIDEO_ENCODER, &layout));
+    EXPECT_EQ(1920u, layout.planes[0].stride);
+    EXPECT_EQ(1088u, layout.planes[0].scanlines);
+    EXPECT_EQ(1920u * 1088, layout.planes[1].offset);
+    EXPECT_EQ(544u, layout.planes[1].scanlines);
+    EXPECT_EQ(1920u * 1088 + 1920 * 544, layout.size);
+
+    ASSERT_EQ(0, GrallocLayoutEngine::Compute(HAL_PIXEL_FORMAT_RAW10, 4000, 3000,
+                                              GRALLOC1_PRODUCER_USAGE_CAMERA,
+                                              GRALLOC1_CONSUMER_USAGE_CPU_READ, &layout));
+    EXPECT_EQ(5120u, layout.planes[0].stride);
+    EXPECT_EQ(3008u, layout.planes[0].scanlines);
+    EXPECT_EQ(0u, layout.pixelStride);
+}
+
+// Metadata plane, then data plane, each padded to a page: one metadata
+// byte per tile in 64-byte rows of 16-row multiples.
+struct UbwcReference {
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    GrallocPlaneLayout metaPlanes[2];
+    GrallocPlaneLayout planes[2];
+    size_t size;
+};
+
+constexpr UbwcReference UBWC_REFERENCES[] = {
+    // RGBA: 16x4 tiles, 256-byte rows of 16-row multiples
+    { HAL_PIXEL_FORMAT_RGBA_8888, 1920, 1080,
+      { { 0, 128, 272 } }, { { 36864, 7680, 1088 } }, 8392704 },
+    { HAL_PIXEL_FORMAT_RGBA_8888, 3840, 2160,
+      { { 0, 256, 544 } }, { { 139264, 15360, 2160 } }, 33316864 },
+    { HAL_PIXEL_FORMAT_RGBA_8888, 33, 17,
+      { { 0, 64, 16 } }, { { 4096, 256, 32 } }, 12288 },
+    // NV12: 32x8 luma and 16x8 chroma tiles, 128-byte rows of 32-row multiples
+    { HAL_PIXEL_FORMAT_NV12_ENCODEABLE, 1920, 1080,
+      { { 0, 64, 144 }, { 2101248, 64, 80 } },
+      { { 12288, 1920, 1088 }, { 2109440, 1920, 544 } }, 3153920 },
+    { HAL_PIXEL_FORMAT_NV12_ENCODEABLE, 3840, 2160,
+      { { 0, 128, 272 }, { 8392704, 128, 144 } },
+      { { 36864, 3840, 2176 }, { 8413184, 3840, 1088 } }, 12591104 },
+    // Odd sizes round the chroma plane up
+    { HAL_PIXEL_FORMAT_NV12_ENCODEABLE, 175, 97,
+      { { 0, 64, 16 }, { 36864, 64, 16 } },
+      { { 4096, 256, 128 }, { 40960, 256, 64 } }, 57344 },
+};
+
+void ExpectPlane(const GrallocPlaneLayout& expected, const GrallocPlaneLayout& actual) {
+    EXPECT_EQ(expected.offset, actual.offset);
+    EXPECT_EQ(expected.stride, actual.stride);
+    EXPECT_EQ(expected.scanlines, actual.scanlines);
+}
+
+TEST(GrallocLayoutTest, UbwcReferenceLayouts) {
+    for (const UbwcReference& ref : UBWC_REFERENCES) {
+        SCOPED_TRACE(testing::Message() << std::hex << "format " << ref.format << std::dec
+                     << " " << ref.width << "x" << ref.height);
+        GrallocLayout layout;
+        ASSERT_EQ(0, GrallocLayoutEngine::Compute(ref.format, ref.width, ref.height,
+                                                  GRALLOC1_PRODUCER_USAGE_GPU_RENDER_TARGET,
+                                                  GRALLOC1_CONSUMER_USAGE_HWCOMPOSER, &layout));
+        EXPECT_EQ(GRALLOC_LAYOUT_UBWC, layout.type);
+        uint32_t planeCount = ref.format == HAL_PIXEL_FORMAT_RGBA_8888 ? 1 : 2;
+        ASSERT_EQ(planeCount, layout.planeCount);
+        for (uint32_t i = 0; i < planeCount; i++) {
+            SCOPED_TRACE(testing::Message() << "plane " << i);
+            ExpectPlane(ref.metaPlanes[i], layout.metaPlanes[i]);
+            ExpectPlane(ref.planes[i], layout.planes[i]);
+        }
+        EXPECT_EQ(ref.size, layout.size);
+    }
+}
+
+TEST(GrallocLayoutTest, RejectsUnknownFormatsAndEmptyBuffers) {
+    GrallocLayout layout;
+    EXPECT_EQ(-EINVAL, GrallocLayoutEngine::Compute(HAL_PIXEL_FORMAT_BLOB, 64, 64, 0, 0,
+                                                    &layout));
+    EXPECT_EQ(-EINVAL, GrallocLayoutEngine::Compute(HAL_PIXEL_FORMAT_RGBA_8888, 0, 64, 0, 0,
+                                                    &layout));
+    EXPECT_EQ(-EINVAL, GrallocLayoutEngine::Compute(HAL_PIXEL_FORMAT_RGBA_8888, 64, 0, 0, 0,
+                                                    &layout));
+}
+
+} // namespace
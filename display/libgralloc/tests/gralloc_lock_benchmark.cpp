@@ -0,0 +1,70 @@
+#include <benchmark/benchmark.h>
+#include <stdint.h>
+#include <string.h>
+#include "gralloc_device.h"
+
+namespace {
+
+constexpr uint32_t WIDTH = 3840;
+constexpr uint32_t HEIGHT = 2160;
+constexpr uint32_t BYTES_PER_PIXEL = 4;
+
+// A CPU-rendered 4K RGBA layer, as a software decoder or a screenshot
+// produces: the app locks it, fills it and unlocks it every frame.
+// range(0) is 0 for a bare lock and unlock, 1 to write every pixel between.
+void BM_LockWriteUnlock(benchmark::State& state) {
+    const bool write = state.range(0);
+    GrallocDevice device;
+    gralloc1_device_t* dev = &device;
+
+    gralloc1_buffer_descriptor_t descriptor;
+    buffer_handle_t buffer;
+    GrallocLayout layout;
+    if (GrallocDevice::CreateDescriptor(dev, &descriptor) != GRALLOC1_ERROR_NONE ||
+            GrallocDevice::SetDimensions(dev, descriptor, WIDTH, HEIGHT) != GRALLOC1_ERROR_NONE ||
+            GrallocDevice::SetFormat(dev, descriptor, HAL_PIXEL_FORMAT_RGBA_8888) !=
+                GRALLOC1_ERROR_NONE ||
+            GrallocDevice::SetProducerUsage(dev, descriptor,
+                GRALLOC1_PRODUCER_USAGE_CPU_WRITE_OFTEN) != GRALLOC1_ERROR_NONE ||
+            GrallocDevice::SetConsumerUsage(dev, descriptor,
+                GRALLOC1_CONSUMER_USAGE_HWCOMPOSER) != GRALLOC1_ERROR_NONE ||
+            GrallocDevice::CreateBuffer(dev, descriptor, &buffer) != GRALLOC1_ERROR_NONE) {
+        state.SkipWithError("failed to allocate the buffer");
+        return;
+    }
+    GrallocDevice::DestroyDescriptor(dev, descriptor);
+    GrallocDevice::GetBufferProperties(dev, buffer, nullptr, nullptr, nullptr, nullptr,
+                                       nullptr, &layout);
+    const size_t rowBytes = WIDTH * BYTES_PER_PIXEL;
+    const size_t strideBytes = layout.planes[0].stride;
+
+    uint8_t pixel = 0;
+    for (auto _ : state) {
+        void* data;
+        if (GrallocDevice::Lock(dev, buffer, GRALLOC1_PRODUCER_USAGE_CPU_WRITE_OFTEN, 0,
+                                nullptr, &data, -1) != GRALLOC1_ERROR_NONE) {
+            state.SkipWithError("lock failed");
+            break;
+        }
+        if (write) {
+            uint8_t* row = static_cast<uint8_t*>(data) + layout.planes[0].offset;
+            for (uint32_t y = 0; y < HEIGHT; y++, row += strideBytes) {
+                memset(row, pixel, rowBytes);
+            }
+            pixel++;
+            benchmark::ClobberMemory();
+        }
+        int32_t releaseFence;
+        GrallocDevice::Unlock(dev, buffer, &releaseFence);
+    }
+    if (write) {
+        state.SetBytesProcessed(state.iterations() * rowBytes * HEIGHT);
+    }
+    GrallocDevice::ReleaseBuffer(dev, buffer);
+}
+
+BENCHMARK(BM_LockWriteUnlock)->ArgName("write")->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+} // namespace
+
+BENCHMARK_MAIN();
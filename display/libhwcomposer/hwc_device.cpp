@@ -1,19 +1,99 @@
 #define LOG_TAG "hwc_sm8650"
 
 #include <log/log.h>
+#include <cutils/properties.h>
+#include <utils/Timers.h>
 #include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include "gralloc_metadata.h"
 #include "hwc_device.h"
 
+namespace {
+
+constexpr const char* VIG_PIPES_PROPERTY = "vendor.hwc.vig_pipes";
+constexpr const char* DMA_PIPES_PROPERTY = "vendor.hwc.dma_pipes";
+
+HWCPipeConfig LoadPipeConfig() {
+    HWCPipeConfig config = SM8650_PIPE_CONFIG;
+    int32_t vig = property_get_int32(VIG_PIPES_PROPERTY, config.vigPipes);
+    int32_t dma = property_get_int32(DMA_PIPES_PROPERTY, config.dmaPipes);
+    config.vigPipes = std::min(static_cast<uint32_t>(std::max(vig, 0)), config.vigPipes);
+    config.dmaPipes = std::min(static_cast<uint32_t>(std::max(dma, 0)), config.dmaPipes);
+    return config;
+}
+
+constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+constexpr uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+template <typename T>
+uint64_t HashValue(uint64_t hash, const T& value) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    for (size_t i = 0; i < sizeof(value); i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+// Everything the planner looks at; the buffer only through its format
+// and compression.
+uint64_t HashLayer(uint64_t hash, const HWCLayer& layer) {
+    hash = HashValue(hash, layer.id);
+    hash = HashValue(hash, layer.compositionType);
+    hash = HashValue(hash, layer.format);
+    hash = HashValue(hash, layer.compressed);
+    hash = HashValue(hash, layer.color);
+    hash = HashValue(hash, layer.displayFrame);
+    hash = HashValue(hash, layer.sourceCrop);
+    hash = HashValue(hash, layer.z);
+    hash = HashValue(hash, layer.blendMode);
+    hash = HashValue(hash, layer.transform);
+    return HashValue(hash, layer.planeAlpha);
+}
+
+double AverageUs(int64_t totalNs, uint64_t count) {
+    return count ? totalNs / 1000.0 / count : 0.0;
+}
+
+} // namespace
+
 HWCDevice::HWCDevice()
-    : mPowerMode(true) {
+    : mPowerMode(true)
+    , mPlanner(LoadPipeConfig()) {
     mActiveConfig.width = 2780;
     mActiveConfig.height = 1264;
     mActiveConfig.vsyncPeriod = 8333333;  // 120Hz in nanoseconds
     mActiveConfig.dpiX = 450;
     mActiveConfig.dpiY = 450;
+
+    Display& primary = mDisplays[PRIMARY_DISPLAY];
+    primary.nextLayer = 1;
+    primary.plan.clientCount = 0;
+    primary.validated = false;
+    primary.planHash = 0;
+    primary.acceptedHash = 0;
+    primary.planValid = false;
+    primary.frameHash = 0;
+    primary.committedHash = 0;
+    primary.committed = false;
+    primary.buffersChanged = false;
+
+    memset(&mCacheStats, 0, sizeof(mCacheStats));
 }
 
 HWCDevice::~HWCDevice() {
+    for (auto& display : mDisplays) {
+        for (auto& entry : display.second.layers) {
+            if (entry.second.acquireFence >= 0) {
+                close(entry.second.acquireFence);
+            }
+        }
+        for (auto& entry : display.second.metadata) {
+            UnmapMetadata(&entry.second);
+        }
+    }
 }
 
 int HWCDevice::HookDevOpen(const struct hw_module_t* module, const char* name,
@@ -23,39 +103,147 @@ int HWCDevice::HookDevOpen(const struct hw_module_t* module, const char* name,
         return -EINVAL;
     }
 
+    // The hooks recover the device from the hwc2_device_t it derives from.
     HWCDevice* dev = new HWCDevice();
     if (!dev) {
         ALOGE("Failed to allocate HWCDevice");
         return -ENOMEM;
     }
 
-    // Initialize HWC2 device
-    hwc2_device_t* hwc2_dev = new hwc2_device_t();
-    if (!hwc2_dev) {
-        delete dev;
-        return -ENOMEM;
-    }
-
-    hwc2_dev->common.tag = HARDWARE_DEVICE_TAG;
-    hwc2_dev->common.version = HWC_DEVICE_API_VERSION_2_0;
-    hwc2_dev->common.module = const_cast<hw_module_t*>(module);
-    hwc2_dev->common.close = nullptr;  // Will be set by framework
+    dev->common.tag = HARDWARE_DEVICE_TAG;
+    dev->common.version = HWC_DEVICE_API_VERSION_2_0;
+    dev->common.module = const_cast<hw_module_t*>(module);
+    dev->common.close = CloseDevice;
 
     // Set function pointers
-    hwc2_dev->getDisplayAttribute = GetDisplayAttribute;
-    hwc2_dev->presentDisplay = PresentDisplay;
-    hwc2_dev->validateDisplay = ValidateDisplay;
+    dev->getDisplayAttribute = GetDisplayAttribute;
+    dev->presentDisplay = PresentDisplay;
+    dev->validateDisplay = ValidateDisplay;
+    dev->getChangedCompositionTypes = GetChangedCompositionTypes;
+    dev->acceptDisplayChanges = AcceptDisplayChanges;
+    dev->dump = Dump;
+    dev->createLayer = CreateLayer;
+    dev->destroyLayer = DestroyLayer;
+    dev->setLayerBuffer = SetLayerBuffer;
+    dev->setLayerCompositionType = SetLayerCompositionType;
+    dev->setLayerColor = SetLayerColor;
+    dev->setLayerDisplayFrame = SetLayerDisplayFrame;
+    dev->setLayerSourceCrop = SetLayerSourceCrop;
+    dev->setLayerZOrder = SetLayerZOrder;
+    dev->setLayerBlendMode = SetLayerBlendMode;
+    dev->setLayerTransform = SetLayerTransform;
+    dev->setLayerPlaneAlpha = SetLayerPlaneAlpha;
+
+    *device = &dev->common;
+    return 0;
+}
 
-    *device = &hwc2_dev->common;
+int HWCDevice::CloseDevice(struct hw_device_t* device) {
+    delete reinterpret_cast<HWCDevice*>(device);
     return 0;
 }
 
-int HWCDevice::GetDisplayAttribute(hwc2_device_t* /*device*/,
-                                 hwc2_display_t /*display*/,
+HWCDevice::Display* HWCDevice::FindDisplayLocked(hwc2_display_t display) {
+    auto it = mDisplays.find(display);
+    return it == mDisplays.end() ? nullptr : &it->second;
+}
+
+int HWCDevice::FindLayerForUpdateLocked(hwc2_display_t display, hwc2_layer_t layer,
+                                        HWCLayer** outLayer) {
+    Display* disp = FindDisplayLocked(display);
+    if (!disp) {
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+    auto it = disp->layers.find(layer);
+    if (it == disp->layers.end()) {
+        return HWC2_ERROR_BAD_LAYER;
+    }
+    disp->validated = false;
+    *outLayer = &it->second;
+    return HWC2_ERROR_NONE;
+}
+
+const GrallocMetadata* HWCDevice::MapMetadataLocked(std::vector<MetadataMapping>* cache,
+                                                    buffer_handle_t buffer) {
+    uint32_t slot;
+    uint32_t generation;
+    if (!GrallocMetadataAccess::GetBufferId(buffer, &slot, &generation)) {
+        return nullptr;
+    }
+    for (auto it = cache->begin(); it != cache->end(); ++it) {
+        if (it->slot != slot) {
+            continue;
+        }
+        if (it->generation == generation) {
+            std::rotate(cache->begin(), it, it + 1);
+            mCacheStats.metadataReuses++;
+            return cache->front().metadata;
+        }
+        // The buffer was freed and its slot reused
+        GrallocMetadataAccess::Unmap(it->metadata);
+        cache->erase(it);
+        break;
+    }
+
+    const GrallocMetadata* metadata = GrallocMetadataAccess::Map(buffer);
+    mCacheStats.metadataMaps++;
+    if (!metadata) {
+        return nullptr;
+    }
+    if (cache->size() == METADATA_CACHE_SIZE) {
+        GrallocMetadataAccess::Unmap(cache->back().metadata);
+        cache->pop_back();
+    }
+    cache->insert(cache->begin(), { slot, generation, metadata });
+    return metadata;
+}
+
+void HWCDevice::UnmapMetadata(std::vector<MetadataMapping>* cache) {
+    for (const MetadataMapping& mapping : *cache) {
+        GrallocMetadataAccess::Unmap(mapping.metadata);
+    }
+    cache->clear();
+}
+
+uint64_t HWCDevice::HashStack(const Display& display, std::vector<const HWCLayer*>* outStack) {
+    outStack->clear();
+    outStack->reserve(display.layers.size());
+    for (const auto& entry : display.layers) {
+        outStack->push_back(&entry.second);
+    }
+    std::stable_sort(outStack->begin(), outStack->end(), [](const HWCLayer* a, const HWCLayer* b) {
+        return a->z < b->z;
+    });
+
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (const HWCLayer* layer : *outStack) {
+        hash = HashLayer(hash, *layer);
+    }
+    return hash;
+}
+
+void HWCDevice::CommitLocked(Display* display) {
+    // No commit to the kernel yet, so the acquire fences are consumed here
+    for (auto& entry : display->layers) {
+        if (entry.second.acquireFence >= 0) {
+            close(entry.second.acquireFence);
+            entry.second.acquireFence = -1;
+        }
+    }
+    display->committedHash = display->frameHash;
+    display->committed = true;
+    display->buffersChanged = false;
+}
+
+int HWCDevice::GetDisplayAttribute(hwc2_device_t* device,
+                                 hwc2_display_t display,
                                  hwc2_config_t /*config*/,
                                  hwc2_attribute_t attribute,
                                  int32_t* outValue) {
     HWCDevice* dev = static_cast<HWCDevice*>(device);
+    if (display != PRIMARY_DISPLAY) {
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
     switch (attribute) {
         case HWC2_ATTRIBUTE_WIDTH:
             *outValue = dev->mActiveConfig.width;
@@ -78,20 +266,429 @@ int HWCDevice::GetDisplayAttribute(hwc2_device_t* /*device*/,
     return HWC2_ERROR_NONE;
 }
 
-int HWCDevice::PresentDisplay(hwc2_device_t* /*device*/,
-                            hwc2_display_t /*display*/,
+int HWCDevice::PresentDisplay(hwc2_device_t* device,
+                            hwc2_display_t display,
                             int32_t* outRetireFence) {
-    // Basic implementation - no fence synchronization
+    HWCDevice* dev = static_cast<HWCDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mStateLock);
+    Display* disp = dev->FindDisplayLocked(display);
+    if (!disp) {
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+    if (!disp->validated) {
+        return HWC2_ERROR_NOT_VALIDATED;
+    }
+
+    // Nothing new since the last commit: the hardware is already showing
+    // this frame.
+    int64_t startNs = systemTime(SYSTEM_TIME_MONOTONIC);
+    CacheStats& stats = dev->mCacheStats;
+    stats.presents++;
+    if (disp->committed && disp->committedHash == disp->frameHash && !disp->buffersChanged) {
+        stats.commitsSkipped++;
+        stats.skipNs += systemTime(SYSTEM_TIME_MONOTONIC) - startNs;
+    } else {
+        dev->CommitLocked(disp);
+        stats.commitNs += systemTime(SYSTEM_TIME_MONOTONIC) - startNs;
+    }
+
     *outRetireFence = -1;
     return HWC2_ERROR_NONE;
 }
 
-int HWCDevice::ValidateDisplay(hwc2_device_t* /*device*/,
-                             hwc2_display_t /*display*/,
+int HWCDevice::ValidateDisplay(hwc2_device_t* device,
+                             hwc2_display_t display,
                              uint32_t* outNumTypes,
                              uint32_t* outNumRequests) {
-    // Basic implementation - no layer validation
-    *outNumTypes = 0;
+    HWCDevice* dev = static_cast<HWCDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mStateLock);
+    Display* disp = dev->FindDisplayLocked(display);
+    if (!disp) {
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    // Reuse the plan when only buffers changed. The client may ask for its
+    // own types again or keep the ones it accepted; both match the plan.
+    int64_t startNs = systemTime(SYSTEM_TIME_MONOTONIC);
+    CacheStats& stats = dev->mCacheStats;
+    std::vector<const HWCLayer*> stack;
+    uint64_t hash = HashStack(*disp, &stack);
+    bool reuse = disp->planValid && (hash == disp->planHash || hash == disp->acceptedHash);
+    if (!reuse) {
+        dev->mPlanner.Plan(stack, dev->mActiveConfig.width, &disp->plan);
+        disp->planHash = hash;
+        disp->acceptedHash = hash;
+        disp->planValid = true;
+    }
+    disp->frameHash = hash;
+
+    disp->changedTypes.clear();
+    for (size_t i = 0; i < stack.size(); i++) {
+        if (disp->plan.layers[i].type != stack[i]->compositionType) {
+            disp->changedTypes.emplace_back(stack[i]->id, disp->plan.layers[i].type);
+        }
+    }
+    disp->validated = true;
+
+    stats.validates++;
+    if (reuse) {
+        stats.planReuses++;
+        stats.reuseNs += systemTime(SYSTEM_TIME_MONOTONIC) - startNs;
+    } else {
+        stats.planNs += systemTime(SYSTEM_TIME_MONOTONIC) - startNs;
+    }
+
+    ALOGV("Validated %zu layers: %u client, %zu changed%s", stack.size(),
+          disp->plan.clientCount, disp->changedTypes.size(), reuse ? ", plan reused" : "");
+    *outNumTypes = static_cast<uint32_t>(disp->changedTypes.size());
     *outNumRequests = 0;
+    return *outNumTypes ? HWC2_ERROR_HAS_CHANGES : HWC2_ERROR_NONE;
+}
+
+int HWCDevice::GetChangedCompositionTypes(hwc2_device_t* device, hwc2_display_t display,
+                                        uint32_t* outNumElements, hwc2_layer_t* outLayers,
+                                        int32_t* outTypes) {
+    HWCDevice* dev = static_cast<HWCDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mStateLock);
+    Display* disp = dev->FindDisplayLocked(display);
+    if (!disp) {
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+    if (!disp->validated) {
+        return HWC2_ERROR_NOT_VALIDATED;
+    }
+
+    // With null arrays, only the count is returned
+    if (!outLayers || !outTypes) {
+        *outNumElements = static_cast<uint32_t>(disp->changedTypes.size());
+        return HWC2_ERROR_NONE;
+    }
+    uint32_t count = std::min(*outNumElements,
+                              static_cast<uint32_t>(disp->changedTypes.size()));
+    for (uint32_t i = 0; i < count; i++) {
+        outLayers[i] = disp->changedTypes[i].first;
+        outTypes[i] = disp->changedTypes[i].second;
+    }
+    *outNumElements = count;
     return HWC2_ERROR_NONE;
-} 
\ No newline at end of file
+}
+
+int HWCDevice::AcceptDisplayChanges(hwc2_device_t* device, hwc2_display_t display) {
+    HWCDevice* dev = static_cast<HWCDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mStateLock);
+    Display* disp = dev->FindDisplayLocked(display);
+    if (!disp) {
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+    if (!disp->validated) {
+        return HWC2_ERROR_NOT_VALIDATED;
+    }
+
+    for (const auto& change : disp->changedTypes) {
+        disp->layers[change.first].compositionType = change.second;
+    }
+    disp->changedTypes.clear();
+
+    // The plan already puts these layers where the client now asks for
+    // them, so it stays valid for the accepted types.
+    std::vector<const HWCLayer*> stack;
+    disp->acceptedHash = HashStack(*disp, &stack);
+    return HWC2_ERROR_NONE;
+}
+
+void HWCDevice::Dump(hwc2_device_t* device, uint32_t* outSize, char* outBuffer) {
+    HWCDevice* dev = static_cast<HWCDevice*>(device);
+    if (!outSize) {
+        return;
+    }
+
+    std::lock_guard<Mutex> lock(dev->mDumpLock);
+    if (!outBuffer) {
+        dev->mDumpCache.clear();
+        dev->Dump(&dev->mDumpCache);
+        *outSize = dev->mDumpCache.size();
+        return;
+    }
+    if (dev->mDumpCache.empty()) {
+        dev->Dump(&dev->mDumpCache);
+    }
+    size_t copied = std::min<size_t>(*outSize, dev->mDumpCache.size());
+    memcpy(outBuffer, dev->mDumpCache.data(), copied);
+    *outSize = copied;
+    dev->mDumpCache.clear();
+}
+
+void HWCDevice::Dump(std::string* out) {
+    std::lock_guard<Mutex> lock(mStateLock);
+    char line[256];
+    const CacheStats& stats = mCacheStats;
+    const HWCPipeConfig& pipes = mPlanner.GetConfig();
+
+    out->append("HWCDevice:\n");
+    snprintf(line, sizeof(line), "  pipes: %u VIG, %u DMA, %u blend stages\n",
+             pipes.vigPipes, pipes.dmaPipes, pipes.maxBlendStages);
+    out->append(line);
+
+    uint64_t planned = stats.validates - stats.planReuses;
+    uint64_t committed = stats.presents - stats.commitsSkipped;
+    double planUs = AverageUs(stats.planNs, planned);
+    double reuseUs = AverageUs(stats.reuseNs, stats.planReuses);
+    double commitUs = AverageUs(stats.commitNs, committed);
+    double skipUs = AverageUs(stats.skipNs, stats.commitsSkipped);
+    snprintf(line, sizeof(line),
+             "  validate: %llu of %llu plans reused (%.1f%%), %.1f us planned vs %.1f us reused\n",
+             static_cast<unsigned long long>(stats.planReuses),
+             static_cast<unsigned long long>(stats.validates),
+             stats.validates ? 100.0 * stats.planReuses / stats.validates : 0.0,
+             planUs, reuseUs);
+    out->append(line);
+    snprintf(line, sizeof(line),
+             "  present: %llu of %llu commits skipped (%.1f%%), %.1f us committed vs %.1f us skipped\n",
+             static_cast<unsigned long long>(stats.commitsSkipped),
+             static_cast<unsigned long long>(stats.presents),
+             stats.presents ? 100.0 * stats.commitsSkipped / stats.presents : 0.0,
+             commitUs, skipUs);
+    out->append(line);
+    // Each hit is credited with the difference of the two average paths
+    double savedUs = std::max(0.0, planUs - reuseUs) * stats.planReuses +
+                     std::max(0.0, commitUs - skipUs) * stats.commitsSkipped;
+    snprintf(line, sizeof(line), "  saved: %.1f us per frame over %llu frames\n",
+             stats.presents ? savedUs / stats.presents : 0.0,
+             static_cast<unsigned long long>(stats.presents));
+    out->append(line);
+    snprintf(line, sizeof(line), "  metadata: %llu pages mapped, %llu reused\n",
+             static_cast<unsigned long long>(stats.metadataMaps),
+             static_cast<unsigned long long>(stats.metadataReuses));
+    out->append(line);
+
+    for (const auto& display : mDisplays) {
+        const Display& disp = display.second;
+        snprintf(line, sizeof(line), "  display %llu: %zu layers, %u client%s\n",
+                 static_cast<unsigned long long>(display.first), disp.layers.size(),
+                 disp.plan.clientCount, disp.planValid ? "" : " (not planned)");
+        out->append(line);
+        if (!disp.planValid) {
+            continue;
+        }
+        for (const HWCLayerPlan& plan : disp.plan.layers) {
+            snprintf(line, sizeof(line), "    layer %llu: %s",
+                     static_cast<unsigned long long>(plan.id),
+                     plan.type == HWC2_COMPOSITION_CLIENT ? "client" :
+                     plan.type == HWC2_COMPOSITION_SOLID_COLOR ? "solid" :
+                     plan.type == HWC2_COMPOSITION_CURSOR ? "cursor" : "device");
+            out->append(line);
+            for (int8_t pipe : plan.pipes) {
+                if (pipe == HWC_NO_PIPE) {
+                    continue;
+                }
+                bool vig = static_cast<uint32_t>(pipe) < pipes.vigPipes;
+                snprintf(line, sizeof(line), " %s%u", vig ? "VIG" : "DMA",
+                         vig ? pipe : pipe - pipes.vigPipes);
+                out->append(line);
+            }
+            out->append("\n");
+        }
+    }
+}
+
+int HWCDevice::CreateLayer(hwc2_device_t* device, hwc2_display_t display,
+                         hwc2_layer_t* outLayer) {
+    HWCDevice* dev = static_cast<HWCDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mStateLock);
+    Display* disp = dev->FindDisplayLocked(display);
+    if (!disp) {
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    hwc2_layer_t id = disp->nextLayer++;
+    HWCLayer& layer = disp->layers[id];
+    memset(&layer, 0, sizeof(layer));
+    layer.id = id;
+    layer.acquireFence = -1;
+    layer.compositionType = HWC2_COMPOSITION_INVALID;
+    layer.blendMode = HWC2_BLEND_MODE_NONE;
+    layer.planeAlpha = 1.0f;
+    disp->validated = false;
+
+    *outLayer = id;
+    return HWC2_ERROR_NONE;
+}
+
+int HWCDevice::DestroyLayer(hwc2_device_t* device, hwc2_display_t display,
+                          hwc2_layer_t layer) {
+    HWCDevice* dev = static_cast<HWCDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mStateLock);
+    HWCLayer* hwcLayer;
+    int error = dev->FindLayerForUpdateLocked(display, layer, &hwcLayer);
+    if (error != HWC2_ERROR_NONE) {
+        return error;
+    }
+
+    if (hwcLayer->acquireFence >= 0) {
+        close(hwcLayer->acquireFence);
+    }
+    Display& disp = dev->mDisplays[display];
+    auto mappings = disp.metadata.find(layer);
+    if (mappings != disp.metadata.end()) {
+        UnmapMetadata(&mappings->second);
+        disp.metadata.erase(mappings);
+    }
+    disp.layers.erase(layer);
+    return HWC2_ERROR_NONE;
+}
+
+int HWCDevice::SetLayerBuffer(hwc2_device_t* device, hwc2_display_t display,
+                            hwc2_layer_t layer, buffer_handle_t buffer,
+                            int32_t acquireFence) {
+    HWCDevice* dev = static_cast<HWCDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mStateLock);
+    HWCLayer* hwcLayer;
+    int error = dev->FindLayerForUpdateLocked(display, layer, &hwcLayer);
+    if (error != HWC2_ERROR_NONE) {
+        if (acquireFence >= 0) {
+            close(acquireFence);
+        }
+        return error;
+    }
+
+    if (buffer != hwcLayer->buffer || acquireFence >= 0) {
+        dev->FindDisplayLocked(display)->buffersChanged = true;
+    }
+    if (hwcLayer->acquireFence >= 0) {
+        close(hwcLayer->acquireFence);
+    }
+    // Format and layout are fixed for the life of a buffer, so the
+    // metadata page is only read when the handle changes.
+    if (buffer != hwcLayer->buffer) {
+        const GrallocMetadata* metadata = dev->MapMetadataLocked(
+            &dev->FindDisplayLocked(display)->metadata[layer], buffer);
+        hwcLayer->format = metadata ? metadata->format : 0;
+        hwcLayer->compressed = metadata && metadata->layoutType == GRALLOC_LAYOUT_UBWC;
+    }
+    hwcLayer->buffer = buffer;
+    hwcLayer->acquireFence = acquireFence;
+    return HWC2_ERROR_NONE;
+}
+
+int HWCDevice::SetLayerCompositionType(hwc2_device_t* device, hwc2_display_t display,
+                                     hwc2_layer_t layer, int32_t type) {
+    if (type == HWC2_COMPOSITION_SIDEBAND) {
+        return HWC2_ERROR_UNSUPPORTED;
+    }
+    if (type < HWC2_COMPOSITION_CLIENT || type > HWC2_COMPOSITION_CURSOR) {
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    HWCDevice* dev = static_cast<HWCDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mStateLock);
+    HWCLayer* hwcLayer;
+    int error = dev->FindLayerForUpdateLocked(display, layer, &hwcLayer);
+    if (error != HWC2_ERROR_NONE) {
+        return error;
+    }
+    hwcLayer->compositionType = static_cast<hwc2_composition_t>(type);
+    return HWC2_ERROR_NONE;
+}
+
+int HWCDevice::SetLayerColor(hwc2_device_t* device, hwc2_display_t display,
+                           hwc2_layer_t layer, hwc_color_t color) {
+    HWCDevice* dev = static_cast<HWCDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mStateLock);
+    HWCLayer* hwcLayer;
+    int error = dev->FindLayerForUpdateLocked(display, layer, &hwcLayer);
+    if (error != HWC2_ERROR_NONE) {
+        return error;
+    }
+    hwcLayer->color = color;
+    return HWC2_ERROR_NONE;
+}
+
+int HWCDevice::SetLayerDisplayFrame(hwc2_device_t* device, hwc2_display_t display,
+                                  hwc2_layer_t layer, hwc_rect_t frame) {
+    HWCDevice* dev = static_cast<HWCDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mStateLock);
+    HWCLayer* hwcLayer;
+    int error = dev->FindLayerForUpdateLocked(display, layer, &hwcLayer);
+    if (error != HWC2_ERROR_NONE) {
+        return error;
+    }
+    hwcLayer->displayFrame = frame;
+    return HWC2_ERROR_NONE;
+}
+
+int HWCDevice::SetLayerSourceCrop(hwc2_device_t* device, hwc2_display_t display,
+                                hwc2_layer_t layer, hwc_frect_t crop) {
+    HWCDevice* dev = static_cast<HWCDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mStateLock);
+    HWCLayer* hwcLayer;
+    int error = dev->FindLayerForUpdateLocked(display, layer, &hwcLayer);
+    if (error != HWC2_ERROR_NONE) {
+        return error;
+    }
+    hwcLayer->sourceCrop = crop;
+    return HWC2_ERROR_NONE;
+}
+
+int HWCDevice::SetLayerZOrder(hwc2_device_t* device, hwc2_display_t display,
+                            hwc2_layer_t layer, uint32_t z) {
+    HWCDevice* dev = static_cast<HWCDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mStateLock);
+    HWCLayer* hwcLayer;
+    int error = dev->FindLayerForUpdateLocked(display, layer, &hwcLayer);
+    if (error != HWC2_ERROR_NONE) {
+        return error;
+    }
+    hwcLayer->z = z;
+    return HWC2_ERROR_NONE;
+}
+
+int HWCDevice::SetLayerBlendMode(hwc2_device_t* device, hwc2_display_t display,
+                               hwc2_layer_t layer, int32_t mode) {
+    if (mode < HWC2_BLEND_MODE_NONE || mode > HWC2_BLEND_MODE_COVERAGE) {
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    HWCDevice* dev = static_cast<HWCDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mStateLock);
+    HWCLayer* hwcLayer;
+    int error = dev->FindLayerForUpdateLocked(display, layer, &hwcLayer);
+    if (error != HWC2_ERROR_NONE) {
+        return error;
+    }
+    hwcLayer->blendMode = static_cast<hwc2_blend_mode_t>(mode);
+    return HWC2_ERROR_NONE;
+}
+
+int HWCDevice::SetLayerTransform(hwc2_device_t* device, hwc2_display_t display,
+                               hwc2_layer_t layer, int32_t transform) {
+    if (transform & ~HWC_TRANSFORM_ROT_270) {
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    HWCDevice* dev = static_cast<HWCDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mStateLock);
+    HWCLayer* hwcLayer;
+    int error = dev->FindLayerForUpdateLocked(display, layer, &hwcLayer);
+    if (error != HWC2_ERROR_NONE) {
+        return error;
+    }
+    hwcLayer->transform = transform;
+    return HWC2_ERROR_NONE;
+}
+
+int HWCDevice::SetLayerPlaneAlpha(hwc2_device_t* device, hwc2_display_t display,
+                                hwc2_layer_t layer, float alpha) {
+    if (!(alpha >= 0.0f && alpha <= 1.0f)) {
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    HWCDevice* dev = static_cast<HWCDevice*>(device);
+    std::lock_guard<Mutex> lock(dev->mStateLock);
+    HWCLayer* hwcLayer;
+    int error = dev->FindLayerForUpdateLocked(display, layer, &hwcLayer);
+    if (error != HWC2_ERROR_NONE) {
+        return error;
+    }
+    hwcLayer->planeAlpha = alpha;
+    return HWC2_ERROR_NONE;
+}
@@ -3,10 +3,35 @@
 
 #include <hardware/hwcomposer2.h>
 #include <utils/Mutex.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "gralloc_metadata.h"
+#include "hwc_layer.h"
+#include "hwc_planner.h"
 
 using namespace android;
 
-class HWCDevice {
+// The HWC2 device. Each display keeps its layers keyed by id; any change
+// to a layer drops the display's validation, and ValidateDisplay runs the
+// planner over the stack in z order and reports every layer whose type
+// it had to change. Only the primary display exists, so it is planned
+// against every pipe. The pipe counts can be lowered with
+// vendor.hwc.vig_pipes and vendor.hwc.dma_pipes.
+//
+// Most frames only swap a buffer on one layer, so ValidateDisplay hashes
+// the state of every layer except its buffer and reuses the last plan
+// when the hash matches. PresentDisplay skips the commit when neither the
+// hash nor any buffer changed since the last one. Both caches count
+// their hits and the time they save, for the dump.
+//
+// The format and compression of a layer's buffer come from its gralloc
+// metadata page. Each layer keeps the pages of its last few buffers
+// mapped, keyed by gralloc slot and generation, so a swapchain cycling
+// through its buffers maps each page once, however often the framework
+// imports it again.
+class HWCDevice : public hwc2_device_t {
 public:
     static int HookDevOpen(const struct hw_module_t* module, const char* name,
                           struct hw_device_t** device);
@@ -14,6 +39,8 @@ public:
     HWCDevice();
     ~HWCDevice();
 
+    static int CloseDevice(struct hw_device_t* device);
+
     static int GetDisplayAttribute(hwc2_device_t* device, hwc2_display_t display,
                                  hwc2_config_t config,
                                  hwc2_attribute_t attribute, int32_t* outValue);
@@ -25,6 +52,54 @@ public:
                              uint32_t* outNumTypes,
                              uint32_t* outNumRequests);
 
+    static int GetChangedCompositionTypes(hwc2_device_t* device, hwc2_display_t display,
+                                        uint32_t* outNumElements, hwc2_layer_t* outLayers,
+                                        int32_t* outTypes);
+
+    static int AcceptDisplayChanges(hwc2_device_t* device, hwc2_display_t display);
+
+    // HWC2 dump: with a null outBuffer, renders the report and returns its
+    // size; otherwise copies up to *outSize bytes of that report.
+    static void Dump(hwc2_device_t* device, uint32_t* outSize, char* outBuffer);
+
+    // Composition cache counters and the current plan of each display
+    void Dump(std::string* out);
+
+    // Layer hooks
+    static int CreateLayer(hwc2_device_t* device, hwc2_display_t display,
+                         hwc2_layer_t* outLayer);
+
+    static int DestroyLayer(hwc2_device_t* device, hwc2_display_t display,
+                          hwc2_layer_t layer);
+
+    static int SetLayerBuffer(hwc2_device_t* device, hwc2_display_t display,
+                            hwc2_layer_t layer, buffer_handle_t buffer,
+                            int32_t acquireFence);
+
+    static int SetLayerCompositionType(hwc2_device_t* device, hwc2_display_t display,
+                                     hwc2_layer_t layer, int32_t type);
+
+    static int SetLayerColor(hwc2_device_t* device, hwc2_display_t display,
+                           hwc2_layer_t layer, hwc_color_t color);
+
+    static int SetLayerDisplayFrame(hwc2_device_t* device, hwc2_display_t display,
+                                  hwc2_layer_t layer, hwc_rect_t frame);
+
+    static int SetLayerSourceCrop(hwc2_device_t* device, hwc2_display_t display,
+                                hwc2_layer_t layer, hwc_frect_t crop);
+
+    static int SetLayerZOrder(hwc2_device_t* device, hwc2_display_t display,
+                            hwc2_layer_t layer, uint32_t z);
+
+    static int SetLayerBlendMode(hwc2_device_t* device, hwc2_display_t display,
+                               hwc2_layer_t layer, int32_t mode);
+
+    static int SetLayerTransform(hwc2_device_t* device, hwc2_display_t display,
+                               hwc2_layer_t layer, int32_t transform);
+
+    static int SetLayerPlaneAlpha(hwc2_device_t* device, hwc2_display_t display,
+                                hwc2_layer_t layer, float alpha);
+
 private:
     // Display attributes
     struct DisplayConfig {
@@ -35,10 +110,71 @@ private:
         int32_t dpiY;
     };
 
+    // A metadata page mapped for a layer
+    struct MetadataMapping {
+        uint32_t slot;
+        uint32_t generation;
+        const GrallocMetadata* metadata;
+    };
+    // Mappings kept per layer; enough for a triple-buffered swapchain
+    static constexpr size_t METADATA_CACHE_SIZE = 4;
+
+    struct Display {
+        std::map<hwc2_layer_t, HWCLayer> layers;
+        // Most recently used first; unmapped with the layer
+        std::map<hwc2_layer_t, std::vector<MetadataMapping>> metadata;
+        hwc2_layer_t nextLayer;
+        HWCPlan plan;
+        std::vector<std::pair<hwc2_layer_t, hwc2_composition_t>> changedTypes;
+        bool validated;
+        uint64_t planHash;      // layer state the plan was made for
+        uint64_t acceptedHash;  // the same state with the changed types accepted
+        bool planValid;
+        uint64_t frameHash;     // layer state at the last validate
+        uint64_t committedHash; // frameHash of the last commit
+        bool committed;
+        bool buffersChanged;    // a new buffer or acquire fence since the last commit
+    };
+
+    // Time is split by path, so the saving is the difference of averages.
+    struct CacheStats {
+        uint64_t validates;
+        uint64_t planReuses;
+        int64_t planNs;
+        int64_t reuseNs;
+        uint64_t presents;
+        uint64_t commitsSkipped;
+        int64_t commitNs;
+        int64_t skipNs;
+        uint64_t metadataMaps;
+        uint64_t metadataReuses;
+    };
+
+    static constexpr hwc2_display_t PRIMARY_DISPLAY = 0;
+
+    Display* FindDisplayLocked(hwc2_display_t display);
+    // Finds a layer about to be changed and drops its display's validation.
+    int FindLayerForUpdateLocked(hwc2_display_t display, hwc2_layer_t layer,
+                                 HWCLayer** outLayer);
+    // Sorts a display's layers by z and hashes their state, buffers aside.
+    static uint64_t HashStack(const Display& display, std::vector<const HWCLayer*>* outStack);
+    void CommitLocked(Display* display);
+    // Returns the metadata page of a buffer set on a layer, mapping it only
+    // if the layer has not shown that slot and generation recently.
+    const GrallocMetadata* MapMetadataLocked(std::vector<MetadataMapping>* cache,
+                                             buffer_handle_t buffer);
+    static void UnmapMetadata(std::vector<MetadataMapping>* cache);
+
     // Device state
     Mutex mStateLock;
     bool mPowerMode;
     DisplayConfig mActiveConfig;
+    HWCPlanner mPlanner;
+    std::map<hwc2_display_t, Display> mDisplays;
+    CacheStats mCacheStats;
+
+    Mutex mDumpLock;
+    std::string mDumpCache;
 };
 
-#endif // HWC_DEVICE_H 
\ No newline at end of file
+#endif // HWC_DEVICE_H
@@ -0,0 +1,26 @@
+#ifndef HWC_LAYER_H
+#define HWC_LAYER_H
+
+#include <hardware/hwcomposer2.h>
+#include <stdint.h>
+
+// State the framework sets on one layer. The format and compression of
+// the buffer are read from its gralloc metadata page when the buffer is
+// set, so planning never touches handles.
+struct HWCLayer {
+    hwc2_layer_t id;
+    buffer_handle_t buffer;
+    int32_t acquireFence;
+    uint32_t format;        // 0 if the buffer has no gralloc metadata
+    bool compressed;
+    hwc2_composition_t compositionType;     // as requested by the client
+    hwc_color_t color;
+    hwc_rect_t displayFrame;
+    hwc_frect_t sourceCrop;
+    uint32_t z;
+    hwc2_blend_mode_t blendMode;
+    int32_t transform;      // hwc_transform_t bits
+    float planeAlpha;
+};
+
+#endif // HWC_LAYER_H
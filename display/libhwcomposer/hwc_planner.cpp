@@ -0,0 +1,158 @@
+#define LOG_TAG "hwc_sm8650"
+
+#include <log/log.h>
+#include <algorithm>
+#include "gralloc_layout.h"
+#include "hwc_planner.h"
+
+HWCPlanner::HWCPlanner(const HWCPipeConfig& config)
+    : mConfig(config) {
+    // Pipe ids are int8_t indices below HWC_MAX_PIPES.
+    mConfig.vigPipes = std::min(mConfig.vigPipes, HWC_MAX_PIPES);
+    mConfig.dmaPipes = std::min(mConfig.dmaPipes, HWC_MAX_PIPES - mConfig.vigPipes);
+}
+
+bool HWCPlanner::InScaleRange(float src, int32_t dst) const {
+    return dst <= src * mConfig.maxUpscale && src <= dst * static_cast<float>(mConfig.maxDownscale);
+}
+
+HWCPlanner::Requirement HWCPlanner::Classify(const HWCLayer& layer) const {
+    switch (layer.compositionType) {
+        case HWC2_COMPOSITION_DEVICE:
+        case HWC2_COMPOSITION_CURSOR:
+            break;
+        case HWC2_COMPOSITION_SOLID_COLOR:
+            return { NEED_STAGE, 0 };
+        default:
+            return { NEED_CLIENT, 0 };
+    }
+
+    // Pipes flip but do not rotate by 90 degrees
+    if (!layer.buffer || !layer.format || (layer.transform & HWC_TRANSFORM_ROT_90)) {
+        return { NEED_CLIENT, 0 };
+    }
+
+    float srcWidth = layer.sourceCrop.right - layer.sourceCrop.left;
+    float srcHeight = layer.sourceCrop.bottom - layer.sourceCrop.top;
+    int32_t dstWidth = layer.displayFrame.right - layer.displayFrame.left;
+    int32_t dstHeight = layer.displayFrame.bottom - layer.displayFrame.top;
+    if (srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0 ||
+            srcWidth > 2 * mConfig.maxPipeWidth) {
+        return { NEED_CLIENT, 0 };
+    }
+
+    // Fractional crops need the scaler's phase stepping too
+    bool scaled = srcWidth != static_cast<float>(dstWidth) ||
+                  srcHeight != static_cast<float>(dstHeight);
+    if (scaled && (!InScaleRange(srcWidth, dstWidth) || !InScaleRange(srcHeight, dstHeight))) {
+        return { NEED_CLIENT, 0 };
+    }
+
+    Need need = scaled || GrallocLayoutEngine::IsYuv(layer.format) ? NEED_VIG : NEED_ANY_PIPE;
+    return { need, srcWidth > mConfig.maxPipeWidth ? 2u : 1u };
+}
+
+void HWCPlanner::Plan(const std::vector<const HWCLayer*>& layers, uint32_t targetWidth,
+                      HWCPlan* outPlan) const {
+    size_t count = layers.size();
+    std::vector<Requirement> reqs(count);
+    // Prefix sums over the stack, so the layers outside [begin, end) are
+    // total - (prefix[end] - prefix[begin])
+    std::vector<uint32_t> vigPrefix(count + 1, 0);
+    std::vector<uint32_t> anyPrefix(count + 1, 0);
+    std::vector<uint64_t> areaPrefix(count + 1, 0);
+    size_t firstClient = count;
+    size_t lastClient = 0;
+    for (size_t i = 0; i < count; i++) {
+        reqs[i] = Classify(*layers[i]);
+        vigPrefix[i + 1] = vigPrefix[i] + (reqs[i].need == NEED_VIG ? reqs[i].pipes : 0);
+        anyPrefix[i + 1] = anyPrefix[i] + (reqs[i].need == NEED_ANY_PIPE ? reqs[i].pipes : 0);
+        const hwc_rect_t& frame = layers[i]->displayFrame;
+        areaPrefix[i + 1] = areaPrefix[i] + static_cast<uint64_t>(
+            std::max(0, frame.right - frame.left)) * std::max(0, frame.bottom - frame.top);
+        if (reqs[i].need == NEED_CLIENT) {
+            firstClient = std::min(firstClient, i);
+            lastClient = i;
+        }
+    }
+
+    uint32_t targetPipes = targetWidth > mConfig.maxPipeWidth ? 2 : 1;
+    auto fits = [&](size_t begin, size_t end) {
+        bool client = end > begin;
+        uint32_t vig = vigPrefix[count] - (vigPrefix[end] - vigPrefix[begin]);
+        uint32_t any = anyPrefix[count] - (anyPrefix[end] - anyPrefix[begin]);
+        size_t stages = count - (end - begin) + (client ? 1 : 0);
+        return vig <= mConfig.vigPipes &&
+               vig + any + (client ? targetPipes : 0) <= mConfig.vigPipes + mConfig.dmaPipes &&
+               stages <= mConfig.maxBlendStages;
+    };
+
+    // Everything in hardware, or else the shortest client range that
+    // covers the forced layers. All-client is the fallback and always
+    // chosen at the last length.
+    size_t clientBegin = 0;
+    size_t clientEnd = count;
+    if (firstClient == count && fits(0, 0)) {
+        clientEnd = 0;
+    } else {
+        bool found = false;
+        for (size_t length = 1; length <= count && !found; length++) {
+            uint64_t bestArea = UINT64_MAX;
+            for (size_t begin = 0; begin + length <= count; begin++) {
+                size_t end = begin + length;
+                if (firstClient != count && (begin > firstClient || end <= lastClient)) {
+                    continue;
+                }
+                uint64_t area = areaPrefix[end] - areaPrefix[begin];
+                if (area < bestArea && fits(begin, end)) {
+                    bestArea = area;
+                    clientBegin = begin;
+                    clientEnd = end;
+                    found = true;
+                }
+            }
+        }
+    }
+
+    // VIG-only layers first, then RGB layers on DMA pipes while they last,
+    // keeping VIG pipes for the layers that need them.
+    uint32_t nextVig = 0;
+    uint32_t nextDma = mConfig.vigPipes;
+    uint32_t dmaEnd = mConfig.vigPipes + mConfig.dmaPipes;
+    auto takePipe = [&](bool vigOnly) -> int8_t {
+        if (!vigOnly && nextDma < dmaEnd) {
+            return static_cast<int8_t>(nextDma++);
+        }
+        if (nextVig < mConfig.vigPipes) {
+            return static_cast<int8_t>(nextVig++);
+        }
+        return HWC_NO_PIPE;
+    };
+
+    outPlan->layers.resize(count);
+    outPlan->clientCount = static_cast<uint32_t>(clientEnd - clientBegin);
+    for (size_t i = 0; i < count; i++) {
+        HWCLayerPlan& plan = outPlan->layers[i];
+        plan.id = layers[i]->id;
+        plan.pipes[0] = plan.pipes[1] = HWC_NO_PIPE;
+        bool client = i >= clientBegin && i < clientEnd;
+        plan.type = client ? HWC2_COMPOSITION_CLIENT : layers[i]->compositionType;
+    }
+    for (Need pass : { NEED_VIG, NEED_ANY_PIPE }) {
+        for (size_t i = 0; i < count; i++) {
+            HWCLayerPlan& plan = outPlan->layers[i];
+            if (reqs[i].need != pass || plan.type == HWC2_COMPOSITION_CLIENT) {
+                continue;
+            }
+            for (uint32_t p = 0; p < reqs[i].pipes; p++) {
+                plan.pipes[p] = takePipe(pass == NEED_VIG);
+            }
+        }
+    }
+    outPlan->clientTargetPipes[0] = outPlan->clientTargetPipes[1] = HWC_NO_PIPE;
+    if (outPlan->clientCount) {
+        for (uint32_t p = 0; p < targetPipes; p++) {
+            outPlan->clientTargetPipes[p] = takePipe(false);
+        }
+    }
+}
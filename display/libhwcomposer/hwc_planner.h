@@ -0,0 +1,79 @@
+#ifndef HWC_PLANNER_H
+#define HWC_PLANNER_H
+
+#include <hardware/hwcomposer2.h>
+#include <stdint.h>
+#include <vector>
+#include "hwc_layer.h"
+
+struct HWCPipeConfig {
+    uint32_t vigPipes;          // RGB and YUV, scaling
+    uint32_t dmaPipes;          // RGB only, no scaling
+    uint32_t maxBlendStages;    // layers one mixer can blend, client target included
+    uint32_t maxPipeWidth;      // source pixels per pipe; wider layers take two
+    uint32_t maxUpscale;
+    uint32_t maxDownscale;
+};
+
+// SM8650 SDE: four VIG and six DMA source pipes, 2560-pixel pipe line
+// width, an 11-stage mixer and a QSEED scaler on the VIG pipes.
+constexpr HWCPipeConfig SM8650_PIPE_CONFIG = { 4, 6, 11, 2560, 20, 4 };
+
+constexpr uint32_t HWC_MAX_PIPES = 16;
+constexpr int8_t HWC_NO_PIPE = -1;
+
+struct HWCLayerPlan {
+    hwc2_layer_t id;
+    hwc2_composition_t type;    // CLIENT, or the type the client asked for
+    int8_t pipes[2];            // HWC_NO_PIPE when unused
+};
+
+// Pipes 0 to vigPipes - 1 are VIG, the rest DMA.
+struct HWCPlan {
+    std::vector<HWCLayerPlan> layers;   // in z order
+    uint32_t clientCount;
+    int8_t clientTargetPipes[2];
+};
+
+// Assigns layers to hardware pipes so the GPU composes as few as possible.
+//
+// Each layer needs a VIG pipe (YUV or scaled), any pipe (RGB at 1:1), only
+// a blend stage (solid color, drawn by the mixer's dim layer), or the GPU
+// (90-degree rotation, scaling out of range, no gralloc buffer, or the
+// client asked for it). A layer whose source is wider than one pipe takes
+// two. When the layers do not all fit, the GPU composes one contiguous
+// z-range into the client target, which itself takes a pipe and a stage;
+// the planner picks the shortest range that covers every layer the
+// hardware cannot take and leaves the rest fitting, preferring the range
+// with the least display area. Prefix sums make each candidate range an
+// O(1) check, so a stack of n layers plans in O(n^2).
+class HWCPlanner {
+public:
+    explicit HWCPlanner(const HWCPipeConfig& config);
+
+    // layers must be sorted by z; targetWidth is the client target width.
+    void Plan(const std::vector<const HWCLayer*>& layers, uint32_t targetWidth,
+              HWCPlan* outPlan) const;
+
+    const HWCPipeConfig& GetConfig() const { return mConfig; }
+
+private:
+    enum Need {
+        NEED_CLIENT,
+        NEED_STAGE,
+        NEED_VIG,
+        NEED_ANY_PIPE,
+    };
+
+    struct Requirement {
+        Need need;
+        uint32_t pipes;
+    };
+
+    Requirement Classify(const HWCLayer& layer) const;
+    bool InScaleRange(float src, int32_t dst) const;
+
+    HWCPipeConfig mConfig;
+};
+
+#endif // HWC_PLANNER_H
@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+#include <cutils/native_handle.h>
+#include <system/graphics.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string>
+#include "gralloc_metadata.h"
+#include "hwc_device.h"
+
+namespace {
+
+constexpr hwc2_display_t PRIMARY_DISPLAY = 0;
+constexpr const char* METADATA_NAME = "hwc_device_test-metadata";
+
+// Pages of this test mapped into the process, from /proc/self/maps; the
+// device may only read them.
+int CountMetadataMappings() {
+    FILE* maps = fopen("/proc/self/maps", "r");
+    if (!maps) {
+        return -1;
+    }
+    int count = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), maps)) {
+        if (strstr(line, METADATA_NAME)) {
+            EXPECT_NE(nullptr, strstr(line, " r--s ")) << line;
+            count++;
+        }
+    }
+    fclose(maps);
+    return count;
+}
+
+class HWCDeviceTest : public testing::Test {
+protected:
+    void TearDown() override {
+        for (native_handle_t* handle : mHandles) {
+            native_handle_close(handle);
+            native_handle_delete(handle);
+        }
+    }
+
+    // A gralloc handle of a buffer in slot with the given generation, its
+    // metadata page filled as gralloc would.
+    buffer_handle_t CreateBuffer(uint32_t slot, uint32_t generation, uint32_t format,
+                                 GrallocLayoutType layoutType) {
+        int fd = memfd_create(METADATA_NAME, MFD_CLOEXEC);
+        EXPECT_GE(fd, 0);
+        EXPECT_EQ(0, ftruncate(fd, GRALLOC_METADATA_SIZE));
+        void* page = mmap(nullptr, GRALLOC_METADATA_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          fd, 0);
+        EXPECT_NE(MAP_FAILED, page);
+        GrallocLayout layout = {};
+        layout.type = layoutType;
+        GrallocMetadataAccess::Init(static_cast<GrallocMetadata*>(page), 64, 64, format,
+                                    layout);
+        munmap(page, GRALLOC_METADATA_SIZE);
+
+        native_handle_t* handle = native_handle_create(2, GRALLOC_HANDLE_GENERATION_INT + 1);
+        handle->data[0] = dup(fd);
+        handle->data[GRALLOC_METADATA_FD_INDEX] = fd;
+        handle->data[2 + GRALLOC_HANDLE_SLOT_INT] = slot;
+        handle->data[2 + GRALLOC_HANDLE_GENERATION_INT] = generation;
+        mHandles.push_back(handle);
+        return handle;
+    }
+
+    // Another import of buffer, as the framework makes in each process
+    buffer_handle_t Import(buffer_handle_t buffer) {
+        native_handle_t* handle = native_handle_create(buffer->numFds, buffer->numInts);
+        for (int i = 0; i < buffer->numFds; i++) {
+            handle->data[i] = dup(buffer->data[i]);
+        }
+        memcpy(&handle->data[buffer->numFds], &buffer->data[buffer->numFds],
+               buffer->numInts * sizeof(int));
+        mHandles.push_back(handle);
+        return handle;
+    }
+
+    hwc2_layer_t CreateLayer() {
+        hwc2_layer_t layer;
+        EXPECT_EQ(HWC2_ERROR_NONE, HWCDevice::CreateLayer(&mDevice, PRIMARY_DISPLAY, &layer));
+        return layer;
+    }
+
+    void SetBuffer(hwc2_layer_t layer, buffer_handle_t buffer) {
+        EXPECT_EQ(HWC2_ERROR_NONE,
+                  HWCDevice::SetLayerBuffer(&mDevice, PRIMARY_DISPLAY, layer, buffer, -1));
+    }
+
+    std::string MetadataStats() {
+        std::string dump;
+        mDevice.Dump(&dump);
+        size_t begin = dump.find("  metadata: ");
+        return begin == std::string::npos ? "" :
+            dump.substr(begin, dump.find('\n', begin) - begin);
+    }
+
+    HWCDevice mDevice;
+    std::vector<native_handle_t*> mHandles;
+};
+
+TEST_F(HWCDeviceTest, SwapchainBuffersAreMappedOnce) {
+    buffer_handle_t first = CreateBuffer(1, 1, HAL_PIXEL_FORMAT_RGBA_8888,
+                                         GRALLOC_LAYOUT_LINEAR);
+    buffer_handle_t second = CreateBuffer(2, 1, HAL_PIXEL_FORMAT_RGBA_8888,
+                                          GRALLOC_LAYOUT_UBWC);
+    hwc2_layer_t layer = CreateLayer();
+
+    SetBuffer(layer, first);
+    SetBuffer(layer, second);
+    EXPECT_EQ("  metadata: 2 pages mapped, 0 reused", MetadataStats());
+    EXPECT_EQ(2, CountMetadataMappings());
+
+    // Back to the first buffer, then a fresh import of it
+    SetBuffer(layer, first);
+    SetBuffer(layer, Import(first));
+    SetBuffer(layer, Import(second));
+    EXPECT_EQ("  metadata: 2 pages mapped, 3 reused", MetadataStats());
+    EXPECT_EQ(2, CountMetadataMappings());
+
+    EXPECT_EQ(HWC2_ERROR_NONE, HWCDevice::DestroyLayer(&mDevice, PRIMARY_DISPLAY, layer));
+    EXPECT_EQ(0, CountMetadataMappings());
+}
+
+TEST_F(HWCDeviceTest, ReusedSlotIsMappedAgain) {
+    hwc2_layer_t layer = CreateLayer();
+    SetBuffer(layer, CreateBuffer(1, 1, HAL_PIXEL_FORMAT_RGBA_8888, GRALLOC_LAYOUT_UBWC));
+
+    // The buffer was freed and another one took its slot
+    SetBuffer(layer, CreateBuffer(1, 2, HAL_PIXEL_FORMAT_YCBCR_420_888,
+                                  GRALLOC_LAYOUT_LINEAR));
+    EXPECT_EQ("  metadata: 2 pages mapped, 0 reused", MetadataStats());
+    EXPECT_EQ(1, CountMetadataMappings());
+
+    EXPECT_EQ(HWC2_ERROR_NONE, HWCDevice::DestroyLayer(&mDevice, PRIMARY_DISPLAY, layer));
+    EXPECT_EQ(0, CountMetadataMappings());
+}
+
+TEST_F(HWCDeviceTest, KeepsTheMostRecentBuffersOfALayer) {
+    hwc2_layer_t layer = CreateLayer();
+    for (uint32_t slot = 1; slot <= 6; slot++) {
+        SetBuffer(layer, CreateBuffer(slot, 1, HAL_PIXEL_FORMAT_RGBA_8888,
+                                      GRALLOC_LAYOUT_LINEAR));
+    }
+    EXPECT_EQ(4, CountMetadataMappings());
+}
+
+} // namespace
@@ -0,0 +1,178 @@
+#include <gtest/gtest.h>
+#include <system/graphics.h>
+#include <vector>
+#include "hwc_planner.h"
+
+namespace {
+
+// The planner only checks that a buffer is set, never reads it.
+const native_handle_t BUFFER = {};
+
+constexpr uint32_t TARGET_WIDTH = 1080;
+
+// Pipe ids of SM8650_PIPE_CONFIG
+constexpr int8_t FIRST_VIG = 0;
+constexpr int8_t FIRST_DMA = 4;
+
+class HWCPlannerTest : public testing::Test {
+protected:
+    HWCPlannerTest() : mPlanner(SM8650_PIPE_CONFIG) {}
+
+    // An unscaled device layer at (left, top); z follows the order added.
+    HWCLayer& AddLayer(uint32_t format, int32_t left, int32_t top, int32_t width,
+                       int32_t height) {
+        HWCLayer layer = {};
+        layer.id = mLayers.size();
+        layer.buffer = &BUFFER;
+        layer.acquireFence = -1;
+        layer.format = format;
+        layer.compositionType = HWC2_COMPOSITION_DEVICE;
+        layer.displayFrame = { left, top, left + width, top + height };
+        layer.sourceCrop = { 0, 0, static_cast<float>(width), static_cast<float>(height) };
+        layer.z = mLayers.size();
+        layer.blendMode = HWC2_BLEND_MODE_PREMULTIPLIED;
+        layer.planeAlpha = 1.0f;
+        mLayers.push_back(layer);
+        return mLayers.back();
+    }
+
+    void Plan() {
+        std::vector<const HWCLayer*> stack;
+        for (const HWCLayer& layer : mLayers) {
+            stack.push_back(&layer);
+        }
+        mPlanner.Plan(stack, TARGET_WIDTH, &mPlan);
+        ASSERT_EQ(mLayers.size(), mPlan.layers.size());
+    }
+
+    bool IsClient(size_t i) const {
+        return mPlan.layers[i].type == HWC2_COMPOSITION_CLIENT;
+    }
+
+    HWCPlanner mPlanner;
+    std::vector<HWCLayer> mLayers;
+    HWCPlan mPlan;
+};
+
+TEST_F(HWCPlannerTest, RgbLayersTakeDmaPipesFirst) {
+    AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, 0, 0, 1080, 2400);
+    AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, 0, 0, 1080, 120);
+    AddLayer(HAL_PIXEL_FORMAT_RGBX_8888, 0, 2280, 1080, 120);
+    Plan();
+
+    EXPECT_EQ(0u, mPlan.clientCount);
+    for (size_t i = 0; i < mLayers.size(); i++) {
+        EXPECT_EQ(HWC2_COMPOSITION_DEVICE, mPlan.layers[i].type);
+        EXPECT_EQ(FIRST_DMA + static_cast<int8_t>(i), mPlan.layers[i].pipes[0]);
+        EXPECT_EQ(HWC_NO_PIPE, mPlan.layers[i].pipes[1]);
+    }
+    EXPECT_EQ(HWC_NO_PIPE, mPlan.clientTargetPipes[0]);
+}
+
+TEST_F(HWCPlannerTest, YuvAndScaledLayersTakeVigPipes) {
+    AddLayer(HAL_PIXEL_FORMAT_YCBCR_420_888, 0, 0, 1920, 1080);
+    HWCLayer& scaled = AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, 0, 0, 540, 1200);
+    scaled.sourceCrop = { 0, 0, 1080, 2400 };
+    AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, 0, 0, 1080, 120);
+    Plan();
+
+    EXPECT_EQ(0u, mPlan.clientCount);
+    EXPECT_EQ(FIRST_VIG, mPlan.layers[0].pipes[0]);
+    EXPECT_EQ(FIRST_VIG + 1, mPlan.layers[1].pipes[0]);
+    EXPECT_EQ(FIRST_DMA, mPlan.layers[2].pipes[0]);
+}
+
+TEST_F(HWCPlannerTest, WideLayersTakeTwoPipes) {
+    AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, 0, 0, 3840, 2160);
+    Plan();
+
+    EXPECT_EQ(0u, mPlan.clientCount);
+    EXPECT_EQ(FIRST_DMA, mPlan.layers[0].pipes[0]);
+    EXPECT_EQ(FIRST_DMA + 1, mPlan.layers[0].pipes[1]);
+}
+
+TEST_F(HWCPlannerTest, SolidColorTakesNoPipe) {
+    AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, 0, 0, 1080, 2400);
+    HWCLayer& dim = AddLayer(0, 0, 0, 1080, 2400);
+    dim.buffer = nullptr;
+    dim.compositionType = HWC2_COMPOSITION_SOLID_COLOR;
+    Plan();
+
+    EXPECT_EQ(0u, mPlan.clientCount);
+    EXPECT_EQ(HWC2_COMPOSITION_SOLID_COLOR, mPlan.layers[1].type);
+    EXPECT_EQ(HWC_NO_PIPE, mPlan.layers[1].pipes[0]);
+}
+
+TEST_F(HWCPlannerTest, UnsupportedLayersGoToTheClient) {
+    AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, 0, 0, 1080, 2400);
+    HWCLayer& rotated = AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, 0, 0, 1080, 1080);
+    rotated.transform = HWC_TRANSFORM_ROT_90;
+    AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, 0, 0, 1080, 120);
+    AddLayer(0, 0, 0, 100, 100);     // no gralloc metadata
+    AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, 0, 0, 1080, 120);
+    HWCLayer& magnified = AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, 0, 0, 1080, 1080);
+    magnified.sourceCrop = { 0, 0, 10, 10 };
+    Plan();
+
+    // One contiguous range from the first unsupported layer to the last
+    EXPECT_EQ(5u, mPlan.clientCount);
+    EXPECT_FALSE(IsClient(0));
+    for (size_t i = 1; i < mLayers.size(); i++) {
+        EXPECT_TRUE(IsClient(i)) << "layer " << i;
+        EXPECT_EQ(HWC_NO_PIPE, mPlan.layers[i].pipes[0]);
+    }
+    EXPECT_EQ(FIRST_DMA, mPlan.layers[0].pipes[0]);
+    EXPECT_EQ(FIRST_DMA + 1, mPlan.clientTargetPipes[0]);
+    EXPECT_EQ(HWC_NO_PIPE, mPlan.clientTargetPipes[1]);
+}
+
+TEST_F(HWCPlannerTest, ClientRequestIsHonoured) {
+    AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, 0, 0, 1080, 2400);
+    AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, 0, 0, 1080, 120).compositionType =
+        HWC2_COMPOSITION_CLIENT;
+    Plan();
+
+    EXPECT_FALSE(IsClient(0));
+    EXPECT_TRUE(IsClient(1));
+    EXPECT_EQ(1u, mPlan.clientCount);
+}
+
+TEST_F(HWCPlannerTest, OverflowComposesTheSmallestRange) {
+    // Twelve RGB layers need twelve pipes and stages: three must go to the
+    // client so the other nine and the client target fit ten pipes.
+    for (int i = 0; i < 12; i++) {
+        int32_t size = i >= 5 && i < 8 ? 50 : 500;
+        AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, 0, 0, size, size);
+    }
+    Plan();
+
+    EXPECT_EQ(3u, mPlan.clientCount);
+    for (size_t i = 0; i < mLayers.size(); i++) {
+        EXPECT_EQ(i >= 5 && i < 8, IsClient(i)) << "layer " << i;
+    }
+    EXPECT_NE(HWC_NO_PIPE, mPlan.clientTargetPipes[0]);
+}
+
+TEST_F(HWCPlannerTest, VigShortageComposesTheSmallestYuvLayer) {
+    for (int i = 0; i < 5; i++) {
+        int32_t size = i == 3 ? 64 : 640;
+        AddLayer(HAL_PIXEL_FORMAT_YCBCR_420_888, 0, 0, size, size);
+    }
+    Plan();
+
+    EXPECT_EQ(1u, mPlan.clientCount);
+    std::vector<bool> used(SM8650_PIPE_CONFIG.vigPipes, false);
+    for (size_t i = 0; i < mLayers.size(); i++) {
+        EXPECT_EQ(i == 3, IsClient(i)) << "layer " << i;
+        if (!IsClient(i)) {
+            int8_t pipe = mPlan.layers[i].pipes[0];
+            ASSERT_GE(pipe, FIRST_VIG);
+            ASSERT_LT(pipe, FIRST_DMA);
+            EXPECT_FALSE(used[pipe]);
+            used[pipe] = true;
+        }
+    }
+    EXPECT_EQ(FIRST_DMA, mPlan.clientTargetPipes[0]);
+}
+
+} // namespace